@@ -5,6 +5,8 @@ const through = require("through2");
 const path = require("path");
 const fs = require("fs");
 const readline = require("readline");
+const zlib = require("zlib");
+const crypto = require("crypto");
 
 const destination = "new_http.c";
 
@@ -17,6 +19,64 @@ function dumpFileSize() {
   });
 }
 
+/** This function replaces region of field_name in new_http.c with output */
+function injectRegion(file, field_name, output, cb) {
+  const target_path = path.join(path.dirname(file.path), destination);
+  //console.log(`Updated ${target_path}`);
+
+  const rl = readline.createInterface({
+    input: fs.createReadStream(target_path),
+    crlfDelay: Infinity,
+  });
+
+  const merged_contents = [];
+  const marker_start = `//region_start ${field_name}`;
+  const marker_end = `//region_end ${field_name}`;
+  let region_state = 0;
+
+  rl.on("line", (line) => {
+    if (line.trim() === marker_start) {
+      region_state = 1;
+      merged_contents.push(marker_start);
+      merged_contents.push(output);
+      merged_contents.push(marker_end);
+    } else {
+      //Skip all existing content lines till region ends
+      if (region_state === 1) {
+        if (line.trim() === marker_end) {
+          region_state = 2;
+        }
+      } else {
+        merged_contents.push(line);
+      }
+    }
+  });
+
+  rl.on("close", () => {
+    if (region_state === 0) {
+      //Starting marker was not found, append
+
+      merged_contents.push("");
+      merged_contents.push(marker_start);
+      merged_contents.push(output);
+      merged_contents.push(marker_end);
+    }
+
+    if (region_state === 1) {
+      cb(`Ending marker "${marker_end}" was not found.`, file);
+    } else {
+      fs.writeFile(
+        target_path,
+        merged_contents.join("\r\n"),
+        "utf8",
+        (err) => {
+          cb(err, file);
+        }
+      );
+    }
+  });
+}
+
 /** This function injects C for a const field in new_http.c */
 function generateCode(field_name, is_script) {
   return through.obj(function (file, enc, cb) {
@@ -33,61 +93,37 @@ function generateCode(field_name, is_script) {
       const suffix = is_script ? "</script>" : "</style>";
       output = `const char ${field_name}[] = "${prefix}${output}${suffix}";`;
 
-      const target_path = path.join(path.dirname(file.path), destination);
-      //console.log(`Updated ${target_path}`);
-
-      const rl = readline.createInterface({
-        input: fs.createReadStream(target_path),
-        crlfDelay: Infinity,
-      });
-
-      const merged_contents = [];
-      const marker_start = `//region_start ${field_name}`;
-      const marker_end = `//region_end ${field_name}`;
-      let region_state = 0;
-
-      rl.on("line", (line) => {
-        if (line.trim() === marker_start) {
-          region_state = 1;
-          merged_contents.push(marker_start);
-          merged_contents.push(output);
-          merged_contents.push(marker_end);
-        } else {
-          //Skip all existing content lines till region ends
-          if (region_state === 1) {
-            if (line.trim() === marker_end) {
-              region_state = 2;
-            }
-          } else {
-            merged_contents.push(line);
-          }
-        }
-      });
+      injectRegion(file, field_name, output, cb);
+      return;
+    }
 
-      rl.on("close", () => {
-        if (region_state === 0) {
-          //Starting marker was not found, append
+    cb(null, file);
+  });
+}
 
-          merged_contents.push("");
-          merged_contents.push(marker_start);
-          merged_contents.push(output);
-          merged_contents.push(marker_end);
-        }
+/**
+ * This function injects C for a separately served asset in new_http.c:
+ * plain text, its gzip-compressed bytes and ETag (start of SHA-1 of plain text).
+ */
+function generateAssetCode(field_name) {
+  return through.obj(function (file, enc, cb) {
+    if (file.isBuffer()) {
+      const contents = file.contents;
+      const gz = zlib.gzipSync(contents, { level: 9 });
+      const etag = crypto.createHash("sha1").update(contents).digest("hex").substring(0, 8);
+      console.log(
+        `Processing ${file.basename}, reduced length ${contents.length}, compressed ${gz.length}`
+      );
 
-        if (region_state === 1) {
-          cb(`Ending marker "${marker_end}" was not found.`, file);
-        } else {
-          fs.writeFile(
-            target_path,
-            merged_contents.join("\r\n"),
-            "utf8",
-            (err) => {
-              cb(err, file);
-            }
-          );
-        }
-      });
+      const text = String(contents).replace(/\"/g, '\\"');
+      const bytes = Array.from(gz, (b) => "0x" + b.toString(16).padStart(2, "0")).join(",");
+      const output = [
+        `const char ${field_name}[] = "${text}";`,
+        `const unsigned char ${field_name}_gz[] = {${bytes}};`,
+        `const char ${field_name}_etag[] = "${etag}";`,
+      ].join("\r\n");
 
+      injectRegion(file, field_name, output, cb);
       return;
     }
 
@@ -100,7 +136,7 @@ function minifyJs() {
     .src("./src/httpserver/script.js")
     .pipe(dumpFileSize())
     .pipe(uglify())
-    .pipe(generateCode("pageScript", true));
+    .pipe(generateAssetCode("scriptJs"));
 }
 
 function minifyHassDiscoveryJs() {
@@ -116,7 +152,7 @@ function minifyCss() {
     .src("./src/httpserver/style.css")
     .pipe(dumpFileSize())
     .pipe(cssnano())
-    .pipe(generateCode("htmlHeadStyle", false));
+    .pipe(generateAssetCode("styleCss"));
 }
 
 exports.default = gulp.series(minifyJs, minifyHassDiscoveryJs, minifyCss);
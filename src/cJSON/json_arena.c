@@ -0,0 +1,91 @@
+#include "../new_common.h"
+#include "../logging/logging.h"
+#include "cJSON.h"
+#include "json_arena.h"
+
+#define JSON_ARENA_ALIGN 8
+
+// allocated on first scope, never freed
+static char* g_arena = 0;
+static int g_arenaUsed = 0;
+static int g_arenaHooked = 0;
+static SemaphoreHandle_t g_arenaMutex = 0;
+static int g_arenaFallbacks = 0;
+static int g_arenaLastPeak = 0;
+static int g_arenaMaxPeak = 0;
+
+static void* JSON_Arena_Malloc(size_t size) {
+	int need = (size + JSON_ARENA_ALIGN - 1) & ~(JSON_ARENA_ALIGN - 1);
+	void* p;
+
+	if (g_arenaUsed + need <= JSON_ARENA_SIZE) {
+		p = g_arena + g_arenaUsed;
+		g_arenaUsed += need;
+		return p;
+	}
+	g_arenaFallbacks++;
+	return os_malloc(size);
+}
+
+static void JSON_Arena_Free(void* p) {
+	// arena memory is reused by next scope
+	if (g_arena != 0 && (char*)p >= g_arena && (char*)p < g_arena + JSON_ARENA_SIZE) {
+		return;
+	}
+	os_free(p);
+}
+
+int JSON_Arena_Lock() {
+	if (g_arenaMutex == 0) {
+		g_arenaMutex = xSemaphoreCreateMutex();
+	}
+	// hooks are global, so cJSON user on other thread waits for our scope to end.
+	// Without lock, globals belong to scope of other thread
+	return xSemaphoreTake(g_arenaMutex, portMAX_DELAY) == pdTRUE;
+}
+
+void JSON_Arena_Unlock() {
+	xSemaphoreGive(g_arenaMutex);
+}
+
+int JSON_Arena_Begin() {
+	cJSON_Hooks hooks;
+
+	if (!JSON_Arena_Lock()) {
+		return 0;
+	}
+	if (g_arena == 0) {
+		g_arena = (char*)os_malloc(JSON_ARENA_SIZE);
+		if (g_arena == 0) {
+			// heap this time, next scope tries again
+			return 1;
+		}
+	}
+	g_arenaUsed = 0;
+	hooks.malloc_fn = JSON_Arena_Malloc;
+	hooks.free_fn = JSON_Arena_Free;
+	cJSON_InitHooks(&hooks);
+	g_arenaHooked = 1;
+	return 1;
+}
+
+void JSON_Arena_End() {
+	if (g_arenaHooked) {
+		cJSON_InitHooks(NULL);
+		g_arenaHooked = 0;
+		g_arenaLastPeak = g_arenaUsed;
+		if (g_arenaUsed > g_arenaMaxPeak) {
+			g_arenaMaxPeak = g_arenaUsed;
+		}
+		ADDLOG_DEBUG(LOG_FEATURE_GENERAL, "JSON arena: used %i of %i, max %i, heap fallbacks %i",
+			g_arenaUsed, JSON_ARENA_SIZE, g_arenaMaxPeak, g_arenaFallbacks);
+		g_arenaUsed = 0;
+	}
+	JSON_Arena_Unlock();
+}
+
+void JSON_Arena_GetStats(int* lastPeak, int* maxPeak, int* fallbacks) {
+	*lastPeak = g_arenaLastPeak;
+	*maxPeak = g_arenaMaxPeak;
+	*fallbacks = g_arenaFallbacks;
+}
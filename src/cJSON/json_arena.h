@@ -0,0 +1,39 @@
+#ifndef __JSON_ARENA_H__
+#define __JSON_ARENA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Arena for cJSON. Between JSON_Arena_Begin and JSON_Arena_End cJSON takes its memory
+// from one block by bumping an offset, and the offset is reset at end,
+// instead of dozens of tiny heap allocations for each build-print-free cycle.
+// Block is allocated on first scope and kept for device lifetime, so scopes don't
+// allocate heap at all as long as they fit. Allocations that don't fit go to heap as before,
+// so they must still be freed with cJSON_Delete/cJSON_free inside the scope - that is a no-op
+// for arena memory.
+// cJSON hooks are global, so scope holds a lock: keep it short, don't nest it,
+// and don't block in it - e.g. publish only after scope is closed.
+// Every cJSON user must hold the lock, otherwise it could get arena memory of other thread's scope.
+// Code that keeps its tree after the lock is given uses JSON_Arena_Lock/Unlock, which is heap only.
+
+#ifndef JSON_ARENA_SIZE
+#define JSON_ARENA_SIZE	4096
+#endif
+
+// Returns 1 when scope is entered, it must then be closed with JSON_Arena_End. If block could not
+// be allocated, cJSON uses heap as usual within scope. Returns 0 if lock could not be taken,
+// then nothing is hooked and there is no scope to close.
+int JSON_Arena_Begin();
+void JSON_Arena_End();
+// lock without arena, cJSON uses heap. Returns 0 if lock could not be taken
+int JSON_Arena_Lock();
+void JSON_Arena_Unlock();
+// peak use of last scope, largest one seen, and allocations that went to heap
+void JSON_Arena_GetStats(int* lastPeak, int* maxPeak, int* fallbacks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __JSON_ARENA_H__
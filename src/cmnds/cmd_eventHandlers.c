@@ -2,6 +2,7 @@
 #include "../new_common.h"
 #include "cmd_local.h"
 #include "../httpserver/new_http.h"
+#include "../httpserver/http_sse.h"
 #include "../logging/logging.h"
 #include "../new_pins.h"
 #include "../new_cfg.h"
@@ -262,10 +263,20 @@ typedef struct eventHandler_s {
 
 static eventHandler_t *g_eventHandlers = 0;
 
+// events report state changes, except the one fired every second
+static void EventHandlers_OnStateEvent(byte eventCode, int argument) {
+	if(eventCode != CMD_EVENT_CHANGE_NOPINGTIME) {
+		STATE_BumpRevision();
+	}
+	HTTP_SSE_OnEvent(eventCode, argument);
+}
 
 void EventHandlers_ProcessVariableChange_Integer(byte eventCode, int oldValue, int newValue) {
 	struct eventHandler_s *ev;
 
+	if(oldValue != newValue) {
+		EventHandlers_OnStateEvent(eventCode, newValue);
+	}
 	ev = g_eventHandlers;
 
 	while(ev) {
@@ -344,6 +355,7 @@ void EventHandlers_FireEvent2(byte eventCode, int argument, int argument2) {
 void EventHandlers_FireEvent(byte eventCode, int argument) {
 	struct eventHandler_s *ev;
 
+	EventHandlers_OnStateEvent(eventCode, argument);
 	ev = g_eventHandlers;
 
 	while(ev) {
@@ -300,6 +300,7 @@ const char *CMD_ExpandConstantString(const char *s, const char *stop, char *out,
 	if (ret) {
 		const char *opening = ret;
 		const char *closingBrace = ret;
+		int idx;
 		while (1) {
 			if (*closingBrace == 0)
 				return false; // fail
@@ -9,6 +9,8 @@
 #include "../driver/drv_public.h"
 #include "../hal/hal_adc.h"
 #include "../memory/memtest.h"
+#include "../httpserver/new_http.h"
+#include "../httpserver/hass.h"
 
 #ifdef ENABLE_LITTLEFS
 #include "../littlefs/our_lfs.h"
@@ -172,6 +174,8 @@ static commandResult_t CMD_ScheduleHADiscovery(const void* context, const char*
 		delay = 5;
 	}
 
+	// asked for explicitly, so unchanged entities are published again too
+	hass_discovery_forget();
 	Main_ScheduleHomeAssistantDiscovery(delay);
 
 	return CMD_RES_OK;
@@ -214,6 +218,24 @@ static commandResult_t CMD_HTTPOTA(const void* context, const char* cmd, const c
 
 	return CMD_RES_OK;
 }
+// http_keepAlive [IdleTimeoutMS] [MaxRequests]
+static commandResult_t CMD_HTTPKeepAlive(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "HTTP keep-alive: idle timeout %ims, max %i requests per connection",
+			g_http_keepAliveIdleTime, g_http_keepAliveMaxRequests);
+		return CMD_RES_OK;
+	}
+	if (Tokenizer_GetArgInteger(0) < 0) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	g_http_keepAliveIdleTime = Tokenizer_GetArgInteger(0);
+	if (Tokenizer_GetArgsCount() >= 2) {
+		g_http_keepAliveMaxRequests = Tokenizer_GetArgInteger(1);
+	}
+	return CMD_RES_OK;
+}
 static commandResult_t CMD_SimonTest(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_SimonTest: ir test routine");
 
@@ -465,6 +487,11 @@ void CMD_Init_Early() {
 	//cmddetail:"fn":"CMD_HTTPOTA","file":"cmnds/cmd_main.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("ota_http", CMD_HTTPOTA, NULL);
+	//cmddetail:{"name":"http_keepAlive","args":"[IdleTimeoutMS][MaxRequests]",
+	//cmddetail:"descr":"Sets how long HTTP server keeps an idle connection open waiting for next request, and how many requests can be served on one connection (1 disables keep-alive). Without arguments, prints current settings.",
+	//cmddetail:"fn":"CMD_HTTPKeepAlive","file":"cmnds/cmd_main.c","requires":"",
+	//cmddetail:"examples":"http_keepAlive 5000 32"}
+	CMD_RegisterCommand("http_keepAlive", CMD_HTTPKeepAlive, NULL);
 	//cmddetail:{"name":"scheduleHADiscovery","args":"[Seconds]",
 	//cmddetail:"descr":"This will schedule HA discovery, the discovery will happen with given number of seconds, but timer only counts when MQTT is connected. It will not work without MQTT online, so you must set MQTT credentials first.",
 	//cmddetail:"fn":"CMD_ScheduleHADiscovery","file":"cmnds/cmd_main.c","requires":"",
@@ -12,6 +12,7 @@
 #include "cmd_local.h"
 #include "../mqtt/new_mqtt.h"
 #include "../cJSON/cJSON.h"
+#include "../cJSON/json_arena.h"
 #include <string.h>
 #include <math.h>
 #ifdef ENABLE_LITTLEFS
@@ -164,7 +165,7 @@ static void sendFullRGBCW_IfEnabled() {
 
 	snprintf(s, sizeof(s),"%02X%02X%02X%02X%02X",c[0],c[1],c[2],c[3],c[4]);
 
-	MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_FINALCOLOR_RGBCW,DEDUP_EXPIRE_TIME,"led_finalcolor_rgbcw",s, 0);
+	MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME,"led_finalcolor_rgbcw",s, 0);
 }
 
 float led_rawLerpCurrent[5] = { 0 };
@@ -348,6 +349,8 @@ void apply_smart_light() {
 	int value_brightness = 0;
 	int value_cold_or_warm = 0;
 
+	STATE_BumpRevision();
+
 	// The color order is RGBCW.
 	// some people set RED to channel 0, and some of them set RED to channel 1
 	// Let's detect if there is a PWM on channel 0
@@ -588,7 +591,7 @@ OBK_Publish_Result sendColorChange() {
 
 	snprintf(s, sizeof(s), "%02X%02X%02X",c[0],c[1],c[2]);
 
-	return MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_BASECOLOR_RGB,DEDUP_EXPIRE_TIME,"led_basecolor_rgb",s, 0);
+	return MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME,"led_basecolor_rgb",s, 0);
 }
 void LED_GetBaseColorString(char * s) {
 	byte c[3];
@@ -613,17 +616,17 @@ OBK_Publish_Result sendFinalColor() {
 
 	snprintf(s, sizeof(s),"%02X%02X%02X",c[0],c[1],c[2]);
 
-	return MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_FINALCOLOR_RGB,DEDUP_EXPIRE_TIME,"led_finalcolor_rgb",s, 0);
+	return MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME,"led_finalcolor_rgb",s, 0);
 }
 OBK_Publish_Result LED_SendDimmerChange() {
 	int iValue;
 
 	iValue = g_brightness0to100;
 
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_DIMMER,DEDUP_EXPIRE_TIME,"led_dimmer", iValue, 0);
+	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME,"led_dimmer", iValue, 0);
 }
 OBK_Publish_Result sendTemperatureChange(){
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_TEMPERATURE,DEDUP_EXPIRE_TIME,"led_temperature", (int)led_temperature_current,0);
+	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME,"led_temperature", (int)led_temperature_current,0);
 }
 float LED_GetTemperature() {
 	return led_temperature_current;
@@ -714,7 +717,7 @@ static commandResult_t temperature(const void *context, const char *cmd, const c
 	//return 0;
 }
 OBK_Publish_Result LED_SendEnableAllState() {
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_ENABLEALL,DEDUP_EXPIRE_TIME,"led_enableAll",g_lightEnableAll,0);
+	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME,"led_enableAll",g_lightEnableAll,0);
 }
 
 void LED_ToggleEnabled() {
@@ -960,7 +963,12 @@ static commandResult_t dimmer(const void *context, const char *cmd, const char *
 			cJSON *json;
 			const cJSON *brightness = NULL;
 			const cJSON *state = NULL;
+			int newDimmer = -1;
+			int newEnable = -1;
+			int bArena;
 
+			// values are taken out, so LED is not driven while arena is held
+			bArena = JSON_Arena_Begin();
 			json = cJSON_Parse(args);
 
 			if(json == 0) {
@@ -971,7 +979,7 @@ static commandResult_t dimmer(const void *context, const char *cmd, const char *
 				{
 					ADDLOG_INFO(LOG_FEATURE_CMD, "Dimmer - cJSON_Parse says brightness is %i",brightness->valueint);
 
-					LED_SetDimmer(brightness->valueint);
+					newDimmer = brightness->valueint;
 				}
 				state = cJSON_GetObjectItemCaseSensitive(json, "state");
 				if (state != 0 && cJSON_IsString(state) && (state->valuestring != NULL))
@@ -979,15 +987,24 @@ static commandResult_t dimmer(const void *context, const char *cmd, const char *
 					ADDLOG_INFO(LOG_FEATURE_CMD, "Dimmer - cJSON_Parse says state is %s",state->valuestring);
 
 					if(!stricmp(state->valuestring,"ON")) {
-						LED_SetEnableAll(true);
+						newEnable = 1;
 					} else if(!stricmp(state->valuestring,"OFF")) {
-						LED_SetEnableAll(false);
+						newEnable = 0;
 					} else {
 
 					}
 				}
 				cJSON_Delete(json);
 			}
+			if (bArena) {
+				JSON_Arena_End();
+			}
+			if (newDimmer != -1) {
+				LED_SetDimmer(newDimmer);
+			}
+			if (newEnable != -1) {
+				LED_SetEnableAll(newEnable);
+			}
 		} else {
 			Tokenizer_TokenizeString(args, 0);
 
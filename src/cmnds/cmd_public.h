@@ -40,6 +40,8 @@ void CMD_RunUartCmndIfRequired();
 void CMD_RegisterCommand(const char* name, commandHandler_t handler,  void* context);
 commandResult_t CMD_ExecuteCommand(const char* s, int cmdFlags);
 commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cmdFlags);
+// human readable result, defined in http_fns.c
+const char *CMD_GetResultString(commandResult_t r);
 // like a strdup, but will expand constants.
 // Please remember to free the returned string
 char *CMD_ExpandingStrdup(const char *in);
@@ -5,6 +5,7 @@
 #include "../new_common.h"
 #include "../obk_config.h"
 #include "../cJSON/cJSON.h"
+#include "../cJSON/json_arena.h"
 #include <ctype.h>
 #include "cmd_local.h"
 #ifdef ENABLE_LITTLEFS
@@ -147,6 +148,7 @@ static commandResult_t testJSON(const void * context, const char *cmd, const cha
     char *msg;
 	int i;
 	int ra1, ra2, ra3, ra4, ra5;
+	int bArena;
 	static int totalCalls = 0;
 
 	repeats = atoi(args);
@@ -163,6 +165,7 @@ static commandResult_t testJSON(const void * context, const char *cmd, const cha
 		ra5 = rand() % 1000;
 
 
+		bArena = JSON_Arena_Begin();
 		root = cJSON_CreateObject();
 		cJSON_AddNumberToObject(root, "uptime", Time_getUpTimeSeconds());
 		cJSON_AddNumberToObject(root, "consumption_total", ra1 );
@@ -180,7 +183,10 @@ static commandResult_t testJSON(const void * context, const char *cmd, const cha
 
 		msg = cJSON_Print(root);
 		cJSON_Delete(root);
-		os_free(msg);
+		cJSON_free(msg);
+		if (bArena) {
+			JSON_Arena_End();
+		}
 	}
 
 	ADDLOG_INFO(LOG_FEATURE_CMD, "testJSON has been tested! Total calls %i, reps now %i",totalCalls,repeats);
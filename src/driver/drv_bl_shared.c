@@ -10,6 +10,7 @@
 #include "drv_uart.h"
 #include "../httpserver/new_http.h"
 #include "../cJSON/cJSON.h"
+#include "../cJSON/json_arena.h"
 #include <time.h>
 #include "drv_ntp.h"
 #include "../hal/hal_flashVars.h"
@@ -339,6 +340,8 @@ void BL_ProcessUpdate(float voltage, float current, float power)
     cJSON* root;
     cJSON* stats;
     char *msg;
+    char *text;
+    int bArena;
     portTickType interval;
     time_t g_time;
     struct tm *ltm;
@@ -441,6 +444,8 @@ void BL_ProcessUpdate(float voltage, float current, float power)
         {
             if ((energyCounterStatsJSONEnable == true) && (MQTT_IsReady() == true))
             {
+                // whole tree and printout come from reused arena block
+                bArena = JSON_Arena_Begin();
                 root = cJSON_CreateObject();
                 cJSON_AddNumberToObject(root, "uptime", Time_getUpTimeSeconds());
                 cJSON_AddNumberToObject(root, "consumption_total", energyCounter );
@@ -488,12 +493,30 @@ void BL_ProcessUpdate(float voltage, float current, float power)
 
                 msg = cJSON_PrintUnformatted(root);
                 cJSON_Delete(root);
+                // printout is reused by next arena scope, and publish may block, so scope ends first
+                text = 0;
+                if (msg != 0)
+                {
+                    text = (char*)os_malloc(strlen(msg) + 1);
+                    if (text != 0)
+                    {
+                        strcpy(text, msg);
+                    }
+                    cJSON_free(msg);
+                }
+                if (bArena)
+                {
+                    JSON_Arena_End();
+                }
 
-               // addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "JSON Printed: %d bytes", strlen(msg));
+               // addLogAdv(LOG_INFO, LOG_FEATURE_ENERGYMETER, "JSON Printed: %d bytes", strlen(text));
 
-                MQTT_PublishMain_StringString(counter_mqttNames[2], msg, 0);
-                stat_updatesSent++;
-                os_free(msg);
+                if (text != 0)
+                {
+                    MQTT_PublishMain_StringString(counter_mqttNames[2], text, 0);
+                    stat_updatesSent++;
+                    os_free(text);
+                }
             }
 
             if (energyCounterMinutes != NULL)
@@ -545,7 +568,7 @@ void BL_ProcessUpdate(float voltage, float current, float power)
             } else {
                 EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_VOLTAGE+i, lastSentValues[i], lastReadings[i]);
             }
-            if (MQTT_IsReady() == true)
+            if (MQTT_IsReady() == true || MQTT_Offline_IsEnabled())
             {
                 lastSentValues[i] = lastReadings[i];
                 MQTT_PublishMain_StringFloat(sensor_mqttNames[i],lastReadings[i]);
@@ -563,7 +586,7 @@ void BL_ProcessUpdate(float voltage, float current, float power)
           (noChangeFrameEnergyCounter >= changeDoNotSendMinFrames)) || 
          (noChangeFrameEnergyCounter >= changeSendAlwaysFrames) )
     {
-        if (MQTT_IsReady() == true)
+        if (MQTT_IsReady() == true || MQTT_Offline_IsEnabled())
         {
             MQTT_PublishMain_StringFloat(counter_mqttNames[0], energyCounter);
             EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_CONSUMPTION_TOTAL, lastSentEnergyCounterValue, energyCounter);
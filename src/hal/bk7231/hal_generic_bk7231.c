@@ -1,8 +1,30 @@
-
+#include "../hal_generic.h"
 
 // from wlan_ui.c
 void bk_reboot(void);
+// from start_type.c, returns RESET_SOURCE_STATUS
+int bk_misc_get_start_type(void);
 
 void HAL_RebootModule() {
 	bk_reboot();
-}
\ No newline at end of file
+}
+
+int HAL_GetResetReason() {
+	switch (bk_misc_get_start_type()) {
+	case 0: // RESET_SOURCE_POWERON
+		return RESET_REASON_POWERON;
+	case 1: // RESET_SOURCE_REBOOT
+		return RESET_REASON_SOFTWARE;
+	case 2: // RESET_SOURCE_WATCHDOG
+		return RESET_REASON_WATCHDOG;
+	case 3: // RESET_SOURCE_DEEPPS_GPIO
+	case 4: // RESET_SOURCE_DEEPPS_RTC
+		return RESET_REASON_DEEPSLEEP;
+	case 5: // RESET_SOURCE_CRASH_XAT0
+	case 6: // RESET_SOURCE_CRASH_UNDEFINED
+	case 7: // RESET_SOURCE_CRASH_PREFETCH_ABORT
+	case 8: // RESET_SOURCE_CRASH_DATA_ABORT
+		return RESET_REASON_CRASH;
+	}
+	return RESET_REASON_UNKNOWN;
+}
@@ -2,6 +2,7 @@
 
 #include "../../new_common.h"
 #include <hal_sys.h>
+#include "../hal_generic.h"
 
 void HAL_RebootModule() {
 
@@ -9,4 +10,9 @@ void HAL_RebootModule() {
 
 }
 
+// not read from SDK yet
+int HAL_GetResetReason() {
+	return RESET_REASON_UNKNOWN;
+}
+
 #endif // PLATFORM_XR809
\ No newline at end of file
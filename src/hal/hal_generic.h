@@ -1,2 +1,18 @@
+#ifndef __HAL_GENERIC_H__
+#define __HAL_GENERIC_H__
 
 void HAL_RebootModule();
+
+// reason of the last reset, as far as the platform can tell
+typedef enum {
+	RESET_REASON_UNKNOWN,
+	RESET_REASON_POWERON,
+	RESET_REASON_SOFTWARE,
+	RESET_REASON_WATCHDOG,
+	RESET_REASON_DEEPSLEEP,
+	RESET_REASON_CRASH,
+} resetReason_t;
+
+int HAL_GetResetReason();
+
+#endif
@@ -1,9 +1,15 @@
 #if defined(PLATFORM_W800) || defined(PLATFORM_W600) 
 
 #include "wm_include.h"
+#include "../hal_generic.h"
 
 void HAL_RebootModule() {
     tls_sys_reset();
 }
 
+// not read from SDK yet
+int HAL_GetResetReason() {
+    return RESET_REASON_UNKNOWN;
+}
+
 #endif
@@ -1,9 +1,15 @@
 #ifdef WINDOWS
 
+#include "../hal_generic.h"
+
 
 void HAL_RebootModule() {
 
 
 }
 
+int HAL_GetResetReason() {
+	return RESET_REASON_POWERON;
+}
+
 #endif // WINDOWS
\ No newline at end of file
@@ -1,5 +1,7 @@
 #ifdef PLATFORM_XR809
 
+#include "../hal_generic.h"
+
 void HAL_WDG_Reboot();
 
 void HAL_RebootModule() {
@@ -8,4 +10,9 @@ void HAL_RebootModule() {
 	HAL_WDG_Reboot();
 }
 
+// not read from SDK yet
+int HAL_GetResetReason() {
+	return RESET_REASON_UNKNOWN;
+}
+
 #endif // PLATFORM_XR809
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "../logging/logging.h"
 #include "../hal/hal_wifi.h"
 #include "../driver/drv_public.h"
+#include "../cmnds/cmd_public.h"
 
 /*
 Abbreviated node names - https://www.home-assistant.io/docs/mqtt/discovery/
@@ -12,10 +13,19 @@ Switch - https://www.home-assistant.io/integrations/switch.mqtt/
 Sensor - https://www.home-assistant.io/integrations/sensor.mqtt/
 */
 
-//Buffer used to populate values in cJSON_Add* calls. The values are based on
+//Buffer used to format values written by hass_json_str. The values are based on
 //CFG_GetShortDeviceName and clientId so it needs to be bigger than them. +64 for light/switch/etc.
 static char g_hassBuffer[CGF_MQTT_CLIENT_ID_SIZE + 64];
 
+// discovery in progress, see hass_discovery_start
+static char g_hassTopic[32];
+static bool g_hassRunning = false;
+static bool g_hassForce;
+static bool g_hassQueued;
+static int g_hassNext;
+// configs known to be published, topicHash 0 is free slot
+static hassPublished_t g_hassPublished[HASS_DISCOVERY_MAX_HASHES];
+
 static char* STATE_TOPIC_KEY = "stat_t";
 static char* COMMAND_TOPIC_KEY = "cmd_t";
 
@@ -74,75 +84,151 @@ void hass_print_unique_id(http_request_t* request, const char* fmt, ENTITY_TYPE
 /// @brief Populates HomeAssistant device configuration MQTT channel e.g. switch/enbrighten_9de8f9_relay_0/config.
 /// @param type Entity type
 /// @param uniq_id Entity unique id
-/// @param info Device info
-void hass_populate_device_config_channel(ENTITY_TYPE type, char* uniq_id, HassDeviceInfo* info) {
+/// @param channel Array to populate (should be of size HASS_CHANNEL_SIZE)
+void hass_populate_device_config_channel(ENTITY_TYPE type, char* uniq_id, char* channel) {
 	switch (type) {
 	case LIGHT_PWM:
 	case LIGHT_PWMCW:
 	case LIGHT_RGB:
 	case LIGHT_RGBCW:
-		sprintf(info->channel, "light/%s/config", uniq_id);
+		sprintf(channel, "light/%s/config", uniq_id);
 		break;
 
 	case RELAY:
-		sprintf(info->channel, "switch/%s/config", uniq_id);
+		sprintf(channel, "switch/%s/config", uniq_id);
 		break;
 
 	case POWER_SENSOR:
 	case TEMPERATURE_SENSOR:
 	case HUMIDITY_SENSOR:
-		sprintf(info->channel, "sensor/%s/config", uniq_id);
+		sprintf(channel, "sensor/%s/config", uniq_id);
 		break;
 
 	case BINARY_SENSOR:
-		sprintf(info->channel, "binary_sensor/%s/config", uniq_id);
+		sprintf(channel, "binary_sensor/%s/config", uniq_id);
 	}
 }
 
-/// @brief Builds HomeAssistant device discovery info. The caller needs to free the returned pointer.
-/// @param ids 
-cJSON* hass_build_device_node(cJSON* ids) {
-	cJSON* dev = cJSON_CreateObject();
-	cJSON_AddItemToObject(dev, "ids", ids);     //identifiers
-	cJSON_AddStringToObject(dev, "name", CFG_GetShortDeviceName());
+/// @brief Appends raw text, sets overflow flag if it does not fit.
+static void hass_json_raw(hassJson_t* w, const char* s, int len) {
+	if (w->bOverflow || w->len + len >= w->size) {
+		w->bOverflow = true;
+		return;
+	}
+	memcpy(w->buf + w->len, s, len);
+	w->len += len;
+	w->buf[w->len] = 0;
+}
 
-#ifdef USER_SW_VER
-	cJSON_AddStringToObject(dev, "sw", USER_SW_VER);   //sw_version
-#endif
+/// @brief Appends quoted string, escaped the same way as cJSON prints it.
+static void hass_json_quoted(hassJson_t* w, const char* s) {
+	char esc[8];
+
+	hass_json_raw(w, "\"", 1);
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		switch (c) {
+		case '"': hass_json_raw(w, "\\\"", 2); break;
+		case '\\': hass_json_raw(w, "\\\\", 2); break;
+		case '\b': hass_json_raw(w, "\\b", 2); break;
+		case '\f': hass_json_raw(w, "\\f", 2); break;
+		case '\n': hass_json_raw(w, "\\n", 2); break;
+		case '\r': hass_json_raw(w, "\\r", 2); break;
+		case '\t': hass_json_raw(w, "\\t", 2); break;
+		default:
+			if (c < 32) {
+				sprintf(esc, "\\u%04x", c);
+				hass_json_raw(w, esc, 6);
+			}
+			else {
+				hass_json_raw(w, s, 1);
+			}
+		}
+	}
+	hass_json_raw(w, "\"", 1);
+}
 
-	cJSON_AddStringToObject(dev, "mf", MANUFACTURER);   //manufacturer
-	cJSON_AddStringToObject(dev, "mdl", PLATFORM_MCU_NAME);  //Using chipset for model
+/// @brief Starts member of current object, or element of current array if key is NULL.
+static void hass_json_key(hassJson_t* w, const char* key) {
+	if (!w->bFirst) {
+		hass_json_raw(w, ",", 1);
+	}
+	w->bFirst = false;
+	if (key) {
+		hass_json_quoted(w, key);
+		hass_json_raw(w, ":", 1);
+	}
+}
 
-	sprintf(g_hassBuffer, "http://%s/index", HAL_GetMyIPString());
-	cJSON_AddStringToObject(dev, "cu", g_hassBuffer);  //configuration_url
+static void hass_json_begin(hassJson_t* w, char* buf, int size) {
+	w->buf = buf;
+	w->size = size;
+	w->len = 0;
+	w->bOverflow = false;
+	w->bFirst = true;
+	buf[0] = 0;
+	hass_json_raw(w, "{", 1);
+}
 
-	return dev;
+/// @brief Opens nested object, or array when bArray is set.
+static void hass_json_open(hassJson_t* w, const char* key, bool bArray) {
+	hass_json_key(w, key);
+	hass_json_raw(w, bArray ? "[" : "{", 1);
+	w->bFirst = true;
 }
 
-/// @brief Initializes HomeAssistant device discovery storage with common values.
-/// @param type 
-/// @param index This is used to generate generate unique_id and name. 
-/// It is ignored for RGB. For power sensors, index corresponds to sensor_mqttNames. For regular sensor, index can be be the channel.
-/// @param payload_on The payload that represents enabled state. This is not added for POWER_SENSOR.
-/// @param payload_off The payload that represents disabled state. This is not added for POWER_SENSOR.
-/// @return 
-HassDeviceInfo* hass_init_device_info(ENTITY_TYPE type, int index, char* payload_on, char* payload_off) {
-	HassDeviceInfo* info = os_malloc(sizeof(HassDeviceInfo));
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_HASS, "hass_init_device_info=%p", info);
+/// @brief Closes nested object or array, or the root one.
+static void hass_json_close(hassJson_t* w, bool bArray) {
+	hass_json_raw(w, bArray ? "]" : "}", 1);
+	w->bFirst = false;
+}
+
+static void hass_json_str(hassJson_t* w, const char* key, const char* value) {
+	hass_json_key(w, key);
+	hass_json_quoted(w, value);
+}
+
+static void hass_json_int(hassJson_t* w, const char* key, int value) {
+	char tmp[12];
+
+	hass_json_key(w, key);
+	hass_json_raw(w, tmp, sprintf(tmp, "%d", value));
+}
 
-	hass_populate_unique_id(type, index, info->unique_id);
-	hass_populate_device_config_channel(type, info->unique_id, info);
+/// @brief Writes HomeAssistant device node.
+/// @param w
+static void hass_write_device_node(hassJson_t* w) {
+	hass_json_open(w, "dev", false);    //device
+	hass_json_open(w, "ids", true);     //identifiers
+	hass_json_str(w, NULL, CFG_GetDeviceName());
+	hass_json_close(w, true);
+	hass_json_str(w, "name", CFG_GetShortDeviceName());
 
-	info->ids = cJSON_CreateArray();
-	cJSON_AddItemToArray(info->ids, cJSON_CreateString(CFG_GetDeviceName()));
+#ifdef USER_SW_VER
+	hass_json_str(w, "sw", USER_SW_VER);   //sw_version
+#endif
 
-	info->device = hass_build_device_node(info->ids);
+	hass_json_str(w, "mf", MANUFACTURER);   //manufacturer
+	hass_json_str(w, "mdl", PLATFORM_MCU_NAME);  //Using chipset for model
 
-	info->root = cJSON_CreateObject();
-	cJSON_AddItemToObject(info->root, "dev", info->device);    //device
+	sprintf(g_hassBuffer, "http://%s/index", HAL_GetMyIPString());
+	hass_json_str(w, "cu", g_hassBuffer);  //configuration_url
+	hass_json_close(w, false);
+}
 
+/// @brief Writes HomeAssistant discovery values common to all entities.
+/// @param w
+/// @param type
+/// @param index This is used to generate generate unique_id and name.
+/// It is ignored for RGB. For power sensors, index corresponds to sensor_mqttNames. For regular sensor, index can be be the channel.
+/// @param uniq_id Entity unique id
+/// @param payload_on The payload that represents enabled state. This is not added for sensors.
+/// @param payload_off The payload that represents disabled state. This is not added for sensors.
+static void hass_write_common(hassJson_t* w, ENTITY_TYPE type, int index, const char* uniq_id, const char* payload_on, const char* payload_off) {
 	bool isSensor = false;	//This does not count binary_sensor
 
+	hass_write_device_node(w);
+
 	//Build the `name`
 	switch (type) {
 	case LIGHT_PWM:
@@ -176,57 +262,45 @@ HassDeviceInfo* hass_init_device_info(ENTITY_TYPE type, int index, char* payload
 		sprintf(g_hassBuffer, "%s Humidity", CFG_GetShortDeviceName());
 		break;
 	}
-	cJSON_AddStringToObject(info->root, "name", g_hassBuffer);
-	cJSON_AddStringToObject(info->root, "~", CFG_GetMQTTClientId());      //base topic
-	cJSON_AddStringToObject(info->root, "avty_t", "~/connected");   //availability_topic, `online` value is broadcasted
+	hass_json_str(w, "name", g_hassBuffer);
+	hass_json_str(w, "~", CFG_GetMQTTClientId());      //base topic
+	hass_json_str(w, "avty_t", "~/connected");   //availability_topic, `online` value is broadcasted
 
 	if (!isSensor) {	//Sensors (except binary_sensor) don't use payload 
-		cJSON_AddStringToObject(info->root, "pl_on", payload_on);    //payload_on
-		cJSON_AddStringToObject(info->root, "pl_off", payload_off);   //payload_off
+		hass_json_str(w, "pl_on", payload_on);    //payload_on
+		hass_json_str(w, "pl_off", payload_off);   //payload_off
 	}
 
-	cJSON_AddStringToObject(info->root, "uniq_id", info->unique_id);  //unique_id
-	cJSON_AddNumberToObject(info->root, "qos", 1);
-
-	addLogAdv(LOG_DEBUG, LOG_FEATURE_HASS, "root=%p", info->root);
-	return info;
+	hass_json_str(w, "uniq_id", uniq_id);  //unique_id
+	hass_json_int(w, "qos", 1);
 }
 
-/// @brief Initializes HomeAssistant relay device discovery storage.
+/// @brief Writes HomeAssistant relay discovery values.
+/// @param w
 /// @param index
-/// @return 
-HassDeviceInfo* hass_init_relay_device_info(int index) {
-	HassDeviceInfo* info = hass_init_device_info(RELAY, index, "1", "0");
-
+static void hass_write_relay(hassJson_t* w, int index) {
 	sprintf(g_hassBuffer, "~/%i/get", index);
-	cJSON_AddStringToObject(info->root, STATE_TOPIC_KEY, g_hassBuffer);   //state_topic
+	hass_json_str(w, STATE_TOPIC_KEY, g_hassBuffer);   //state_topic
 	sprintf(g_hassBuffer, "~/%i/set", index);
-	cJSON_AddStringToObject(info->root, COMMAND_TOPIC_KEY, g_hassBuffer);    //command_topic
-
-	return info;
+	hass_json_str(w, COMMAND_TOPIC_KEY, g_hassBuffer);    //command_topic
 }
 
-/// @brief Initializes HomeAssistant light device discovery storage.
+/// @brief Writes HomeAssistant light discovery values.
+/// @param w
 /// @param type 
-/// @return 
-HassDeviceInfo* hass_init_light_device_info(ENTITY_TYPE type) {
+static void hass_write_light(hassJson_t* w, ENTITY_TYPE type) {
 	const char* clientId = CFG_GetMQTTClientId();
-	HassDeviceInfo* info = NULL;
-	double brightness_scale = 100;
-
-	//We can just use 1 to generate unique_id and name for single PWM.
-	//The payload_on/payload_off have to match the state_topic/command_topic values.
-	info = hass_init_device_info(type, 1, "1", "0");
+	int brightness_scale = 100;
 
 	switch (type) {
 	case LIGHT_RGBCW:
 	case LIGHT_RGB:
-		cJSON_AddStringToObject(info->root, "rgb_cmd_tpl", "{{'#%02x%02x%02x0000'|format(red,green,blue)}}");  //rgb_command_template
-		cJSON_AddStringToObject(info->root, "rgb_val_tpl", "{{ value[0:2]|int(base=16) }},{{ value[2:4]|int(base=16) }},{{ value[4:6]|int(base=16) }}");  //rgb_value_template
+		hass_json_str(w, "rgb_cmd_tpl", "{{'#%02x%02x%02x0000'|format(red,green,blue)}}");  //rgb_command_template
+		hass_json_str(w, "rgb_val_tpl", "{{ value[0:2]|int(base=16) }},{{ value[2:4]|int(base=16) }},{{ value[4:6]|int(base=16) }}");  //rgb_value_template
 
-		cJSON_AddStringToObject(info->root, "rgb_stat_t", "~/led_basecolor_rgb/get"); //rgb_state_topic
+		hass_json_str(w, "rgb_stat_t", "~/led_basecolor_rgb/get"); //rgb_state_topic
 		sprintf(g_hassBuffer, "cmnd/%s/led_basecolor_rgb", clientId);
-		cJSON_AddStringToObject(info->root, "rgb_cmd_t", g_hassBuffer);  //rgb_command_topic
+		hass_json_str(w, "rgb_cmd_t", g_hassBuffer);  //rgb_command_topic
 		break;
 
 	case LIGHT_PWM:
@@ -239,141 +313,336 @@ HassDeviceInfo* hass_init_light_device_info(ENTITY_TYPE type) {
 		//Using `last` (the default) will send any style (brightness, color, etc) topics first and then a payload_on to the command_topic. 
 		//Using `first` will send the payload_on and then any style topics. 
 		//Using `brightness` will only send brightness commands instead of the payload_on to turn the light on.
-		cJSON_AddStringToObject(info->root, "on_cmd_type", "first");	//on_command_type
+		hass_json_str(w, "on_cmd_type", "first");	//on_command_type
 		break;
 
 	default:
-		addLogAdv(LOG_ERROR, LOG_FEATURE_HASS, "Unsupported light type %s", type);
+		addLogAdv(LOG_ERROR, LOG_FEATURE_HASS, "Unsupported light type %i", type);
 	}
 
 	if ((type == LIGHT_PWMCW) || (type == LIGHT_RGBCW)) {
 		sprintf(g_hassBuffer, "cmnd/%s/led_temperature", clientId);
-		cJSON_AddStringToObject(info->root, "clr_temp_cmd_t", g_hassBuffer);    //color_temp_command_topic
+		hass_json_str(w, "clr_temp_cmd_t", g_hassBuffer);    //color_temp_command_topic
 
-		cJSON_AddStringToObject(info->root, "clr_temp_stat_t", "~/led_temperature/get");    //color_temp_state_topic
+		hass_json_str(w, "clr_temp_stat_t", "~/led_temperature/get");    //color_temp_state_topic
 	}
 
-	cJSON_AddStringToObject(info->root, STATE_TOPIC_KEY, "~/led_enableAll/get");  //state_topic
+	hass_json_str(w, STATE_TOPIC_KEY, "~/led_enableAll/get");  //state_topic
 	sprintf(g_hassBuffer, "cmnd/%s/led_enableAll", clientId);
-	cJSON_AddStringToObject(info->root, COMMAND_TOPIC_KEY, g_hassBuffer);  //command_topic
+	hass_json_str(w, COMMAND_TOPIC_KEY, g_hassBuffer);  //command_topic
 
-	cJSON_AddStringToObject(info->root, "bri_stat_t", "~/led_dimmer/get");  //brightness_state_topic
+	hass_json_str(w, "bri_stat_t", "~/led_dimmer/get");  //brightness_state_topic
 	sprintf(g_hassBuffer, "cmnd/%s/led_dimmer", clientId);
-	cJSON_AddStringToObject(info->root, "bri_cmd_t", g_hassBuffer);  //brightness_command_topic
-
-	cJSON_AddNumberToObject(info->root, "bri_scl", brightness_scale);	//brightness_scale
+	hass_json_str(w, "bri_cmd_t", g_hassBuffer);  //brightness_command_topic
 
-	return info;
+	hass_json_int(w, "bri_scl", brightness_scale);	//brightness_scale
 }
 
-/// @brief Initializes HomeAssistant binary sensor device discovery storage.
+/// @brief Writes HomeAssistant binary sensor discovery values.
+/// @param w
 /// @param index
-/// @return
-HassDeviceInfo* hass_init_binary_sensor_device_info(int index) {
-	HassDeviceInfo* info = hass_init_device_info(BINARY_SENSOR, index, "1", "0");
-
+static void hass_write_binary_sensor(hassJson_t* w, int index) {
 	sprintf(g_hassBuffer, "~/%i/get", index);
-	cJSON_AddStringToObject(info->root, STATE_TOPIC_KEY, g_hassBuffer);   //state_topic
-
-	return info;
+	hass_json_str(w, STATE_TOPIC_KEY, g_hassBuffer);   //state_topic
 }
 
 #ifndef OBK_DISABLE_ALL_DRIVERS
 
-/// @brief Initializes HomeAssistant power sensor device discovery storage.
+/// @brief Writes HomeAssistant power sensor discovery values.
+/// @param w
 /// @param index Index corresponding to sensor_mqttNames.
-/// @return 
-HassDeviceInfo* hass_init_power_sensor_device_info(int index) {
-	HassDeviceInfo* info = hass_init_device_info(POWER_SENSOR, index, NULL, NULL);
-
+static void hass_write_power_sensor(hassJson_t* w, int index) {
 	//https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
 	//device_class automatically assigns unit,icon
 	if ((index >= OBK_VOLTAGE) && (index <= OBK_POWER))
 	{
-		cJSON_AddStringToObject(info->root, "dev_cla", sensor_mqtt_device_classes[index]);   //device_class=voltage,current,power
-		cJSON_AddStringToObject(info->root, "unit_of_meas", sensor_mqtt_device_units[index]);   //unit_of_measurement
+		hass_json_str(w, "dev_cla", sensor_mqtt_device_classes[index]);   //device_class=voltage,current,power
+		hass_json_str(w, "unit_of_meas", sensor_mqtt_device_units[index]);   //unit_of_measurement
 
 		sprintf(g_hassBuffer, "~/%s/get", sensor_mqttNames[index]);
-		cJSON_AddStringToObject(info->root, STATE_TOPIC_KEY, g_hassBuffer);
+		hass_json_str(w, STATE_TOPIC_KEY, g_hassBuffer);
 
-		cJSON_AddStringToObject(info->root, "stat_cla", "measurement");
+		hass_json_str(w, "stat_cla", "measurement");
 	}
 	else if ((index >= OBK_CONSUMPTION_TOTAL) && (index <= OBK_CONSUMPTION_STATS))
 	{
 		const char* device_class_value = counter_devClasses[index - OBK_CONSUMPTION_TOTAL];
 		if (strlen(device_class_value) > 0) {
-			cJSON_AddStringToObject(info->root, "dev_cla", device_class_value);  //device_class=energy
-			cJSON_AddStringToObject(info->root, "unit_of_meas", "Wh");   //unit_of_measurement
+			hass_json_str(w, "dev_cla", device_class_value);  //device_class=energy
+			hass_json_str(w, "unit_of_meas", "Wh");   //unit_of_measurement
 
 			//state_class can be measurement, total or total_increasing. Energy values should be total_increasing.
-			cJSON_AddStringToObject(info->root, "stat_cla", "total_increasing");
+			hass_json_str(w, "stat_cla", "total_increasing");
 		}
 
 		sprintf(g_hassBuffer, "~/%s/get", counter_mqttNames[index - OBK_CONSUMPTION_TOTAL]);
-		cJSON_AddStringToObject(info->root, STATE_TOPIC_KEY, g_hassBuffer);
+		hass_json_str(w, STATE_TOPIC_KEY, g_hassBuffer);
 	}
-
-	return info;
 }
 
 #endif
 
-/// @brief Initializes HomeAssistant sensor device discovery storage.
+/// @brief Writes HomeAssistant temperature or humidity sensor discovery values.
+/// @param w
 /// @param type
 /// @param channel
-/// @return 
-HassDeviceInfo* hass_init_sensor_device_info(ENTITY_TYPE type, int channel) {
-	//Assuming that there is only one DHT setup per device which keeps uniqueid/names simpler
-	HassDeviceInfo* info = hass_init_device_info(type, channel, NULL, NULL);	//using channel as index to generate uniqueId
-
+static void hass_write_sensor(hassJson_t* w, ENTITY_TYPE type, int channel) {
 	//https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
-	switch (type) {
-	case TEMPERATURE_SENSOR:
-		cJSON_AddStringToObject(info->root, "dev_cla", "temperature");
-		cJSON_AddStringToObject(info->root, "unit_of_meas", "°C");
+	if (type == TEMPERATURE_SENSOR) {
+		hass_json_str(w, "dev_cla", "temperature");
+		hass_json_str(w, "unit_of_meas", "°C");
 
 		//https://www.home-assistant.io/integrations/sensor.mqtt/ refers to value_template (val_tpl)
 		//{{ float(value)*0.1 }} for value=12 give 1.2000000000000002, using round() to limit the decimal places
-		cJSON_AddStringToObject(info->root, "val_tpl", "{{ float(value)*0.1|round(2) }}");
+		hass_json_str(w, "val_tpl", "{{ float(value)*0.1|round(2) }}");
+	}
+	else {
+		hass_json_str(w, "dev_cla", "humidity");
+		hass_json_str(w, "unit_of_meas", "%");
+	}
+
+	sprintf(g_hassBuffer, "~/%d/get", channel);
+	hass_json_str(w, STATE_TOPIC_KEY, g_hassBuffer);
+
+	hass_json_str(w, "stat_cla", "measurement");
+}
+
+/// @brief Gets n-th entity of current configuration, in discovery order.
+/// @param n
+/// @param type
+/// @param index Channel, or sensor index for power sensors
+/// @return false if there are not that many entities
+static bool hass_get_entity(int n, ENTITY_TYPE* type, int* index) {
+	int i;
+	int relayCount;
+	int pwmCount;
+	int dInputCount;
+
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		if (h_isChannelRelay(i) && n-- == 0) {
+			*type = RELAY;
+			*index = i;
+			return true;
+		}
+	}
+	for (i = 0; i < CHANNEL_MAX; i++) {
+		if (h_isChannelDigitalInput(i) && n-- == 0) {
+			*type = BINARY_SENSOR;
+			*index = i;
+			return true;
+		}
+	}
+
+	get_Relay_PWM_Count(&relayCount, &pwmCount, &dInputCount);
+	// 4 PWM device not yet handled
+	if ((pwmCount > 0 && pwmCount != 4) || LED_IsLedDriverChipRunning()) {
+		if (n-- == 0) {
+			if (pwmCount == 5 || LED_IsLedDriverChipRunning()) {
+				// Enable + RGB control + CW control
+				*type = LIGHT_RGBCW;
+			}
+			else if (pwmCount == 3) {
+				// Enable + RGB control
+				*type = LIGHT_RGB;
+			}
+			else if (pwmCount == 2) {
+				// PWM + Temperature (https://github.com/openshwprojects/OpenBK7231T_App/issues/279)
+				*type = LIGHT_PWMCW;
+			}
+			else {
+				*type = LIGHT_PWM;
+			}
+			//We can just use 1 to generate unique_id and name for single PWM.
+			*index = 1;
+			return true;
+		}
+	}
+
+#ifndef OBK_DISABLE_ALL_DRIVERS
+	if (DRV_IsMeasuringPower()) {
+		for (i = 0; i <= OBK_CONSUMPTION_STATS; i++) {
+			if (n-- == 0) {
+				*type = POWER_SENSOR;
+				*index = i;
+				return true;
+			}
+		}
+	}
+#endif
+
+	//Assuming that there is only one DHT setup per device which keeps uniqueid/names simpler
+	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
+		if (IS_PIN_DHT_ROLE(g_cfg.pins.roles[i]) || IS_PIN_TEMP_HUM_SENSOR_ROLE(g_cfg.pins.roles[i])) {
+			if (n < 2) {
+				*type = n == 0 ? TEMPERATURE_SENSOR : HUMIDITY_SENSOR;
+				*index = n == 0 ? PIN_GetPinChannelForPinIndex(i) : PIN_GetPinChannel2ForPinIndex(i);
+				return true;
+			}
+			n -= 2;
+		}
+	}
+	return false;
+}
+
+/// @brief Writes discovery payload of entity.
+/// @param w
+/// @param type
+/// @param index
+/// @param channel Array to populate with config channel (should be of size HASS_CHANNEL_SIZE)
+static void hass_write_entity(hassJson_t* w, ENTITY_TYPE type, int index, char* channel) {
+	char uniq_id[HASS_UNIQUE_ID_SIZE];
+
+	hass_populate_unique_id(type, index, uniq_id);
+	hass_populate_device_config_channel(type, uniq_id, channel);
+
+	switch (type) {
+	case RELAY:
+		hass_write_common(w, type, index, uniq_id, "1", "0");
+		hass_write_relay(w, index);
+		break;
+	case BINARY_SENSOR:
+		hass_write_common(w, type, index, uniq_id, "1", "0");
+		hass_write_binary_sensor(w, index);
 		break;
+	case LIGHT_PWM:
+	case LIGHT_PWMCW:
+	case LIGHT_RGB:
+	case LIGHT_RGBCW:
+		//The payload_on/payload_off have to match the state_topic/command_topic values.
+		hass_write_common(w, type, index, uniq_id, "1", "0");
+		hass_write_light(w, type);
+		break;
+	case POWER_SENSOR:
+		hass_write_common(w, type, index, uniq_id, NULL, NULL);
+#ifndef OBK_DISABLE_ALL_DRIVERS
+		hass_write_power_sensor(w, index);
+#endif
+		break;
+	case TEMPERATURE_SENSOR:
 	case HUMIDITY_SENSOR:
-		cJSON_AddStringToObject(info->root, "dev_cla", "humidity");
-		cJSON_AddStringToObject(info->root, "unit_of_meas", "%");
+		//using channel as index to generate uniqueId
+		hass_write_common(w, type, index, uniq_id, NULL, NULL);
+		hass_write_sensor(w, type, index);
 		break;
+	}
+	hass_json_close(w, false);
+}
 
-	default:
-		return NULL;
+static unsigned int hass_hash(unsigned int h, const char* s) {
+	while (*s) {
+		h = (h ^ (unsigned char)*s++) * 16777619u;
 	}
+	return h;
+}
 
-	sprintf(g_hassBuffer, "~/%d/get", channel);
-	cJSON_AddStringToObject(info->root, STATE_TOPIC_KEY, g_hassBuffer);
+static unsigned int hass_topic_hash(const char* topic, const char* channel) {
+	return hass_hash(hass_hash(2166136261u, topic), channel);
+}
 
-	cJSON_AddStringToObject(info->root, "stat_cla", "measurement");
-	return info;
+static hassPublished_t* hass_find_published(unsigned int topicHash) {
+	int i;
+
+	for (i = 0; i < HASS_DISCOVERY_MAX_HASHES; i++) {
+		if (g_hassPublished[i].topicHash == topicHash) {
+			return &g_hassPublished[i];
+		}
+	}
+	return 0;
 }
 
-/// @brief Returns the discovery JSON.
-/// @param info 
-/// @return 
-const char* hass_build_discovery_json(HassDeviceInfo* info) {
-	if (info == NULL) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_HASS, "ERROR: someone passed NULL pointer to hass_build_discovery_json\r\n");
-		return "";
+void hass_discovery_onPublished(const char* topic, const char* channel, const char* value) {
+	hassPublished_t* p;
+	unsigned int topicHash;
+
+	topicHash = hass_topic_hash(topic, channel);
+	p = hass_find_published(topicHash);
+	if (p == 0) {
+		p = hass_find_published(0);
+		if (p == 0) {
+			// not remembered, so it is just published again next time
+			return;
+		}
+		p->topicHash = topicHash;
 	}
-	cJSON_PrintPreallocated(info->root, info->json, HASS_JSON_SIZE, 0);
-	return info->json;
+	p->hash = hass_hash(topicHash, value);
 }
 
-/// @brief Release allocated memory.
-/// @param info 
-void hass_free_device_info(HassDeviceInfo* info) {
-	if (info == NULL)
-		return;
-	//addLogAdv(LOG_DEBUG, LOG_FEATURE_HASS, "hass_free_device_info \r\n");
+void hass_discovery_forget() {
+	memset(g_hassPublished, 0, sizeof(g_hassPublished));
+}
+
+int hass_discovery_start(const char* topic, bool bForce) {
+	ENTITY_TYPE type;
+	int index;
+	int count = 0;
 
-	if (info->root != NULL) {
-		cJSON_Delete(info->root);
+	if (topic == 0 || *topic == 0) {
+		topic = "homeassistant";
 	}
+	strcpy_safe(g_hassTopic, topic, sizeof(g_hassTopic));
+	while (hass_get_entity(count, &type, &index)) {
+		count++;
+	}
+	// running discovery starts over with new settings
+	g_hassRunning = count > 0;
+	g_hassForce = bForce;
+	g_hassQueued = false;
+	g_hassNext = 0;
+	addLogAdv(LOG_INFO, LOG_FEATURE_HASS, "Discovery of %i entities started", count);
+	return count;
+}
 
-	os_free(info);
+bool hass_discovery_isRunning() {
+	return g_hassRunning;
+}
+
+/// @brief Queues next entities of running discovery. Each is written in place into publish queue,
+/// and dropped again if config published for it before has the same hash.
+/// Hash is remembered only once publish succeeded, see hass_discovery_onPublished.
+void hass_discovery_runEverySecond() {
+	char channel[HASS_CHANNEL_SIZE];
+	hassJson_t w;
+	hassPublished_t* p;
+	ENTITY_TYPE type;
+	unsigned int topicHash;
+	char* buf;
+	int index;
+	int done = 0;
+
+	if (g_hassRunning == false || MQTT_IsReady() == false) {
+		return;
+	}
+	while (done < HASS_DISCOVERY_PER_SECOND) {
+		if (hass_get_entity(g_hassNext, &type, &index) == false) {
+			g_hassRunning = false;
+			if (g_hassQueued) {
+				MQTT_InvokeCommandAtEnd(PublishChannels);
+			}
+			addLogAdv(LOG_INFO, LOG_FEATURE_HASS, "Discovery done");
+			return;
+		}
+		buf = MQTT_QueuePublishReserve();
+		if (buf == 0) {
+			// queue is full, try again next second
+			return;
+		}
+		hass_json_begin(&w, buf, MQTT_PUBLISH_ITEM_VALUE_LENGTH);
+		hass_write_entity(&w, type, index, channel);
+		topicHash = hass_topic_hash(g_hassTopic, channel);
+		p = hass_find_published(topicHash);
+		if (w.bOverflow) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_HASS, "Discovery of %s does not fit", channel);
+			MQTT_QueuePublishCancel();
+		}
+		else if (g_hassForce == false && p != 0 && p->hash == hass_hash(topicHash, buf)) {
+			addLogAdv(LOG_DEBUG, LOG_FEATURE_HASS, "Discovery of %s unchanged", channel);
+			MQTT_QueuePublishCancel();
+		}
+		else {
+			MQTT_QueuePublishCommit(g_hassTopic, channel, OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_HASS_CONFIG);
+			g_hassQueued = true;
+			done++;
+		}
+		g_hassNext++;
+	}
 }
@@ -1,6 +1,5 @@
 
 #include "new_http.h"
-#include "../cJSON/cJSON.h"
 #include "../new_pins.h"
 #include "../mqtt/new_mqtt.h"
 
@@ -40,25 +39,38 @@ typedef enum {
 //channel is based on unique_id (see hass_populate_device_config_channel)
 #define HASS_CHANNEL_SIZE       (HASS_UNIQUE_ID_SIZE + 32)
 
-//Size of JSON (1 less than MQTT queue holding)
-#define HASS_JSON_SIZE          (MQTT_PUBLISH_ITEM_VALUE_LENGTH - 1)
+// Entities queued per second, so discovery of many channels does not flood publish queue
+#define HASS_DISCOVERY_PER_SECOND	2
+// Entities whose published config is remembered, to skip unchanged ones on next discovery
+#define HASS_DISCOVERY_MAX_HASHES	32
 
-/// @brief HomeAssistant device discovery information
-typedef struct HassDeviceInfo_s {
-	char unique_id[HASS_UNIQUE_ID_SIZE];
-	char channel[HASS_CHANNEL_SIZE];
-	char json[HASS_JSON_SIZE];
+/// @brief Published config of one entity, keyed by its config topic
+typedef struct hassPublished_s {
+	unsigned int topicHash;
+	unsigned int hash;
+} hassPublished_t;
 
-	cJSON* root;
-	cJSON* device;
-	cJSON* ids;
-} HassDeviceInfo;
+/// @brief Streaming JSON writer. Discovery payload is written member by member straight
+/// into MQTT queue item, escaped as cJSON does it, without building a tree.
+typedef struct hassJson_s {
+	char* buf;
+	int size;
+	int len;
+	// something did not fit, payload is not usable
+	bool bOverflow;
+	// no comma before next member
+	bool bFirst;
+} hassJson_t;
 
 void hass_print_unique_id(http_request_t* request, const char* fmt, ENTITY_TYPE type, int index);
-HassDeviceInfo* hass_init_relay_device_info(int index);
-HassDeviceInfo* hass_init_light_device_info(ENTITY_TYPE type);
-HassDeviceInfo* hass_init_power_sensor_device_info(int index);
-HassDeviceInfo* hass_init_binary_sensor_device_info(int index);
-HassDeviceInfo* hass_init_sensor_device_info(ENTITY_TYPE type, int channel);
-const char* hass_build_discovery_json(HassDeviceInfo* info);
-void hass_free_device_info(HassDeviceInfo* info);
+/// @brief Starts discovery of all entities device has, they are queued from hass_discovery_runEverySecond.
+/// @param topic Discovery prefix, "homeassistant" if empty
+/// @param bForce Publish also entities whose config was already published unchanged
+/// @return Number of entities, 0 if there is nothing to discover
+int hass_discovery_start(const char* topic, bool bForce);
+void hass_discovery_runEverySecond();
+bool hass_discovery_isRunning();
+/// @brief Remembers config that was published, so that next scheduled discovery can skip it if unchanged
+void hass_discovery_onPublished(const char* topic, const char* channel, const char* value);
+/// @brief Forgets all published configs, next discovery publishes everything
+void hass_discovery_forget();
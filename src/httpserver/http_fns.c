@@ -857,6 +857,11 @@ int http_fn_index(http_request_t* request) {
 	else {
 		const char *stateStr;
 		const char *colorStr;
+		int rxSize, rxUsed, rxHighWater, rxOverflows, rxDrops;
+		int rxLatLast, rxLatAvg, rxLatMax, rxLatCount;
+		int pubAllocs, lockWaits, lockFails;
+		int queued, coalesced, dropped;
+		int offPending, offStored, offSpilled, offDropped, offReplayed;
 		if (mqtt_reconnect > 0) {
 			stateStr = "awaiting reconnect";
 			colorStr = "orange";
@@ -871,8 +876,24 @@ int http_fn_index(http_request_t* request) {
 		hprintf255(request, "<h5>MQTT State: <span style=\"color:%s\">%s</span> RES: %d(%s)<br>", colorStr,
 			stateStr,MQTT_GetConnectResult(), get_error_name(MQTT_GetConnectResult()));
 		hprintf255(request, "MQTT ErrMsg: %s <br>", (MQTT_GetStatusMessage() != NULL) ? MQTT_GetStatusMessage() : "");
-		hprintf255(request, "MQTT Stats:CONN: %d PUB: %d RECV: %d ERR: %d </h5>", MQTT_GetConnectEvents(),
+		hprintf255(request, "MQTT Stats:CONN: %d PUB: %d RECV: %d ERR: %d <br>", MQTT_GetConnectEvents(),
 			MQTT_GetPublishEventCounter(), MQTT_GetReceivedEventCounter(), MQTT_GetPublishErrorCounter());
+		MQTT_GetRxBufferStats(&rxSize, &rxUsed, &rxHighWater, &rxOverflows, &rxDrops);
+		hprintf255(request, "MQTT RX Buffer: %d/%d HIGH: %d OVERFLOW: %d DROP: %d <br>", rxUsed, rxSize,
+			rxHighWater, rxOverflows, rxDrops);
+		MQTT_GetRxLatencyStats(&rxLatLast, &rxLatAvg, &rxLatMax, &rxLatCount);
+		hprintf255(request, "MQTT RX Latency: LAST: %dms AVG: %dms MAX: %dms COUNT: %d <br>", rxLatLast,
+			rxLatAvg, rxLatMax, rxLatCount);
+		MQTT_GetPublishPathStats(&pubAllocs, &lockWaits, &lockFails);
+		MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+		hprintf255(request, "MQTT Publish ALLOC: %d LOCK WAIT: %d LOCK FAIL: %d QUEUED: %d COALESCED: %d DROPPED: %d",
+			pubAllocs, lockWaits, lockFails, queued, coalesced, dropped);
+		if (MQTT_Offline_IsEnabled()) {
+			MQTT_Offline_GetStats(&offPending, &offStored, &offSpilled, &offDropped, &offReplayed);
+			hprintf255(request, "<br>MQTT Offline PENDING: %d STORED: %d SPILLED: %d DROPPED: %d REPLAYED: %d",
+				offPending, offStored, offSpilled, offDropped, offReplayed);
+		}
+		hprintf255(request, " </h5>");
 	}
 	/* Format current PINS input state for all unused pins */
 	if (CFG_HasFlag(OBK_FLAG_HTTP_PINMONITOR))
@@ -1608,123 +1629,13 @@ int http_fn_cfg_quick(http_request_t* request) {
 	return 0;
 }
 
+/// @brief Starts HomeAssistant discovery, entities are queued a few per second.
+/// Scheduled discovery skips entities whose config was already published unchanged,
+/// discovery requested from web page publishes all of them again.
+/// @param topic Discovery prefix
+/// @param request Web page request, or NULL
 void doHomeAssistantDiscovery(const char *topic, http_request_t *request) {
-	int i;
-	int relayCount;
-	int pwmCount;
-	int dInputCount;
-	bool ledDriverChipRunning;
-	HassDeviceInfo* dev_info = NULL;
-	bool measuringPower = false;
-	struct cJSON_Hooks hooks;
-	bool discoveryQueued = false;
-
-	if (topic == 0 || *topic == 0) {
-		topic = "homeassistant";
-	}
-
-#ifndef OBK_DISABLE_ALL_DRIVERS
-	measuringPower = DRV_IsMeasuringPower();
-#endif
-
-	get_Relay_PWM_Count(&relayCount, &pwmCount, &dInputCount);
-
-	ledDriverChipRunning = LED_IsLedDriverChipRunning();
-
-	hooks.malloc_fn = os_malloc;
-	hooks.free_fn = os_free;
-	cJSON_InitHooks(&hooks);
-
-	if (relayCount > 0) {
-		for (i = 0; i < CHANNEL_MAX; i++) {
-			if (h_isChannelRelay(i)) {
-                dev_info = hass_init_relay_device_info(i);
-				if (dev_info != NULL) {
-					MQTT_QueuePublish((char*)topic, dev_info->channel, (char*)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-					hass_free_device_info(dev_info);
-                    dev_info = NULL;
-                    discoveryQueued = true;
-				}
-			}
-		}
-	}
-
-	if (dInputCount > 0) {
-		for (i = 0; i < CHANNEL_MAX; i++) {
-			if (h_isChannelDigitalInput(i)) {
-				dev_info = hass_init_binary_sensor_device_info(i);
-				MQTT_QueuePublish((char*)topic, dev_info->channel, (char*)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-				hass_free_device_info(dev_info);
-				dev_info = NULL;
-				discoveryQueued = true;
-			}
-		}
-	}
-
-	if (pwmCount == 5 || ledDriverChipRunning) {
-		if (dev_info == NULL) {
-			dev_info = hass_init_light_device_info(LIGHT_RGBCW);
-		}
-		// Enable + RGB control + CW control
-		MQTT_QueuePublish((char*)topic, dev_info->channel, (char*)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-		hass_free_device_info(dev_info);
-		dev_info = NULL;
-		discoveryQueued = true;
-	}
-	else if (pwmCount > 0) {
-		if (pwmCount == 4) {
-			addLogAdv(LOG_ERROR, LOG_FEATURE_HTTP, "4 PWM device not yet handled\r\n");
-		}
-		else if (pwmCount == 3) {
-			// Enable + RGB control
-			dev_info = hass_init_light_device_info(LIGHT_RGB);
-		}
-		else if (pwmCount == 2) {
-			// PWM + Temperature (https://github.com/openshwprojects/OpenBK7231T_App/issues/279)
-			dev_info = hass_init_light_device_info(LIGHT_PWMCW);
-		}
-		else {
-			dev_info = hass_init_light_device_info(LIGHT_PWM);
-		}
-
-		if (dev_info != NULL) {
-			MQTT_QueuePublish((char*)topic, dev_info->channel, (char*)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-			hass_free_device_info(dev_info);
-			dev_info = NULL;
-			discoveryQueued = true;
-		}
-	}
-
-#ifndef OBK_DISABLE_ALL_DRIVERS
-	if (measuringPower == true) {
-		for (i = 0; i < OBK_NUM_SENSOR_COUNT; i++)
-		{
-			dev_info = hass_init_sensor_device_info(POWER_SENSOR, i);
-			MQTT_QueuePublish((char*)topic, dev_info->channel, (char *)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-			hass_free_device_info(dev_info);
-			discoveryQueued = true;
-		}
-	}
-#endif
-
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		if (IS_PIN_DHT_ROLE(g_cfg.pins.roles[i]) || IS_PIN_TEMP_HUM_SENSOR_ROLE(g_cfg.pins.roles[i])) {
-			dev_info = hass_init_sensor_device_info(TEMPERATURE_SENSOR, PIN_GetPinChannelForPinIndex(i));
-			MQTT_QueuePublish((char*)topic, dev_info->channel, (char*)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-			hass_free_device_info(dev_info);
-
-			dev_info = hass_init_sensor_device_info(HUMIDITY_SENSOR, PIN_GetPinChannel2ForPinIndex(i));
-			MQTT_QueuePublish((char*)topic, dev_info->channel, (char*)hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
-			hass_free_device_info(dev_info);
-
-			discoveryQueued = true;
-		}
-	}
-
-	if (discoveryQueued) {
-		MQTT_InvokeCommandAtEnd(PublishChannels);
-	}
-	else {
+	if (hass_discovery_start(topic, request != 0) == 0) {
 		const char *msg = "No relay, PWM, sensor or power driver running.";
 		if (request) {
 			poststr(request, msg);
@@ -1979,14 +1890,36 @@ const char *skipToNextWord(const char *p) {
 	return p;
 }
 
+// Tasmota STATUS queries made only of firmware, network and MQTT config sections get ETag
+// of state revision. STATE, STATUS 0/8/10 and others carry time, uptime, sensor and energy
+// readings, which change without revision bump, so they are always sent in full.
+static bool http_isConfigQuery(const char* cmd) {
+	const char* arg;
+
+	if (wal_strnicmp(cmd, "STATUS", 6)) {
+		return false;
+	}
+	arg = skipToNextWord(cmd);
+	return !stricmp(arg, "2") || !stricmp(arg, "4") || !stricmp(arg, "5") || !stricmp(arg, "6");
+}
+
 int http_fn_cm(http_request_t* request) {
 	char tmpA[128];
+	char headers[64];
 	char *long_str_alloced = 0;
 	int commandLen;
 
-	http_setup(request, httpMimeTypeJson);
-	// exec command
 	commandLen = http_getArg(request->url, "cmnd", tmpA, sizeof(tmpA));
+	if (commandLen && commandLen <= (sizeof(tmpA) - 5) && http_isConfigQuery(tmpA)) {
+		if (HTTP_CheckStateRevision(request, headers, sizeof(headers))) {
+			return 0;
+		}
+		http_setup_headers(request, httpMimeTypeJson, headers);
+	}
+	else {
+		http_setup(request, httpMimeTypeJson);
+	}
+	// exec command
 	if (commandLen) {
 		if (commandLen > (sizeof(tmpA) - 5)) {
 			commandLen += 8;
@@ -2054,7 +1987,7 @@ int http_fn_cfg_pins(http_request_t* request) {
 	int iChanged = 0;
 	int iChangedRequested = 0;
 	int i;
-	char tmpA[128];
+	char tmpA[16];
 	char tmpB[64];
 
 	http_setup(request, httpMimeTypeHTML);
@@ -2127,72 +2060,8 @@ int http_fn_cfg_pins(http_request_t* request) {
 
 		hprintf255(request, "Pins update - %i reqs, %i changed!<br><br>", iChangedRequested, iChanged);
 	}
-	//	strcat(outbuf,"<button type=\"button\">Click Me!</button>");
-	poststr(request, "<form action=\"cfg_pins\">");
-	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
-		int si, ch, ch2;
-		int j;
-		const char* alias;
-		// On BL602, any GPIO can be mapped to one of 5 PWM channels
-		// But on Beken chips, only certain pins can be PWM
-		int bCanThisPINbePWM;
-
-		si = PIN_GetPinRoleForPinIndex(i);
-		ch = PIN_GetPinChannelForPinIndex(i);
-		ch2 = PIN_GetPinChannel2ForPinIndex(i);
-
-		bCanThisPINbePWM = HAL_PIN_CanThisPinBePWM(i);
-
-		// if available..
-		alias = HAL_PIN_GetPinNameAlias(i);
-		poststr(request, "<div class=\"hdiv\">");
-		if (alias) {
-#if defined(PLATFORM_BEKEN) || defined(WINDOWS)
-			hprintf255(request, "P%i (%s) ", i, alias);
-#else
-			poststr(request, alias);
-			poststr(request, " ");
-#endif
-		}
-		else {
-			hprintf255(request, "P%i ", i);
-		}
-		hprintf255(request, "<select class=\"hele\" name=\"%i\">", i);
-		for (j = 0; j < IOR_Total_Options; j++) {
-			// do not show hardware PWM on non-PWM pin
-			if (j == IOR_PWM || j == IOR_PWM_n) {
-				if (bCanThisPINbePWM == 0) {
-					continue;
-				}
-			}
-
-			if (j == si) {
-				hprintf255(request, "<option value=\"%i\" selected>%s</option>", j, htmlPinRoleNames[j]);
-			}
-			else {
-				hprintf255(request, "<option value=\"%i\">%s</option>", j, htmlPinRoleNames[j]);
-			}
-		}
-		poststr(request, "</select>");
-		// Primary linked channel
-		// Some roles do not need any channels
-		if (si != IOR_SHT3X_CLK && si != IOR_CHT8305_CLK && si != IOR_Button_ToggleAll && si != IOR_Button_ToggleAll_n
-			&& si != IOR_BL0937_CF && si != IOR_BL0937_CF1 && si != IOR_BL0937_SEL
-			&& si != IOR_LED_WIFI && si != IOR_LED_WIFI_n && si != IOR_LED_WIFI_n
-			&& !(si >= IOR_IRRecv && si <= IOR_DHT11)
-			&& !(si >= IOR_SM2135_DAT && si <= IOR_BP1658CJ_CLK))
-		{
-			hprintf255(request, "<input class=\"hele\" name=\"r%i\" type=\"text\" value=\"%i\"/>", i, ch);
-		}
-		// Secondary linked channel
-		// For button, is relay index to toggle on double click
-		if (si == IOR_Button || si == IOR_Button_n || IS_PIN_DHT_ROLE(si) || IS_PIN_TEMP_HUM_SENSOR_ROLE(si) )
-		{
-			hprintf255(request, "<input class=\"hele\" name=\"e%i\" type=\"text\" value=\"%i\"/>", i, ch2);
-		}
-		poststr(request, "</div>");
-	}
-	poststr(request, "<input type=\"submit\" value=\"Save\"/></form>");
+	// form is rendered by script.js from api/pinconfig, page itself stays small
+	poststr(request, "<form action=\"cfg_pins\" id=\"pins\">Loading...</form>");
 
 	poststr(request, htmlFooterReturnToCfgLink);
 	http_html_end(request);
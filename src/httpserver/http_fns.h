@@ -30,6 +30,8 @@ int http_fn_ota(http_request_t* request);
 int http_fn_empty_url(http_request_t* request);
 int http_fn_other(http_request_t* request);
 int http_fn_cm(http_request_t* request);
+// returns arguments part of command line
+const char *skipToNextWord(const char *p);
 int http_fn_startup_command(http_request_t* request);
 int http_fn_cfg_generic(http_request_t* request);
 int http_fn_cfg_startup(http_request_t* request);
@@ -0,0 +1,317 @@
+
+#include "../new_common.h"
+#include "lwip/sockets.h"
+#include "../logging/logging.h"
+#include "../new_pins.h"
+#include "../cmnds/cmd_public.h"
+#include "new_http.h"
+#include "http_sse.h"
+
+// lwIP has it, on Windows sockets are already non-blocking
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+#define SSE_EVENT_BUFFER_SIZE 64
+#define SSE_LOG_BUFFER_SIZE 256
+// log chunks sent per tick, rest waits in log ring
+#define SSE_LOG_CHUNKS_PER_TICK 2
+
+typedef struct sseClient_s {
+	int bUsed;
+	// set when headers were sent, slot is reserved before
+	int bReady;
+	int fd;
+	int bLog;
+	// seconds since anything was sent
+	int idle;
+} sseClient_t;
+
+static sseClient_t g_sse_clients[SSE_MAX_CLIENTS];
+// read without lock by hooks, so they cost nothing without clients
+static volatile int g_sse_numClients = 0;
+static int g_sse_numLogClients = 0;
+// log memory subscription shared by clients that want log
+static int g_sse_logSub = -1;
+static SemaphoreHandle_t g_sse_mutex = 0;
+// changes since last tick
+static unsigned int g_sse_changedChannels[(CHANNEL_MAX + 31) / 32];
+static int g_sse_bChannelsChanged = 0;
+static int g_sse_bEvent = 0;
+static int g_sse_event;
+static int g_sse_eventArg;
+// clients closed on send error, logged outside of lock
+static int g_sse_dropped = 0;
+
+#ifdef WINDOWS
+static char g_sse_simOutput[4096];
+static int g_sse_simOutputLen = 0;
+
+const char* SIM_GetSSEOutput() {
+	return g_sse_simOutput;
+}
+void SIM_ClearSSEOutput() {
+	g_sse_simOutputLen = 0;
+	g_sse_simOutput[0] = 0;
+}
+#endif
+
+static bool HTTP_SSE_Lock(int waitMs) {
+	return xSemaphoreTake(g_sse_mutex, waitMs) == pdTRUE;
+}
+
+// only after HTTP_SSE_Lock has succeeded
+static void HTTP_SSE_Unlock() {
+	xSemaphoreGive(g_sse_mutex);
+}
+
+// with lock
+static void HTTP_SSE_Close(sseClient_t* c) {
+#ifdef WINDOWS
+	if (c->fd != 0) {
+		closesocket(c->fd);
+	}
+#else
+	lwip_close(c->fd);
+#endif
+	if (c->bLog) {
+		g_sse_numLogClients--;
+		if (g_sse_numLogClients == 0) {
+			LOG_Unsubscribe(g_sse_logSub);
+			g_sse_logSub = -1;
+		}
+	}
+	c->bUsed = 0;
+	c->bReady = 0;
+	g_sse_numClients--;
+}
+
+// with lock. Partial event would break the stream, so client that can't take it at once is dropped
+static void HTTP_SSE_Send(sseClient_t* c, const char* data, int len) {
+	c->idle = 0;
+#ifdef WINDOWS
+	if (c->fd == 0) {
+		if (g_sse_simOutputLen + len < sizeof(g_sse_simOutput)) {
+			memcpy(g_sse_simOutput + g_sse_simOutputLen, data, len);
+			g_sse_simOutputLen += len;
+			g_sse_simOutput[g_sse_simOutputLen] = 0;
+		}
+		return;
+	}
+#endif
+	if (send(c->fd, data, len, MSG_DONTWAIT) != len) {
+		HTTP_SSE_Close(c);
+		g_sse_dropped++;
+	}
+}
+
+static void HTTP_SSE_SendAll(const char* data, int len, int bLogOnly) {
+	int i;
+
+	for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+		if (g_sse_clients[i].bReady && (bLogOnly == 0 || g_sse_clients[i].bLog)) {
+			HTTP_SSE_Send(&g_sse_clients[i], data, len);
+		}
+	}
+}
+
+void HTTP_SSE_OnChannelChanged(int ch) {
+	if (g_sse_numClients == 0 || ch < 0 || ch >= CHANNEL_MAX) {
+		return;
+	}
+	if (!HTTP_SSE_Lock(100)) {
+		return;
+	}
+	g_sse_changedChannels[ch / 32] |= 1u << (ch % 32);
+	g_sse_bChannelsChanged = 1;
+	HTTP_SSE_Unlock();
+}
+
+void HTTP_SSE_OnEvent(int eventCode, int argument) {
+	if (g_sse_numClients == 0) {
+		return;
+	}
+	// sent as "channel" event, or fired every second
+	if (eventCode == CMD_EVENT_CHANNEL_ONCHANGE || eventCode == CMD_EVENT_CHANGE_NOPINGTIME
+		|| (eventCode >= CMD_EVENT_CHANGE_CHANNEL0 && eventCode <= CMD_EVENT_CHANGE_CHANNEL63)) {
+		return;
+	}
+	if (!HTTP_SSE_Lock(100)) {
+		return;
+	}
+	g_sse_bEvent = 1;
+	g_sse_event = eventCode;
+	g_sse_eventArg = argument;
+	HTTP_SSE_Unlock();
+}
+
+// sends new log lines as one event, each line as data field.
+// Line split by chunk boundary is continued in next event.
+static void HTTP_SSE_SendLog() {
+	char chunk[SSE_LOG_BUFFER_SIZE];
+	char out[SSE_LOG_BUFFER_SIZE * 2];
+	char* line;
+	char* end;
+	int chunks, len;
+
+	for (chunks = 0; chunks < SSE_LOG_CHUNKS_PER_TICK; chunks++) {
+		if (LOG_GetSubscriberData(g_sse_logSub, chunk, sizeof(chunk)) <= 0) {
+			break;
+		}
+		strcpy(out, "event: log\n");
+		len = strlen(out);
+		for (line = chunk; *line; line = end) {
+			end = line + strcspn(line, "\r\n");
+			if (end != line) {
+				len += sprintf(out + len, "data: %.*s\n", (int)(end - line), line);
+			}
+			end += strspn(end, "\r\n");
+		}
+		out[len++] = '\n';
+		HTTP_SSE_SendAll(out, len, 1);
+	}
+}
+
+void HTTP_SSE_RunQuickTick() {
+	char buf[SSE_EVENT_BUFFER_SIZE];
+	int ch, len, dropped;
+
+	if (g_sse_numClients == 0) {
+		return;
+	}
+	// changes wait for next tick
+	if (!HTTP_SSE_Lock(100)) {
+		return;
+	}
+	if (g_sse_bChannelsChanged) {
+		g_sse_bChannelsChanged = 0;
+		for (ch = 0; ch < CHANNEL_MAX; ch++) {
+			if ((g_sse_changedChannels[ch / 32] & (1u << (ch % 32))) == 0) {
+				continue;
+			}
+			g_sse_changedChannels[ch / 32] &= ~(1u << (ch % 32));
+			len = snprintf(buf, sizeof(buf), "event: channel\ndata: {\"ch\":%i,\"val\":%i}\n\n", ch, CHANNEL_Get(ch));
+			HTTP_SSE_SendAll(buf, len, 0);
+		}
+	}
+	if (g_sse_bEvent) {
+		g_sse_bEvent = 0;
+		len = snprintf(buf, sizeof(buf), "event: state\ndata: {\"event\":%i,\"arg\":%i}\n\n", g_sse_event, g_sse_eventArg);
+		HTTP_SSE_SendAll(buf, len, 0);
+	}
+	if (g_sse_numLogClients > 0) {
+		HTTP_SSE_SendLog();
+	}
+	dropped = g_sse_dropped;
+	g_sse_dropped = 0;
+	HTTP_SSE_Unlock();
+	if (dropped) {
+		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "Event stream: dropped %i client(s)", dropped);
+	}
+}
+
+void HTTP_SSE_RunEverySecond() {
+	static const char ping[] = ": ping\n\n";
+	int i;
+
+	if (g_sse_numClients == 0) {
+		return;
+	}
+	if (!HTTP_SSE_Lock(100)) {
+		return;
+	}
+	for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+		if (g_sse_clients[i].bReady && ++g_sse_clients[i].idle >= SSE_HEARTBEAT_SECONDS) {
+			HTTP_SSE_Send(&g_sse_clients[i], ping, sizeof(ping) - 1);
+		}
+	}
+	HTTP_SSE_Unlock();
+}
+
+int HTTP_SSE_GetClientsCount() {
+	return g_sse_numClients;
+}
+
+static int http_fn_events(http_request_t* request) {
+	char tmp[8];
+	sseClient_t* c = 0;
+	int i;
+
+	// busy lock is treated like no free slot
+	if (HTTP_SSE_Lock(100)) {
+		for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+			if (g_sse_clients[i].bUsed == 0) {
+				c = &g_sse_clients[i];
+				c->bUsed = 1;
+				c->bLog = 0;
+				g_sse_numClients++;
+				break;
+			}
+		}
+		HTTP_SSE_Unlock();
+	}
+	if (c == 0) {
+		// browser gives up on EventSource and page falls back to polling
+		request->responseCode = 503;
+		http_setup(request, httpMimeTypeText);
+		poststr(request, "Too many event streams");
+		poststr(request, NULL);
+		return 0;
+	}
+	// stream has no length, so connection can't be reused
+	request->keepAlive = 0;
+	http_setup_headers(request, "text/event-stream", "Cache-Control: no-cache\r\n");
+	hprintf255(request, "retry: %i\n\n", SSE_RETRY_MS);
+	poststr(request, NULL);
+
+	// slot is reserved, so it has to be completed, wait for lock as long as it takes
+	if (!HTTP_SSE_Lock(portMAX_DELAY)) {
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "Event stream: lock failed, slot is lost");
+		return 0;
+	}
+	c->fd = request->fd;
+	c->idle = 0;
+	c->bLog = http_getArg(request->url, "log", tmp, sizeof(tmp)) && atoi(tmp);
+	if (c->bLog) {
+		if (g_sse_numLogClients == 0) {
+			// only lines logged from now on
+			g_sse_logSub = LOG_Subscribe();
+		}
+		g_sse_numLogClients++;
+	}
+	c->bReady = 1;
+	HTTP_SSE_Unlock();
+	// socket belongs to us now
+	request->fdTakenOver = 1;
+	return 0;
+}
+
+#ifdef WINDOWS
+void HTTP_SSE_CloseAll() {
+	int i;
+
+	if (HTTP_SSE_Lock(100)) {
+		for (i = 0; i < SSE_MAX_CLIENTS; i++) {
+			if (g_sse_clients[i].bUsed) {
+				HTTP_SSE_Close(&g_sse_clients[i]);
+			}
+		}
+		memset(g_sse_changedChannels, 0, sizeof(g_sse_changedChannels));
+		g_sse_bChannelsChanged = 0;
+		g_sse_bEvent = 0;
+		HTTP_SSE_Unlock();
+	}
+	SIM_ClearSSEOutput();
+}
+#endif
+
+void HTTP_SSE_Init() {
+	if (g_sse_mutex == 0) {
+		g_sse_mutex = xSemaphoreCreateMutex();
+	}
+	// WINDOWS must support reinit
+#ifdef WINDOWS
+	HTTP_SSE_CloseAll();
+#endif
+	HTTP_RegisterCallback("/events", HTTP_GET, http_fn_events);
+}
@@ -0,0 +1,34 @@
+#ifndef __HTTP_SSE_H__
+#define __HTTP_SSE_H__
+
+// Server-Sent Events stream at GET /events, used by index page instead of polling.
+// Connection is taken over from HTTP server and kept open, changes are pushed from QuickTick:
+// - "channel" event with {"ch":N,"val":V}, latest value only if channel changed many times in between,
+// - "state" event with {"event":E,"arg":A} for other state changes of event system
+//   (LED state, MQTT/WiFi state, sensor readings, etc), only the last one per tick,
+// - "log" event with new log lines, only for clients that asked with events?log=1.
+// Without clients, hooks return at once and QuickTick does nothing.
+
+#define SSE_MAX_CLIENTS 2
+// comment line sent to idle clients, so dead ones are noticed and proxies don't time out
+#define SSE_HEARTBEAT_SECONDS 15
+// reconnection delay suggested to browser
+#define SSE_RETRY_MS 3000
+
+void HTTP_SSE_Init();
+// called from Channel_OnChanged
+void HTTP_SSE_OnChannelChanged(int ch);
+// called from event system, events already covered by "channel" are ignored
+void HTTP_SSE_OnEvent(int eventCode, int argument);
+void HTTP_SSE_RunQuickTick();
+void HTTP_SSE_RunEverySecond();
+int HTTP_SSE_GetClientsCount();
+
+#ifdef WINDOWS
+// client of faked request (fd 0) writes here, for selftests
+const char* SIM_GetSSEOutput();
+void SIM_ClearSSEOutput();
+void HTTP_SSE_CloseAll();
+#endif
+
+#endif // __HTTP_SSE_H__
@@ -22,9 +22,320 @@
 #define HTTP_CLIENT_STACK_SIZE 2048
 #endif
 
+// Fixed pool of worker threads serving HTTP/1.1 keep-alive connections from a bounded accept queue.
+// Page load, its assets and state polls then don't pay for thread creation and TCP setup each time.
+// Idle timeout and requests per connection are set with http_keepAlive command.
+// RAM: each worker keeps its HTTP_CLIENT_STACK_SIZE stack for life of device (2 x 8 KB on Beken and W600),
+// request and reply buffers (1 KB + 2 KB) are allocated only while worker serves a connection.
+#if PLATFORM_BEKEN || PLATFORM_W600 || PLATFORM_W800
+#define HTTP_WORKER_POOL
+#define HTTP_WORKER_POOL_CONNECTIONS
+#elif WINDOWS
+// simulator serves HTTP with http_tcp_server_nonblocking.c, only connection handling
+// of worker pool is built here, so selftests can run it on loopback sockets
+#define HTTP_WORKER_POOL_CONNECTIONS
+#else
 #define CREATE_THREAD_PER_EACH_HTTP_CLIENT
+#endif
+
+#define HTTP_WORKER_COUNT			2
+// accepted connections waiting for a worker, more are refused with 503
+#define HTTP_ACCEPT_QUEUE_SIZE		4
+// idle keep-alive connection looks at accept queue this often, so it's dropped soon when work is waiting
+#define HTTP_KEEPALIVE_POLL_MS		100
+
+#ifdef HTTP_WORKER_POOL_CONNECTIONS
+
+static const char httpBusyReply[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+static int g_http_queue[HTTP_ACCEPT_QUEUE_SIZE];
+static int g_http_queueFirst = 0;
+static int g_http_queueCount = 0;
+static SemaphoreHandle_t g_http_queueMutex = 0;
+#ifdef HTTP_WORKER_POOL
+// counts connections in queue, workers wait on it
+static SemaphoreHandle_t g_http_queueSem = 0;
+#endif
+
+static void HTTP_Queue_Init() {
+	if (g_http_queueMutex == 0) {
+		g_http_queueMutex = xSemaphoreCreateMutex();
+	}
+#ifdef HTTP_WORKER_POOL
+	if (g_http_queueSem == 0) {
+		g_http_queueSem = xSemaphoreCreateCounting(HTTP_ACCEPT_QUEUE_SIZE, 0);
+	}
+#endif
+}
+
+static int HTTP_Queue_Push(int fd) {
+	int bOk = 0;
+
+	if (xSemaphoreTake(g_http_queueMutex, portMAX_DELAY) != pdTRUE) {
+		return 0;
+	}
+	if (g_http_queueCount < HTTP_ACCEPT_QUEUE_SIZE) {
+		g_http_queue[(g_http_queueFirst + g_http_queueCount) % HTTP_ACCEPT_QUEUE_SIZE] = fd;
+		g_http_queueCount++;
+		bOk = 1;
+	}
+	xSemaphoreGive(g_http_queueMutex);
+#ifdef HTTP_WORKER_POOL
+	if (bOk) {
+		xSemaphoreGive(g_http_queueSem);
+	}
+#endif
+	return bOk;
+}
+
+static int HTTP_Queue_Pop() {
+	int fd = -1;
+
+	if (xSemaphoreTake(g_http_queueMutex, portMAX_DELAY) != pdTRUE) {
+		return -1;
+	}
+	if (g_http_queueCount > 0) {
+		fd = g_http_queue[g_http_queueFirst];
+		g_http_queueFirst = (g_http_queueFirst + 1) % HTTP_ACCEPT_QUEUE_SIZE;
+		g_http_queueCount--;
+	}
+	xSemaphoreGive(g_http_queueMutex);
+	return fd;
+}
+
+static int HTTP_Queue_IsWaiting() {
+	int count;
+
+	if (xSemaphoreTake(g_http_queueMutex, portMAX_DELAY) != pdTRUE) {
+		return 0;
+	}
+	count = g_http_queueCount;
+	xSemaphoreGive(g_http_queueMutex);
+	return count > 0;
+}
+
+// waits for next request on idle keep-alive connection, in short slices so that
+// connection is given up as soon as another one is queued.
+// Returns 1 when there is data to read
+static int HTTP_WaitForNextRequest(int fd) {
+	fd_set readfds;
+	struct timeval tv;
+	int waited = 0;
+	int slice;
+	int res;
+
+	while (waited < g_http_keepAliveIdleTime) {
+		if (HTTP_Queue_IsWaiting()) {
+			return 0;
+		}
+		slice = g_http_keepAliveIdleTime - waited;
+		if (slice > HTTP_KEEPALIVE_POLL_MS) {
+			slice = HTTP_KEEPALIVE_POLL_MS;
+		}
+		FD_ZERO(&readfds);
+		FD_SET(fd, &readfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = slice * 1000;
+		res = select(fd + 1, &readfds, NULL, NULL, &tv);
+		if (res < 0) {
+			return 0;
+		}
+		if (res > 0) {
+			return 1;
+		}
+		waited += slice;
+	}
+	return 0;
+}
 
-#ifdef CREATE_THREAD_PER_EACH_HTTP_CLIENT
+// serves requests on one connection until client closes it, it's idle for too long,
+// reply can't be kept open or other connections are waiting
+static void tcp_serve_connection(int fd, char* buf, char* reply) {
+	http_request_t request;
+	int served = 0;
+	int lenret;
+
+	while (1) {
+		if (served > 0 && HTTP_WaitForNextRequest(fd) == 0) {
+			break;
+		}
+		os_memset(&request, 0, sizeof(request));
+
+		request.fd = fd;
+		request.received = buf;
+		request.receivedLenmax = INCOMING_BUFFER_SIZE - 2;
+		request.responseCode = HTTP_RESPONSE_OK;
+		request.reply = reply;
+		request.replylen = 0;
+		reply[0] = '\0';
+		request.replymaxlen = REPLY_BUFFER_SIZE - 1;
+		request.keepAlive = served + 1 < g_http_keepAliveMaxRequests;
+
+		request.receivedLen = recv(fd, request.received, request.receivedLenmax, 0);
+		if (request.receivedLen <= 0) {
+			break;
+		}
+		request.received[request.receivedLen] = 0;
+		served++;
+
+		lenret = HTTP_ProcessPacket(&request);
+		if (request.fdTakenOver) {
+			return;
+		}
+		if (HTTP_FinishKeepAlive(&request)) {
+			if (request.replylen > 0) {
+				send(fd, reply, request.replylen, 0);
+			}
+			continue;
+		}
+		if (lenret > 0) {
+			ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP sending reply len %i\n", lenret);
+			send(fd, reply, lenret, 0);
+		}
+		break;
+	}
+	lwip_close(fd);
+}
+
+// queues accepted connection for workers, refuses it with 503 when queue is full.
+// Returns 1 if queued
+int HTTP_Pool_AddConnection(int fd) {
+	HTTP_Queue_Init();
+	if (HTTP_Queue_Push(fd)) {
+		return 1;
+	}
+	ADDLOG_DEBUG(LOG_FEATURE_HTTP, "HTTP accept queue full, refusing fd: %d", fd);
+	send(fd, httpBusyReply, sizeof(httpBusyReply) - 1, 0);
+	lwip_close(fd);
+	return 0;
+}
+
+// serves first queued connection, with buffers allocated only for that connection.
+// Returns 0 if queue was empty
+int HTTP_Pool_ServeNext() {
+	char* buf;
+	char* reply;
+	int fd;
+
+	HTTP_Queue_Init();
+	fd = HTTP_Queue_Pop();
+	if (fd < 0) {
+		return 0;
+	}
+	reply = (char*)os_malloc(REPLY_BUFFER_SIZE);
+	buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
+	if (buf == 0 || reply == 0)
+	{
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP worker failed to malloc buffer");
+		send(fd, httpBusyReply, sizeof(httpBusyReply) - 1, 0);
+		lwip_close(fd);
+	}
+	else {
+		tcp_serve_connection(fd, buf, reply);
+	}
+	if (buf != NULL)
+		os_free(buf);
+	if (reply != NULL)
+		os_free(reply);
+	return 1;
+}
+
+#endif
+
+#ifdef HTTP_WORKER_POOL
+
+xTaskHandle g_http_thread = NULL;
+
+int sendfn(int fd, char* data, int len) {
+	if (fd) {
+		return send(fd, data, len, 0);
+	}
+	return -1;
+}
+
+static void tcp_worker_thread(beken_thread_arg_t arg)
+{
+	while (1)
+	{
+		xSemaphoreTake(g_http_queueSem, portMAX_DELAY);
+		HTTP_Pool_ServeNext();
+	}
+}
+
+/* TCP server listener thread, hands connections to workers */
+static void tcp_server_thread(beken_thread_arg_t arg)
+{
+	(void)(arg);
+	OSStatus err = kNoErr;
+	struct sockaddr_in server_addr, client_addr;
+	socklen_t sockaddr_t_size = sizeof(client_addr);
+	int tcp_listen_fd = -1, client_fd = -1;
+	fd_set readfds;
+
+	tcp_listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY;/* Accept conenction request on all network interface */
+	server_addr.sin_port = htons(HTTP_SERVER_PORT);
+	err = bind(tcp_listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+
+	err = listen(tcp_listen_fd, HTTP_ACCEPT_QUEUE_SIZE);
+
+	while (1)
+	{
+		FD_ZERO(&readfds);
+		FD_SET(tcp_listen_fd, &readfds);
+
+		select(tcp_listen_fd + 1, &readfds, NULL, NULL, NULL);
+
+		if (FD_ISSET(tcp_listen_fd, &readfds))
+		{
+			client_fd = accept(tcp_listen_fd, (struct sockaddr*)&client_addr, &sockaddr_t_size);
+			if (client_fd >= 0)
+			{
+				HTTP_Pool_AddConnection(client_fd);
+			}
+		}
+	}
+
+	if (err != kNoErr)
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "Server listerner thread exit with err: %d", err);
+
+	lwip_close(tcp_listen_fd);
+
+	rtos_delete_thread(NULL);
+}
+
+void HTTPServer_Start()
+{
+	OSStatus err = kNoErr;
+	int i;
+
+	HTTP_Queue_Init();
+
+	for (i = 0; i < HTTP_WORKER_COUNT; i++) {
+		err = rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
+			"HTTP Worker",
+			(beken_thread_function_t)tcp_worker_thread,
+			HTTP_CLIENT_STACK_SIZE,
+			(beken_thread_arg_t)0);
+		if (err != kNoErr)
+		{
+			ADDLOG_ERROR(LOG_FEATURE_HTTP, "create \"HTTP Worker\" thread failed with %i!\r\n", err);
+		}
+	}
+	err = rtos_create_thread(&g_http_thread, BEKEN_APPLICATION_PRIORITY,
+		"TCP_server",
+		(beken_thread_function_t)tcp_server_thread,
+		0x800,
+		(beken_thread_arg_t)0);
+	if (err != kNoErr)
+	{
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "create \"TCP_server\" thread failed with %i!\r\n", err);
+	}
+}
+
+#elif defined(CREATE_THREAD_PER_EACH_HTTP_CLIENT)
 
 
 #if PLATFORM_XR809
@@ -114,6 +425,9 @@ static void tcp_client_thread(beken_thread_arg_t arg)
 		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP sending reply len %i\n", lenret);
 		send(fd, reply, lenret, 0);
 	}
+	if (request.fdTakenOver) {
+		fd = -1;
+	}
 
 	//rtos_delay_milliseconds(10);
 
@@ -126,7 +440,8 @@ exit:
 	if (reply != NULL)
 		os_free(reply);
 
-	lwip_close(fd);;
+	if (fd >= 0)
+		lwip_close(fd);
 #if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
 
 #else
@@ -224,7 +539,7 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 
 }
 
-#else
+#elif !WINDOWS
 
 
 xTaskHandle g_http_thread = NULL;
@@ -236,7 +551,8 @@ int sendfn(int fd, char* data, int len) {
 	return -1;
 }
 
-static void tcp_client_thread(int fd, char* buf, char* reply)
+// returns 1 if socket was taken over by handler and must stay open
+static int tcp_client_thread(int fd, char* buf, char* reply)
 {
 	//OSStatus err = kNoErr;
 
@@ -259,13 +575,14 @@ static void tcp_client_thread(int fd, char* buf, char* reply)
 	if (request.receivedLen <= 0)
 	{
 		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
-		return;
+		return 0;
 	}
 	int lenret = HTTP_ProcessPacket(&request);
 	if (lenret > 0) {
 		send(fd, reply, lenret, 0);
 	}
 	rtos_delay_milliseconds(10 / portTICK_RATE_MS);
+	return request.fdTakenOver;
 
 }
 
@@ -309,9 +626,9 @@ static void tcp_server_thread(beken_thread_arg_t arg)
 				os_strcpy(client_ip_str, inet_ntoa(client_addr.sin_addr));
 				//  ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd );
 
-				tcp_client_thread(client_fd, reply, buf);
-
-				lwip_close(client_fd);
+				if (tcp_client_thread(client_fd, reply, buf) == 0) {
+					lwip_close(client_fd);
+				}
 			}
 		}
 	}
@@ -1,2 +1,5 @@
 
 void HTTPServer_Start();
+// worker pool connection handling, also built in simulator for selftests
+int HTTP_Pool_AddConnection(int fd);
+int HTTP_Pool_ServeNext();
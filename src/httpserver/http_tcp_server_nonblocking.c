@@ -78,125 +78,167 @@ int HTTPServer_Start() {
     }
 }
 #define DEFAULT_BUFLEN 10000
-void HTTPServer_RunQuickTick() {
+// connections kept open between requests (HTTP/1.1 keep-alive), like workers on device.
+// When all are busy, new clients wait in listen backlog.
+// Benchmark with a local load generator against simulator port, e.g. ab -k -c 4 -n 2000 http://127.0.0.1/index?state=1
+#define HTTP_SIM_MAX_CLIENTS 4
+// client that connected but sent nothing is dropped after this time
+#define HTTP_SIM_FIRST_REQUEST_TIMEOUT 5000
+
+typedef struct httpSimClient_s {
+	int bUsed;
+	SOCKET s;
+	int served;
+	long lastActivity;
+} httpSimClient_t;
+
+static httpSimClient_t g_httpClients[HTTP_SIM_MAX_CLIENTS];
+
+static void HTTP_Sim_CloseClient(httpSimClient_t *c) {
+	char recvbuf[256];
 	int iResult;
 	int err;
-    char recvbuf[DEFAULT_BUFLEN];
-    char outbuf[DEFAULT_BUFLEN];
-    int recvbuflen = DEFAULT_BUFLEN;
-    SOCKET ClientSocket = INVALID_SOCKET;
-	int len, iSendResult;
-	int argp;
 
-	// Accept a client socket
-	ClientSocket = accept(ListenSocket, NULL, NULL);
-	if (ClientSocket == INVALID_SOCKET) {
-		iResult = WSAGetLastError();
-		if(iResult != WSAEWOULDBLOCK) {
-			printf("accept failed with error: %d\n", iResult);
+	// shutdown the connection since we're done
+	iResult = shutdown(c->s, SD_SEND);
+	long firstAttempt = timeGetTime();
+	while (1) {
+		iResult = recv(c->s, recvbuf, sizeof(recvbuf), 0);
+		if (iResult == 0)
+			break;
+		err = WSAGetLastError();
+		if (err != WSAEWOULDBLOCK) {
+			break;
+		}
+		long delta = timeGetTime() - firstAttempt;
+		if (delta > 2) {
+			printf("HTTP server would freeze to long!\n");
+			break; // too long freeze!
+
 		}
-		return;
 	}
+	closesocket(c->s);
+	c->bUsed = 0;
+}
 
-	//argp = 0;
-	//if (ioctlsocket(ClientSocket,
-	//	FIONBIO,
-	//	&argp) == SOCKET_ERROR)
-	//{
-	//	printf("ioctlsocket() error %d\n", WSAGetLastError());
-	//	return 1;
-	//}
-		// Receive until the peer shuts down the connection
-		do {
+static void HTTP_Sim_ServeClient(httpSimClient_t *c) {
+	int iResult;
+	int err;
+	char recvbuf[DEFAULT_BUFLEN];
+	char outbuf[DEFAULT_BUFLEN];
+	int recvbuflen = DEFAULT_BUFLEN;
+	int len, iSendResult;
+	long idle;
 
-			iResult = recv(ClientSocket, recvbuf, recvbuflen, 0);
-			if (iResult > 0) {
-				http_request_t request;
-				memset(&request, 0, sizeof(request));
+	iResult = recv(c->s, recvbuf, recvbuflen - 1, 0);
+	if (iResult > 0) {
+		http_request_t request;
+		memset(&request, 0, sizeof(request));
 
-				recvbuf[iResult] = 0;
+		recvbuf[iResult] = 0;
 
 #if 1
-				// debug test code, you can disable it but dont remove it
-				if (1) {
-					FILE *f;
-
-					f = fopen("lastHTTPPacket.txt", "wb");
-					fwrite(recvbuf, 1, recvbuflen, f);
-					fclose(f);
-				}
+		// debug test code, you can disable it but dont remove it
+		if (1) {
+			FILE *f;
+
+			f = fopen("lastHTTPPacket.txt", "wb");
+			fwrite(recvbuf, 1, recvbuflen, f);
+			fclose(f);
+		}
 #endif
 
-				request.fd = ClientSocket;
-				request.received = recvbuf;
-				request.receivedLen = iResult;
-				outbuf[0] = '\0';
-				request.reply = outbuf;
-				request.replylen = 0;
-
-				request.replymaxlen = DEFAULT_BUFLEN;
-
-				//printf("HTTP Server for Windows: Bytes received: %d \n", iResult);
-				len = HTTP_ProcessPacket(&request);
-
-				if(len > 0) {
-					printf("Bytes rremaining tosend %d\n", len);
-					//printf("%s\n",outbuf);
-					// Echo the buffer back to the sender
-					//leen =  strlen(request.reply);
-					iSendResult = send( ClientSocket, outbuf,len, 0 );
-					if (iSendResult == SOCKET_ERROR) {
-						printf("send failed with error: %d\n", WSAGetLastError());
-						closesocket(ClientSocket);
-						return 1;
-					}
-					printf("HTTP Server for Windows: Bytes sent: %d\n", iSendResult);
-				}
-				break;
-			}
-			else if (iResult == 0) {
-				printf("Connection closing...\n");
-				break;
-			}
-			else {
-				err = WSAGetLastError();
-				if (err != WSAEWOULDBLOCK) {
-					printf("recv failed with error: %d\n", err);
-					closesocket(ClientSocket);
-					break;
-				}
+		request.fd = c->s;
+		request.received = recvbuf;
+		request.receivedLen = iResult;
+		outbuf[0] = '\0';
+		request.reply = outbuf;
+		request.replylen = 0;
+
+		request.replymaxlen = DEFAULT_BUFLEN;
+		request.keepAlive = c->served + 1 < g_http_keepAliveMaxRequests;
+
+		//printf("HTTP Server for Windows: Bytes received: %d \n", iResult);
+		len = HTTP_ProcessPacket(&request);
+		c->served++;
+		c->lastActivity = timeGetTime();
+
+		if (request.fdTakenOver) {
+			// event stream owns socket now, slot is free for others
+			c->bUsed = 0;
+			return;
+		}
+
+		if (HTTP_FinishKeepAlive(&request)) {
+			if (request.replylen > 0 && send(c->s, outbuf, request.replylen, 0) == SOCKET_ERROR) {
+				printf("send failed with error: %d\n", WSAGetLastError());
+				closesocket(c->s);
+				c->bUsed = 0;
 			}
-			break;
-		} while (1);
-		//byte zero = 0;
-		//send(ClientSocket, &zero, 0, 0);
-		//Sleep(50);
-		// shutdown the connection since we're done
-		iResult = shutdown(ClientSocket, SD_SEND);
-		long firstAttempt = timeGetTime();
-		while (1) {
-			iResult = recv(ClientSocket, recvbuf, recvbuflen, 0);
-			if (iResult == 0)
-				break;
-			err = WSAGetLastError();
-			if (err != WSAEWOULDBLOCK) {
-				break;
+			return;
+		}
+		if (len > 0) {
+			printf("Bytes rremaining tosend %d\n", len);
+			//printf("%s\n",outbuf);
+			// Echo the buffer back to the sender
+			//leen =  strlen(request.reply);
+			iSendResult = send(c->s, outbuf, len, 0);
+			if (iSendResult == SOCKET_ERROR) {
+				printf("send failed with error: %d\n", WSAGetLastError());
+				closesocket(c->s);
+				c->bUsed = 0;
+				return;
 			}
-			long delta = timeGetTime() - firstAttempt;
-			if (delta > 2) {
-				printf("HTTP server would freeze to long!\n");
-				break; // too long freeze!
+			printf("HTTP Server for Windows: Bytes sent: %d\n", iSendResult);
+		}
+	}
+	else if (iResult == 0) {
+		printf("Connection closing...\n");
+	}
+	else {
+		err = WSAGetLastError();
+		if (err != WSAEWOULDBLOCK) {
+			printf("recv failed with error: %d\n", err);
+			closesocket(c->s);
+			c->bUsed = 0;
+			return;
+		}
+		idle = timeGetTime() - c->lastActivity;
+		if (idle < (c->served ? g_http_keepAliveIdleTime : HTTP_SIM_FIRST_REQUEST_TIMEOUT)) {
+			return;
+		}
+	}
+	HTTP_Sim_CloseClient(c);
+}
 
+void HTTPServer_RunQuickTick() {
+	int iResult;
+	int i;
+	SOCKET ClientSocket = INVALID_SOCKET;
+
+	// Accept client sockets while there are free slots
+	for (i = 0; i < HTTP_SIM_MAX_CLIENTS; i++) {
+		if (g_httpClients[i].bUsed) {
+			continue;
+		}
+		ClientSocket = accept(ListenSocket, NULL, NULL);
+		if (ClientSocket == INVALID_SOCKET) {
+			iResult = WSAGetLastError();
+			if (iResult != WSAEWOULDBLOCK) {
+				printf("accept failed with error: %d\n", iResult);
 			}
+			break;
+		}
+		g_httpClients[i].bUsed = 1;
+		g_httpClients[i].s = ClientSocket;
+		g_httpClients[i].served = 0;
+		g_httpClients[i].lastActivity = timeGetTime();
+	}
+	for (i = 0; i < HTTP_SIM_MAX_CLIENTS; i++) {
+		if (g_httpClients[i].bUsed) {
+			HTTP_Sim_ServeClient(&g_httpClients[i]);
 		}
-		//Sleep(50);
-		//iResult = closesocket(ClientSocket);
-		//if (iResult == SOCKET_ERROR) {
-		///	printf("shutdown failed with error: %d\n", WSAGetLastError());
-			closesocket(ClientSocket);
-			//WSACleanup();
-			//return 1;
-		//}
+	}
 }
 
 #endif
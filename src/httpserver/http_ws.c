@@ -0,0 +1,626 @@
+
+#include "../new_common.h"
+#include "lwip/sockets.h"
+#include "../logging/logging.h"
+#include "../cmnds/cmd_public.h"
+#include "new_http.h"
+#include "http_fns.h"
+#include "http_ws.h"
+#ifndef WINDOWS
+#include <errno.h>
+#endif
+
+// lwIP has it, on Windows sockets are already non-blocking
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xA
+
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_TOO_BIG 1009
+
+// log is read in pieces of that size, escaped it may take up to 6 times more in send buffer
+#define WS_LOG_CHUNK_SIZE 200
+// header (up to 4 bytes, server frames are not masked) is reserved before payload is known
+#define WS_FRAME_HEADER_MAX 4
+
+static const char wsGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+typedef struct wsSession_s {
+	int bUsed;
+	// set when handshake was sent, slot is reserved before
+	int bReady;
+	int fd;
+	int logSub;
+	// one extra byte to terminate command
+	unsigned char* rx;
+	int rxLen;
+	char* tx;
+	int txLen;
+	// start of frame being built
+	int frameAt;
+	int bFrameOverflow;
+	// totals for session, and what client was told so far
+	int dropped;
+	int logLost;
+	int reportedDropped;
+	int reportedLogLost;
+} wsSession_t;
+
+static wsSession_t g_ws_sessions[WS_MAX_SESSIONS];
+// read without lock by QuickTick, so it costs nothing without sessions
+static volatile int g_ws_numSessions = 0;
+static SemaphoreHandle_t g_ws_mutex = 0;
+
+#ifdef WINDOWS
+static char g_ws_simOutput[4096];
+static int g_ws_simOutputLen = 0;
+
+const char* SIM_GetWSOutput(int* len) {
+	*len = g_ws_simOutputLen;
+	return g_ws_simOutput;
+}
+void SIM_ClearWSOutput() {
+	g_ws_simOutputLen = 0;
+}
+// goes to first such session, and as with recv, only what fits
+void SIM_WS_Receive(const void* data, int len) {
+	wsSession_t* s;
+	int i;
+
+	for (i = 0; i < WS_MAX_SESSIONS; i++) {
+		s = &g_ws_sessions[i];
+		if (s->bReady && s->fd == 0) {
+			if (len > WS_RX_BUFFER_SIZE - s->rxLen) {
+				len = WS_RX_BUFFER_SIZE - s->rxLen;
+			}
+			memcpy(s->rx + s->rxLen, data, len);
+			s->rxLen += len;
+			return;
+		}
+	}
+}
+#endif
+
+/////////////////////////////////////////////////////////////
+// SHA-1 and base64, only for Sec-WebSocket-Accept
+#define WS_ROL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+static void HTTP_WS_SHA1_Block(unsigned int h[5], const unsigned char* p) {
+	unsigned int w[80];
+	unsigned int a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+	}
+	for (i = 16; i < 80; i++) {
+		w[i] = WS_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+	a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		t = WS_ROL(a, 5) + f + e + k + w[i];
+		e = d; d = c; c = WS_ROL(b, 30); b = a; a = t;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static void HTTP_WS_SHA1(const unsigned char* data, int len, unsigned char out[20]) {
+	unsigned int h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	unsigned char block[64];
+	int done, rest, i;
+
+	for (done = 0; done + 64 <= len; done += 64) {
+		HTTP_WS_SHA1_Block(h, data + done);
+	}
+	rest = len - done;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + done, rest);
+	block[rest] = 0x80;
+	if (rest >= 56) {
+		HTTP_WS_SHA1_Block(h, block);
+		memset(block, 0, sizeof(block));
+	}
+	// length in bits, big endian; keys are short, so upper bytes are 0
+	block[60] = (unsigned char)((unsigned int)len >> 21);
+	block[61] = (unsigned char)((unsigned int)len >> 13);
+	block[62] = (unsigned char)((unsigned int)len >> 5);
+	block[63] = (unsigned char)((unsigned int)len << 3);
+	HTTP_WS_SHA1_Block(h, block);
+	for (i = 0; i < 20; i++) {
+		out[i] = (unsigned char)(h[i / 4] >> (24 - (i % 4) * 8));
+	}
+}
+
+static void HTTP_WS_Base64(const unsigned char* in, int len, char* out) {
+	static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned int v;
+	int i;
+
+	for (i = 0; i < len; i += 3) {
+		v = in[i] << 16;
+		if (i + 1 < len) {
+			v |= in[i + 1] << 8;
+		}
+		if (i + 2 < len) {
+			v |= in[i + 2];
+		}
+		*out++ = chars[(v >> 18) & 0x3F];
+		*out++ = chars[(v >> 12) & 0x3F];
+		*out++ = i + 1 < len ? chars[(v >> 6) & 0x3F] : '=';
+		*out++ = i + 2 < len ? chars[v & 0x3F] : '=';
+	}
+	*out = 0;
+}
+
+// out must have room for 29 bytes
+static void HTTP_WS_AcceptKey(const char* key, char* out) {
+	char tmp[96];
+	unsigned char digest[20];
+	int len;
+
+	len = snprintf(tmp, sizeof(tmp), "%s%s", key, wsGuid);
+	HTTP_WS_SHA1((const unsigned char*)tmp, len, digest);
+	HTTP_WS_Base64(digest, sizeof(digest), out);
+}
+
+/////////////////////////////////////////////////////////////
+// send buffer, frames are built in place
+
+static void HTTP_WS_BeginFrame(wsSession_t* s) {
+	s->frameAt = s->txLen;
+	s->bFrameOverflow = 0;
+	if (s->txLen + WS_FRAME_HEADER_MAX > WS_TX_BUFFER_SIZE) {
+		s->bFrameOverflow = 1;
+		return;
+	}
+	s->txLen += WS_FRAME_HEADER_MAX;
+}
+
+static void HTTP_WS_Append(wsSession_t* s, const char* data, int len) {
+	if (s->bFrameOverflow || s->txLen + len > WS_TX_BUFFER_SIZE) {
+		s->bFrameOverflow = 1;
+		return;
+	}
+	memcpy(s->tx + s->txLen, data, len);
+	s->txLen += len;
+}
+
+// jsonCb_t printer, as for JSON_ProcessCommandReply
+static int HTTP_WS_Printf(void* userData, const char* fmt, ...) {
+	wsSession_t* s = (wsSession_t*)userData;
+	va_list argList;
+	char tmp[256];
+	int len;
+
+	va_start(argList, fmt);
+	len = vsnprintf(tmp, sizeof(tmp), fmt, argList);
+	va_end(argList);
+	if (len >= sizeof(tmp)) {
+		len = sizeof(tmp) - 1;
+	}
+	HTTP_WS_Append(s, tmp, len);
+	return 0;
+}
+
+static void HTTP_WS_AppendEscaped(wsSession_t* s, const char* str, int len) {
+	char tmp[8];
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (str[i] == '"' || str[i] == '\\') {
+			tmp[0] = '\\';
+			tmp[1] = str[i];
+			HTTP_WS_Append(s, tmp, 2);
+		}
+		else if (str[i] == '\n') {
+			HTTP_WS_Append(s, "\\n", 2);
+		}
+		else if (str[i] == '\r') {
+			HTTP_WS_Append(s, "\\r", 2);
+		}
+		else if ((unsigned char)str[i] < 0x20) {
+			sprintf(tmp, "\\u%04x", str[i]);
+			HTTP_WS_Append(s, tmp, 6);
+		}
+		else {
+			HTTP_WS_Append(s, str + i, 1);
+		}
+	}
+}
+
+// frame that didn't fit is dropped whole
+static void HTTP_WS_EndFrame(wsSession_t* s, int opcode) {
+	unsigned char* h;
+	int len;
+
+	if (s->bFrameOverflow) {
+		s->txLen = s->frameAt;
+		s->dropped++;
+		return;
+	}
+	h = (unsigned char*)s->tx + s->frameAt;
+	len = s->txLen - s->frameAt - WS_FRAME_HEADER_MAX;
+	h[0] = 0x80 | opcode;
+	if (len < 126) {
+		h[1] = len;
+		memmove(h + 2, h + WS_FRAME_HEADER_MAX, len);
+		s->txLen -= 2;
+	}
+	else {
+		h[1] = 126;
+		h[2] = len >> 8;
+		h[3] = len & 0xFF;
+	}
+}
+
+static void HTTP_WS_SendClose(wsSession_t* s, int code) {
+	char payload[2];
+
+	payload[0] = code >> 8;
+	payload[1] = code & 0xFF;
+	HTTP_WS_BeginFrame(s);
+	HTTP_WS_Append(s, payload, 2);
+	HTTP_WS_EndFrame(s, WS_OP_CLOSE);
+}
+
+static int HTTP_WS_WouldBlock() {
+#ifdef WINDOWS
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EWOULDBLOCK || errno == EAGAIN;
+#endif
+}
+
+// returns 0 if connection is broken
+static int HTTP_WS_Flush(wsSession_t* s) {
+	int sent;
+
+	if (s->txLen == 0) {
+		return 1;
+	}
+#ifdef WINDOWS
+	if (s->fd == 0) {
+		if (g_ws_simOutputLen + s->txLen <= sizeof(g_ws_simOutput)) {
+			memcpy(g_ws_simOutput + g_ws_simOutputLen, s->tx, s->txLen);
+			g_ws_simOutputLen += s->txLen;
+		}
+		s->txLen = 0;
+		return 1;
+	}
+#endif
+	sent = send(s->fd, s->tx, s->txLen, MSG_DONTWAIT);
+	if (sent < 0) {
+		return HTTP_WS_WouldBlock();
+	}
+	memmove(s->tx, s->tx + sent, s->txLen - sent);
+	s->txLen -= sent;
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////
+// session
+
+static void HTTP_WS_Release(wsSession_t* s) {
+	int bTaken;
+
+	free(s->rx);
+	free(s->tx);
+	s->rx = 0;
+	s->tx = 0;
+	bTaken = xSemaphoreTake(g_ws_mutex, portMAX_DELAY) == pdTRUE;
+	s->bReady = 0;
+	s->bUsed = 0;
+	g_ws_numSessions--;
+	if (bTaken) {
+		xSemaphoreGive(g_ws_mutex);
+	}
+}
+
+static void HTTP_WS_Close(wsSession_t* s) {
+	LOG_Unsubscribe(s->logSub);
+	s->logSub = -1;
+#ifdef WINDOWS
+	if (s->fd != 0) {
+		closesocket(s->fd);
+	}
+#else
+	lwip_close(s->fd);
+#endif
+	HTTP_WS_Release(s);
+}
+
+static void HTTP_WS_Command(wsSession_t* s, const char* cmd) {
+	commandResult_t res;
+	int replyAt, jsonAt;
+
+	res = CMD_ExecuteCommand(cmd, COMMAND_FLAG_SOURCE_CONSOLE);
+	HTTP_WS_BeginFrame(s);
+	HTTP_WS_Printf(s, "{\"res\":\"%s\"", CMD_GetResultString(res));
+	replyAt = s->txLen;
+	HTTP_WS_Append(s, ",\"reply\":", 9);
+	jsonAt = s->txLen;
+	JSON_ProcessCommandReply(cmd, skipToNextWord(cmd), s, (jsonCb_t)HTTP_WS_Printf, COMMAND_FLAG_SOURCE_CONSOLE);
+	if (s->bFrameOverflow == 0 && s->txLen == jsonAt) {
+		// command has no JSON reply
+		s->txLen = replyAt;
+	}
+	HTTP_WS_Append(s, "}", 1);
+	HTTP_WS_EndFrame(s, WS_OP_TEXT);
+}
+
+// returns 0 when session should end
+static int HTTP_WS_ProcessFrames(wsSession_t* s) {
+	unsigned char* rx = s->rx;
+	unsigned char* payload;
+	unsigned char next;
+	int op, len, hdr, i;
+
+	while (s->rxLen >= 2) {
+		op = rx[0] & 0x0F;
+		len = rx[1] & 0x7F;
+		hdr = 2;
+		if (len == 126) {
+			if (s->rxLen < 4) {
+				break;
+			}
+			len = (rx[2] << 8) | rx[3];
+			hdr = 4;
+		}
+		else if (len == 127) {
+			HTTP_WS_SendClose(s, WS_CLOSE_TOO_BIG);
+			return 0;
+		}
+		// client frames must be masked
+		if ((rx[1] & 0x80) == 0) {
+			HTTP_WS_SendClose(s, WS_CLOSE_PROTOCOL_ERROR);
+			return 0;
+		}
+		hdr += 4;
+		if (hdr + len > WS_RX_BUFFER_SIZE) {
+			HTTP_WS_SendClose(s, WS_CLOSE_TOO_BIG);
+			return 0;
+		}
+		if (s->rxLen < hdr + len) {
+			break;
+		}
+		payload = rx + hdr;
+		for (i = 0; i < len; i++) {
+			payload[i] ^= rx[hdr - 4 + (i % 4)];
+		}
+		// fragmented messages are not supported, commands are short
+		if ((rx[0] & 0x80) == 0 || op == WS_OP_CONTINUATION) {
+			HTTP_WS_SendClose(s, WS_CLOSE_UNSUPPORTED);
+			return 0;
+		}
+		if (op == WS_OP_TEXT) {
+			// terminator goes over first byte of next frame, if it came in same recv
+			next = payload[len];
+			payload[len] = 0;
+			HTTP_WS_Command(s, (const char*)payload);
+			payload[len] = next;
+		}
+		else if (op == WS_OP_PING) {
+			HTTP_WS_BeginFrame(s);
+			HTTP_WS_Append(s, (const char*)payload, len);
+			HTTP_WS_EndFrame(s, WS_OP_PONG);
+		}
+		else if (op == WS_OP_CLOSE) {
+			HTTP_WS_SendClose(s, WS_CLOSE_NORMAL);
+			return 0;
+		}
+		else if (op != WS_OP_PONG) {
+			HTTP_WS_SendClose(s, WS_CLOSE_UNSUPPORTED);
+			return 0;
+		}
+		s->rxLen -= hdr + len;
+		memmove(rx, rx + hdr + len, s->rxLen);
+	}
+	return 1;
+}
+
+// returns 0 if client has closed connection
+static int HTTP_WS_Receive(wsSession_t* s) {
+	int len;
+
+#ifdef WINDOWS
+	if (s->fd == 0) {
+		return 1;
+	}
+#endif
+	if (s->rxLen >= WS_RX_BUFFER_SIZE) {
+		return 1;
+	}
+	len = recv(s->fd, s->rx + s->rxLen, WS_RX_BUFFER_SIZE - s->rxLen, MSG_DONTWAIT);
+	if (len == 0) {
+		return 0;
+	}
+	if (len < 0) {
+		return HTTP_WS_WouldBlock();
+	}
+	s->rxLen += len;
+	return 1;
+}
+
+// log is read from memory only when it surely fits, so backlog stays there and is not counted as dropped.
+// Each frame is passed to socket at once, so backlog goes out as fast as client takes it.
+static void HTTP_WS_SendLog(wsSession_t* s) {
+	char chunk[WS_LOG_CHUNK_SIZE];
+	int len;
+
+	while (s->txLen + WS_FRAME_HEADER_MAX + 12 + WS_LOG_CHUNK_SIZE * 6 <= WS_TX_BUFFER_SIZE) {
+		len = LOG_GetSubscriberData(s->logSub, chunk, sizeof(chunk));
+		if (len <= 0) {
+			break;
+		}
+		HTTP_WS_BeginFrame(s);
+		HTTP_WS_Append(s, "{\"log\":\"", 8);
+		HTTP_WS_AppendEscaped(s, chunk, len);
+		HTTP_WS_Append(s, "\"}", 2);
+		HTTP_WS_EndFrame(s, WS_OP_TEXT);
+		if (HTTP_WS_Flush(s) == 0) {
+			break;
+		}
+	}
+	s->logLost += LOG_TakeSubscriberLost(s->logSub);
+}
+
+static void HTTP_WS_ReportDrops(wsSession_t* s) {
+	int dropped = s->dropped;
+
+	if (dropped == s->reportedDropped && s->logLost == s->reportedLogLost) {
+		return;
+	}
+	HTTP_WS_BeginFrame(s);
+	HTTP_WS_Printf(s, "{\"dropped\":%i,\"logLost\":%i}", dropped, s->logLost);
+	HTTP_WS_EndFrame(s, WS_OP_TEXT);
+	// if notice itself didn't fit, it's tried again next time
+	if (s->dropped == dropped) {
+		s->reportedDropped = dropped;
+		s->reportedLogLost = s->logLost;
+	}
+}
+
+void HTTP_WS_RunQuickTick() {
+	wsSession_t* s;
+	int bOpen;
+	int i;
+
+	if (g_ws_numSessions == 0) {
+		return;
+	}
+	for (i = 0; i < WS_MAX_SESSIONS; i++) {
+		s = &g_ws_sessions[i];
+		if (s->bReady == 0) {
+			continue;
+		}
+		bOpen = HTTP_WS_Receive(s) && HTTP_WS_ProcessFrames(s);
+		if (bOpen) {
+			HTTP_WS_SendLog(s);
+			HTTP_WS_ReportDrops(s);
+		}
+		if (HTTP_WS_Flush(s) == 0) {
+			bOpen = 0;
+		}
+		if (bOpen == 0) {
+			HTTP_WS_Close(s);
+		}
+	}
+}
+
+int HTTP_WS_GetSessionsCount() {
+	return g_ws_numSessions;
+}
+
+static int http_fn_ws(http_request_t* request) {
+	const char* upgrade = http_getHeader(request, "Upgrade");
+	const char* key = http_getHeader(request, "Sec-WebSocket-Key");
+	char accept[32];
+	wsSession_t* s = 0;
+	int bTaken;
+	int i;
+
+	if (upgrade == 0 || wal_strnicmp(upgrade, "websocket", 9) || key == 0 || strlen(key) > 32) {
+		request->responseCode = 400;
+		http_setup(request, httpMimeTypeText);
+		poststr(request, "WebSocket handshake expected");
+		poststr(request, NULL);
+		return 0;
+	}
+	bTaken = xSemaphoreTake(g_ws_mutex, portMAX_DELAY) == pdTRUE;
+	for (i = 0; i < WS_MAX_SESSIONS; i++) {
+		if (g_ws_sessions[i].bUsed == 0) {
+			s = &g_ws_sessions[i];
+			s->bUsed = 1;
+			g_ws_numSessions++;
+			break;
+		}
+	}
+	if (bTaken) {
+		xSemaphoreGive(g_ws_mutex);
+	}
+	if (s) {
+		s->rx = (unsigned char*)malloc(WS_RX_BUFFER_SIZE + 1);
+		s->tx = (char*)malloc(WS_TX_BUFFER_SIZE);
+		if (s->rx == 0 || s->tx == 0) {
+			HTTP_WS_Release(s);
+			s = 0;
+		}
+	}
+	if (s == 0) {
+		request->responseCode = 503;
+		http_setup(request, httpMimeTypeText);
+		poststr(request, "Too many WebSocket sessions");
+		poststr(request, NULL);
+		return 0;
+	}
+	HTTP_WS_AcceptKey(key, accept);
+	request->keepAlive = 0;
+	poststr(request, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ");
+	poststr(request, accept);
+	poststr(request, "\r\n\r\n");
+	poststr(request, NULL);
+
+	s->fd = request->fd;
+	s->rxLen = 0;
+	s->txLen = 0;
+	s->dropped = s->reportedDropped = 0;
+	s->logLost = s->reportedLogLost = 0;
+	// first frames may have come with handshake
+	if (request->bodylen > 0 && request->bodylen <= WS_RX_BUFFER_SIZE) {
+		memcpy(s->rx, request->bodystart, request->bodylen);
+		s->rxLen = request->bodylen;
+	}
+	s->logSub = LOG_Subscribe();
+	s->bReady = 1;
+	// socket belongs to us now
+	request->fdTakenOver = 1;
+	return 0;
+}
+
+#ifdef WINDOWS
+void HTTP_WS_CloseAll() {
+	int i;
+
+	for (i = 0; i < WS_MAX_SESSIONS; i++) {
+		if (g_ws_sessions[i].bReady) {
+			HTTP_WS_Close(&g_ws_sessions[i]);
+		}
+	}
+	SIM_ClearWSOutput();
+}
+#endif
+
+void HTTP_WS_Init() {
+	if (g_ws_mutex == 0) {
+		g_ws_mutex = xSemaphoreCreateMutex();
+	}
+	// WINDOWS must support reinit
+#ifdef WINDOWS
+	HTTP_WS_CloseAll();
+#endif
+	HTTP_RegisterCallback("/ws", HTTP_GET, http_fn_ws);
+}
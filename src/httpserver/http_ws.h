@@ -0,0 +1,31 @@
+#ifndef __HTTP_WS_H__
+#define __HTTP_WS_H__
+
+// WebSocket command console at GET /ws (RFC 6455, text frames only).
+// Connection is taken over from HTTP server after handshake and served from QuickTick, like event stream.
+// Each text frame from client is one command line, executed as from console. Server sends text frames:
+// - {"res":"OK","reply":{...}} after each command, reply is Tasmota JSON as /cm gives, if command has one,
+// - {"log":"..."} with new log lines, as subscriber of log memory,
+// - {"dropped":N,"logLost":M} when frames were dropped because send buffer was full,
+//   or log was overwritten before it could be sent.
+// Ping is answered with pong, close with close.
+
+#define WS_MAX_SESSIONS 2
+// client frames larger than that are refused with close 1009
+#define WS_RX_BUFFER_SIZE 256
+// frames that don't fit are dropped and counted
+#define WS_TX_BUFFER_SIZE 1536
+
+void HTTP_WS_Init();
+void HTTP_WS_RunQuickTick();
+int HTTP_WS_GetSessionsCount();
+
+#ifdef WINDOWS
+// session of faked request (fd 0) writes here and reads frames given to SIM_WS_Receive, for selftests
+const char* SIM_GetWSOutput(int* len);
+void SIM_ClearWSOutput();
+void SIM_WS_Receive(const void* data, int len);
+void HTTP_WS_CloseAll();
+#endif
+
+#endif // __HTTP_WS_H__
@@ -412,7 +412,7 @@ static int http_tasmota_json_status_MQT(void* request, jsonCb_t printer) {
 /*
 {"Status":{"Module":0,"DeviceName":"Tasmota","FriendlyName":["Tasmota"],"Topic":"tasmota_48E7F3","ButtonTopic":"0","Power":1,"PowerOnState":3,"LedState":1,"LedMask":"FFFF","SaveData":1,"SaveState":1,"SwitchTopic":"0","SwitchMode":[0,0,0,0,0,0,0,0],"ButtonRetain":0,"SwitchRetain":0,"SensorRetain":0,"PowerRetain":0,"InfoRetain":0,"StateRetain":0}}
 */
-static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
+static int http_tasmota_json_status_main(void* request, jsonCb_t printer) {
 	const char* deviceName;
 	const char* friendlyName;
 	const char* clientId;
@@ -457,7 +457,6 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 		}
 	}
 
-	printer(request, "{");
 	// Status section
 	printer(request, "\"Status\":{\"Module\":0,\"DeviceName\":\"%s\"", deviceName);
 	printer(request, ",\"FriendlyName\":[");
@@ -493,10 +492,9 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 	printer(request, ",\"ButtonRetain\":0,\"SwitchRetain\":0,\"SensorRetain\":0");
 	printer(request, ",\"PowerRetain\":0,\"InfoRetain\":0,\"StateRetain\":0");
 	printer(request, "}");
-
-	printer(request, ",");
-
-
+	return 0;
+}
+static int http_tasmota_json_status_PRM(void* request, jsonCb_t printer) {
 	printer(request, "\"StatusPRM\":{");
 	printer(request, "\"Baudrate\":115200,");
 	printer(request, "\"SerialConfig\":\"8N1\",");
@@ -512,15 +510,9 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 	printer(request, "\"SaveCount\":1235,");
 	printer(request, "\"SaveAddress\":\"F9000\"");
 	printer(request, "}");
-
-	printer(request, ",");
-
-	http_tasmota_json_status_FWR(request, printer);
-
-	printer(request, ",");
-
-
-
+	return 0;
+}
+static int http_tasmota_json_status_LOG(void* request, jsonCb_t printer) {
 	printer(request, "\"StatusLOG\":{");
 	printer(request, "\"SerialLog\":2,");
 	printer(request, "\"WebLog\":2,");
@@ -542,42 +534,164 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 	printer(request, "\"00004000\"");
 	printer(request, "]");
 	printer(request, "}");
+	return 0;
+}
 
-	printer(request, ",");
-
-
+// Sections of STATUS reply that don't carry time or readings are rendered once into RAM
+// and sent from there until marked dirty, so polling STATUS 0 costs little more than a copy.
+// Main "Status" block follows state revision, which changes with channels, LED and config.
+typedef struct jsonSection_s {
+	int (*render)(void* request, jsonCb_t printer);
+	char* text;
+	int len;
+	unsigned int revision;
+} jsonSection_t;
+
+// printers take at most that much per call, as hprintf255 does
+#define JSON_SECTION_PRINT_MAX 255
+// cached text is given back to printer in chunks of that size
+#define JSON_SECTION_CHUNK 200
+
+// order as in JSON_STATUS_* bits
+static jsonSection_t g_json_sections[JSON_STATUS_SECTIONS] = {
+	{ http_tasmota_json_status_main },
+	{ http_tasmota_json_status_PRM },
+	{ http_tasmota_json_status_FWR },
+	{ http_tasmota_json_status_LOG },
+	{ http_tasmota_json_status_MEM },
+	{ http_tasmota_json_status_NET },
+	{ http_tasmota_json_status_MQT },
+};
+static volatile int g_json_dirty = (1 << JSON_STATUS_SECTIONS) - 1;
+static SemaphoreHandle_t g_json_mutex = 0;
+static int g_json_renders = 0;
+
+typedef struct jsonSectionPrinter_s {
+	char* buf;
+	int size;
+	int len;
+} jsonSectionPrinter_t;
+
+// without buffer only counts length
+static int JSON_Section_Printf(void* userData, const char* fmt, ...) {
+	jsonSectionPrinter_t* p = (jsonSectionPrinter_t*)userData;
+	char tmp[JSON_SECTION_PRINT_MAX + 1];
+	va_list argList;
+	int n;
+
+	va_start(argList, fmt);
+	n = vsnprintf(tmp, sizeof(tmp), fmt, argList);
+	va_end(argList);
+	if (n < 0) {
+		return 0;
+	}
+	if (n > JSON_SECTION_PRINT_MAX) {
+		n = JSON_SECTION_PRINT_MAX;
+	}
+	if (p->buf != 0 && p->len + n < p->size) {
+		memcpy(p->buf + p->len, tmp, n);
+	}
+	p->len += n;
+	return n;
+}
 
-	http_tasmota_json_status_MEM(request, printer);
+void JSON_MarkStatusDirty(int sections) {
+	g_json_dirty |= sections;
+}
 
-	printer(request, ",");
+int JSON_GetStatusRenders() {
+	return g_json_renders;
+}
 
-	http_tasmota_json_status_NET(request, printer);
+static void JSON_Section_Render(jsonSection_t* s) {
+	jsonSectionPrinter_t p;
 
-	printer(request, ",");
+	if (s->text != 0) {
+		os_free(s->text);
+		s->text = 0;
+	}
+	memset(&p, 0, sizeof(p));
+	s->render(&p, JSON_Section_Printf);
+	p.size = p.len + 1;
+	p.buf = (char*)os_malloc(p.size);
+	if (p.buf == 0) {
+		return;
+	}
+	p.len = 0;
+	s->render(&p, JSON_Section_Printf);
+	// state may have changed between passes
+	if (p.len >= p.size) {
+		p.len = p.size - 1;
+	}
+	p.buf[p.len] = 0;
+	s->text = p.buf;
+	s->len = p.len;
+	g_json_renders++;
+}
 
+static void JSON_PrintSection(int section, void* request, jsonCb_t printer) {
+	jsonSection_t* s = &g_json_sections[section];
+	int bit = 1 << section;
+	char* copy = 0;
+	int len = 0;
+	int i, n;
 
-	http_tasmota_json_status_MQT(request, printer);
+	if (g_json_mutex == 0) {
+		g_json_mutex = xSemaphoreCreateMutex();
+	}
+	if (xSemaphoreTake(g_json_mutex, 100) == pdTRUE) {
+		if (section == JSON_STATUS_INDEX_MAIN && s->revision != STATE_GetRevision()) {
+			g_json_dirty |= bit;
+		}
+		if (s->text == 0 || (g_json_dirty & bit)) {
+			// cleared first, so change during render marks it again
+			g_json_dirty &= ~bit;
+			s->revision = STATE_GetRevision();
+			JSON_Section_Render(s);
+		}
+		// printer may block on socket, so send a copy after lock is given
+		if (s->text != 0) {
+			copy = (char*)os_malloc(s->len);
+			if (copy != 0) {
+				memcpy(copy, s->text, s->len);
+				len = s->len;
+			}
+		}
+		xSemaphoreGive(g_json_mutex);
+	}
+	if (copy == 0) {
+		// cache busy or out of memory, print directly
+		s->render(request, printer);
+		return;
+	}
+	for (i = 0; i < len; i += n) {
+		n = len - i;
+		if (n > JSON_SECTION_CHUNK) {
+			n = JSON_SECTION_CHUNK;
+		}
+		printer(request, "%.*s", n, copy + i);
+	}
+	os_free(copy);
+}
 
+// time, sensor readings and uptime change all the time, so TIM, SNS and STS are always rendered
+static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
+	int i;
 
-	printer(request, ",");
+	printer(request, "{");
+	for (i = 0; i < JSON_STATUS_SECTIONS; i++) {
+		JSON_PrintSection(i, request, printer);
+		printer(request, ",");
+	}
 
 	http_tasmota_json_status_TIM(request, printer);
-
 	printer(request, ",");
-
-
 	http_tasmota_json_status_SNS(request, printer, true);
-
 	printer(request, ",");
-
-
 	http_tasmota_json_status_STS(request, printer, true);
 
 	// end
 	printer(request, "}");
-
-
-
 	return 0;
 }
 int JSON_ProcessCommandReply(const char *cmd, const char *arg, void *request, jsonCb_t printer, int flags) {
@@ -648,7 +762,7 @@ int JSON_ProcessCommandReply(const char *cmd, const char *arg, void *request, js
 			}
 		} else if (!stricmp(arg, "6") ) {
 			printer(request, "{");
-			http_tasmota_json_status_MQT(request, printer);
+			JSON_PrintSection(JSON_STATUS_INDEX_MQT, request, printer);
 			printer(request, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s *)request, "STATUS6");
@@ -664,7 +778,7 @@ int JSON_ProcessCommandReply(const char *cmd, const char *arg, void *request, js
 		}
 		else if (!stricmp(arg, "5")) {
 			printer(request, "{");
-			http_tasmota_json_status_NET(request, printer);
+			JSON_PrintSection(JSON_STATUS_INDEX_NET, request, printer);
 			printer(request, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s *)request, "STATUS5");
@@ -672,7 +786,7 @@ int JSON_ProcessCommandReply(const char *cmd, const char *arg, void *request, js
 		}
 		else if (!stricmp(arg, "4")) {
 			printer(request, "{");
-			http_tasmota_json_status_MEM(request, printer);
+			JSON_PrintSection(JSON_STATUS_INDEX_MEM, request, printer);
 			printer(request, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s *)request, "STATUS4");
@@ -680,7 +794,7 @@ int JSON_ProcessCommandReply(const char *cmd, const char *arg, void *request, js
 		}
 		else if (!stricmp(arg, "2")) {
 			printer(request, "{");
-			http_tasmota_json_status_FWR(request, printer);
+			JSON_PrintSection(JSON_STATUS_INDEX_FWR, request, printer);
 			printer(request, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s *)request, "STATUS2");
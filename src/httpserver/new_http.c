@@ -58,6 +58,31 @@ const char* g_build_str = "Build on " __DATE__ " " __TIME__ " version " USER_SW_
 
 const char httpCorsHeaders[] = "Access-Control-Allow-Origin: *\r\nAccess-Control-Allow-Headers: Origin, X-Requested-With, Content-Type, Accept";           // TEXT MIME type
 
+// Written by http_setup when connection may be kept open. Content-Length is filled when
+// reply is complete, or whole line is changed to "Connection: close" if reply had to be sent earlier.
+// Spaces after colon and at end of header line are allowed by HTTP.
+static const char httpKeepAliveHeader[] = "Connection: keep-alive\r\nContent-Length:           ";
+#define HTTP_CONTENT_LENGTH_DIGITS 10
+// Replaces above when body has to be sent before it is complete, so connection can stay open. Same length.
+static const char httpChunkedHeader[] = "Connection: keep-alive\r\nTransfer-Encoding: chunked";
+// Chunk is sent as "XXXX\r\n<data>\r\n". Size line is reserved in buffer before data is written,
+// so data is formatted in place and chunk goes out with one send.
+#define HTTP_CHUNK_SIZE_LINE 6
+// size line, chunk end and "0\r\n\r\n" of last chunk must always fit
+#define HTTP_CHUNK_RESERVE 8
+
+// Reply buffer is sent in whole TCP segments, as much as it can hold
+#ifdef TCP_MSS
+#define HTTP_SEND_SEGMENT TCP_MSS
+#else
+#define HTTP_SEND_SEGMENT 1460
+#endif
+
+// milliseconds to wait for next request on open connection
+int g_http_keepAliveIdleTime = 2000;
+// requests served on one connection before it's closed, 1 disables keep-alive
+int g_http_keepAliveMaxRequests = 16;
+
 const char* methodNames[] = {
 	"GET",
 	"PUT",
@@ -73,52 +98,267 @@ const char* methodNames[] = {
 void misc_formatUpTimeString(int totalSeconds, char* o);
 int Time_getUpTimeSeconds();
 
-typedef struct http_callback_tag {
-	char* url;
-	int method;
+// Route table, sorted by fixed part of route (without leading '/'), then by exact/parametric, then method,
+// so lookup is a binary search for the path, and then for its '/' prefixes from the longest one.
+typedef struct http_route_tag {
+	const char* url;
 	http_callback_fn callback;
-} http_callback_t;
+	// length of fixed part, not counting leading '/'
+	short prefixLen;
+	signed char method;
+	char bParams;
+} http_route_t;
+
+#define MAX_HTTP_ROUTES 96
+static http_route_t g_routes[MAX_HTTP_ROUTES];
+static int g_numRoutes = 0;
+// drivers register routes at runtime while HTTP workers search the table
+static SemaphoreHandle_t g_routesMutex = 0;
+
+static void HTTP_RegisterBuiltInRoutes();
+
+static int HTTP_Route_Compare(const http_route_t* r, const char* key, int keyLen, int bParams, int method) {
+	int len = r->prefixLen < keyLen ? r->prefixLen : keyLen;
+	int res = memcmp(r->url + 1, key, len);
+
+	if (res) {
+		return res;
+	}
+	if (r->prefixLen != keyLen) {
+		return r->prefixLen - keyLen;
+	}
+	if (r->bParams != bParams) {
+		return r->bParams - bParams;
+	}
+	return r->method - method;
+}
 
-#define MAX_HTTP_CALLBACKS 32
-static http_callback_t* callbacks[MAX_HTTP_CALLBACKS];
-static int numCallbacks = 0;
+// index of first route not less than given key
+static int HTTP_Route_LowerBound(const char* key, int keyLen, int bParams, int method) {
+	int lo = 0;
+	int hi = g_numRoutes;
+	int mid;
 
-int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback) {
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (HTTP_Route_Compare(&g_routes[mid], key, keyLen, bParams, method) < 0) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// built-in routes are put in on first use of the table
+static bool HTTP_Routes_Lock() {
+	if (g_routesMutex == 0) {
+		g_routesMutex = xSemaphoreCreateMutex();
+	}
+	if (xSemaphoreTake(g_routesMutex, portMAX_DELAY) != pdTRUE) {
+		return false;
+	}
+	HTTP_RegisterBuiltInRoutes();
+	return true;
+}
+
+static void HTTP_Routes_Unlock() {
+	xSemaphoreGive(g_routesMutex);
+}
+
+// route table lock must be held
+static int HTTP_Route_Insert(const char* url, int method, http_callback_fn callback) {
+	const char* p;
+	int prefixLen;
+	int bParams;
 	int i;
 
-	if (!url || !callback) {
-		return -1;
+	// fixed part ends at first segment that is a parameter
+	prefixLen = strlen(url + 1);
+	bParams = 0;
+	for (p = url + 1; *p; p++) {
+		if ((*p == ':' || *p == '*') && (p == url + 1 || p[-1] == '/')) {
+			prefixLen = p - (url + 1);
+			bParams = 1;
+			break;
+		}
 	}
-	if (numCallbacks >= MAX_HTTP_CALLBACKS) {
+	i = HTTP_Route_LowerBound(url + 1, prefixLen, bParams, method);
+	if (i < g_numRoutes && HTTP_Route_Compare(&g_routes[i], url + 1, prefixLen, bParams, method) == 0
+		&& !strcmp(g_routes[i].url, url)) {
+		g_routes[i].callback = callback;
+		return i;
+	}
+	if (g_numRoutes >= MAX_HTTP_ROUTES) {
+		ADDLOGF_ERROR("Too many HTTP routes, %s not registered", url);
 		return -4;
 	}
-	for (i = 0; i < MAX_HTTP_CALLBACKS; i++) {
-		if (callbacks[i]) {
-			if (callbacks[i]->callback == callback && !strcmp(callbacks[i]->url, url)
-				&& callbacks[i]->method == method) {
-				return i;
+	memmove(&g_routes[i + 1], &g_routes[i], (g_numRoutes - i) * sizeof(http_route_t));
+	g_routes[i].url = url;
+	g_routes[i].callback = callback;
+	g_routes[i].prefixLen = prefixLen;
+	g_routes[i].method = method;
+	g_routes[i].bParams = bParams;
+	g_numRoutes++;
+
+	// success
+	return 0;
+}
+
+int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback) {
+	int res;
+
+	if (!url || !callback || url[0] != '/') {
+		return -1;
+	}
+	if (HTTP_Routes_Lock() == false) {
+		return -1;
+	}
+	res = HTTP_Route_Insert(url, method, callback);
+	HTTP_Routes_Unlock();
+	return res;
+}
+
+const char* HTTP_GetRoute(int index, int* method) {
+	const char* url = 0;
+
+	if (HTTP_Routes_Lock() == false) {
+		return 0;
+	}
+	if (index >= 0 && index < g_numRoutes) {
+		*method = g_routes[index].method;
+		url = g_routes[index].url;
+	}
+	HTTP_Routes_Unlock();
+	return url;
+}
+
+// matches parametric part of route against rest of path, storing parameters in request
+static bool HTTP_Route_MatchParams(http_request_t* request, const char* pattern, const char* path, int pathLen) {
+	const char* end = path + pathLen;
+	int segLen;
+
+	request->numpathparams = 0;
+	while (*pattern) {
+		if (*pattern == '*') {
+			if (request->numpathparams < MAX_PATH_PARAMS) {
+				request->pathparams[request->numpathparams] = path;
+				request->pathparamlens[request->numpathparams] = end - path;
+				request->numpathparams++;
+			}
+			return true;
+		}
+		segLen = 0;
+		while (path + segLen < end && path[segLen] != '/') {
+			segLen++;
+		}
+		if (*pattern == ':') {
+			if (segLen == 0) {
+				return false;
+			}
+			if (request->numpathparams < MAX_PATH_PARAMS) {
+				request->pathparams[request->numpathparams] = path;
+				request->pathparamlens[request->numpathparams] = segLen;
+				request->numpathparams++;
+			}
+			while (*pattern && *pattern != '/') {
+				pattern++;
 			}
 		}
+		else {
+			if (strncmp(pattern, path, segLen) || (pattern[segLen] != 0 && pattern[segLen] != '/')) {
+				return false;
+			}
+			pattern += segLen;
+		}
+		path += segLen;
+		// both must continue with next segment, or both end
+		if (*pattern == '/') {
+			if (path >= end || *path != '/') {
+				return false;
+			}
+			pattern++;
+			path++;
+		}
+		else if (path < end) {
+			return false;
+		}
 	}
-	callbacks[numCallbacks] = (http_callback_t*)os_malloc(sizeof(http_callback_t));
-	if (!callbacks[numCallbacks]) {
-		return -2;
+	return path >= end;
+}
+
+// looks for route with given fixed part, of request's method or HTTP_ANY
+static http_route_t* HTTP_Route_FindWithKey(http_request_t* request, const char* path, int pathLen, int keyLen, int bParams) {
+	http_route_t* anyMethod = 0;
+	http_route_t* r;
+	int i;
+
+	// HTTP_ANY sorts first
+	for (i = HTTP_Route_LowerBound(path, keyLen, bParams, HTTP_ANY); i < g_numRoutes; i++) {
+		r = &g_routes[i];
+		if (HTTP_Route_Compare(r, path, keyLen, bParams, r->method) != 0) {
+			break;
+		}
+		if (r->method != request->method && r->method != HTTP_ANY) {
+			continue;
+		}
+		if (bParams && !HTTP_Route_MatchParams(request, r->url + 1 + keyLen, path + keyLen, pathLen - keyLen)) {
+			continue;
+		}
+		if (r->method == request->method) {
+			return r;
+		}
+		if (anyMethod == 0) {
+			anyMethod = r;
+		}
 	}
-	callbacks[numCallbacks]->url = (char*)os_malloc(strlen(url) + 1);
-	if (!callbacks[numCallbacks]->url) {
-		os_free(callbacks[numCallbacks]);
-		return -3;
+	// parameters were overwritten by other candidates
+	if (anyMethod && bParams) {
+		HTTP_Route_MatchParams(request, anyMethod->url + 1 + keyLen, path + keyLen, pathLen - keyLen);
 	}
-	strcpy(callbacks[numCallbacks]->url, url);
-	callbacks[numCallbacks]->callback = callback;
-	callbacks[numCallbacks]->method = method;
+	return anyMethod;
+}
 
-	numCallbacks++;
+// exact route first, then ones with parameters, from the longest fixed part
+static http_route_t* HTTP_Route_Find(http_request_t* request, const char* path, int pathLen) {
+	http_route_t* r;
+	int keyLen;
 
-	// success
+	request->numpathparams = 0;
+	r = HTTP_Route_FindWithKey(request, path, pathLen, pathLen, 0);
+	if (r) {
+		return r;
+	}
+	for (keyLen = pathLen; keyLen >= 0; keyLen--) {
+		if (keyLen > 0 && path[keyLen - 1] != '/') {
+			continue;
+		}
+		r = HTTP_Route_FindWithKey(request, path, pathLen, keyLen, 1);
+		if (r) {
+			return r;
+		}
+	}
+	request->numpathparams = 0;
 	return 0;
 }
 
+int http_getPathParam(http_request_t* request, int index, char* o, int maxSize) {
+	int len;
+
+	if (index < 0 || index >= request->numpathparams) {
+		*o = 0;
+		return 0;
+	}
+	len = request->pathparamlens[index];
+	if (len >= maxSize) {
+		len = maxSize - 1;
+	}
+	memcpy(o, request->pathparams[index], len);
+	o[len] = 0;
+	return 1;
+}
+
 int my_strnicmp(const char* a, const char* b, int len) {
 	int i;
 	for (i = 0; i < len; i++) {
@@ -202,6 +442,19 @@ bool http_startsWith(const char* base, const char* substr) {
 	return true;
 }
 
+// checks if header value between s and end contains given word
+static bool http_hasTokenCaseInsensitive(const char* s, const char* end, const char* token) {
+	int len = strlen(token);
+
+	while (s + len <= end) {
+		if (!my_strnicmp(s, token, len)) {
+			return true;
+		}
+		s++;
+	}
+	return false;
+}
+
 bool http_checkUrlBase(const char* base, const char* fileName) {
 	while (*base != 0 && *base != '?' && *base != ' ') {
 		if (*base != *fileName)
@@ -217,8 +470,15 @@ bool http_checkUrlBase(const char* base, const char* fileName) {
 }
 
 void http_setup(http_request_t* request, const char* type) {
+	http_setup_headers(request, type, NULL);
+}
+
+void http_setup_headers(http_request_t* request, const char* type, const char* extraHeaders) {
 	hprintf255(request, httpHeader, request->responseCode, type);
 	poststr(request, "\r\n"); // next header
+	if (extraHeaders) {
+		poststr(request, extraHeaders);
+	}
 	poststr(request, httpCorsHeaders);
 #if 0
 	poststr(request, "Server: Tasmota/10.1.0 (ESP8266EX)");
@@ -234,9 +494,393 @@ void http_setup(http_request_t* request, const char* type) {
 	poststr(request, "Transfer-Encoding: chunked");
 #endif
 	poststr(request, "\r\n");
-	poststr(request, "Connection: close");
+	if (request->keepAlive && request->replylen + sizeof(httpKeepAliveHeader) + 4 < request->replymaxlen) {
+		request->keepAliveHeaderAt = request->replylen;
+		poststr(request, httpKeepAliveHeader);
+	}
+	else {
+		request->keepAlive = 0;
+		poststr(request, "Connection: close");
+	}
 	poststr(request, "\r\n"); // end headers with double CRLF
 	poststr(request, "\r\n");
+	request->bodyAt = request->replylen;
+}
+
+// request body reader states, see HTTP_ReadBody
+enum {
+	BODY_DATA,
+	// chunked only
+	BODY_CHUNK_SIZE,
+	BODY_CHUNK_EXT,
+	BODY_CHUNK_END,
+	BODY_TRAILER,
+	BODY_TRAILER_LINE,
+	BODY_DONE,
+};
+// how long to wait for rest of body
+#define HTTP_BODY_RECV_TIMEOUT_MS 5000
+
+#ifdef WINDOWS
+static const char* g_http_simBody = 0;
+static int g_http_simBodyLen = 0;
+static int g_http_simBodyMaxRecv = 0;
+
+void SIM_SetHTTPBodyInput(const char* data, int len, int maxRecv) {
+	g_http_simBody = data;
+	g_http_simBodyLen = len;
+	g_http_simBodyMaxRecv = maxRecv;
+}
+#endif
+
+// called by HTTP_ProcessPacket when headers are parsed
+static void HTTP_InitBodyReader(http_request_t* request, int bChunked) {
+	httpBodyReader_t* r = &request->bodyReader;
+	int expected = request->contentLength >= 0 ? request->contentLength : request->bodylen;
+
+	r->chunked = bChunked;
+	r->pending = request->bodystart;
+	r->pendingLen = request->bodylen;
+	r->recvAt = request->bodystart;
+	r->bWhole = 0;
+	r->bTooLarge = 0;
+	if (r->chunked) {
+		r->state = BODY_CHUNK_SIZE;
+		r->chunkSize = 0;
+		r->chunkDigits = 0;
+		r->left = 0;
+	}
+	else {
+		r->state = BODY_DATA;
+		r->left = expected;
+	}
+}
+
+// more body is received after url and headers, or in whole buffer if there is no room there
+// and body is streamed
+static int HTTP_ReceiveBody(http_request_t* request) {
+	httpBodyReader_t* r = &request->bodyReader;
+	char* at = r->recvAt;
+	int max;
+	int len;
+
+	if (at == 0 || (r->bWhole == 0 && request->received + request->receivedLenmax - at < 128)) {
+		at = request->received;
+	}
+	max = request->received + request->receivedLenmax - at;
+	if (r->bWhole) {
+		// room for terminating zero
+		max--;
+	}
+	if (max <= 0) {
+		return 0;
+	}
+#ifdef WINDOWS
+	// fd will be NULL for unit tests where HTTP packet is faked locally
+	if (request->fd == 0) {
+		len = g_http_simBodyLen;
+		if (len > g_http_simBodyMaxRecv) {
+			len = g_http_simBodyMaxRecv;
+		}
+		if (len > max) {
+			len = max;
+		}
+		memcpy(at, g_http_simBody, len);
+		g_http_simBody += len;
+		g_http_simBodyLen -= len;
+		r->pending = at;
+		r->pendingLen = len;
+		return len > 0;
+	}
+#endif
+	{
+		fd_set readfds;
+		struct timeval tv;
+
+		FD_ZERO(&readfds);
+		FD_SET(request->fd, &readfds);
+		tv.tv_sec = HTTP_BODY_RECV_TIMEOUT_MS / 1000;
+		tv.tv_usec = (HTTP_BODY_RECV_TIMEOUT_MS % 1000) * 1000;
+		if (select(request->fd + 1, &readfds, NULL, NULL, &tv) <= 0) {
+			return 0;
+		}
+	}
+	len = recv(request->fd, at, max, 0);
+	if (len <= 0) {
+		return 0;
+	}
+	r->pending = at;
+	r->pendingLen = len;
+	return 1;
+}
+
+// parses size lines and ends of chunks, returns 0 if they are malformed
+static int HTTP_ParseChunked(httpBodyReader_t* r, char c) {
+	switch (r->state) {
+	case BODY_CHUNK_SIZE:
+		if (isxdigit((unsigned char)c)) {
+			// 7 digits are more than any upload we can take
+			if (++r->chunkDigits > 7) {
+				return 0;
+			}
+			r->chunkSize = r->chunkSize * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+			return 1;
+		}
+		if (c == ';' && r->chunkDigits) {
+			r->state = BODY_CHUNK_EXT;
+			return 1;
+		}
+		// fall through
+	case BODY_CHUNK_EXT:
+		if (c == '\r') {
+			return 1;
+		}
+		if (c != '\n') {
+			return r->state == BODY_CHUNK_EXT;
+		}
+		if (r->chunkDigits == 0) {
+			return 0;
+		}
+		r->left = r->chunkSize;
+		r->state = r->left ? BODY_DATA : BODY_TRAILER;
+		return 1;
+	case BODY_CHUNK_END:
+		if (c == '\r') {
+			return 1;
+		}
+		if (c != '\n') {
+			return 0;
+		}
+		r->state = BODY_CHUNK_SIZE;
+		r->chunkSize = 0;
+		r->chunkDigits = 0;
+		return 1;
+	case BODY_TRAILER:
+		if (c == '\r') {
+			return 1;
+		}
+		r->state = c == '\n' ? BODY_DONE : BODY_TRAILER_LINE;
+		return 1;
+	case BODY_TRAILER_LINE:
+		if (c == '\n') {
+			r->state = BODY_TRAILER;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+int HTTP_ReadBody(http_request_t* request, char** data) {
+	httpBodyReader_t* r = &request->bodyReader;
+	int len;
+
+	while (1) {
+		if (r->state == BODY_DONE) {
+			return 0;
+		}
+		if (r->state == BODY_DATA && r->left == 0) {
+			if (r->chunked == 0) {
+				r->state = BODY_DONE;
+				return 0;
+			}
+			r->state = BODY_CHUNK_END;
+		}
+		if (r->pendingLen == 0 && HTTP_ReceiveBody(request) == 0) {
+			ADDLOGF_ERROR("body not received, %d bytes left", r->left);
+			return -1;
+		}
+		if (r->state == BODY_DATA) {
+			len = r->pendingLen < r->left ? r->pendingLen : r->left;
+			*data = r->pending;
+			r->pending += len;
+			r->pendingLen -= len;
+			r->left -= len;
+			return len;
+		}
+		while (r->pendingLen > 0 && r->state != BODY_DATA && r->state != BODY_DONE) {
+			if (HTTP_ParseChunked(r, *r->pending) == 0) {
+				ADDLOGF_ERROR("malformed chunked body");
+				return -1;
+			}
+			r->pending++;
+			r->pendingLen--;
+		}
+	}
+}
+
+char* HTTP_GetWholeBody(http_request_t* request) {
+	httpBodyReader_t* r = &request->bodyReader;
+	char* data;
+	int total = 0;
+	int len;
+
+	char* end = request->received + request->receivedLenmax;
+
+	if (request->bodystart == 0) {
+		return 0;
+	}
+	// more is received only after body read so far, never over it
+	r->bWhole = 1;
+	while ((len = HTTP_ReadBody(request, &data)) > 0) {
+		if (data < request->bodystart + total || data + len >= end) {
+			break;
+		}
+		// pieces are moved together, next one is received after them
+		memmove(request->bodystart + total, data, len);
+		total += len;
+		r->recvAt = request->bodystart + total;
+	}
+	if (len != 0) {
+		// receiving fails when no room is left
+		if (len > 0 || r->recvAt >= end - 1) {
+			r->bTooLarge = 1;
+			ADDLOGF_ERROR("body too large");
+		}
+		return 0;
+	}
+	request->bodystart[total] = 0;
+	request->bodylen = total;
+	return request->bodystart;
+}
+
+// rest of body is still on socket and would be taken as next request
+static int HTTP_IsBodyLeft(http_request_t* request) {
+	httpBodyReader_t* r = &request->bodyReader;
+
+	// or next request was already received, it is not handled
+	if (r->chunked == 0 && request->contentLength < 0) {
+		return request->bodylen > 0;
+	}
+	if (r->chunked) {
+		return r->state != BODY_DONE || r->pendingLen > 0;
+	}
+	return r->left != r->pendingLen;
+}
+
+#ifdef WINDOWS
+static char g_http_simSent[16384];
+static int g_http_simSentLen = 0;
+static int g_http_simSends = 0;
+
+const char* SIM_GetHTTPSentOutput(int* len, int* sends) {
+	*len = g_http_simSentLen;
+	*sends = g_http_simSends;
+	return g_http_simSent;
+}
+void SIM_ClearHTTPSentOutput() {
+	g_http_simSentLen = 0;
+	g_http_simSends = 0;
+}
+#endif
+
+static void HTTP_Send(http_request_t* request, const char* data, int len) {
+#ifdef WINDOWS
+	// fd will be NULL for unit tests where HTTP packet is faked locally
+	if (request->fd == 0) {
+		if (g_http_simSentLen + len <= sizeof(g_http_simSent)) {
+			memcpy(g_http_simSent + g_http_simSentLen, data, len);
+			g_http_simSentLen += len;
+		}
+		g_http_simSends++;
+		return;
+	}
+#endif
+	send(request->fd, data, len, 0);
+}
+
+// how far reply buffer may be filled before it's sent
+static int HTTP_GetReplyLimit(http_request_t* request) {
+	// keep place for terminating zero
+	int limit = request->replymaxlen - 1;
+
+	if (limit >= HTTP_SEND_SEGMENT) {
+		limit -= limit % HTTP_SEND_SEGMENT;
+	}
+	if (request->chunked || (request->keepAlive && request->keepAliveHeaderAt)) {
+		limit -= HTTP_CHUNK_RESERVE;
+	}
+	return limit;
+}
+
+// part of reply is about to be sent before its length is known
+static void HTTP_DropKeepAlive(http_request_t* request) {
+	char* at;
+
+	if (request->keepAliveHeaderAt == 0) {
+		return;
+	}
+	at = request->reply + request->keepAliveHeaderAt;
+	memset(at, ' ', sizeof(httpKeepAliveHeader) - 1);
+	if (request->keepAlive) {
+		// body written so far becomes first chunk
+		memcpy(at, httpChunkedHeader, sizeof(httpChunkedHeader) - 1);
+		memmove(request->reply + request->bodyAt + HTTP_CHUNK_SIZE_LINE, request->reply + request->bodyAt,
+			request->replylen - request->bodyAt);
+		request->chunkAt = request->bodyAt;
+		request->replylen += HTTP_CHUNK_SIZE_LINE;
+		request->chunked = 1;
+	}
+	else {
+		memcpy(at, "Connection: close", 17);
+	}
+	request->keepAliveHeaderAt = 0;
+}
+
+// fills size line of chunk being filled and ends it, or drops it if empty
+static void HTTP_EndChunk(http_request_t* request) {
+	char tmp[HTTP_CHUNK_SIZE_LINE + 1];
+	int size = request->replylen - request->chunkAt - HTTP_CHUNK_SIZE_LINE;
+
+	if (size == 0) {
+		request->replylen = request->chunkAt;
+		return;
+	}
+	snprintf(tmp, sizeof(tmp), "%04X\r\n", size);
+	memcpy(request->reply + request->chunkAt, tmp, HTTP_CHUNK_SIZE_LINE);
+	memcpy(request->reply + request->replylen, "\r\n", 2);
+	request->replylen += 2;
+}
+
+// sends what is in reply buffer, to make room for more
+static void HTTP_FlushReply(http_request_t* request) {
+	HTTP_DropKeepAlive(request);
+	if (request->chunked) {
+		HTTP_EndChunk(request);
+	}
+	if (request->replylen > 0) {
+		HTTP_Send(request, request->reply, request->replylen);
+	}
+	request->replylen = 0;
+	if (request->chunked) {
+		request->chunkAt = 0;
+		request->replylen = HTTP_CHUNK_SIZE_LINE;
+	}
+	request->reply[request->replylen] = 0;
+}
+
+int HTTP_FinishKeepAlive(http_request_t* request) {
+	char tmp[HTTP_CONTENT_LENGTH_DIGITS + 1];
+
+	if (HTTP_IsBodyLeft(request)) {
+		request->keepAlive = 0;
+	}
+	if (request->chunked) {
+		HTTP_EndChunk(request);
+		memcpy(request->reply + request->replylen, "0\r\n\r\n", 5);
+		request->replylen += 5;
+		request->chunked = 0;
+		return request->keepAlive;
+	}
+	if (request->keepAlive == 0 || request->keepAliveHeaderAt == 0) {
+		request->keepAlive = 0;
+		HTTP_DropKeepAlive(request);
+		return 0;
+	}
+	snprintf(tmp, sizeof(tmp), "%*i", HTTP_CONTENT_LENGTH_DIGITS, request->replylen - request->bodyAt);
+	memcpy(request->reply + request->keepAliveHeaderAt + sizeof(httpKeepAliveHeader) - 1 - HTTP_CONTENT_LENGTH_DIGITS,
+		tmp, HTTP_CONTENT_LENGTH_DIGITS);
+	request->keepAliveHeaderAt = 0;
+	return 1;
 }
 
 void http_html_start(http_request_t* request, const char* pagename) {
@@ -249,7 +893,8 @@ void http_html_start(http_request_t* request, const char* pagename) {
 	poststr(request, "</title>");
 	poststr(request, htmlShortcutIcon);
 	poststr(request, htmlHeadMeta);
-	poststr(request, htmlHeadStyle);
+	// served separately and cached by browser, query changes with content
+	hprintf255(request, "<link rel=\"stylesheet\" href=\"/style.css?%s\">", styleCss_etag);
 	poststr(request, "</head>");
 	poststr(request, htmlBodyStart);
 	poststr(request, CFG_GetDeviceName());
@@ -275,7 +920,46 @@ void http_html_end(http_request_t* request) {
 	poststr(request, upTimeStr);
 
 	poststr(request, htmlBodyEnd);
-	poststr(request, pageScript);
+	hprintf255(request, "<script src=\"/script.js?%s\"></script>", scriptJs_etag);
+}
+
+const char* http_getHeader(http_request_t* request, const char* name) {
+	const char* h;
+	int len = strlen(name);
+	int i;
+
+	for (i = 0; i < request->numheaders; i++) {
+		h = request->headers[i];
+		if (!my_strnicmp(h, name, len) && h[len] == ':') {
+			h += len + 1;
+			while (*h == ' ') {
+				h++;
+			}
+			return h;
+		}
+	}
+	return 0;
+}
+
+int HTTP_CheckStateRevision(http_request_t* request, char* headers, int maxSize) {
+	const char* ifNoneMatch;
+	char since[16];
+	char rev[16];
+	char etag[20];
+
+	snprintf(rev, sizeof(rev), "%u", STATE_GetRevision());
+	snprintf(etag, sizeof(etag), "\"%s\"", rev);
+	// no-cache makes browser revalidate every time, instead of guessing freshness
+	snprintf(headers, maxSize, "ETag: %s\r\nCache-Control: no-cache\r\n", etag);
+	ifNoneMatch = http_getHeader(request, "If-None-Match");
+	if ((ifNoneMatch && strstr(ifNoneMatch, etag))
+		|| (http_getArg(request->url, "since", since, sizeof(since)) && !strcmp(since, rev))) {
+		request->responseCode = 304;
+		http_setup_headers(request, httpMimeTypeJson, headers);
+		poststr(request, NULL);
+		return 1;
+	}
+	return 0;
 }
 
 const char* http_checkArg(const char* p, const char* n) {
@@ -491,44 +1175,40 @@ int postany(http_request_t* request, const char* str, int len) {
 	send(request->fd, str, len, 0);
 	return 0;
 #else
-	int currentlen;
-	int addlen = len;
+	int limit, part;
 
 	if (NULL == str) {
 		// fd will be NULL for unit tests where HTTP packet is faked locally
 		if (request->fd == 0) {
 			return request->replylen;
 		}
+		// reply is sent by server after HTTP_FinishKeepAlive
+		if (request->keepAlive && (request->keepAliveHeaderAt || request->chunked)) {
+			return request->replylen;
+		}
 		if (request->replylen > 0) {
-			send(request->fd, request->reply, request->replylen, 0);
+			HTTP_FlushReply(request);
 		}
-		request->reply[0] = 0;
-		request->replylen = 0;
 		return 0;
 	}
 
-	currentlen = request->replylen;
-	if (currentlen + addlen >= request->replymaxlen) {
-		send(request->fd, request->reply, request->replylen, 0);
-		request->reply[0] = 0;
-		request->replylen = 0;
-		currentlen = 0;
-	}
-	while (addlen >= request->replymaxlen) {
-		if (request->replylen > 0) {
-			send(request->fd, request->reply, request->replylen, 0);
-			request->replylen = 0;
+	// buffer is filled up and sent in full segments
+	limit = HTTP_GetReplyLimit(request);
+	while (request->replylen + len > limit) {
+		part = limit - request->replylen;
+		if (part < 0) {
+			part = 0;
 		}
-		send(request->fd, str, (request->replymaxlen - 1), 0);
-		addlen -= (request->replymaxlen - 1);
-		str += (request->replymaxlen - 1);
-
-		rtos_delay_milliseconds(1 / portTICK_RATE_MS);
+		memcpy(request->reply + request->replylen, str, part);
+		request->replylen += part;
+		str += part;
+		len -= part;
+		HTTP_FlushReply(request);
+		limit = HTTP_GetReplyLimit(request);
 	}
-
-	memcpy(request->reply + request->replylen, str, addlen);
-	request->replylen += addlen;
-	return (currentlen + addlen);
+	memcpy(request->reply + request->replylen, str, len);
+	request->replylen += len;
+	return request->replylen;
 #endif
 }
 
@@ -544,16 +1224,97 @@ int poststr(http_request_t* request, const char* str) {
 
 int hprintf255(http_request_t* request, const char* fmt, ...) {
 	va_list argList;
-	//BaseType_t taken;
+#if PLATFORM_BL602
 	char tmp[256];
-	memset(tmp, 0, sizeof(tmp));
+
 	va_start(argList, fmt);
-	vsnprintf(tmp, 255, fmt, argList);
+	vsnprintf(tmp, sizeof(tmp), fmt, argList);
 	va_end(argList);
 	return postany(request, tmp, strlen(tmp));
+#else
+	int space, len;
+
+	space = HTTP_GetReplyLimit(request) - request->replylen;
+	len = space + 1;
+	if (space > 0) {
+		va_start(argList, fmt);
+		len = vsnprintf(request->reply + request->replylen, space + 1, fmt, argList);
+		va_end(argList);
+	}
+	if (len > space) {
+		// didn't fit, format again into emptied buffer
+		HTTP_FlushReply(request);
+		space = HTTP_GetReplyLimit(request) - request->replylen;
+		va_start(argList, fmt);
+		len = vsnprintf(request->reply + request->replylen, space + 1, fmt, argList);
+		va_end(argList);
+		if (len > space) {
+			len = space;
+		}
+	}
+	if (len > 0) {
+		request->replylen += len;
+	}
+	return request->replylen;
+#endif
 }
 
 
+static int http_fn_asset(http_request_t* request);
+
+typedef struct http_builtInRoute_tag {
+	const char* url;
+	http_callback_fn callback;
+} http_builtInRoute_t;
+
+// pages of http_fns.c, for any method
+static const http_builtInRoute_t g_builtInRoutes[] = {
+	{ "/", http_fn_empty_url },
+	{ "/testmsg", http_fn_testmsg },
+	{ "/index", http_fn_index },
+	{ "/about", http_fn_about },
+	{ "/cfg_mqtt", http_fn_cfg_mqtt },
+	{ "/cfg_mqtt_set", http_fn_cfg_mqtt_set },
+	{ "/cfg_webapp", http_fn_cfg_webapp },
+	{ "/cfg_webapp_set", http_fn_cfg_webapp_set },
+	{ "/cfg_wifi", http_fn_cfg_wifi },
+	{ "/cfg_name", http_fn_cfg_name },
+	{ "/cfg_wifi_set", http_fn_cfg_wifi_set },
+	{ "/cfg_loglevel_set", http_fn_cfg_loglevel_set },
+	{ "/cfg_mac", http_fn_cfg_mac },
+	{ "/flash_read_tool", http_fn_flash_read_tool },
+	{ "/uart_tool", http_fn_uart_tool },
+	{ "/cmd_tool", http_fn_cmd_tool },
+	{ "/startup_command", http_fn_startup_command },
+	{ "/cfg_generic", http_fn_cfg_generic },
+	{ "/cfg_startup", http_fn_cfg_startup },
+	{ "/cfg_dgr", http_fn_cfg_dgr },
+	{ "/cfg_quick", http_fn_cfg_quick },
+	{ "/ha_cfg", http_fn_ha_cfg },
+	{ "/ha_discovery", http_fn_ha_discovery },
+	{ "/cfg", http_fn_cfg },
+	{ "/cfg_pins", http_fn_cfg_pins },
+	{ "/cfg_ping", http_fn_cfg_ping },
+	{ "/ota", http_fn_ota },
+	{ "/ota_exec", http_fn_ota_exec },
+	{ "/cm", http_fn_cm },
+	{ "/style.css", http_fn_asset },
+	{ "/script.js", http_fn_asset },
+};
+
+static void HTTP_RegisterBuiltInRoutes() {
+	static bool bDone = false;
+	int i;
+
+	if (bDone) {
+		return;
+	}
+	bDone = true;
+	for (i = 0; i < sizeof(g_builtInRoutes) / sizeof(g_builtInRoutes[0]); i++) {
+		HTTP_Route_Insert(g_builtInRoutes[i].url, HTTP_ANY, g_builtInRoutes[i].callback);
+	}
+}
+
 int HTTP_ProcessPacket(http_request_t* request) {
 	int i;
 	char* p;
@@ -562,6 +1323,9 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	//int bChanged = 0;
 	char* urlStr = "";
 	char* recvbuf;
+	http_route_t* route;
+	http_callback_fn callback;
+	int bChunked = 0;
 
 	if (request->received == 0) {
 		ADDLOGF_ERROR("You gave request with NULL input");
@@ -593,6 +1357,7 @@ int HTTP_ProcessPacket(http_request_t* request) {
 
 	// if OPTIONS, return now - for CORS
 	if (request->method == HTTP_OPTIONS) {
+		request->keepAlive = 0;
 		http_setup(request, httpMimeTypeHTML);
 		i = strlen(request->reply);
 		return i;
@@ -627,6 +1392,9 @@ int HTTP_ProcessPacket(http_request_t* request) {
 			return 0;
 		}
 	}
+	if (protocol == 0 || strcmp(protocol, "HTTP/1.1")) {
+		request->keepAlive = 0;
+	}
 	// i.e. not received
 	request->contentLength = -1;
 	headers = p;
@@ -643,6 +1411,12 @@ int HTTP_ProcessPacket(http_request_t* request) {
 					if (!my_strnicmp(headers, "Content-Length:", 15)) {
 						request->contentLength = atoi(headers + 15);
 					}
+					if (!my_strnicmp(headers, "Connection:", 11) && http_hasTokenCaseInsensitive(headers + 11, p, "close")) {
+						request->keepAlive = 0;
+					}
+					if (!my_strnicmp(headers, "Transfer-Encoding:", 18) && http_hasTokenCaseInsensitive(headers + 18, p, "chunked")) {
+						bChunked = 1;
+					}
 
 					*p = 0;
 					p++; // past \r
@@ -671,6 +1445,8 @@ int HTTP_ProcessPacket(http_request_t* request) {
 		request->bodystart = p;
 		request->bodylen = request->receivedLen - (p - request->received);
 	}
+	// connection is reused only if handler reads rest of body, see HTTP_FinishKeepAlive
+	HTTP_InitBodyReader(request, bChunked);
 #if 0
 	postany(request, "test", 4);
 	return 0;
@@ -678,55 +1454,19 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	return http_fn_empty_url(request);
 #endif
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	for (i = 0; i < numCallbacks; i++) {
-		char* url = callbacks[i]->url;
-		if (http_startsWith(urlStr, &url[1])) {
-			int method = callbacks[i]->method;
-			if (method == HTTP_ANY || method == request->method) {
-				return callbacks[i]->callback(request);
-			}
+	// look for a route with this path and method, or HTTP_ANY.
+	// Handler runs without lock, it may register routes itself
+	callback = 0;
+	if (HTTP_Routes_Lock()) {
+		route = HTTP_Route_Find(request, urlStr, strcspn(urlStr, "?"));
+		if (route) {
+			callback = route->callback;
 		}
+		HTTP_Routes_Unlock();
+	}
+	if (callback) {
+		return callback(request);
 	}
-	if (http_checkUrlBase(urlStr, "")) return http_fn_empty_url(request);
-
-	if (http_checkUrlBase(urlStr, "testmsg")) return http_fn_testmsg(request);
-	if (http_checkUrlBase(urlStr, "index")) return http_fn_index(request);
-
-	if (http_checkUrlBase(urlStr, "about")) return http_fn_about(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_mqtt")) return http_fn_cfg_mqtt(request);
-	if (http_checkUrlBase(urlStr, "cfg_mqtt_set")) return http_fn_cfg_mqtt_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_webapp")) return http_fn_cfg_webapp(request);
-	if (http_checkUrlBase(urlStr, "cfg_webapp_set")) return http_fn_cfg_webapp_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_wifi")) return http_fn_cfg_wifi(request);
-	if (http_checkUrlBase(urlStr, "cfg_name")) return http_fn_cfg_name(request);
-	if (http_checkUrlBase(urlStr, "cfg_wifi_set")) return http_fn_cfg_wifi_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_loglevel_set")) return http_fn_cfg_loglevel_set(request);
-	if (http_checkUrlBase(urlStr, "cfg_mac")) return http_fn_cfg_mac(request);
-
-	if (http_checkUrlBase(urlStr, "flash_read_tool")) return http_fn_flash_read_tool(request);
-	if (http_checkUrlBase(urlStr, "uart_tool")) return http_fn_uart_tool(request);
-	if (http_checkUrlBase(urlStr, "cmd_tool")) return http_fn_cmd_tool(request);
-	if (http_checkUrlBase(urlStr, "startup_command")) return http_fn_startup_command(request);
-	if (http_checkUrlBase(urlStr, "cfg_generic")) return http_fn_cfg_generic(request);
-	if (http_checkUrlBase(urlStr, "cfg_startup")) return http_fn_cfg_startup(request);
-	if (http_checkUrlBase(urlStr, "cfg_dgr")) return http_fn_cfg_dgr(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_quick")) return http_fn_cfg_quick(request);
-	if (http_checkUrlBase(urlStr, "ha_cfg")) return http_fn_ha_cfg(request);
-	if (http_checkUrlBase(urlStr, "ha_discovery")) return http_fn_ha_discovery(request);
-	if (http_checkUrlBase(urlStr, "cfg")) return http_fn_cfg(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_pins")) return http_fn_cfg_pins(request);
-	if (http_checkUrlBase(urlStr, "cfg_ping")) return http_fn_cfg_ping(request);
-
-	if (http_checkUrlBase(urlStr, "ota")) return http_fn_ota(request);
-	if (http_checkUrlBase(urlStr, "ota_exec")) return http_fn_ota_exec(request);
-	if (http_checkUrlBase(urlStr, "cm")) return http_fn_cm(request);
 
 	return http_fn_other(request);
 }
@@ -740,14 +1480,78 @@ Gulp tasks should automatically appear in Visual Code or can be invoked from con
 See https://github.com/openshwprojects/OpenBK7231T_App/blob/main/BUILDING.md for gulp setup.
 */
 
-//region_start htmlHeadStyle
-const char htmlHeadStyle[] = "<style>div,fieldset,input,select{padding:5px;font-size:1em;margin:0 0 .2em}fieldset{background:#4f4f4f}p{margin:.5em 0}input{width:100%;box-sizing:border-box;-webkit-box-sizing:border-box;-moz-box-sizing:border-box;background:#ddd;color:#000}form{margin-bottom:.5em}input[type=checkbox],input[type=radio]{width:1em;margin-right:6px;vertical-align:-1px}input[type=range]{width:99%}select{width:100%;background:#ddd;color:#000}textarea{resize:vertical;width:98%;height:318px;padding:5px;overflow:auto;background:#1f1f1f;color:#65c115}body{text-align:center;font-family:verdana,sans-serif}body,h1 a{background:#21333e;color:#eaeaea}td{padding:0}button,input[type=submit]{border:0;border-radius:.3rem;background:#1fa3ec;color:#faffff;line-height:2.4rem;font-size:1.2rem;cursor:pointer}input[type=submit]{width:100%;transition-duration:.4s}input[type=submit]:hover{background:#0e70a4}.bred{background:#d43535!important}.bred:hover{background:#931f1f!important}.bgrn{background:#47c266!important}.bgrn:hover{background:#5aaf6f!important}a{color:#1fa3ec;text-decoration:none}.p{float:left;text-align:left}.q{float:right;text-align:right}.r{border-radius:.3em;padding:2px;margin:6px 2px;background:linear-gradient(90deg,#ffa000,#a6d1ff)}.hf{display:none}.hdiv{width:95%;white-space:nowrap}.hele{width:210px;display:inline-block;margin-left:2px}div#state{padding:0}div#changed{padding:0;height:23px}div#main{text-align:left;display:inline-block;color:#eaeaea;min-width:340px;max-width:800px}table{table-layout:fixed;width:100%}.disp-none{display:none}.disp-inline{display:inline-block}.safe{color:red}form.indent{padding-left:16px}li{margin:5px 0}.off,.on{text-align:center;font-size:54px}.on{font-weight:700}</style>";
-//region_end htmlHeadStyle
+//region_start styleCss
+const char styleCss[] = "div,fieldset,input,select{padding:5px;font-size:1em;margin:0 0 .2em}fieldset{background:#4f4f4f}p{margin:.5em 0}input{width:100%;box-sizing:border-box;-webkit-box-sizing:border-box;-moz-box-sizing:border-box;background:#ddd;color:#000}form{margin-bottom:.5em}input[type=checkbox],input[type=radio]{width:1em;margin-right:6px;vertical-align:-1px}input[type=range]{width:99%}select{width:100%;background:#ddd;color:#000}textarea{resize:vertical;width:98%;height:318px;padding:5px;overflow:auto;background:#1f1f1f;color:#65c115}body{text-align:center;font-family:verdana,sans-serif}body,h1 a{background:#21333e;color:#eaeaea}td{padding:0}button,input[type=submit]{border:0;border-radius:.3rem;background:#1fa3ec;color:#faffff;line-height:2.4rem;font-size:1.2rem;cursor:pointer}input[type=submit]{width:100%;transition-duration:.4s}input[type=submit]:hover{background:#0e70a4}.bred{background:#d43535!important}.bred:hover{background:#931f1f!important}.bgrn{background:#47c266!important}.bgrn:hover{background:#5aaf6f!important}a{color:#1fa3ec;text-decoration:none}.p{float:left;text-align:left}.q{float:right;text-align:right}.r{border-radius:.3em;padding:2px;margin:6px 2px;background:linear-gradient(90deg,#ffa000,#a6d1ff)}.hf{display:none}.hdiv{width:95%;white-space:nowrap}.hele{width:210px;display:inline-block;margin-left:2px}div#state{padding:0}div#changed{padding:0;height:23px}div#main{text-align:left;display:inline-block;color:#eaeaea;min-width:340px;max-width:800px}table{table-layout:fixed;width:100%}.disp-none{display:none}.disp-inline{display:inline-block}.safe{color:red}form.indent{padding-left:16px}li{margin:5px 0}.off,.on{text-align:center;font-size:54px}.on{font-weight:700}";
+const unsigned char styleCss_gz[] = {0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x75,0x54,0x61,0x6f,0xa3,0x30,0x0c,0xfd,0x2b,0x3d,0x55,0x93,0xee,0x24,0x40,0x50,0x4a,0xb7,0x81,0xee,0x97,0x9c,0xf6,0xc1,0x10,0x07,0xa2,0x41,0xc2,0x85,0xb0,0xb6,0x43,0xf9,0xef,0xe7,0xd0,0xb0,0x83,0xaa,0x1b,0xd2,0xd4,0x24,0xb6,0x9f,0xfd,0x9e,0x6d,0x26,0x3e,0x02,0x2e,0xb0,0x65,0x03,0x9a,0x40,0xc8,0x7e,0x34,0xc1,0x80,0x2d,0x56,0x66,0xea,0x81,0x31,0x21,0xeb,0x3c,0xeb,0x2f,0x05,0x57,0xd2,0x84,0x83,0xf8,0xc4,0x3c,0xc1,0xae,0xe8,0x40,0xd7,0x42,0xe6,0xf1,0x2e,0xde,0x45,0x07,0xec,0xec,0xe2,0x3f,0x95,0x50,0xbd,0xd7,0x5a,0x8d,0x92,0xe5,0xfb,0x23,0x77,0x9f,0xed,0x27,0x6f,0x1d,0x65,0xd8,0xed,0x62,0x3b,0x43,0x4c,0x67,0xc1,0x4c,0x93,0x27,0x71,0xfc,0x54,0x94,0xea,0xe2,0x22,0x3b,0xa4,0x52,0x69,0x86,0x3a,0xa4,0x9b,0x22,0x3c,0x63,0xf9,0x2e,0x4c,0xf8,0xcd,0x6b,0xa7,0x3e,0xbf,0x79,0x5a,0xa7,0xc0,0x18,0x2b,0x2a,0xd5,0x2a,0x9d,0xef,0xe3,0x38,0xb6,0x5c,0xe9,0xce,0x67,0x43,0xa6,0xc6,0xa8,0x6e,0x4e,0xea,0x96,0xd2,0x1f,0x73,0xed,0xf1,0x77,0xd5,0x60,0xf5,0x4e,0x61,0xde,0x82,0xd5,0xa5,0x06,0x26,0xd4,0xdb,0x92,0xf3,0x57,0xfd,0xa1,0x16,0x75,0x63,0xf2,0x13,0xd1,0xf3,0x81,0xda,0x88,0x0a,0xda,0x10,0x5a,0x51,0xcb,0x3c,0x4c,0xfa,0x8b,0xdd,0x04,0x90,0x35,0x2e,0x01,0x5e,0x5f,0x9f,0xac,0x67,0x78,0xcd,0xc2,0xf7,0x69,0x1b,0xbc,0x18,0xd0,0x08,0x93,0xc6,0x59,0x81,0x05,0xac,0xf0,0xf1,0x5e,0x9e,0x8a,0x06,0xe7,0x54,0xd2,0xe4,0x85,0x92,0x59,0xeb,0xa6,0xc8,0x98,0xb7,0xea,0x9c,0xc3,0x68,0xd4,0x06,0x24,0xe1,0xee,0x5b,0x70,0x4e,0x59,0x95,0x24,0x99,0x2d,0x15,0xbb,0x4e,0x0e,0xcf,0x17,0x52,0xa1,0x34,0xa8,0x6f,0xea,0x73,0xe8,0x44,0x7b,0x75,0xe8,0x0c,0x24,0x04,0x03,0xc8,0x21,0x1c,0x50,0x0b,0x3e,0x7b,0x05,0x4d,0xb2,0x83,0x8d,0xfe,0x87,0x24,0x4d,0x53,0x5c,0x00,0x10,0xdc,0x67,0x0d,0xfb,0x6a,0xab,0xd8,0x96,0x23,0x69,0x20,0xd7,0x4c,0x0f,0x63,0xd9,0x09,0xf3,0x36,0xdd,0xf4,0xcc,0xe3,0xc2,0x0b,0xeb,0x14,0x18,0x87,0x3c,0x4a,0x35,0xb1,0xbf,0xad,0x02,0x52,0xac,0x16,0x10,0x0e,0x9c,0xfe,0x8a,0x56,0x48,0x0c,0x3d,0x25,0x87,0xe8,0xe8,0x7c,0x56,0xfd,0x1b,0x1d,0xdc,0x45,0x35,0xea,0x81,0x5c,0x7a,0x25,0x5c,0x85,0xf6,0x41,0x0e,0x2b,0x71,0x0c,0x09,0x38,0x08,0x23,0x94,0x0c,0xd9,0xa8,0xc1,0xfd,0xc8,0xa3,0xe3,0xf0,0xc0,0x2b,0x6f,0x1c,0xe3,0x1b,0x1e,0x62,0x7c,0x8e,0xe1,0x68,0xa3,0x52,0x23,0xdb,0x3c,0xb0,0x63,0x9a,0xa5,0xd9,0x0f,0xd1,0xf5,0x4a,0x1b,0x90,0xe6,0x66,0xf2,0x20,0xc2,0x6b,0xea,0xa4,0xda,0x18,0xd6,0x5a,0x6e,0x87,0xed,0xb9,0x3a,0x9c,0x4e,0xf7,0x26,0x0f,0x62,0x65,0x00,0xfc,0xb4,0x8e,0x05,0x93,0x27,0xcf,0x53,0x39,0xab,0xcf,0xb0,0x52,0xbe,0x4e,0xa9,0x24,0xda,0xa8,0x9f,0xa8,0x8b,0xc0,0xe4,0x2d,0x72,0x53,0xac,0x1a,0xc4,0x9d,0x6d,0xf4,0xd7,0xbf,0xce,0x03,0xb1,0x7e,0x9e,0x2f,0x6c,0xa4,0xa7,0x7b,0x1d,0x49,0x81,0xa5,0x0f,0x0e,0xd4,0xa6,0x7e,0x45,0xd0,0x28,0xed,0xdc,0x71,0x95,0xb0,0xd3,0x12,0x74,0x58,0x3b,0x4f,0x6a,0xc6,0x9f,0xaf,0x31,0xc3,0x3a,0xd8,0x73,0x0e,0x34,0x1a,0xc1,0x1e,0x4e,0x2c,0xe1,0xfc,0x97,0x8d,0x1a,0x3e,0x31,0x31,0xf4,0x2d,0x5c,0x7d,0xc6,0x0d,0x13,0x1f,0xcb,0xc4,0x65,0x4f,0xc5,0xb9,0x11,0x06,0xc3,0xa1,0x87,0x0a,0xc9,0xe0,0xac,0xa1,0x27,0x13,0x9a,0x42,0x6f,0x72,0x48,0x62,0xc2,0x5d,0x22,0x08,0x39,0xb7,0x50,0xd9,0xaa,0xea,0x7d,0x19,0x76,0x57,0xa9,0xcb,0xd5,0x52,0xdc,0xfd,0x60,0xc0,0xe0,0xaa,0x93,0xdd,0x5d,0xd5,0xb8,0x29,0x5f,0xf5,0xf7,0x32,0x95,0x87,0xd4,0x7b,0x75,0x20,0xe4,0x74,0x47,0xde,0x63,0xcc,0xcd,0xd0,0x14,0x1d,0xc1,0xdf,0xd2,0x4c,0x8f,0xf1,0xcc,0xd6,0xc5,0x9f,0x5f,0x62,0x3a,0x5b,0x03,0x25,0x15,0x32,0xff,0x0f,0x29,0x94,0x1a,0x4d,0xce,0xc5,0x05,0x59,0xf1,0xbf,0x85,0x6d,0xe4,0x70,0x42,0x47,0xcd,0x1d,0x4f,0xf3,0xfd,0x0d,0x7c,0x7a,0x94,0x8b,0x8d,0x06,0xe0,0xe8,0x9b,0x84,0xfa,0x73,0xde,0xa2,0x91,0x90,0x8c,0xd4,0x58,0x6a,0xbd,0x91,0x93,0x90,0x7c,0xb6,0x15,0xcb,0xbe,0xa7,0xf5,0x43,0xeb,0x3e,0x52,0x9c,0x07,0x91,0x92,0xdf,0x6d,0x95,0x79,0x26,0xb3,0x23,0x79,0x3a,0xa3,0xf9,0xea,0x7c,0xa3,0xed,0x99,0x56,0xdf,0x3f,0xb0,0xd4,0x79,0x7e,0x9d,0x06,0x00,0x00};
+const char styleCss_etag[] = "21a9d195";
+//region_end styleCss
 
-//region_start pageScript
-const char pageScript[] = "<script type='text/javascript'>var firstTime,lastTime,onlineFor,req=null,onlineForEl=null,getElement=e=>document.getElementById(e);function showState(){clearTimeout(firstTime),clearTimeout(lastTime),null!=req&&req.abort(),(req=new XMLHttpRequest).onreadystatechange=()=>{var e;4==req.readyState&&\"OK\"==req.statusText&&((\"INPUT\"!=document.activeElement.tagName||\"number\"!=document.activeElement.type&&\"color\"!=document.activeElement.type)&&(e=getElement(\"state\"))&&(e.innerHTML=req.responseText),clearTimeout(firstTime),clearTimeout(lastTime),lastTime=setTimeout(showState,3e3))},req.open(\"GET\",\"index?state=1\",!0),req.send(),firstTime=setTimeout(showState,3e3)}function fmtUpTime(e){var t,n,o=Math.floor(e/86400);return e%=86400,t=Math.floor(e/3600),e%=3600,n=Math.floor(e/60),e=e%60,0<o?o+` days, ${t} hours, ${n} minutes and ${e} seconds`:0<t?t+` hours, ${n} minutes and ${e} seconds`:0<n?n+` minutes and ${e} seconds`:`just ${e} seconds`}function updateOnlineFor(){onlineForEl.textContent=fmtUpTime(++onlineFor)}function onLoad(){(onlineForEl=getElement(\"onlineFor\"))&&(onlineFor=parseInt(onlineForEl.dataset.initial,10))&&setInterval(updateOnlineFor,1e3),showState()}function submitTemperature(e){var t=getElement(\"form132\");getElement(\"kelvin132\").value=Math.round(1e6/parseInt(e.value)),t.submit()}window.addEventListener(\"load\",onLoad),history.pushState(null,\"\",window.location.pathname.slice(1)),setTimeout(()=>{var e=getElement(\"changed\");e&&(e.innerHTML=\"\")},5e3);</script>";
-//region_end pageScript
+//region_start scriptJs
+const char scriptJs[] = "var firstTime,lastTime,stateDelay,onlineFor,req=null,events=null,onlineForEl=null,getElement=e=>document.getElementById(e);function showState(){clearTimeout(firstTime),clearTimeout(lastTime),null!=req&&req.abort(),(req=new XMLHttpRequest).onreadystatechange=()=>{var e;4==req.readyState&&\"OK\"==req.statusText&&((\"INPUT\"!=document.activeElement.tagName||\"number\"!=document.activeElement.type&&\"color\"!=document.activeElement.type)&&(e=getElement(\"state\"))&&(e.innerHTML=req.responseText),clearTimeout(firstTime),clearTimeout(lastTime),null==events&&(lastTime=setTimeout(showState,3e3)))},req.open(\"GET\",\"index?state=1\",!0),req.send(),null==events&&(firstTime=setTimeout(showState,3e3))}function startEvents(){var e;window.EventSource&&getElement(\"state\")&&(events=new EventSource(\"events\"),e=()=>{clearTimeout(stateDelay),stateDelay=setTimeout(showState,100)},events.addEventListener(\"channel\",e),events.addEventListener(\"state\",e),events.onerror=()=>{events.close(),events=null,showState()})}function showPins(){var o,e=getElement(\"pins\");e&&((o=new XMLHttpRequest).onload=()=>{var n=JSON.parse(o.responseText),t=e=>n.roles.map((t,l)=>e||n.pwm.indexOf(l)<0?`<option value=\"${l}\">${t}</option>`:\"\").join(\"\"),l=t(1),a=t(0);e.innerHTML=n.pins.map((e,n)=>`<div class=\"hdiv\">${e[0]} <select class=\"hele\" name=\"${n}\">${e[4]?l:a}</select><input class=\"hele\" name=\"r${n}\" type=\"text\" value=\"${e[2]}\"/><input class=\"hele\" name=\"e${n}\" type=\"text\" value=\"${e[3]}\"/></div>`).join(\"\")+'<input type=\"submit\" value=\"Save\"/>',e.querySelectorAll(\"select\").forEach(t=>{var l=()=>{var l=n.flags[t.value];e[\"r\"+t.name].hidden=e[\"r\"+t.name].disabled=!(1&l),e[\"e\"+t.name].hidden=e[\"e\"+t.name].disabled=!(2&l)};t.value=n.pins[t.name][1],t.onchange=l,l()})},o.open(\"GET\",\"api/pinconfig\",!0),o.send())}function fmtUpTime(e){var t,n,o=Math.floor(e/86400);return e%=86400,t=Math.floor(e/3600),e%=3600,n=Math.floor(e/60),e=e%60,0<o?o+` days, ${t} hours, ${n} minutes and ${e} seconds`:0<t?t+` hours, ${n} minutes and ${e} seconds`:0<n?n+` minutes and ${e} seconds`:`just ${e} seconds`}function updateOnlineFor(){onlineForEl.textContent=fmtUpTime(++onlineFor)}function onLoad(){(onlineForEl=getElement(\"onlineFor\"))&&(onlineFor=parseInt(onlineForEl.dataset.initial,10))&&setInterval(updateOnlineFor,1e3),startEvents(),showState(),showPins()}function submitTemperature(e){var t=getElement(\"form132\");getElement(\"kelvin132\").value=Math.round(1e6/parseInt(e.value)),t.submit()}window.addEventListener(\"load\",onLoad),history.pushState(null,\"\",window.location.pathname.slice(1)),setTimeout(()=>{var e=getElement(\"changed\");e&&(e.innerHTML=\"\")},5e3);";
+const unsigned char scriptJs_gz[] = {0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x8d,0x56,0xfb,0x6f,0xdb,0x36,0x10,0xfe,0x57,0x14,0xa2,0x75,0x25,0x84,0xa0,0xed,0x24,0x0b,0x86,0xd8,0x72,0xb0,0x47,0xba,0x66,0xcb,0xa3,0x58,0x5c,0x60,0x80,0x61,0xc0,0x8c,0x74,0x8e,0xd5,0xd1,0xa4,0x4a,0x52,0x4e,0x8d,0x54,0xff,0xfb,0x8e,0x94,0x62,0x49,0x69,0x92,0xf5,0x97,0x84,0xba,0x07,0xef,0xc1,0xef,0xbe,0xf3,0x86,0xeb,0x60,0x99,0x69,0x63,0xa7,0xd9,0x1a,0xa8,0xe0,0xf5,0xc1,0x58,0x6e,0xe1,0x77,0x10,0x7c,0x4b,0x95,0x14,0x99,0x84,0xf7,0x4a,0x53,0x0d,0x5f,0x62,0x59,0x08,0x41,0x61,0x03,0xd2,0x9a,0xea,0xbc,0x53,0x9f,0x89,0x4a,0x70,0x07,0xf6,0x4c,0xc0,0x1a,0x2d,0x62,0x88,0x27,0xa9,0x4a,0x0a,0x77,0x66,0x8d,0xf8,0xd7,0xed,0x79,0x1a,0x42,0x34,0x5a,0x16,0x32,0xb1,0x99,0x92,0x81,0x59,0xa9,0xfb,0x1b,0x17,0x30,0x8c,0x1e,0x12,0x01,0x5c,0xbb,0x14,0x54,0x61,0xc3,0x5d,0x62,0x11,0xed,0xc8,0x1f,0xd3,0x8c,0xa8,0x8b,0xb8,0x17,0x63,0x62,0xbd,0x1e,0xfe,0x61,0xfc,0x56,0x69,0x1b,0x46,0x34,0xf4,0xa9,0xc2,0x7d,0xf0,0xcf,0xe5,0xc5,0x07,0x6b,0xf3,0xbf,0xe1,0x4b,0x01,0xc6,0x46,0x4c,0x49,0x0d,0x3c,0xdd,0xfa,0xf2,0x92,0x15,0x97,0x77,0x10,0x87,0x51,0x3c,0x79,0xd8,0x60,0x1b,0x60,0x74,0x14,0xbb,0xab,0x98,0x37,0xf1,0x09,0xf5,0x7a,0xe4,0xfa,0x2f,0x52,0x49,0x9d,0x4f,0x61,0xa6,0xf0,0xd5,0xf6,0x7a,0x61,0x48,0xce,0xaf,0x3e,0x7e,0x9a,0x92,0xbd,0x78,0x57,0x20,0xc7,0x62,0x36,0x50,0xd7,0xc8,0x2c,0xbf,0xbb,0xe2,0x6b,0xf8,0xf6,0x8d,0xc8,0x62,0x7d,0x0b,0xfa,0x15,0xcb,0x6d,0xee,0xe2,0x24,0x4a,0xa8,0xff,0xb1,0x8a,0x30,0x30,0xc4,0x4d,0x23,0x43,0xe2,0xeb,0x20,0x91,0x57,0xb0,0x4c,0x4a,0xd0,0x1f,0xa6,0x97,0x17,0x75,0x11,0x26,0x57,0xd2,0x80,0x4b,0xf8,0x49,0xfb,0x7e,0xac,0xad,0x71,0x5c,0x3d,0x33,0xde,0xfd,0xa8,0x88,0x0d,0xd8,0x47,0xe3,0xdd,0xa3,0xd1,0x43,0x38,0x8c,0xa2,0xa8,0x74,0xf0,0x60,0x2a,0x07,0x19,0x92,0x3f,0xce,0xa6,0x84,0x92,0x4c,0xa6,0xf0,0xf5,0xd4,0xa7,0x18,0x0f,0x09,0xdd,0x1b,0x44,0xde,0xc4,0x80,0x4c,0xc3,0xef,0x42,0xec,0x72,0x7a,0x25,0x46,0xd9,0x20,0xc6,0x72,0x6d,0xcf,0xbc,0x2f,0x62,0xa6,0x7a,0xbc,0x7b,0x8c,0xa7,0xee,0x99,0x97,0xde,0xa8,0x42,0x27,0xd8,0xd5,0x67,0x7a,0xe5,0x5a,0x55,0xc3,0x17,0xf1,0xd1,0xb2,0x0e,0x49,0x25,0x27,0x11,0xad,0x41,0xd1,0x69,0x4e,0x33,0x11,0x51,0x6b,0x3a,0x9e,0xcf,0x76,0x38,0x18,0x60,0x3f,0xaa,0xeb,0x18,0x4f,0x53,0x1f,0xe5,0x22,0x33,0x16,0xf0,0x85,0x42,0xe2,0x80,0x27,0x41,0x10,0x8a,0x9d,0x7e,0xd1,0xa8,0x4a,0xb7,0x65,0xa2,0x50,0xac,0x95,0xae,0x52,0xab,0x65,0x89,0x50,0x06,0xa7,0xa6,0x33,0x90,0xad,0x69,0x2a,0xdb,0x2d,0x43,0xf1,0xc7,0x4c,0x3e,0xf6,0x4b,0xd1,0x2e,0x92,0x72,0x54,0x91,0x68,0x04,0x0e,0xdb,0xea,0x85,0xd1,0x11,0x8a,0xa7,0xcd,0xb8,0xc8,0xf8,0xcf,0x9b,0xeb,0x2b,0x96,0x73,0x8d,0x29,0xa8,0x27,0x78,0xf3,0xb3,0x2f,0x99,0x56,0x02,0x0c,0x5b,0xf3,0x3c,0x0c,0x2d,0x15,0xe8,0x89,0x03,0x21,0x59,0x7e,0xbf,0x66,0x1e,0x1c,0xd7,0xcb,0x50,0x44,0xe3,0xc1,0xe9,0x62,0xac,0x72,0x9f,0xe4,0x86,0x8b,0x02,0x62,0xf2,0xe6,0x41,0x94,0x64,0xf2,0xe6,0xc1,0x96,0xe3,0x7e,0xa5,0x99,0x2c,0x4e,0x08,0x89,0xd8,0x67,0x95,0x21,0xbc,0xf0,0x85,0x44,0x6c,0xc3,0x61,0x44,0x39,0xfe,0x1b,0x60,0xd6,0x2d,0xec,0xe3,0xf5,0x58,0x4a,0x15,0x13,0xa8,0xc4,0x98,0x8b,0x71,0x9a,0x6d,0x82,0x04,0x41,0x6c,0x62,0xb2,0xc2,0xb3,0xbb,0x1a,0x66,0x83,0x79,0x19,0x8c,0x0d,0x08,0x48,0xec,0x4e,0x89,0x5f,0x24,0x90,0x38,0xb7,0x2e,0x07,0x59,0x56,0x86,0x47,0xf3,0x53,0x71,0xc2,0x31,0x95,0xca,0x78,0x32,0xce,0x64,0x5e,0x3c,0xeb,0xa3,0xbd,0x53,0xe0,0x66,0x35,0x26,0x16,0x1b,0x41,0x9a,0x8a,0x60,0x76,0x30,0x2f,0x49,0xff,0x15,0x6f,0x78,0xd5,0xfb,0xb0,0xf2,0xee,0x63,0xfe,0x93,0x45,0xd3,0x89,0xfd,0x77,0xf5,0x85,0x95,0x9b,0x29,0x6e,0xd7,0x59,0xe3,0x78,0xc3,0x37,0x80,0x5e,0xef,0x28,0x30,0x7c,0x45,0xbd,0xbd,0xf1,0x15,0x28,0xfd,0x8b,0x10,0x88,0x30,0xff,0x81,0x5d,0x5d,0x22,0x79,0xf3,0x64,0x15,0xda,0xfa,0x65,0x45,0xf3,0xc8,0xc8,0xe9,0x6c,0x29,0xf8,0x9d,0x99,0x59,0xe6,0xef,0x9c,0x8f,0x60,0x46,0x34,0xd9,0xb7,0xcc,0x25,0x3d,0x67,0xab,0x2c,0x4d,0x41,0xc6,0x5d,0x61,0x9a,0x19,0x7e,0x2b,0x20,0x8d,0xf7,0xc2,0x61,0x4f,0x20,0x3c,0x67,0x04,0x9e,0x73,0x81,0x67,0x5d,0x0e,0xd0,0xa5,0x1c,0xd5,0xf1,0xea,0xf7,0x9c,0xd5,0x76,0xb3,0xe1,0x9c,0x5a,0x84,0x62,0xcd,0xdd,0x82,0x0a,0x8f,0x72,0xaa,0x3a,0xcc,0xc3,0xf3,0xac,0x8f,0x5e,0x89,0x92,0xcb,0xec,0xae,0x62,0x1e,0x55,0xf3,0x4e,0x6b,0x22,0x96,0x6b,0xfb,0x29,0x77,0xc3,0x8b,0xcb,0xc8,0x17,0x6b,0xa9,0xa4,0x2a,0xbe,0xe4,0x76,0x85,0x35,0x2b,0xa5,0x43,0xe8,0xff,0x7c,0x7c,0x84,0xb3,0x3c,0xd2,0x60,0x0b,0x2d,0x03,0x78,0x1b,0x7b,0x01,0xc2,0xbb,0x63,0x75,0x78,0x8c,0x46,0x14,0xb5,0xee,0x40,0x65,0x57,0x79,0xec,0x54,0x31,0xbc,0x3d,0x1e,0xd0,0xc1,0x58,0x9d,0xaa,0xfd,0x45,0x90,0xf2,0xad,0xa1,0x81,0xc3,0x77,0xb0,0x42,0xee,0xf1,0x67,0x59,0x06,0xeb,0x4c,0x16,0x16,0x4c,0xc0,0x65,0x8a,0x02,0x28,0x03,0x03,0x58,0x42,0x6a,0x16,0x27,0x83,0xb1,0x3d,0xb5,0xe8,0xf8,0xa3,0xd6,0xf2,0x54,0xa2,0xf5,0xcb,0x16,0x8b,0xcf,0x85,0xb1,0x5d,0x59,0xd3,0x97,0x22,0x4f,0x91,0x3d,0xae,0x1f,0xf7,0x3a,0x12,0x46,0x6b,0xc7,0x33,0x07,0xcc,0xdf,0x94,0xb4,0x6e,0xbf,0x37,0x1d,0xdc,0xdf,0xdf,0xd9,0xb4,0x3a,0xac,0xe4,0x05,0x52,0x06,0x5e,0x10,0xb6,0x7f,0x25,0xb4,0x69,0x67,0x27,0xaf,0x96,0xd8,0xee,0x33,0xf6,0xb4,0x72,0x8e,0x26,0xed,0xd8,0x98,0x17,0x47,0xc2,0xc5,0x69,0xcf,0x6c,0xc6,0x05,0xf2,0xac,0xf3,0x42,0x09,0x1a,0x82,0x46,0xbc,0x84,0x4f,0x72,0xa7,0x43,0xdc,0x1b,0xb4,0xb3,0x2d,0xda,0xfc,0x48,0x1b,0x52,0x6c,0x11,0xa5,0x1f,0xa1,0x29,0xac,0x73,0xd0,0xb8,0xf1,0x75,0x03,0x8f,0x4e,0xe6,0x38,0x34,0xeb,0xe1,0xe1,0x01,0x72,0x66,0x5b,0xfa,0x2f,0x88,0x4d,0x26,0xbd,0xbc,0xc6,0xaf,0xc7,0x82,0x56,0x05,0x82,0x6f,0x08,0xc7,0xfd,0x5d,0x5d,0x50,0xe9,0x23,0xe4,0x4a,0x56,0x85,0xc4,0x24,0xea,0x1d,0xf6,0xfd,0x36,0x70,0xd4,0x4b,0x68,0xd5,0xcf,0x88,0xae,0x50,0xae,0xf4,0x96,0xe5,0x85,0x59,0x55,0xa5,0x78,0xe6,0x27,0x84,0xd6,0x17,0x08,0x95,0x70,0x57,0x0c,0xb2,0xb3,0x5d,0xb9,0xc1,0x61,0x46,0x64,0xb8,0xe2,0x86,0x18,0xae,0xb5,0xb1,0x9a,0x9f,0x3e,0x9d,0xd2,0xaa,0xe1,0x4a,0xeb,0x75,0xd0,0x26,0x57,0x24,0x9c,0x92,0xfe,0x84,0x3d,0x1d,0xfd,0x07,0x73,0x57,0x86,0x59,0x38,0x0a,0x00,0x00};
+const char scriptJs_etag[] = "cd698a29";
+//region_end scriptJs
 
 //region_start ha_discovery_script
 const char ha_discovery_script[] = "<script type='text/javascript'>function send_ha_disc(){var e=new XMLHttpRequest;e.open(\"GET\",\"/ha_discovery?prefix=\"+document.getElementById(\"ha_disc_topic\").value,!1),e.onload=function(){200===e.status?alert(e.responseText):404===e.status&&alert(\"Error invoking ha_discovery\")},e.onerror=function(){alert(\"Error invoking ha_discovery\")},e.send()}</script>";
 //region_end ha_discovery_script
+
+typedef struct http_asset_tag {
+	const char* url;
+	const char* mimeType;
+	const char* plain;
+	const unsigned char* gz;
+	int gzLen;
+	const char* etag;
+} http_asset_t;
+
+static const http_asset_t g_assets[] = {
+	{ "style.css", "text/css", styleCss, styleCss_gz, sizeof(styleCss_gz), styleCss_etag },
+	{ "script.js", "application/javascript", scriptJs, scriptJs_gz, sizeof(scriptJs_gz), scriptJs_etag },
+};
+
+// Pages link assets with their ETag in query, so they can be cached for long.
+// Gzip variant is sent if client accepts it, with its own ETag. Matching If-None-Match gets 304.
+static int http_fn_asset(http_request_t* request) {
+	const http_asset_t* a = 0;
+	const char* acceptEncoding;
+	const char* ifNoneMatch;
+	char etag[24];
+	char headers[192];
+	bool bGzip;
+	int i;
+
+	for (i = 0; i < sizeof(g_assets) / sizeof(g_assets[0]); i++) {
+		if (http_checkUrlBase(request->url, g_assets[i].url)) {
+			a = &g_assets[i];
+			break;
+		}
+	}
+	if (a == 0) {
+		return http_fn_other(request);
+	}
+	acceptEncoding = http_getHeader(request, "Accept-Encoding");
+	bGzip = acceptEncoding && strstr(acceptEncoding, "gzip");
+	snprintf(etag, sizeof(etag), "\"%s%s\"", a->etag, bGzip ? "-gz" : "");
+	ifNoneMatch = http_getHeader(request, "If-None-Match");
+	if (ifNoneMatch && (strstr(ifNoneMatch, etag) || !strcmp(ifNoneMatch, "*"))) {
+		request->responseCode = 304;
+		bGzip = false;
+	}
+	snprintf(headers, sizeof(headers), "ETag: %s\r\nCache-Control: public, max-age=31536000, immutable\r\nVary: Accept-Encoding\r\n%s",
+		etag, bGzip ? "Content-Encoding: gzip\r\n" : "");
+	if (request->responseCode == 304) {
+		http_setup_headers(request, a->mimeType, headers);
+		poststr(request, NULL);
+		return 0;
+	}
+	http_setup_headers(request, a->mimeType, headers);
+	if (bGzip) {
+		postany(request, (const char*)a->gz, a->gzLen);
+	}
+	else {
+		poststr(request, a->plain);
+	}
+	poststr(request, NULL);
+	return 0;
+}
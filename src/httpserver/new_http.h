@@ -21,8 +21,10 @@ extern const char* htmlPinRoleNames[];
 
 extern const char* g_build_str;
 
-extern const char htmlHeadStyle[];
-extern const char pageScript[];
+extern const char styleCss[];
+extern const char styleCss_etag[];
+extern const char scriptJs[];
+extern const char scriptJs_etag[];
 extern const char ha_discovery_script[];
 
 #define HTTP_RESPONSE_OK 200
@@ -31,6 +33,29 @@ extern const char ha_discovery_script[];
 
 #define MAX_QUERY 16
 #define MAX_HEADERS 16
+#define MAX_PATH_PARAMS 4
+
+// state of request body reader, see HTTP_ReadBody
+typedef struct httpBodyReader_s {
+	// request has Transfer-Encoding: chunked
+	int chunked;
+	int state;
+	// bytes left of body, or of current chunk
+	int left;
+	// size line of chunk being parsed
+	int chunkSize;
+	int chunkDigits;
+	// received but not yet delivered
+	char* pending;
+	int pendingLen;
+	// where more body is received. When there is no room left after it, streaming reader
+	// continues from buffer start, over url and headers - unless whole body is collected
+	char* recvAt;
+	// set by HTTP_GetWholeBody, which must keep url, headers and body read so far
+	int bWhole;
+	// set by HTTP_GetWholeBody when body doesn't fit in request buffer
+	int bTooLarge;
+} httpBodyReader_t;
 typedef struct http_request_tag {
 	char* received; // partial or whole received data, up to 1024
 	int receivedLen;
@@ -48,17 +73,61 @@ typedef struct http_request_tag {
 	int bodylen;
 	int contentLength;
 	int responseCode;
+	// ':name' and '*' parts of matched route, pointing into url (not terminated)
+	int numpathparams;
+	const char* pathparams[MAX_PATH_PARAMS];
+	int pathparamlens[MAX_PATH_PARAMS];
 
 	// used to respond
 	char* reply;
 	int replylen;
 	int replymaxlen;
 	int fd;
+
+	// set by server if connection may be kept open after this request,
+	// cleared if client asked to close, body was not fully received, or reply can't get Content-Length
+	int keepAlive;
+	// offset of Connection/Content-Length headers written by http_setup, 0 if not in reply buffer
+	int keepAliveHeaderAt;
+	// offset of reply body, after headers
+	int bodyAt;
+	// set when part of kept-alive reply had to be sent before its length was known,
+	// body then goes out with chunked transfer encoding
+	int chunked;
+	// offset of space reserved for size line of chunk being filled
+	int chunkAt;
+	// set by handler that keeps the socket (event stream), server must not close it
+	int fdTakenOver;
+	httpBodyReader_t bodyReader;
 } http_request_t;
 
 
 int HTTP_ProcessPacket(http_request_t* request);
+// call after HTTP_ProcessPacket. If reply is still whole in buffer, fills its Content-Length
+// and returns 1 - then request->replylen bytes of reply are left to send and connection stays open.
+// If reply was sent in chunks, closes last one and also returns 1.
+// Otherwise returns 0 and connection must be closed after sending.
+int HTTP_FinishKeepAlive(http_request_t* request);
+// keep-alive settings, see http_keepAlive command
+extern int g_http_keepAliveIdleTime;
+extern int g_http_keepAliveMaxRequests;
 void http_setup(http_request_t* request, const char* type);
+// extraHeaders are lines ending with \r\n, or NULL
+void http_setup_headers(http_request_t* request, const char* type, const char* extraHeaders);
+// returns value of request header, or NULL
+const char* http_getHeader(http_request_t* request, const char* name);
+// Conditional reply of REST state endpoints, state revision (see STATE_GetRevision) is the ETag.
+// If client already has current state - If-None-Match with its ETag, or since=<revision> equal to it -
+// sends 304 and returns 1. Otherwise writes ETag header lines into headers, for http_setup_headers, and returns 0.
+int HTTP_CheckStateRevision(http_request_t* request, char* headers, int maxSize);
+// Reads request body in pieces, in constant memory - Content-Length and chunked bodies are handled.
+// First piece is what came with headers, rest is received into request buffer after headers.
+// Sets *data to piece in request buffer, valid until next call.
+// Returns its length, 0 at end of body, or -1 if connection was closed or timed out, or body is malformed.
+int HTTP_ReadBody(http_request_t* request, char** data);
+// Reads whole body into request buffer after headers, for small bodies like JSON.
+// Returns it terminated with zero, or NULL if it can't be read, or doesn't fit - then bodyReader.bTooLarge is set.
+char* HTTP_GetWholeBody(http_request_t* request);
 void http_html_start(http_request_t* request, const char* pagename);
 void http_html_end(http_request_t* request);
 int poststr(http_request_t* request, const char* str);
@@ -69,9 +138,18 @@ void misc_formatUpTimeString(int totalSeconds, char* o);
 // void HTTP_AddHeader(http_request_t *request);
 int http_getArg(const char* base, const char* name, char* o, int maxSize);
 int http_getArgInteger(const char* base, const char* name);
+// copies path parameter of matched route, in order of appearance; returns 0 if there is no such
+int http_getPathParam(http_request_t* request, int index, char* o, int maxSize);
 
-// poststr with format - for results LESS THAN 128
+// poststr with format, formatted directly into reply buffer - result is limited by buffer size
 int hprintf255(http_request_t* request, const char* fmt, ...);
+#ifdef WINDOWS
+// parts of reply sent by faked request (fd 0) before it was complete, for selftests
+const char* SIM_GetHTTPSentOutput(int* len, int* sends);
+void SIM_ClearHTTPSentOutput();
+// rest of body of faked request (fd 0), received at most maxRecv bytes at a time. Data is not copied.
+void SIM_SetHTTPBodyInput(const char* data, int len, int maxRecv);
+#endif
 
 typedef enum {
 	HTTP_ANY = -1,
@@ -83,9 +161,16 @@ typedef enum {
 
 // callback function for http
 typedef int (*http_callback_fn)(http_request_t* request);
-// url MUST start with '/'
-// urls must be unique (i.e. you can't have /about and /aboutme or /about/me)
+// Route MUST start with '/' and is not copied, so it must be a string literal.
+// Path is matched without query string. Whole segments can be parameters:
+// ':name' matches one segment, '*' at end matches rest of path, e.g. "/api/lfs/*".
+// Exact routes win over ones with parameters, and longer fixed part wins.
+// Route registered again for same method replaces previous one.
+// HTTP_ANY route is used when there is none for request's method.
 int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback);
+// for diagnostics, returns 0 past last route
+const char* HTTP_GetRoute(int index, int* method);
+extern const char* methodNames[];
 
 #endif
 
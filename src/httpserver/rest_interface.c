@@ -8,6 +8,7 @@
 #include "../ota/ota.h"
 #include "../hal/hal_wifi.h"
 #include "../hal/hal_flashVars.h"
+#include "../hal/hal_pins.h"
 #ifdef ENABLE_LITTLEFS
 #include "../littlefs/our_lfs.h"
 #endif
@@ -65,6 +66,7 @@ extern UINT32 flash_read(char* user_buf, UINT32 count, UINT32 address);
 
 
 static int http_rest_error(http_request_t* request, int code, char* msg);
+static int http_rest_body_error(http_request_t* request);
 
 static int http_rest_get(http_request_t* request);
 static int http_rest_post(http_request_t* request);
@@ -72,6 +74,7 @@ static int http_rest_app(http_request_t* request);
 
 static int http_rest_post_pins(http_request_t* request);
 static int http_rest_get_pins(http_request_t* request);
+static int http_rest_get_pinconfig(http_request_t* request);
 
 static int http_rest_get_seriallog(http_request_t* request);
 
@@ -82,6 +85,7 @@ static int http_rest_get_logconfig(http_request_t* request);
 static int http_rest_get_lfs_delete(http_request_t* request);
 static int http_rest_get_lfs_file(http_request_t* request);
 static int http_rest_post_lfs_file(http_request_t* request);
+static int http_rest_get_logtail(http_request_t* request);
 #endif
 
 static int http_rest_post_reboot(http_request_t* request);
@@ -101,11 +105,44 @@ static int http_rest_get_channels(http_request_t* request);
 static int http_rest_get_flash_vars_test(http_request_t* request);
 
 static int http_rest_post_cmd(http_request_t* request);
+static int http_rest_post_ota(http_request_t* request);
+static int http_rest_get_routes(http_request_t* request);
+#ifdef ENABLE_LITTLEFS
+static int http_rest_get_fsblock(http_request_t* request);
+static int http_rest_post_fsblock(http_request_t* request);
+#endif
 
 
 void init_rest() {
-	HTTP_RegisterCallback("/api/", HTTP_GET, http_rest_get);
-	HTTP_RegisterCallback("/api/", HTTP_POST, http_rest_post);
+	HTTP_RegisterCallback("/api/channels", HTTP_GET, http_rest_get_channels);
+	HTTP_RegisterCallback("/api/channels", HTTP_POST, http_rest_post_channels);
+	HTTP_RegisterCallback("/api/pins", HTTP_GET, http_rest_get_pins);
+	HTTP_RegisterCallback("/api/pins", HTTP_POST, http_rest_post_pins);
+	HTTP_RegisterCallback("/api/pinconfig", HTTP_GET, http_rest_get_pinconfig);
+	HTTP_RegisterCallback("/api/logconfig", HTTP_GET, http_rest_get_logconfig);
+	HTTP_RegisterCallback("/api/logconfig", HTTP_POST, http_rest_post_logconfig);
+	HTTP_RegisterCallback("/api/seriallog", HTTP_GET, http_rest_get_seriallog);
+	HTTP_RegisterCallback("/api/info", HTTP_GET, http_rest_get_info);
+	HTTP_RegisterCallback("/api/flash/*", HTTP_GET, http_rest_get_flash_advanced);
+	HTTP_RegisterCallback("/api/flash/*", HTTP_POST, http_rest_post_flash_advanced);
+	HTTP_RegisterCallback("/api/dumpconfig", HTTP_GET, http_rest_get_dumpconfig);
+	HTTP_RegisterCallback("/api/testconfig", HTTP_GET, http_rest_get_testconfig);
+	HTTP_RegisterCallback("/api/testflashvars", HTTP_GET, http_rest_get_flash_vars_test);
+	HTTP_RegisterCallback("/api/reboot", HTTP_POST, http_rest_post_reboot);
+	HTTP_RegisterCallback("/api/ota", HTTP_POST, http_rest_post_ota);
+	HTTP_RegisterCallback("/api/cmnd", HTTP_POST, http_rest_post_cmd);
+	HTTP_RegisterCallback("/api/routes", HTTP_GET, http_rest_get_routes);
+#ifdef ENABLE_LITTLEFS
+	HTTP_RegisterCallback("/api/fsblock", HTTP_GET, http_rest_get_fsblock);
+	HTTP_RegisterCallback("/api/fsblock", HTTP_POST, http_rest_post_fsblock);
+	HTTP_RegisterCallback("/api/lfs/*", HTTP_GET, http_rest_get_lfs_file);
+	HTTP_RegisterCallback("/api/lfs/*", HTTP_POST, http_rest_post_lfs_file);
+	HTTP_RegisterCallback("/api/del/*", HTTP_GET, http_rest_get_lfs_delete);
+	HTTP_RegisterCallback("/api/logtail", HTTP_GET, http_rest_get_logtail);
+#endif
+	// anything else under /api/ just shows the request
+	HTTP_RegisterCallback("/api/*", HTTP_GET, http_rest_get);
+	HTTP_RegisterCallback("/api/*", HTTP_POST, http_rest_post);
 	HTTP_RegisterCallback("/app", HTTP_GET, http_rest_app);
 }
 
@@ -128,73 +165,29 @@ bool tryGetTokenString(const char* json, jsmntok_t* tok, char* outBuffer) {
 	return true;
 }
 
-static int http_rest_get(http_request_t* request) {
-	ADDLOG_DEBUG(LOG_FEATURE_API, "GET of %s", request->url);
-
-	if (!strcmp(request->url, "api/channels")) {
-		return http_rest_get_channels(request);
-	}
-
-	if (!strcmp(request->url, "api/pins")) {
-		return http_rest_get_pins(request);
-	}
-	if (!strcmp(request->url, "api/logconfig")) {
-		return http_rest_get_logconfig(request);
-	}
-
-	if (!strncmp(request->url, "api/seriallog", 13)) {
-		return http_rest_get_seriallog(request);
-	}
-
-#ifdef ENABLE_LITTLEFS
-	if (!strcmp(request->url, "api/fsblock")) {
-		uint32_t newsize = CFG_GetLFS_Size();
-		uint32_t newstart = (LFS_BLOCKS_END - newsize);
-
-		newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
-
-		// double check again that we're within bounds - don't want
-		// boot overwrite or anything nasty....
-		if (newstart < LFS_BLOCKS_START_MIN) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-		if ((newstart + newsize > LFS_BLOCKS_END) ||
-			(newstart + newsize < LFS_BLOCKS_START_MIN)) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-
-		return http_rest_get_flash(request, newstart, newsize);
-	}
-#endif
-
 #ifdef ENABLE_LITTLEFS
-	if (!strncmp(request->url, "api/lfs/", 8)) {
-		return http_rest_get_lfs_file(request);
-	}
-	if (!strncmp(request->url, "api/del/", 8)) {
-		return http_rest_get_lfs_delete(request);
-	}
-#endif
+static int http_rest_get_fsblock(http_request_t* request) {
+	uint32_t newsize = CFG_GetLFS_Size();
+	uint32_t newstart = (LFS_BLOCKS_END - newsize);
 
-	if (!strcmp(request->url, "api/info")) {
-		return http_rest_get_info(request);
-	}
+	newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
 
-	if (!strncmp(request->url, "api/flash/", 10)) {
-		return http_rest_get_flash_advanced(request);
+	// double check again that we're within bounds - don't want
+	// boot overwrite or anything nasty....
+	if (newstart < LFS_BLOCKS_START_MIN) {
+		return http_rest_error(request, -20, "LFS Size mismatch");
 	}
-
-	if (!strcmp(request->url, "api/dumpconfig")) {
-		return http_rest_get_dumpconfig(request);
+	if ((newstart + newsize > LFS_BLOCKS_END) ||
+		(newstart + newsize < LFS_BLOCKS_START_MIN)) {
+		return http_rest_error(request, -20, "LFS Size mismatch");
 	}
 
-	if (!strcmp(request->url, "api/testconfig")) {
-		return http_rest_get_testconfig(request);
-	}
+	return http_rest_get_flash(request, newstart, newsize);
+}
+#endif
 
-	if (!strncmp(request->url, "api/testflashvars", 17)) {
-		return http_rest_get_flash_vars_test(request);
-	}
+static int http_rest_get(http_request_t* request) {
+	ADDLOG_DEBUG(LOG_FEATURE_API, "GET of %s", request->url);
 
 	http_setup(request, httpMimeTypeHTML);
 	http_html_start(request, "GET REST API");
@@ -205,77 +198,71 @@ static int http_rest_get(http_request_t* request) {
 	return 0;
 }
 
-static int http_rest_post(http_request_t* request) {
-	char tmp[20];
-	ADDLOG_DEBUG(LOG_FEATURE_API, "POST to %s", request->url);
-
-	if (!strcmp(request->url, "api/channels")) {
-		return http_rest_post_channels(request);
-	}
-
-	if (!strcmp(request->url, "api/pins")) {
-		return http_rest_post_pins(request);
-	}
-	if (!strcmp(request->url, "api/logconfig")) {
-		return http_rest_post_logconfig(request);
-	}
-
-	if (!strcmp(request->url, "api/reboot")) {
-		return http_rest_post_reboot(request);
-	}
-	if (!strcmp(request->url, "api/ota")) {
+static int http_rest_post_ota(http_request_t* request) {
 #if PLATFORM_BK7231T
-		return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
+	return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
 #elif PLATFORM_BK7231N
-		return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
+	return http_rest_post_flash(request, START_ADR_OF_BK_PARTITION_OTA, LFS_BLOCKS_END);
 #elif PLATFORM_W600
-		return http_rest_post_flash(request, -1, -1);
+	return http_rest_post_flash(request, -1, -1);
 #elif PLATFORM_BL602
-		return http_rest_post_flash(request, -1, -1);
+	return http_rest_post_flash(request, -1, -1);
 #else
-		// TODO
+	// TODO
+	return http_rest_post(request);
 #endif
-	}
-	if (!strncmp(request->url, "api/flash/", 10)) {
-		return http_rest_post_flash_advanced(request);
-	}
+}
 
-	if (!strcmp(request->url, "api/cmnd")) {
-		return http_rest_post_cmd(request);
+#ifdef ENABLE_LITTLEFS
+static int http_rest_post_fsblock(http_request_t* request) {
+	if (lfs_present()) {
+		release_lfs();
 	}
+	uint32_t newsize = CFG_GetLFS_Size();
+	uint32_t newstart = (LFS_BLOCKS_END - newsize);
 
+	newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
 
-#ifdef ENABLE_LITTLEFS
-	if (!strcmp(request->url, "api/fsblock")) {
-		if (lfs_present()) {
-			release_lfs();
-		}
-		uint32_t newsize = CFG_GetLFS_Size();
-		uint32_t newstart = (LFS_BLOCKS_END - newsize);
+	// double check again that we're within bounds - don't want
+	// boot overwrite or anything nasty....
+	if (newstart < LFS_BLOCKS_START_MIN) {
+		return http_rest_error(request, -20, "LFS Size mismatch");
+	}
+	if ((newstart + newsize > LFS_BLOCKS_END) ||
+		(newstart + newsize < LFS_BLOCKS_START_MIN)) {
+		return http_rest_error(request, -20, "LFS Size mismatch");
+	}
 
-		newsize = (newsize / LFS_BLOCK_SIZE) * LFS_BLOCK_SIZE;
+	// we are writing the lfs block
+	int res = http_rest_post_flash(request, newstart, LFS_BLOCKS_END);
+	// initialise the filesystem, it should be there now.
+	// don't create if it does not mount
+	init_lfs(0);
+	return res;
+}
+#endif
 
-		// double check again that we're within bounds - don't want
-		// boot overwrite or anything nasty....
-		if (newstart < LFS_BLOCKS_START_MIN) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
-		if ((newstart + newsize > LFS_BLOCKS_END) ||
-			(newstart + newsize < LFS_BLOCKS_START_MIN)) {
-			return http_rest_error(request, -20, "LFS Size mismatch");
-		}
+// lists registered HTTP routes
+static int http_rest_get_routes(http_request_t* request) {
+	const char* url;
+	int method;
+	int i;
 
-		// we are writing the lfs block
-		int res = http_rest_post_flash(request, newstart, LFS_BLOCKS_END);
-		// initialise the filesystem, it should be there now.
-		// don't create if it does not mount
-		init_lfs(0);
-		return res;
-	}
-	if (!strncmp(request->url, "api/lfs/", 8)) {
-		return http_rest_post_lfs_file(request);
+	http_setup(request, httpMimeTypeJson);
+	poststr(request, "[");
+	for (i = 0; (url = HTTP_GetRoute(i, &method)) != 0; i++) {
+		hprintf255(request, "%s{\"url\":\"%s\",\"method\":\"%s\"}", i ? "," : "", url,
+			method == HTTP_ANY ? "ANY" : methodNames[method]);
 	}
-#endif
+	poststr(request, "]");
+	poststr(request, NULL);
+	return 0;
+}
+
+static int http_rest_post(http_request_t* request) {
+	char tmp[20];
+	char* body = HTTP_GetWholeBody(request);
+	ADDLOG_DEBUG(LOG_FEATURE_API, "POST to %s", request->url);
 
 	http_setup(request, httpMimeTypeHTML);
 	http_html_start(request, "POST REST API");
@@ -285,7 +272,9 @@ static int http_rest_post(http_request_t* request) {
 	sprintf(tmp, "%d", request->contentLength);
 	poststr(request, tmp);
 	poststr(request, "<br/>Content:[");
-	poststr(request, request->bodystart);
+	if (body) {
+		poststr(request, body);
+	}
 	poststr(request, "]<br/>");
 	http_html_end(request);
 	poststr(request, NULL);
@@ -538,24 +527,10 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 	lfsres = lfs_file_open(&lfs, file, fpath, LFS_O_RDWR | LFS_O_CREAT);
 	if (lfsres >= 0) {
 		//ADDLOG_DEBUG(LOG_FEATURE_API, "opened %s");
-		int towrite = request->bodylen;
-		char* writebuf = request->bodystart;
-		int writelen = request->bodylen;
-		if (request->contentLength >= 0) {
-			towrite = request->contentLength;
-		}
-		//ADDLOG_DEBUG(LOG_FEATURE_API, "bodylen %d, contentlen %d", request->bodylen, request->contentLength);
-
-		if (writelen < 0) {
-			ADDLOG_DEBUG(LOG_FEATURE_API, "ABORTED: %d bytes to write", writelen);
-			lfs_file_close(&lfs, file);
-			request->responseCode = HTTP_RESPONSE_SERVER_ERROR;
-			http_setup(request, httpMimeTypeJson);
-			hprintf255(request, "{\"fname\":\"%s\",\"error\":%d}", fpath, -20);
-			goto exit;
-		}
+		char* writebuf;
+		int writelen;
 
-		do {
+		while ((writelen = HTTP_ReadBody(request, &writebuf)) > 0) {
 			//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes to write", writelen);
 			len = lfs_file_write(&lfs, file, writebuf, writelen);
 			if (len < 0) {
@@ -563,18 +538,15 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 				break;
 			}
 			total += len;
-			if (len > 0) {
-				//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes written", len);
-			}
-			towrite -= len;
-			if (towrite > 0) {
-				writebuf = request->received;
-				writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-				if (writelen < 0) {
-					ADDLOG_DEBUG(LOG_FEATURE_API, "recv returned %d - end of data - remaining %d", writelen, towrite);
-				}
-			}
-		} while ((towrite > 0) && (writelen >= 0));
+		}
+		if (writelen < 0) {
+			ADDLOG_DEBUG(LOG_FEATURE_API, "ABORTED: body not received, %d bytes written", total);
+			lfs_file_close(&lfs, file);
+			request->responseCode = HTTP_RESPONSE_SERVER_ERROR;
+			http_setup(request, httpMimeTypeJson);
+			hprintf255(request, "{\"fname\":\"%s\",\"error\":%d}", fpath, -20);
+			goto exit;
+		}
 
 		// no more data
 		lfs_file_truncate(&lfs, file, total);
@@ -668,7 +640,43 @@ static int http_rest_get_pins(http_request_t* request) {
 	return 0;
 }
 
+// Everything cfg_pins page needs to render its form in browser:
+// {"roles":[names],"flags":[per role, 1 - uses channel, 2 - uses channel 2],"pwm":[roles only for PWM pins],
+//  "pins":[[name,role,channel,channel2,canBePWM],...]}
+static int http_rest_get_pinconfig(http_request_t* request) {
+	const char* alias;
+	int i;
 
+	http_setup(request, httpMimeTypeJson);
+	poststr(request, "{\"roles\":[");
+	for (i = 0; i < IOR_Total_Options; i++) {
+		hprintf255(request, i ? ",\"%s\"" : "\"%s\"", htmlPinRoleNames[i]);
+	}
+	poststr(request, "],\"flags\":[");
+	for (i = 0; i < IOR_Total_Options; i++) {
+		hprintf255(request, i ? ",%i" : "%i", PIN_RoleUsesChannel(i) | (PIN_RoleUsesChannel2(i) << 1));
+	}
+	hprintf255(request, "],\"pwm\":[%i,%i],\"pins\":[", IOR_PWM, IOR_PWM_n);
+	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
+		poststr(request, i ? ",[\"" : "[\"");
+		alias = HAL_PIN_GetPinNameAlias(i);
+		if (alias) {
+#if defined(PLATFORM_BEKEN) || defined(WINDOWS)
+			hprintf255(request, "P%i (%s)", i, alias);
+#else
+			poststr(request, alias);
+#endif
+		}
+		else {
+			hprintf255(request, "P%i", i);
+		}
+		hprintf255(request, "\",%i,%i,%i,%i]", PIN_GetPinRoleForPinIndex(i), PIN_GetPinChannelForPinIndex(i),
+			PIN_GetPinChannel2ForPinIndex(i), HAL_PIN_CanThisPinBePWM(i));
+	}
+	poststr(request, "]}");
+	poststr(request, NULL);
+	return 0;
+}
 
 ////////////////////////////
 // log config
@@ -711,8 +719,15 @@ static int http_rest_post_logconfig(http_request_t* request) {
 	//jsmntok_t t[128]; /* We expect no more than 128 tokens */
 #define TOKEN_COUNT 128
 	jsmntok_t* t = os_malloc(sizeof(jsmntok_t) * TOKEN_COUNT);
-	char* json_str = request->bodystart;
-	int json_len = strlen(json_str);
+	char* json_str = HTTP_GetWholeBody(request);
+	int json_len;
+
+	if (json_str == 0) {
+		os_free(p);
+		os_free(t);
+		return http_rest_body_error(request);
+	}
+	json_len = strlen(json_str);
 
 	http_setup(request, httpMimeTypeText);
 	memset(p, 0, sizeof(jsmn_parser));
@@ -775,9 +790,25 @@ static int http_rest_post_logconfig(http_request_t* request) {
 /////////////////////////////////////////////////
 
 
+#ifdef ENABLE_LITTLEFS
+// log tail saved by logPersist before last reboot, api/logtail?current=1 for this session
+static int http_rest_get_logtail(http_request_t* request) {
+	http_setup(request, httpMimeTypeText);
+	LOG_PersistTail_Post(request, http_getArgInteger(request->url, "current"));
+	poststr(request, NULL);
+	return 0;
+}
+#endif
+
+// ETag covers configuration only, uptime_s is fresh only in full reply
 static int http_rest_get_info(http_request_t* request) {
 	char macstr[3 * 6 + 1];
-	http_setup(request, httpMimeTypeJson);
+	char headers[64];
+
+	if (HTTP_CheckStateRevision(request, headers, sizeof(headers))) {
+		return 0;
+	}
+	http_setup_headers(request, httpMimeTypeJson, headers);
 	hprintf255(request, "{\"uptime_s\":%d,", Time_getUpTimeSeconds());
 	hprintf255(request, "\"build\":\"%s\",", g_build_str);
 	hprintf255(request, "\"ip\":\"%s\",", HAL_GetMyIPString());
@@ -812,8 +843,15 @@ static int http_rest_post_pins(http_request_t* request) {
 	//jsmntok_t t[128]; /* We expect no more than 128 tokens */
 #define TOKEN_COUNT 128
 	jsmntok_t* t = os_malloc(sizeof(jsmntok_t) * TOKEN_COUNT);
-	char* json_str = request->bodystart;
-	int json_len = strlen(json_str);
+	char* json_str = HTTP_GetWholeBody(request);
+	int json_len;
+
+	if (json_str == 0) {
+		os_free(p);
+		os_free(t);
+		return http_rest_body_error(request);
+	}
+	json_len = strlen(json_str);
 
 	memset(p, 0, sizeof(jsmn_parser));
 	memset(t, 0, sizeof(jsmntok_t) * TOKEN_COUNT);
@@ -933,6 +971,14 @@ static int http_rest_error(http_request_t* request, int code, char* msg) {
 	return 0;
 }
 
+// after HTTP_GetWholeBody failed
+static int http_rest_body_error(http_request_t* request) {
+	if (request->bodyReader.bTooLarge) {
+		return http_rest_error(request, 413, "Body too large");
+	}
+	return http_rest_error(request, 400, "Body not received");
+}
+
 #if PLATFORM_BL602
 
 typedef struct ota_header {
@@ -1011,9 +1057,9 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 
 	int total = 0;
-	int towrite = request->bodylen;
-	char* writebuf = request->bodystart;
-	int writelen = request->bodylen;
+	char* writebuf;
+	// first piece is what came with headers
+	int writelen = HTTP_ReadBody(request, &writebuf);
 
 	ADDLOG_DEBUG(LOG_FEATURE_OTA, "OTA post len %d", request->contentLength);
 
@@ -1033,10 +1079,6 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 	char* Buffer = (char*)os_malloc(2048 + 3);
 	memset(Buffer, 0, 2048 + 3);
 
-	if (request->contentLength >= 0) {
-		towrite = request->contentLength;
-	}
-
 	int recvLen = 0;
 	int totalLen = 0;
 	//printf("\ntowrite %d writelen=%d\n", towrite, writelen);
@@ -1103,19 +1145,14 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 				recvLen += writelen;
 				printf("Downloaded %d / %d\n", recvLen, totalLen);
 			}
-
-			towrite -= writelen;
 		}
 
-		if (towrite > 0) {
-			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				sprintf(error_message, "recv returned %d - end of data - remaining %d", writelen, towrite);
-				nRetCode = -17;
-			}
+		writelen = HTTP_ReadBody(request, &writebuf);
+		if (writelen < 0) {
+			sprintf(error_message, "body not received - %d bytes done", recvLen);
+			nRetCode = -17;
 		}
-	} while ((nRetCode == 0) && (towrite > 0) && (writelen >= 0));
+	} while ((nRetCode == 0) && (writelen > 0));
 
 	tls_mem_free(Buffer);
 
@@ -1183,10 +1220,6 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 	bl_mtd_erase_all(handle);
 	printf("Done\r\n");
 
-	if (request->contentLength >= 0) {
-		towrite = request->contentLength;
-	}
-
 	// get header
 	// recv_buffer	
 	//buffer_offset = 0;
@@ -1260,17 +1293,12 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 		total += writelen;
 		startaddr += writelen;
-		towrite -= writelen;
-
 
-		if (towrite > 0) {
-			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				ADDLOG_DEBUG(LOG_FEATURE_OTA, "recv returned %d - end of data - remaining %d", writelen, towrite);
-			}
+		writelen = HTTP_ReadBody(request, &writebuf);
+		if (writelen < 0) {
+			ADDLOG_DEBUG(LOG_FEATURE_OTA, "body not received - %d bytes done", total);
 		}
-	} while ((towrite > 0) && (writelen >= 0));
+	} while (writelen > 0);
 
 	if (ota_header == 0) {
 		return http_rest_error(request, -20, "No header found");
@@ -1301,10 +1329,6 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 	init_ota(startaddr);
 
-	if (request->contentLength >= 0) {
-		towrite = request->contentLength;
-	}
-
 	if (writelen < 0 || (startaddr + writelen > maxaddr)) {
 		ADDLOG_DEBUG(LOG_FEATURE_OTA, "ABORTED: %d bytes to write", writelen);
 		return http_rest_error(request, -20, "writelen < 0 or end > 0x200000");
@@ -1315,15 +1339,11 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 		add_otadata((unsigned char*)writebuf, writelen);
 		total += writelen;
 		startaddr += writelen;
-		towrite -= writelen;
-		if (towrite > 0) {
-			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				ADDLOG_DEBUG(LOG_FEATURE_OTA, "recv returned %d - end of data - remaining %d", writelen, towrite);
-			}
+		writelen = HTTP_ReadBody(request, &writebuf);
+		if (writelen < 0) {
+			ADDLOG_DEBUG(LOG_FEATURE_OTA, "body not received - %d bytes done", total);
 		}
-	} while ((towrite > 0) && (writelen >= 0));
+	} while (writelen > 0);
 	close_ota();
 #endif
 
@@ -1478,6 +1498,10 @@ static int http_rest_get_flash_vars_test(http_request_t* request) {
 static int http_rest_get_channels(http_request_t* request) {
 	int i;
 	int addcomma = 0;
+	int bSince;
+	unsigned int since;
+	char headers[64];
+	char tmp[16];
 	/*typedef struct pinsState_s {
 		byte roles[32];
 		byte channels[32];
@@ -1485,7 +1509,13 @@ static int http_rest_get_channels(http_request_t* request) {
 
 	extern pinsState_t g_pins;
 	*/
-	http_setup(request, httpMimeTypeJson);
+	if (HTTP_CheckStateRevision(request, headers, sizeof(headers))) {
+		return 0;
+	}
+	// since=<ETag of earlier reply> gives only channels changed after it
+	bSince = http_getArg(request->url, "since", tmp, sizeof(tmp));
+	since = bSince ? strtoul(tmp, 0, 10) : 0;
+	http_setup_headers(request, httpMimeTypeJson, headers);
 	poststr(request, "{");
 
 	// TODO: maybe we should cull futher channels that are not used?
@@ -1495,7 +1525,7 @@ static int http_rest_get_channels(http_request_t* request) {
 		// Get channel index and role
 		int ch = PIN_GetPinChannelForPinIndex(i);
 		int role = PIN_GetPinRoleForPinIndex(i);
-		if (role) {
+		if (role && (bSince == 0 || CHANNEL_ChangedSince(ch, since))) {
 			if (addcomma) {
 				hprintf255(request, ",");
 			}
@@ -1520,8 +1550,15 @@ static int http_rest_post_channels(http_request_t* request) {
 	//jsmntok_t t[128]; /* We expect no more than 128 tokens */
 #define TOKEN_COUNT 128
 	jsmntok_t* t = os_malloc(sizeof(jsmntok_t) * TOKEN_COUNT);
-	char* json_str = request->bodystart;
-	int json_len = strlen(json_str);
+	char* json_str = HTTP_GetWholeBody(request);
+	int json_len;
+
+	if (json_str == 0) {
+		os_free(p);
+		os_free(t);
+		return http_rest_body_error(request);
+	}
+	json_len = strlen(json_str);
 
 	memset(p, 0, sizeof(jsmn_parser));
 	memset(t, 0, sizeof(jsmntok_t) * 128);
@@ -1563,7 +1600,11 @@ static int http_rest_post_channels(http_request_t* request) {
 
 
 static int http_rest_post_cmd(http_request_t* request) {
-	char* cmd = request->bodystart;
+	char* cmd = HTTP_GetWholeBody(request);
+
+	if (cmd == 0) {
+		return http_rest_body_error(request);
+	}
 	CMD_ExecuteCommand(cmd, COMMAND_FLAG_SOURCE_CONSOLE);
 	return http_rest_error(request, 200, "OK");
 }
@@ -2,13 +2,15 @@
 
 var firstTime,
 	lastTime,
-	req = null;
+	stateDelay,
+	req = null,
+	events = null;
 var onlineFor;
 var onlineForEl = null;
 
 var getElement = (id) => document.getElementById(id);
 
-// refresh status section every 3 seconds
+// refresh status section, every 3 seconds unless device pushes changes
 function showState() {
 	clearTimeout(firstTime);
 	clearTimeout(lastTime);
@@ -32,12 +34,77 @@ function showState() {
 			}
 			clearTimeout(firstTime);
 			clearTimeout(lastTime);
-			lastTime = setTimeout(showState, 3e3);
+			if (events == null) {
+				lastTime = setTimeout(showState, 3e3);
+			}
 		}
 	};
 	req.open("GET", "index?state=1", true);
 	req.send();
-	firstTime = setTimeout(showState, 3e3);
+	if (events == null) {
+		firstTime = setTimeout(showState, 3e3);
+	}
+}
+
+// refresh status section only when device says something changed, burst gives one refresh
+function startEvents() {
+	if (!window.EventSource || !getElement("state")) {
+		return;
+	}
+	events = new EventSource("events");
+	var refresh = () => {
+		clearTimeout(stateDelay);
+		stateDelay = setTimeout(showState, 100);
+	};
+	events.addEventListener("channel", refresh);
+	events.addEventListener("state", refresh);
+	// device is busy or gone, back to polling
+	events.onerror = () => {
+		events.close();
+		events = null;
+		showState();
+	};
+}
+
+// cfg_pins form, rendered from api/pinconfig instead of by device
+function showPins() {
+	var form = getElement("pins");
+	if (!form) {
+		return;
+	}
+	var pinReq = new XMLHttpRequest();
+	pinReq.onload = () => {
+		var cfg = JSON.parse(pinReq.responseText);
+		var options = (bPWM) =>
+			cfg.roles
+				.map((name, role) => (bPWM || cfg.pwm.indexOf(role) < 0 ? `<option value="${role}">${name}</option>` : ""))
+				.join("");
+		var all = options(1),
+			noPWM = options(0);
+		// pin is [name, role, channel, channel2, canBePWM]
+		form.innerHTML =
+			cfg.pins
+				.map(
+					(pin, i) =>
+						`<div class="hdiv">${pin[0]} <select class="hele" name="${i}">${pin[4] ? all : noPWM}</select>` +
+						`<input class="hele" name="r${i}" type="text" value="${pin[2]}"/>` +
+						`<input class="hele" name="e${i}" type="text" value="${pin[3]}"/></div>`
+				)
+				.join("") + '<input type="submit" value="Save"/>';
+		// channel fields are shown, and sent, only for roles that use them
+		form.querySelectorAll("select").forEach((sel) => {
+			var showChannels = () => {
+				var flags = cfg.flags[sel.value];
+				form["r" + sel.name].hidden = form["r" + sel.name].disabled = !(flags & 1);
+				form["e" + sel.name].hidden = form["e" + sel.name].disabled = !(flags & 2);
+			};
+			sel.value = cfg.pins[sel.name][1];
+			sel.onchange = showChannels;
+			showChannels();
+		});
+	};
+	pinReq.open("GET", "api/pinconfig", true);
+	pinReq.send();
 }
 
 function fmtUpTime(totalSeconds) {
@@ -75,7 +142,9 @@ function onLoad() {
 		}
 	}
 
+	startEvents();
 	showState();
+	showPins();
 }
 
 function submitTemperature(slider) {
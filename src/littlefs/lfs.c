@@ -73,7 +73,7 @@ static int lfs_bd_read(lfs_t *lfs,
             diff = lfs_min(diff, rcache->off-off);
         }
 
-        if ((size >= hint) && (off) % (lfs->cfg->read_size == 0) &&
+        if ((size >= hint) && (off % lfs->cfg->read_size == 0) &&
                 (size >= lfs->cfg->read_size)) 
         {
             // bypass cache?
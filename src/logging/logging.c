@@ -7,6 +7,11 @@
 #include "../logging/logging.h"
 // Commands register, execution API and cmd tokenizer
 #include "../cmnds/cmd_public.h"
+#ifdef ENABLE_LITTLEFS
+#include "../littlefs/our_lfs.h"
+#include "../hal/hal_flashVars.h"
+#include "../hal/hal_generic.h"
+#endif
 
 extern uint8_t g_StartupDelayOver;
 
@@ -121,6 +126,13 @@ static struct tag_logMemory {
 	int tailserial;
 	int tailtcp;
 	int tailhttp;
+	// other readers, see LOG_Subscribe
+	int subTails[LOG_MAX_SUBSCRIBERS];
+	// bytes overwritten before subscriber read them, -1 if not used
+	int subLost[LOG_MAX_SUBSCRIBERS];
+	int numSubs;
+	// total bytes ever written, used to know if ring has wrapped
+	unsigned int written;
 	SemaphoreHandle_t mutex;
 } logMemory;
 
@@ -141,8 +153,15 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 
 static void initLog(void)
 {
+	int i;
+
 	bk_printf("Entering initLog()...\r\n");
 	logMemory.head = logMemory.tailserial = logMemory.tailtcp = logMemory.tailhttp = 0;
+	for (i = 0; i < LOG_MAX_SUBSCRIBERS; i++) {
+		logMemory.subLost[i] = -1;
+	}
+	logMemory.numSubs = 0;
+	logMemory.written = 0;
 	logMemory.mutex = xSemaphoreCreateMutex();
 	initialised = 1;
 	startSerialLog();
@@ -337,6 +356,7 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	{
 		logMemory.log[logMemory.head] = tmp[i];
 		logMemory.head = (logMemory.head + 1) % LOGSIZE;
+		logMemory.written++;
 		if (logMemory.tailserial == logMemory.head)
 		{
 			logMemory.tailserial = (logMemory.tailserial + 1) % LOGSIZE;
@@ -349,6 +369,18 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 		{
 			logMemory.tailhttp = (logMemory.tailhttp + 1) % LOGSIZE;
 		}
+		if (logMemory.numSubs)
+		{
+			int s;
+			for (s = 0; s < LOG_MAX_SUBSCRIBERS; s++)
+			{
+				if (logMemory.subLost[s] >= 0 && logMemory.subTails[s] == logMemory.head)
+				{
+					logMemory.subTails[s] = (logMemory.subTails[s] + 1) % LOGSIZE;
+					logMemory.subLost[s]++;
+				}
+			}
+		}
 	}
 
 	if (taken == pdTRUE) {
@@ -466,6 +498,65 @@ static int getHttp(char* buff, int buffsize) {
 	return len;
 }
 
+int LOG_Subscribe() {
+	BaseType_t taken;
+	int id = -1;
+	int i;
+
+	if (!initialised)
+		initLog();
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	for (i = 0; i < LOG_MAX_SUBSCRIBERS; i++) {
+		if (logMemory.subLost[i] < 0) {
+			logMemory.subTails[i] = logMemory.head;
+			logMemory.subLost[i] = 0;
+			logMemory.numSubs++;
+			id = i;
+			break;
+		}
+	}
+	if (taken == pdTRUE) {
+		xSemaphoreGive(logMemory.mutex);
+	}
+	return id;
+}
+
+void LOG_Unsubscribe(int id) {
+	BaseType_t taken;
+
+	if (id < 0 || id >= LOG_MAX_SUBSCRIBERS || !initialised)
+		return;
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	if (logMemory.subLost[id] >= 0) {
+		logMemory.subLost[id] = -1;
+		logMemory.numSubs--;
+	}
+	if (taken == pdTRUE) {
+		xSemaphoreGive(logMemory.mutex);
+	}
+}
+
+int LOG_GetSubscriberData(int id, char* buff, int buffsize) {
+	if (id < 0 || id >= LOG_MAX_SUBSCRIBERS || logMemory.subLost[id] < 0)
+		return 0;
+	return getData(buff, buffsize, &logMemory.subTails[id]);
+}
+
+int LOG_TakeSubscriberLost(int id) {
+	BaseType_t taken;
+	int lost;
+
+	if (id < 0 || id >= LOG_MAX_SUBSCRIBERS || logMemory.subLost[id] < 0)
+		return 0;
+	taken = xSemaphoreTake(logMemory.mutex, 100);
+	lost = logMemory.subLost[id];
+	logMemory.subLost[id] = 0;
+	if (taken == pdTRUE) {
+		xSemaphoreGive(logMemory.mutex);
+	}
+	return lost;
+}
+
 void startLogServer() {
 #if WINDOWS
 
@@ -659,6 +750,349 @@ static void log_serial_thread(beken_thread_arg_t arg)
 #endif
 
 
+#ifdef ENABLE_LITTLEFS
+
+// Persistent log tail.
+// The RAM log is lost on watchdog reset, so optionally we keep the last
+// LOG_PERSIST_TAIL_SIZE bytes of it in LFS. Writes are lazy (only every
+// logPersist seconds and only if something new was logged).
+// LFS commits a file atomically on close, so a reset in the middle of a save
+// leaves the previous copy; the CRC catches anything else.
+// On the first save after boot, the tail from the previous session
+// is rotated to LOG_PERSIST_PREV_FILE, so it is not overwritten later.
+// The interval itself is kept in LOG_PERSIST_CFG_FILE, so saving goes on
+// after a reboot without anything in autoexec.
+#define LOG_PERSIST_TAIL_SIZE	1024
+// bumped when the header changes, old files are then ignored
+#define LOG_PERSIST_MAGIC		0x4C544B50
+#define LOG_PERSIST_FILE		"logtail.bin"
+#define LOG_PERSIST_PREV_FILE	"logtail_prev.bin"
+#define LOG_PERSIST_CFG_FILE	"logtail.cfg"
+
+typedef struct logTailHeader_s {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t uptime;
+	uint16_t bootCount;
+	uint16_t len;
+	// HAL_GetResetReason of the session that saved the tail
+	uint8_t resetReason;
+	uint8_t reserved[3];
+	uint32_t crc;
+} logTailHeader_t;
+
+static int log_persist_interval = 0;
+static int log_persist_counter = 0;
+static unsigned int log_persist_lastWritten = 0;
+// set after the previous session tail was rotated away
+static int log_persist_sessionStarted = 0;
+static uint32_t log_persist_seq = 0;
+
+static const char *LOG_ResetReasonName(int reason) {
+	switch (reason) {
+	case RESET_REASON_POWERON:
+		return "power on";
+	case RESET_REASON_SOFTWARE:
+		return "software";
+	case RESET_REASON_WATCHDOG:
+		return "watchdog";
+	case RESET_REASON_DEEPSLEEP:
+		return "deep sleep wake";
+	case RESET_REASON_CRASH:
+		return "crash";
+	}
+	return "unknown";
+}
+
+static uint32_t LOG_PersistTail_CRC(logTailHeader_t *hdr, const char *data) {
+	uint32_t crc;
+	uint32_t saved = hdr->crc;
+
+	hdr->crc = 0;
+	crc = lfs_crc(0xffffffff, hdr, sizeof(*hdr));
+	crc = lfs_crc(crc, data, hdr->len);
+	hdr->crc = saved;
+	return crc;
+}
+
+// reads and validates a tail file, data must have LOG_PERSIST_TAIL_SIZE bytes.
+// returns 1 if valid
+static int LOG_PersistTail_ReadFile(const char *fname, logTailHeader_t *hdr, char *data) {
+	lfs_file_t f;
+	int ok = 0;
+
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, fname, LFS_O_RDONLY) < 0) {
+		return 0;
+	}
+	if (lfs_file_read(&lfs, &f, hdr, sizeof(*hdr)) == sizeof(*hdr)
+		&& hdr->magic == LOG_PERSIST_MAGIC && hdr->len <= LOG_PERSIST_TAIL_SIZE) {
+		if (lfs_file_read(&lfs, &f, data, hdr->len) == hdr->len) {
+			ok = (LOG_PersistTail_CRC(hdr, data) == hdr->crc);
+		}
+	}
+	lfs_file_close(&lfs, &f);
+	return ok;
+}
+
+static void LOG_PersistTail_StartSession() {
+	logTailHeader_t hdr;
+	lfs_file_t f;
+
+	log_persist_seq = 0;
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, LOG_PERSIST_FILE, LFS_O_RDONLY) >= 0) {
+		if (lfs_file_read(&lfs, &f, &hdr, sizeof(hdr)) == sizeof(hdr)
+			&& hdr.magic == LOG_PERSIST_MAGIC) {
+			log_persist_seq = hdr.seq + 1;
+		}
+		lfs_file_close(&lfs, &f);
+		// rename replaces tail from the session before
+		lfs_rename(&lfs, LOG_PERSIST_FILE, LOG_PERSIST_PREV_FILE);
+	}
+	log_persist_sessionStarted = 1;
+}
+
+// copies up to maxLen newest bytes of RAM log into out, returns count,
+// or -1 if log is busy (nothing copied, caller may retry later)
+static int LOG_CopyNewest(char *out, int maxLen) {
+	int len;
+	int start;
+	int firstPart;
+
+	if (xSemaphoreTake(logMemory.mutex, 100) != pdTRUE) {
+		return -1;
+	}
+	len = maxLen;
+	if (logMemory.written < LOGSIZE && len > logMemory.head) {
+		len = logMemory.head;
+	}
+	start = (logMemory.head - len + LOGSIZE) % LOGSIZE;
+	firstPart = LOGSIZE - start;
+	if (firstPart >= len) {
+		memcpy(out, logMemory.log + start, len);
+	}
+	else {
+		memcpy(out, logMemory.log + start, firstPart);
+		memcpy(out + firstPart, logMemory.log, len - firstPart);
+	}
+	log_persist_lastWritten = logMemory.written;
+	xSemaphoreGive(logMemory.mutex);
+	return len;
+}
+
+static void LOG_PersistTail_Save() {
+	logTailHeader_t hdr;
+	lfs_file_t f;
+	char *data;
+	int len;
+
+	if (!lfs_present()) {
+		return;
+	}
+	if (!log_persist_sessionStarted) {
+		LOG_PersistTail_StartSession();
+	}
+	data = (char*)os_malloc(LOG_PERSIST_TAIL_SIZE);
+	if (data == 0) {
+		return;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	len = LOG_CopyNewest(data, LOG_PERSIST_TAIL_SIZE);
+	if (len < 0) {
+		// log busy, keep old tail, next interval will try again
+		os_free(data);
+		return;
+	}
+	hdr.len = len;
+	hdr.magic = LOG_PERSIST_MAGIC;
+	hdr.seq = log_persist_seq++;
+	hdr.uptime = Time_getUpTimeSeconds();
+	hdr.bootCount = HAL_FlashVars_GetBootCount();
+	hdr.resetReason = HAL_GetResetReason();
+	hdr.crc = LOG_PersistTail_CRC(&hdr, data);
+
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, LOG_PERSIST_FILE, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) >= 0) {
+		lfs_file_write(&lfs, &f, &hdr, sizeof(hdr));
+		lfs_file_write(&lfs, &f, data, hdr.len);
+		lfs_file_close(&lfs, &f);
+	}
+	os_free(data);
+}
+
+void LOG_PersistTail_OnEverySecond() {
+	if (log_persist_interval <= 0 || !initialised) {
+		return;
+	}
+	log_persist_counter++;
+	if (log_persist_counter < log_persist_interval) {
+		return;
+	}
+	log_persist_counter = 0;
+	if (logMemory.written == log_persist_lastWritten) {
+		return;
+	}
+	LOG_PersistTail_Save();
+}
+
+// loads saved tail into a newly allocated buffer, caller must free it.
+// previous session is either in LOG_PERSIST_PREV_FILE (if we already started
+// saving in this session) or still in LOG_PERSIST_FILE.
+static char *LOG_PersistTail_Load(int bCurrent, logTailHeader_t *hdr) {
+	char *data;
+	const char *fname;
+
+	if (!lfs_present()) {
+		return 0;
+	}
+	// nothing saved yet in this session
+	if (bCurrent && !log_persist_sessionStarted) {
+		return 0;
+	}
+	if (bCurrent || log_persist_sessionStarted == 0) {
+		fname = LOG_PERSIST_FILE;
+	}
+	else {
+		fname = LOG_PERSIST_PREV_FILE;
+	}
+	data = (char*)os_malloc(LOG_PERSIST_TAIL_SIZE + 1);
+	if (data == 0) {
+		return 0;
+	}
+	if (!LOG_PersistTail_ReadFile(fname, hdr, data)) {
+		os_free(data);
+		return 0;
+	}
+	data[hdr->len] = 0;
+	return data;
+}
+
+int LOG_PersistTail_Post(http_request_t* request, int bCurrent) {
+	logTailHeader_t hdr;
+	char *data;
+
+	hprintf255(request, "boot count %i, boot failures %i, reset reason %s, uptime %i\n",
+		HAL_FlashVars_GetBootCount(), Main_GetLastRebootBootFailures(),
+		LOG_ResetReasonName(HAL_GetResetReason()), Time_getUpTimeSeconds());
+	data = LOG_PersistTail_Load(bCurrent, &hdr);
+	if (data == 0) {
+		poststr(request, "no saved log tail\n");
+		return 0;
+	}
+	hprintf255(request, "saved at boot %i (reset reason %s), uptime %i, seq %i, %i bytes\n",
+		hdr.bootCount, LOG_ResetReasonName(hdr.resetReason), hdr.uptime, hdr.seq, hdr.len);
+	poststr(request, "----\n");
+	postany(request, data, hdr.len);
+	os_free(data);
+	return hdr.len;
+}
+
+// interval is stored as a plain int, 0 removes the file
+static void LOG_PersistTail_SaveInterval() {
+	lfs_file_t f;
+	int32_t interval = log_persist_interval;
+
+	if (!lfs_present()) {
+		return;
+	}
+	if (interval <= 0) {
+		lfs_remove(&lfs, LOG_PERSIST_CFG_FILE);
+		return;
+	}
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, LOG_PERSIST_CFG_FILE, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) >= 0) {
+		lfs_file_write(&lfs, &f, &interval, sizeof(interval));
+		lfs_file_close(&lfs, &f);
+	}
+}
+
+static void LOG_PersistTail_LoadInterval() {
+	lfs_file_t f;
+	int32_t interval;
+
+	if (!lfs_present()) {
+		return;
+	}
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, LOG_PERSIST_CFG_FILE, LFS_O_RDONLY) < 0) {
+		return;
+	}
+	if (lfs_file_read(&lfs, &f, &interval, sizeof(interval)) == sizeof(interval) && interval > 0) {
+		log_persist_interval = interval;
+	}
+	lfs_file_close(&lfs, &f);
+}
+
+static commandResult_t log_persist_command(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	logTailHeader_t hdr;
+	char *data;
+	char *p, *end;
+
+	if (!stricmp(cmd, "logPersist")) {
+		if (args && *args) {
+			log_persist_interval = atoi(args);
+			log_persist_counter = 0;
+			LOG_PersistTail_SaveInterval();
+		}
+		ADDLOG_INFO(LOG_FEATURE_CMD, "logPersist interval %i", log_persist_interval);
+		return CMD_RES_OK;
+	}
+	// logTail
+	data = LOG_PersistTail_Load(args && !stricmp(args, "current"), &hdr);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "boot count %i, boot failures %i, reset reason %s",
+		HAL_FlashVars_GetBootCount(), Main_GetLastRebootBootFailures(),
+		LOG_ResetReasonName(HAL_GetResetReason()));
+	if (data == 0) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "no saved log tail");
+		return CMD_RES_OK;
+	}
+	ADDLOG_INFO(LOG_FEATURE_CMD, "saved at boot %i (reset reason %s), uptime %i, seq %i, %i bytes",
+		hdr.bootCount, LOG_ResetReasonName(hdr.resetReason), hdr.uptime, hdr.seq, hdr.len);
+	// print line by line, so each one fits in log buffer
+	p = data;
+	while (*p) {
+		end = strchr(p, '\n');
+		if (end == 0) {
+			end = p + strlen(p);
+		}
+		if (end - p > 200) {
+			end = p + 200;
+		}
+		if (end - p > 1 || (end > p && *p != '\r')) {
+			addLogAdv(LOG_INFO, LOG_FEATURE_RAW, "%.*s", (int)(end - p), p);
+		}
+		p = end;
+		if (*p == '\n') {
+			p++;
+		}
+	}
+	os_free(data);
+	return CMD_RES_OK;
+}
+
+// called at boot, after LFS was mounted
+void LOG_PersistTail_Init() {
+	log_persist_interval = 0;
+	log_persist_counter = 0;
+	log_persist_lastWritten = 0;
+	log_persist_sessionStarted = 0;
+	LOG_PersistTail_LoadInterval();
+
+	//cmddetail:{"name":"logPersist","args":"[IntervalSeconds]",
+	//cmddetail:"descr":"Periodically saves the last part of the log to LFS, so it survives a crash or watchdog reset. Only written if something was logged since last save. The interval is kept in LFS, so it stays active after reboot. 0 disables (default).",
+	//cmddetail:"fn":"log_persist_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":"logPersist 30"}
+	CMD_RegisterCommand("logPersist", log_persist_command, NULL);
+	//cmddetail:{"name":"logTail","args":"[current]",
+	//cmddetail:"descr":"Prints the log tail saved by logPersist before the last reboot, together with boot count, boot failures and reset reason. With 'current', prints the tail saved during this session.",
+	//cmddetail:"fn":"log_persist_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("logTail", log_persist_command, NULL);
+}
+
+#endif
+
 static int http_getlograw(http_request_t* request) {
 	int len = 0;
 	http_setup(request, httpMimeTypeHTML);
@@ -17,6 +17,22 @@
 void addLogAdv(int level, int feature, const char *fmt, ...);
 void LOG_SetRawSocketCallback(int newFD);
 
+// Readers of log memory with own tail, like event stream and WebSocket console.
+// Subscriber gets what is logged after LOG_Subscribe. Returns id, or -1 if all are taken.
+#define LOG_MAX_SUBSCRIBERS 4
+int LOG_Subscribe();
+void LOG_Unsubscribe(int id);
+int LOG_GetSubscriberData(int id, char* buff, int buffsize);
+// returns number of bytes overwritten before subscriber read them, since last call
+int LOG_TakeSubscriberLost(int id);
+
+struct http_request_tag;
+// persistent log tail (LFS only), see logPersist command
+void LOG_PersistTail_Init();
+void LOG_PersistTail_OnEverySecond();
+// posts saved log tail of previous (or current) session, returns tail length
+int LOG_PersistTail_Post(struct http_request_tag* request, int bCurrent);
+
 #define ADDLOG_ERROR(x, fmt, ...) addLogAdv(LOG_ERROR, x, fmt, ##__VA_ARGS__)
 #define ADDLOG_WARN(x, fmt, ...)  addLogAdv(LOG_WARN, x, fmt, ##__VA_ARGS__)
 #define ADDLOG_INFO(x, fmt, ...)  addLogAdv(LOG_INFO, x, fmt, ##__VA_ARGS__)
@@ -1,5 +1,8 @@
 
 #include "new_mqtt.h"
+#include "new_mqtt_trie.h"
+#include "new_mqtt5.h"
+#include "new_mqtt_pacer.h"
 #include "../new_common.h"
 #include "../new_pins.h"
 #include "../new_cfg.h"
@@ -11,6 +14,7 @@
 #include "../driver/drv_ntp.h"
 #include "../driver/drv_tuyaMCU.h"
 #include "../ota/ota.h"
+#include "../httpserver/hass.h"
 
 #ifndef LWIP_MQTT_EXAMPLE_IPADDR_INIT
 #if LWIP_IPV4
@@ -22,9 +26,10 @@
 
 #ifdef PLATFORM_BEKEN
 #include <tcpip.h>
-// from hal_main_bk7231.c
-// triggers a one-shot timer to cause read.
-extern void MQTT_TriggerRead();
+#endif
+#if !WINDOWS && !PLATFORM_XR809
+// for output ring buffer fill level
+#include "lwip/apps/mqtt_priv.h"
 #endif
 
 
@@ -45,69 +50,41 @@ static int g_secondsBeforeNextFullBroadcast = 30;
 // constant value, how much interval between self state broadcast (enabled by flag)
 // You can change it with command: mqtt_broadcastInterval 60
 static int g_intervalBetweenMQTTBroadcasts = 60;
-// While doing self state broadcast, it limits the number of publishes 
-// per second in order not to overload LWIP
-static int g_maxBroadcastItemsPublishedPerSecond = 1;
-
-/////////////////////////////////////////////////////////////
-// mqtt receive buffer, so we can action in our threads, not
-// in tcp_thread
-//
-#define MQTT_RX_BUFFER_MAX 4096
-unsigned char mqtt_rx_buffer[MQTT_RX_BUFFER_MAX];
-int mqtt_rx_buffer_head;
-int mqtt_rx_buffer_tail;
-int mqtt_rx_buffer_count;
-unsigned char temp_topic[128];
-unsigned char temp_data[2048];
-
-int addLenData(int len, const unsigned char *data){
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len >> 8) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	for (int i = 0; i < len; i++){
-		mqtt_rx_buffer[mqtt_rx_buffer_head] = data[i];
-		mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count++;
-	}
-	return len + 2;
-}
-
-int getLenData(int *len, unsigned char *data, int maxlen){
-	int l;
-	l = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-	l = l<<8;
-	l |= mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-
-	for (int i = 0; i < l; i++){
-		if (i < maxlen){
-			data[i] = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-		}
-		mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count--;
-	}
-	if (mqtt_rx_buffer_count < 0){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer underflow!!!");
-		mqtt_rx_buffer_count = 0;
-		mqtt_rx_buffer_tail = mqtt_rx_buffer_head = 0;
-	}
-
-	if (l > maxlen){
-		*len = maxlen;
-	} else {
-		*len = l;
-	}
-	return l + 2;
-}
+// While doing self state broadcast, the number of publishes per second
+// is limited by MQTT_Pacer in order not to overload LWIP
+// Aggregated channel state: instead of a publish per channel, all channels
+// go in one JSON message every g_aggregateInterval seconds.
+// You can change it with command: mqtt_aggregate [Mode] [IntervalSeconds]
+#define MQTT_AGGREGATE_OFF		0
+// all published channels, every interval
+#define MQTT_AGGREGATE_FULL		1
+// only channels changed since last message, skipped if nothing has changed
+#define MQTT_AGGREGATE_DELTA	2
+#define MQTT_AGGREGATE_JSON_SIZE	(CHANNEL_MAX * 24 + 8)
+static int g_aggregateMode = MQTT_AGGREGATE_OFF;
+static int g_aggregateInterval = 10;
+static int g_aggregateCountdown = 0;
+// set when full state broadcast is requested, so next message has all channels
+static int g_aggregateForceFull = 0;
+// channels changed since last message, set from any thread, guarded by g_aggregateMutex
+static unsigned int g_aggregateDirty[(CHANNEL_MAX + 31) / 32];
+static SemaphoreHandle_t g_aggregateMutex = 0;
+static char* g_aggregateJSON = 0;
+
+// protocol level asked by user, MQTT 5 is used only if lwIP port supports it (LWIP_MQTT_V5),
+// which is only simulator for now
+static int g_mqttProtocolVersion = MQTT311_PROTOCOL_LEVEL;
+// set when broker refused MQTT 5, cleared when version is set again
+static int g_mqttV5Fallback = 0;
+// message expiry (seconds) for not retained publishes, MQTT 5 only
+static int g_mqttTelemetryExpiry = 0;
 
 static SemaphoreHandle_t g_mutex = 0;
+// times the mutex was busy and we had to wait for it, and times we gave up
+static int mqtt_lock_waits = 0;
+static int mqtt_lock_fails = 0;
+// heap allocations done while publishing, should stay at 0 in normal operation
+static int mqtt_publish_allocs = 0;
 
 static bool MQTT_Mutex_Take(int del) {
 	int taken;
@@ -116,10 +93,16 @@ static bool MQTT_Mutex_Take(int del) {
 	{
 		g_mutex = xSemaphoreCreateMutex();
 	}
+	taken = xSemaphoreTake(g_mutex, 0);
+	if (taken == pdTRUE) {
+		return true;
+	}
+	mqtt_lock_waits++;
 	taken = xSemaphoreTake(g_mutex, del);
 	if (taken == pdTRUE) {
 		return true;
 	}
+	mqtt_lock_fails++;
 	return false;
 }
 
@@ -128,6 +111,209 @@ static void MQTT_Mutex_Free()
 	xSemaphoreGive(g_mutex);
 }
 
+// callbacks list and trie, and publish policy trie, have their own lock, because callbacks may be
+// registered again while g_mutex is held (see MQTT_InitCallbacks), and policies are read from
+// lwIP connection callback, which doesn't hold g_mutex.
+// It is only held for short list and trie work, never while callbacks run, so it is waited for.
+static SemaphoreHandle_t g_callbacksMutex = 0;
+
+static bool MQTT_Callbacks_Lock() {
+	if (g_callbacksMutex == 0)
+	{
+		g_callbacksMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_callbacksMutex, portMAX_DELAY) == pdTRUE;
+}
+
+// only gives what MQTT_Callbacks_Lock has taken
+static void MQTT_Callbacks_Unlock(bool bTaken) {
+	if (bTaken) {
+		xSemaphoreGive(g_callbacksMutex);
+	}
+}
+
+void MQTT_GetPublishPathStats(int* allocs, int* lockWaits, int* lockFails) {
+	*allocs = mqtt_publish_allocs;
+	*lockWaits = mqtt_lock_waits;
+	*lockFails = mqtt_lock_fails;
+}
+
+/////////////////////////////////////////////////////////////
+// mqtt receive ring, so we can action in our threads, not
+// in tcp_thread.
+// Each message is kept as a single record: header, topic, NUL, payload, NUL.
+// A record is written with two memcpys (topic and payload) and callbacks
+// get pointers straight into the ring, so payload is never copied again
+// and its size is only limited by the ring size.
+// If a record does not fit before the end of the ring, the rest of the ring
+// is skipped and the record is placed at the start.
+//
+#define MQTT_RX_BUFFER_DEFAULT 4096
+#define MQTT_RX_BUFFER_MIN 512
+
+#define MQTT_RX_REC_WRITING 0
+#define MQTT_RX_REC_READY 1
+#define MQTT_RX_REC_WRAP 2
+#define MQTT_RX_REC_DROPPED 3
+
+typedef struct mqttRxRecord_s {
+	unsigned short topicLen;
+	unsigned short state;
+	unsigned int dataLen;
+	// MQTT_GetTimeMS() when the record was reserved by tcp_thread
+	unsigned int rxTime;
+	// followed by topic, NUL, data, NUL
+} mqttRxRecord_t;
+
+#define MQTT_RX_RECORD_SIZE(topicLen, dataLen) ((sizeof(mqttRxRecord_t) + (topicLen) + 1 + (dataLen) + 1 + 3) & ~3)
+#define MQTT_RX_RECORD_TOPIC(r) ((char*)((r) + 1))
+#define MQTT_RX_RECORD_DATA(r) ((unsigned char*)((r) + 1) + (r)->topicLen + 1)
+
+static unsigned char* mqtt_rx_buffer = 0;
+static int mqtt_rx_buffer_size = MQTT_RX_BUFFER_DEFAULT;
+// write position, read position and bytes in use (including skipped end of ring)
+static int mqtt_rx_head;
+static int mqtt_rx_tail;
+static int mqtt_rx_used;
+// record reserved by mqtt_incoming_publish_cb and filled by mqtt_incoming_data_cb,
+// only accessed from tcp_thread
+static mqttRxRecord_t* mqtt_rx_pending = 0;
+static unsigned int mqtt_rx_pendingFill;
+// set when message could not be reserved because mutex was busy, its data is skipped (tcp_thread only)
+static int mqtt_rx_skipData = 0;
+// record whose callbacks are done, but which could not be released yet because mutex was busy
+static mqttRxRecord_t* mqtt_rx_unreleased = 0;
+// max bytes in use seen so far
+static int mqtt_rx_highWater;
+// messages dropped because ring was full at the time
+static int mqtt_rx_overflows;
+// messages dropped because they would never fit, memory was low, or they were not completed
+static int mqtt_rx_drops;
+// time from receipt in tcp_thread to dispatch to callbacks, in ms
+static unsigned int mqtt_rx_latencyLast;
+static unsigned int mqtt_rx_latencyMax;
+static unsigned int mqtt_rx_latencyTotal;
+static unsigned int mqtt_rx_latencyCount;
+
+unsigned int MQTT_GetTimeMS() {
+#if defined(PLATFORM_BEKEN) || defined(WINDOWS)
+	return rtos_get_time();
+#elif PLATFORM_XR809
+	return OS_TicksToMSecs(OS_GetTicks());
+#else
+	return xTaskGetTickCount() * portTICK_PERIOD_MS;
+#endif
+}
+
+// mutex must be taken. Returns record to fill, or NULL if there is no space.
+static mqttRxRecord_t* MQTT_RxRing_Reserve(int topicLen, unsigned int dataLen) {
+	mqttRxRecord_t* r;
+	int need;
+	int endSpace;
+
+	if (mqtt_rx_buffer == 0) {
+		mqtt_rx_buffer = (unsigned char*)os_malloc(mqtt_rx_buffer_size);
+		if (mqtt_rx_buffer == 0) {
+			mqtt_rx_drops++;
+			return 0;
+		}
+		mqtt_rx_head = mqtt_rx_tail = mqtt_rx_used = 0;
+	}
+	if (topicLen > 0xffff || dataLen > (unsigned int)mqtt_rx_buffer_size
+		|| MQTT_RX_RECORD_SIZE(topicLen, dataLen) > mqtt_rx_buffer_size) {
+		mqtt_rx_drops++;
+		return 0;
+	}
+	need = MQTT_RX_RECORD_SIZE(topicLen, dataLen);
+	if (mqtt_rx_used == 0) {
+		// empty, so start from the beginning, this gives the most space
+		mqtt_rx_head = mqtt_rx_tail = 0;
+	}
+	if (mqtt_rx_head > mqtt_rx_tail || mqtt_rx_used == 0) {
+		endSpace = mqtt_rx_buffer_size - mqtt_rx_head;
+		if (need > endSpace) {
+			if (need > mqtt_rx_tail) {
+				mqtt_rx_overflows++;
+				return 0;
+			}
+			// reader skips to start when it finds this, or when there is no room for a header
+			if (endSpace >= sizeof(mqttRxRecord_t)) {
+				((mqttRxRecord_t*)(mqtt_rx_buffer + mqtt_rx_head))->state = MQTT_RX_REC_WRAP;
+			}
+			mqtt_rx_used += endSpace;
+			mqtt_rx_head = 0;
+		}
+	}
+	else if (need > mqtt_rx_tail - mqtt_rx_head) {
+		mqtt_rx_overflows++;
+		return 0;
+	}
+	r = (mqttRxRecord_t*)(mqtt_rx_buffer + mqtt_rx_head);
+	r->topicLen = topicLen;
+	r->dataLen = dataLen;
+	r->rxTime = MQTT_GetTimeMS();
+	r->state = MQTT_RX_REC_WRITING;
+	mqtt_rx_head += need;
+	if (mqtt_rx_head == mqtt_rx_buffer_size) {
+		mqtt_rx_head = 0;
+	}
+	mqtt_rx_used += need;
+	if (mqtt_rx_used > mqtt_rx_highWater) {
+		mqtt_rx_highWater = mqtt_rx_used;
+	}
+	return r;
+}
+
+// mutex must be taken
+static void MQTT_RxRing_Release(mqttRxRecord_t* r) {
+	int size = MQTT_RX_RECORD_SIZE(r->topicLen, r->dataLen);
+
+	mqtt_rx_tail += size;
+	if (mqtt_rx_tail == mqtt_rx_buffer_size) {
+		mqtt_rx_tail = 0;
+	}
+	mqtt_rx_used -= size;
+}
+
+// mutex must be taken. Returns oldest complete record, it stays in ring until released.
+static mqttRxRecord_t* MQTT_RxRing_Peek() {
+	mqttRxRecord_t* r;
+
+	while (mqtt_rx_used > 0) {
+		r = (mqttRxRecord_t*)(mqtt_rx_buffer + mqtt_rx_tail);
+		if (mqtt_rx_buffer_size - mqtt_rx_tail < sizeof(mqttRxRecord_t) || r->state == MQTT_RX_REC_WRAP) {
+			mqtt_rx_used -= mqtt_rx_buffer_size - mqtt_rx_tail;
+			mqtt_rx_tail = 0;
+		}
+		else if (r->state == MQTT_RX_REC_DROPPED) {
+			MQTT_RxRing_Release(r);
+		}
+		else if (r->state == MQTT_RX_REC_READY) {
+			return r;
+		}
+		else {
+			// still being written by tcp_thread
+			break;
+		}
+	}
+	return 0;
+}
+
+void MQTT_GetRxBufferStats(int* size, int* used, int* highWater, int* overflows, int* drops) {
+	*size = mqtt_rx_buffer_size;
+	*used = mqtt_rx_used;
+	*highWater = mqtt_rx_highWater;
+	*overflows = mqtt_rx_overflows;
+	*drops = mqtt_rx_drops;
+}
+
+void MQTT_GetRxLatencyStats(int* last, int* avg, int* max, int* count) {
+	*last = mqtt_rx_latencyLast;
+	*avg = mqtt_rx_latencyCount ? mqtt_rx_latencyTotal / mqtt_rx_latencyCount : 0;
+	*max = mqtt_rx_latencyMax;
+	*count = mqtt_rx_latencyCount;
+}
+
 // this is called from tcp_thread context to queue received mqtt,
 // and then we'll retrieve them from our own thread for processing.
 //
@@ -135,47 +321,55 @@ static void MQTT_Mutex_Free()
 // system can use it to spoof MQTT packets to check if MQTT commands
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen){
-	MQTT_Mutex_Take(100);
-	if ((MQTT_RX_BUFFER_MAX - 1 - mqtt_rx_buffer_count) < topiclen + datalen + 2 + 2){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
-	} else {
-		addLenData(topiclen, (unsigned char *)topic);
-		addLenData(datalen, data);
+	mqttRxRecord_t* r;
+
+	if (MQTT_Mutex_Take(100) == 0) {
+		// counted in mqtt_lock_fails
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx mutex busy, dropped topic %.*s", topiclen, topic);
+		return 0;
+	}
+	r = MQTT_RxRing_Reserve(topiclen, datalen);
+	if (r) {
+		memcpy(MQTT_RX_RECORD_TOPIC(r), topic, topiclen);
+		MQTT_RX_RECORD_TOPIC(r)[topiclen] = 0;
+		memcpy(MQTT_RX_RECORD_DATA(r), data, datalen);
+		MQTT_RX_RECORD_DATA(r)[datalen] = 0;
+		r->state = MQTT_RX_REC_READY;
 	}
 	MQTT_Mutex_Free();
+	if (r == 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %.*s", topiclen, topic);
+	}
 
-
-#ifdef PLATFORM_BEKEN
 	MQTT_TriggerRead();
-#endif
 	return 1;
 }
 int MQTT_Post_Received_Str(const char *topic, const char *data) {
 	return MQTT_Post_Received(topic, strlen(topic), (const unsigned char*)data, strlen(data));
 }
-int get_received(char **topic, int *topiclen, unsigned char **data, int *datalen){
-	int res = 0;
-	MQTT_Mutex_Take(100);
-	if (mqtt_rx_buffer_tail != mqtt_rx_buffer_head){
-		getLenData(topiclen, temp_topic, sizeof(temp_topic)-1);
-		temp_topic[*topiclen] = 0;
-		getLenData(datalen, temp_data, sizeof(temp_data)-1);
-		temp_data[*datalen] = 0;
-		*topic = (char *)temp_topic;
-		*data = temp_data;
-		res = 1;
-	}
-	MQTT_Mutex_Free();
-	return res;
-}
 //
 //////////////////////////////////////////////////////////////////////
 
-#define MQTT_QUEUE_ITEM_IS_REUSABLE(x)  (x->topic[0] == 0)
-#define MQTT_QUEUE_ITEM_SET_REUSABLE(x) (x->topic[0] = 0)
-
-MqttPublishItem_t* g_MqttPublishQueueHead = NULL;
 int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published. This is not the queue length.
+// fixed publish queue, see MQTT_QueuePublishWithCommand
+#define MQTT_QUEUE_HASH_SIZE 8
+static MqttPublishItem_t* g_queuePool = 0;
+static short g_queueFree = -1;
+static short g_queueHeads[MQTT_QUEUE_PRIORITIES];
+static short g_queueTails[MQTT_QUEUE_PRIORITIES];
+static short g_queueHash[MQTT_QUEUE_HASH_SIZE];
+// last queued item, for MQTT_InvokeCommandAtEnd
+static short g_queueLast = -1;
+// item taken by MQTT_QueuePublishReserve, not on any list
+static short g_queueReserved = -1;
+// head item published by PublishQueuedItems without queue lock
+static short g_queuePublishing = -1;
+// queue is changed from any thread that publishes, and by MQTT thread taking items off it
+static SemaphoreHandle_t g_queueMutex = 0;
+static int g_queueCoalesce = 1;
+static int g_queueCoalesced = 0;
+static int g_queueDropped = 0;
+static int MQTT_Queue_Init();
 OBK_Publish_Result PublishQueuedItems();
 OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags);
 
@@ -202,13 +396,15 @@ typedef struct mqtt_callback_tag {
 	char* subscriptionTopic;
 	int ID;
 	mqtt_callback_fn callback;
+	struct mqtt_callback_tag* next;
 } mqtt_callback_t;
 
-#define MAX_MQTT_CALLBACKS 32
-static mqtt_callback_t* callbacks[MAX_MQTT_CALLBACKS];
-static int numCallbacks = 0;
+// all callbacks in registration order, there is no fixed limit
+static mqtt_callback_t* g_callbacks = 0;
+// topic filters of callbacks, used to find callbacks for incoming topic
+// in time proportional to topic depth, not to callbacks count
+static mqttTrieNode_t* g_callbacksTrie = 0;
 // note: only one incomming can be processed at a time.
-static obk_mqtt_request_t g_mqtt_request;
 static obk_mqtt_request_t g_mqtt_request_cb;
 
 #define LOOPS_WITH_DISCONNECTED 15
@@ -225,6 +421,7 @@ int g_mqtt_bBaseTopicDirty = 0;
 void MQTT_PublishWholeDeviceState_Internal(bool bAll)
 {
 	g_bPublishAllStatesNow = 1;
+	g_aggregateForceFull = 1;
 	if (bAll) {
 		g_publishItemIndex = PUBLISHITEM_ALL_INDEX_FIRST;
 	}
@@ -357,104 +554,121 @@ char* MQTT_GetStatusMessage(void)
 	return mqtt_status_message;
 }
 
+// callback is found by its subscription topic, which may use + and # wildcards.
+// If there is no subscription, base topic is used as a prefix.
+static void MQTT_GetCallbackFilter(mqtt_callback_t* cb, char* out, int outSize) {
+	int len;
+
+	if (cb->subscriptionTopic && cb->subscriptionTopic[0]) {
+		strncpy(out, cb->subscriptionTopic, outSize - 1);
+		out[outSize - 1] = 0;
+		return;
+	}
+	len = strlen(cb->topic);
+	snprintf(out, outSize, "%s%s#", cb->topic, (len && cb->topic[len - 1] == '/') ? "" : "/");
+}
+
+static void MQTT_FreeCallback(mqtt_callback_t* cb) {
+	char filter[128];
+
+	MQTT_GetCallbackFilter(cb, filter, sizeof(filter));
+	MQTT_Trie_Remove(&g_callbacksTrie, filter, cb);
+	os_free(cb->topic);
+	os_free(cb->subscriptionTopic);
+	os_free(cb);
+}
+
 void MQTT_ClearCallbacks() {
-	int i;
-	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
-		if (callbacks[i]) {
-			free(callbacks[i]->topic);
-			free(callbacks[i]->subscriptionTopic);
-			free(callbacks[i]);
-			callbacks[i] = 0;
-		}
+	mqtt_callback_t* cb;
+	bool bLocked;
+
+	bLocked = MQTT_Callbacks_Lock();
+	while (g_callbacks) {
+		cb = g_callbacks;
+		g_callbacks = cb->next;
+		os_free(cb->topic);
+		os_free(cb->subscriptionTopic);
+		os_free(cb);
+	}
+	MQTT_Trie_Free(&g_callbacksTrie);
+	MQTT_Callbacks_Unlock(bLocked);
+}
+
+static char* MQTT_StrDup(const char* s) {
+	char* r = (char*)os_malloc(strlen(s) + 1);
+	if (r) {
+		strcpy(r, s);
 	}
+	return r;
 }
+
 // this can REPLACE callbacks, since we MAY wish to change the root topic....
 // in which case we would re-resigster all callbacks?
 int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic, int ID, mqtt_callback_fn callback) {
-	int index;
-	int i;
+	mqtt_callback_t* cb;
+	mqtt_callback_t** slot;
+	mqtt_callback_t* other;
+	char filter[128];
 	int subscribechange = 0;
+	int res;
+	bool bLocked;
+
 	if (!basetopic || !subscriptiontopic || !callback) {
 		return -1;
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_RegisterCallback called for bT %s subT %s", basetopic, subscriptiontopic);
-
-	// find existing to replace
-	for (index = 0; index < numCallbacks; index++) {
-		if (callbacks[index]) {
-			if (callbacks[index]->ID == ID) {
-				break;
-			}
-		}
-	}
-
-	// find empty if any (empty by MQTT_RemoveCallback)
-	if (index == numCallbacks) {
-		for (index = 0; index < numCallbacks; index++) {
-			if (!callbacks[index]) {
-				break;
-			}
-		}
+	if (subscriptiontopic[0] && !MQTT_Trie_IsValidFilter(subscriptiontopic)) {
+		return -1;
 	}
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_RegisterCallback called for bT %s subT %s", basetopic, subscriptiontopic);
 
-	if (index >= MAX_MQTT_CALLBACKS) {
-		return -4;
-	}
-	if (!callbacks[index]) {
-		callbacks[index] = (mqtt_callback_t*)os_malloc(sizeof(mqtt_callback_t));
-		if (callbacks[index] != 0) {
-			memset(callbacks[index], 0, sizeof(mqtt_callback_t));
-		}
-	}
-	if (!callbacks[index]) {
+	cb = (mqtt_callback_t*)os_malloc(sizeof(mqtt_callback_t));
+	if (!cb) {
 		return -2;
 	}
-	if (!callbacks[index]->topic || strcmp(callbacks[index]->topic, basetopic)) {
-		if (callbacks[index]->topic) {
-			os_free(callbacks[index]->topic);
-		}
-		callbacks[index]->topic = (char*)os_malloc(strlen(basetopic) + 1);
-		if (!callbacks[index]->topic) {
-			os_free(callbacks[index]);
-			return -3;
+	memset(cb, 0, sizeof(mqtt_callback_t));
+	cb->topic = MQTT_StrDup(basetopic);
+	cb->subscriptionTopic = MQTT_StrDup(subscriptiontopic);
+	if (!cb->topic || !cb->subscriptionTopic) {
+		os_free(cb->topic);
+		os_free(cb->subscriptionTopic);
+		os_free(cb);
+		return -3;
+	}
+	cb->ID = ID;
+	cb->callback = callback;
+
+	bLocked = MQTT_Callbacks_Lock();
+	// if this subscription is new, must reconnect
+	subscribechange = 1;
+	for (other = g_callbacks; other; other = other->next) {
+		if (other->ID != ID && !strcmp(other->subscriptionTopic, subscriptiontopic)) {
+			subscribechange = 0;
+			break;
 		}
-		strcpy(callbacks[index]->topic, basetopic);
 	}
-
-	if (!callbacks[index]->subscriptionTopic || strcmp(callbacks[index]->subscriptionTopic, subscriptiontopic)) {
-		if (callbacks[index]->subscriptionTopic) {
-			os_free(callbacks[index]->subscriptionTopic);
-		}
-		callbacks[index]->subscriptionTopic = (char*)os_malloc(strlen(subscriptiontopic) + 1);
-		callbacks[index]->subscriptionTopic[0] = '\0';
-		if (!callbacks[index]->subscriptionTopic) {
-			os_free(callbacks[index]->topic);
-			os_free(callbacks[index]);
-			return -3;
-		}
-
-		// find out if this subscription is new.
-		for (i = 0; i < numCallbacks; i++) {
-			if (callbacks[i]) {
-				if (callbacks[i]->subscriptionTopic &&
-					!strcmp(callbacks[i]->subscriptionTopic, subscriptiontopic)) {
-					break;
-				}
-			}
-		}
-		strcpy(callbacks[index]->subscriptionTopic, subscriptiontopic);
-		// if this subscription is new, must reconnect
-		if (i == numCallbacks) {
-			subscribechange++;
+	// find existing to replace, it keeps its place in the list
+	slot = &g_callbacks;
+	while (*slot && (*slot)->ID != ID) {
+		slot = &(*slot)->next;
+	}
+	if (*slot) {
+		other = *slot;
+		if (!strcmp(other->subscriptionTopic, subscriptiontopic)) {
+			subscribechange = 0;
 		}
+		cb->next = other->next;
+		MQTT_FreeCallback(other);
 	}
+	*slot = cb;
 
-	callbacks[index]->callback = callback;
-	if (index == numCallbacks) {
-		numCallbacks++;
+	MQTT_GetCallbackFilter(cb, filter, sizeof(filter));
+	res = MQTT_Trie_Insert(&g_callbacksTrie, filter, cb);
+	MQTT_Callbacks_Unlock(bLocked);
+	if (res) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_RegisterCallback failed to add %s (%i)", filter, res);
 	}
 
-	if (subscribechange) {
+	if (subscribechange && subscriptiontopic[0]) {
 		mqtt_reconnect = 8;
 	}
 	// success
@@ -462,26 +676,22 @@ int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic,
 }
 
 int MQTT_RemoveCallback(int ID) {
-	int index;
-
-	for (index = 0; index < numCallbacks; index++) {
-		if (callbacks[index]) {
-			if (callbacks[index]->ID == ID) {
-				if (callbacks[index]->topic) {
-					os_free(callbacks[index]->topic);
-					callbacks[index]->topic = NULL;
-				}
-				if (callbacks[index]->subscriptionTopic) {
-					os_free(callbacks[index]->subscriptionTopic);
-					callbacks[index]->subscriptionTopic = NULL;
-				}
-				os_free(callbacks[index]);
-				callbacks[index] = NULL;
-				mqtt_reconnect = 8;
-				return 1;
-			}
+	mqtt_callback_t** slot;
+	mqtt_callback_t* cb;
+	bool bLocked;
+
+	bLocked = MQTT_Callbacks_Lock();
+	for (slot = &g_callbacks; *slot; slot = &(*slot)->next) {
+		if ((*slot)->ID == ID) {
+			cb = *slot;
+			*slot = cb->next;
+			MQTT_FreeCallback(cb);
+			MQTT_Callbacks_Unlock(bLocked);
+			mqtt_reconnect = 8;
+			return 1;
 		}
 	}
+	MQTT_Callbacks_Unlock(bLocked);
 	return 0;
 }
 
@@ -783,18 +993,198 @@ static void mqtt_pub_request_cb(void* arg, err_t result)
 	if (result != ERR_OK)
 	{
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish result: %d(%s)\n", result, get_error_name(result));
+#if LWIP_MQTT_V5
+		if (mqtt_client && mqtt_client_reason_code(mqtt_client)) {
+			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish reason: 0x%02X(%s)\n", mqtt_client_reason_code(mqtt_client),
+				MQTT5_ReasonCodeStr(mqtt_client_reason_code(mqtt_client)));
+		}
+#endif
 		mqtt_publish_errors++;
 	}
+	MQTT_Pacer_OnAck(arg, result == ERR_OK);
+}
+
+// free bytes in lwIP MQTT output ring buffer
+static int MQTT_GetOutputFree() {
+	int used;
+
+	if (mqtt_client == 0) {
+		return MQTT_OUTPUT_RINGBUF_SIZE;
+	}
+	LOCK_TCPIP_CORE();
+	used = mqtt_client->output.put - mqtt_client->output.get;
+	UNLOCK_TCPIP_CORE();
+	if (used < 0) {
+		used += MQTT_OUTPUT_RINGBUF_SIZE;
+	}
+	return MQTT_OUTPUT_RINGBUF_SIZE - used;
+}
+
+/////////////////////////////////////////////////////////////
+// QoS and retain policy for published topics.
+// Each entry is an MQTT topic filter. The first match wins, with exact
+// levels tried before '+' and '+' before '#', so "tele/#" overrides "#".
+// Retain -1 keeps what the publisher asked for.
+//
+typedef struct mqttPublishPolicy_s {
+	char* filter;
+	char qos;
+	char retain;
+	struct mqttPublishPolicy_s* next;
+} mqttPublishPolicy_t;
+
+static mqttPublishPolicy_t* g_publishPolicies = 0;
+static mqttTrieNode_t* g_publishPoliciesTrie = 0;
+
+// MQTT_Callbacks_Lock must be held
+static int MQTT_SetPublishPolicy(const char* filter, int qos, int retain) {
+	mqttPublishPolicy_t** slot;
+	mqttPublishPolicy_t* p;
+
+	if (!MQTT_Trie_IsValidFilter(filter) || qos > 2 || retain > 1) {
+		return -1;
+	}
+	for (slot = &g_publishPolicies; *slot; slot = &(*slot)->next) {
+		if (!strcmp((*slot)->filter, filter)) {
+			p = *slot;
+			*slot = p->next;
+			MQTT_Trie_Remove(&g_publishPoliciesTrie, p->filter, p);
+			os_free(p->filter);
+			os_free(p);
+			break;
+		}
+	}
+	// negative qos just removes the entry
+	if (qos < 0) {
+		return 0;
+	}
+	p = (mqttPublishPolicy_t*)os_malloc(sizeof(mqttPublishPolicy_t));
+	if (p == 0) {
+		return -2;
+	}
+	p->filter = MQTT_StrDup(filter);
+	if (p->filter == 0) {
+		os_free(p);
+		return -2;
+	}
+	p->qos = qos;
+	p->retain = retain < 0 ? -1 : retain;
+	if (MQTT_Trie_Insert(&g_publishPoliciesTrie, filter, p)) {
+		os_free(p->filter);
+		os_free(p);
+		return -2;
+	}
+	p->next = g_publishPolicies;
+	g_publishPolicies = p;
+	return 0;
+}
+
+static void MQTT_InitPublishPolicies() {
+	mqttPublishPolicy_t* p;
+	bool bLocked;
+
+	bLocked = MQTT_Callbacks_Lock();
+	while (g_publishPolicies) {
+		p = g_publishPolicies;
+		g_publishPolicies = p->next;
+		os_free(p->filter);
+		os_free(p);
+	}
+	MQTT_Trie_Free(&g_publishPoliciesTrie);
+
+	// anything not listed below
+	MQTT_SetPublishPolicy("#", 1, -1);
+	// periodic values, like obk0696FB33/1/get or obk0696FB33/voltage/get,
+	// a lost one is replaced by the next one anyway
+	MQTT_SetPublishPolicy("+/+/get", 0, -1);
+	MQTT_SetPublishPolicy("tele/#", 0, -1);
+	MQTT_SetPublishPolicy("stat/#", 1, -1);
+	MQTT_SetPublishPolicy("homeassistant/#", 1, -1);
+	// online/offline (LWT) state must survive broker restarts and new subscribers
+	MQTT_SetPublishPolicy("+/connected", 1, 1);
+	MQTT_Callbacks_Unlock(bLocked);
+}
+
+static int MQTT_PublishPolicyVisitor(void* value, void* userData) {
+	*(mqttPublishPolicy_t**)userData = (mqttPublishPolicy_t*)value;
+	return 1;
+}
+
+// qos and retain are given as requested by caller, and changed if there is a policy for topic
+static void MQTT_ApplyPublishPolicy(const char* topic, u8_t* qos, u8_t* retain) {
+	mqttPublishPolicy_t* p = 0;
+	bool bLocked;
+
+	bLocked = MQTT_Callbacks_Lock();
+	MQTT_Trie_Match(g_publishPoliciesTrie, topic, MQTT_PublishPolicyVisitor, &p);
+	if (p != 0) {
+		*qos = p->qos;
+		if (p->retain >= 0) {
+			*retain = p->retain;
+		}
+	}
+	MQTT_Callbacks_Unlock(bLocked);
+}
+
+// Topics are built here instead of allocating each time. Prefixes for own topics
+// are rendered once per connection (or base topic change), so a publish only
+// appends the channel name. Guarded by g_mutex, prefixes are rendered only with it
+// taken (or from MQTT_init, before anything publishes).
+#define MQTT_PUB_TOPIC_MAX 256
+#define MQTT_PUB_PREFIX_CLIENT 0
+#define MQTT_PUB_PREFIX_TELE 1
+#define MQTT_PUB_PREFIX_STAT 2
+#define MQTT_PUB_PREFIX_COUNT 3
+static char g_pubTopic[MQTT_PUB_TOPIC_MAX];
+static char g_pubPrefixes[MQTT_PUB_PREFIX_COUNT][CGF_MQTT_CLIENT_ID_SIZE + 8];
+static int g_pubPrefixLens[MQTT_PUB_PREFIX_COUNT];
+static int g_pubPrefixesRendered = 0;
+
+static void MQTT_RenderTopicPrefixes() {
+	const char* clientId = CFG_GetMQTTClientId();
+
+	g_pubPrefixLens[MQTT_PUB_PREFIX_CLIENT] = snprintf(g_pubPrefixes[MQTT_PUB_PREFIX_CLIENT],
+		sizeof(g_pubPrefixes[0]), "%s", clientId);
+	g_pubPrefixLens[MQTT_PUB_PREFIX_TELE] = snprintf(g_pubPrefixes[MQTT_PUB_PREFIX_TELE],
+		sizeof(g_pubPrefixes[0]), "tele/%s", clientId);
+	g_pubPrefixLens[MQTT_PUB_PREFIX_STAT] = snprintf(g_pubPrefixes[MQTT_PUB_PREFIX_STAT],
+		sizeof(g_pubPrefixes[0]), "stat/%s", clientId);
+	g_pubPrefixesRendered = 1;
+}
+
+// returns topic in g_pubTopic, or allocated one if it does not fit (must be freed by caller)
+static char* MQTT_BuildPublishTopic(const char* prefix, int prefixLen, const char* sChannel, bool appendGet) {
+	int channelLen = strlen(sChannel);
+	int total = prefixLen + 1 + channelLen + (appendGet ? 4 : 0);
+	char* out = g_pubTopic;
+
+	if (total >= sizeof(g_pubTopic)) {
+		out = (char*)os_malloc(total + 1);
+		if (out == 0) {
+			return 0;
+		}
+		mqtt_publish_allocs++;
+	}
+	memcpy(out, prefix, prefixLen);
+	out[prefixLen] = '/';
+	memcpy(out + prefixLen + 1, sChannel, channelLen);
+	if (appendGet) {
+		memcpy(out + prefixLen + 1 + channelLen, "/get", 4);
+	}
+	out[total] = 0;
+	return out;
 }
 
 // This publishes value to the specified topic/channel.
-static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet)
+// ownPrefix is one of MQTT_PUB_PREFIX_*, to publish under own topic instead of sTopic, or -1
+static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, int ownPrefix, const char* sTopic, int topicLen, const char* sChannel, const char* sVal, int flags, bool appendGet)
 {
 	err_t err;
-	u8_t qos = 2; /* 0 1 or 2, see MQTT specification */
+	u8_t qos = 1; /* 0 1 or 2, see MQTT specification, final value comes from policy table */
 	u8_t retain = 0; /* No don't retain such crappy payload... */
 	size_t sVal_len;
 	char* pub_topic;
+	void* pacerTag;
 
 	if (client == 0)
 		return OBK_PUBLISH_WAS_DISCONNECTED;
@@ -817,11 +1207,6 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 	{
 		retain = 1;
 	}
-	// global tool
-	if (CFG_HasFlag(OBK_FLAG_MQTT_ALWAYSSETRETAIN))
-	{
-		retain = 1;
-	}
 	if (flags & OBK_PUBLISH_FLAG_FORCE_REMOVE_GET)
 	{
 		appendGet = false;
@@ -841,24 +1226,49 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 
 	g_timeSinceLastMQTTPublish = 0;
 
-	pub_topic = (char*)os_malloc(strlen(sTopic) + 1 + strlen(sChannel) + 5 + 1); //5 for /get
+	if (ownPrefix >= 0) {
+		// client id has changed, but callbacks were not updated yet
+		if (g_pubPrefixesRendered == 0 || g_mqtt_bBaseTopicDirty) {
+			MQTT_RenderTopicPrefixes();
+		}
+		sTopic = g_pubPrefixes[ownPrefix];
+		topicLen = g_pubPrefixLens[ownPrefix];
+	}
+	if (topicLen < 0) {
+		topicLen = strlen(sTopic);
+	}
+	pub_topic = MQTT_BuildPublishTopic(sTopic, topicLen, sChannel, appendGet);
 	if ((pub_topic != NULL) && (sVal != NULL))
 	{
+		MQTT_ApplyPublishPolicy(pub_topic, &qos, &retain);
+		// global tool
+		if (CFG_HasFlag(OBK_FLAG_MQTT_ALWAYSSETRETAIN))
+		{
+			retain = 1;
+		}
 		sVal_len = strlen(sVal);
-		sprintf(pub_topic, "%s/%s%s", sTopic, sChannel, (appendGet == true ? "/get" : ""));
 		if (sVal_len < 128)
 		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i\n", sVal, pub_topic, retain);
+			addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Publishing val %s to %s qos=%i retain=%i\n", sVal, pub_topic, qos, retain);
 		}
 		else {
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i\n", sVal_len, pub_topic, retain);
+			addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s qos=%i retain=%i\n", sVal_len, pub_topic, qos, retain);
 		}
 
 
+		// lwIP copies topic and payload into its output buffer, so nothing here has to outlive the call
+		pacerTag = MQTT_Pacer_OnSent();
 		LOCK_TCPIP_CORE();
-		err = mqtt_publish(client, pub_topic, sVal, strlen(sVal), qos, retain, mqtt_pub_request_cb, 0);
+#if LWIP_MQTT_V5
+		// retained ones are state, they must not expire
+		err = mqtt_publish_v5(client, pub_topic, sVal, sVal_len, qos, retain, retain ? 0 : g_mqttTelemetryExpiry, mqtt_pub_request_cb, pacerTag);
+#else
+		err = mqtt_publish(client, pub_topic, sVal, sVal_len, qos, retain, mqtt_pub_request_cb, pacerTag);
+#endif
 		UNLOCK_TCPIP_CORE();
-		os_free(pub_topic);
+		if (pub_topic != g_pubTopic) {
+			os_free(pub_topic);
+		}
 
 		if (err != ERR_OK)
 		{
@@ -874,6 +1284,7 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
 			}
 			mqtt_publish_errors++;
+			MQTT_Pacer_OnSendError(pacerTag);
 			MQTT_Mutex_Free();
 			return OBK_PUBLISH_MEM_FAIL;
 		}
@@ -882,29 +1293,45 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 		return OBK_PUBLISH_OK;
 	}
 	else {
+		if (pub_topic != NULL && pub_topic != g_pubTopic) {
+			os_free(pub_topic);
+		}
 		MQTT_Mutex_Free();
 		return OBK_PUBLISH_MEM_FAIL;
 	}
 }
 
+// publishes to one of our own topics, with prefix rendered in advance
+static OBK_Publish_Result MQTT_PublishWithPrefix(int prefix, const char* sChannel, const char* sVal, int flags, bool appendGet)
+{
+	return MQTT_PublishTopicToClient(mqtt_client, prefix, NULL, -1, sChannel, sVal, flags, appendGet);
+}
+
 // This is used to publish channel values in "obk0696FB33/1/get" format with numerical value,
 // This is also used to publish custom information with string name,
 // for example, "obk0696FB33/voltage/get" is used to publish voltage from the sensor
 static OBK_Publish_Result MQTT_PublishMain(mqtt_client_t* client, const char* sChannel, const char* sVal, int flags, bool appendGet)
 {
-	return MQTT_PublishTopicToClient(mqtt_client, CFG_GetMQTTClientId(), sChannel, sVal, flags, appendGet);
+	OBK_Publish_Result res;
+
+	// names with mqtt_dedup rule go through deduper, it will call us again with NO_DEDUP flag
+	if (appendGet && !(flags & OBK_PUBLISH_FLAG_NO_DEDUP) && MQTT_Dedup_HasRule(sChannel)) {
+		return MQTT_PublishMain_StringString_DeDuped(0, sChannel, sVal, flags);
+	}
+	res = MQTT_PublishWithPrefix(MQTT_PUB_PREFIX_CLIENT, sChannel, sVal, flags, appendGet);
+	// keep it for replay after reconnect
+	if (res == OBK_PUBLISH_WAS_DISCONNECTED && MQTT_Offline_IsEnabled()) {
+		MQTT_Offline_Store(sChannel, sVal);
+	}
+	return res;
 }
 OBK_Publish_Result MQTT_PublishTele(const char* teleName, const char* teleValue)
 {
-	char topic[64];
-	snprintf(topic, sizeof(topic), "tele/%s", CFG_GetMQTTClientId());
-	return MQTT_PublishTopicToClient(mqtt_client, topic, teleName, teleValue, 0, false);
+	return MQTT_PublishWithPrefix(MQTT_PUB_PREFIX_TELE, teleName, teleValue, 0, false);
 }
 OBK_Publish_Result MQTT_PublishStat(const char* statName, const char* statValue)
 {
-	char topic[64];
-	snprintf(topic,sizeof(topic),"stat/%s", CFG_GetMQTTClientId());
-	return MQTT_PublishTopicToClient(mqtt_client, topic, statName, statValue, 0, false);
+	return MQTT_PublishWithPrefix(MQTT_PUB_PREFIX_STAT, statName, statValue, 0, false);
 }
 /// @brief Publish a MQTT message immediately.
 /// @param sTopic 
@@ -914,7 +1341,7 @@ OBK_Publish_Result MQTT_PublishStat(const char* statName, const char* statValue)
 /// @return 
 OBK_Publish_Result MQTT_Publish(const char* sTopic, const char* sChannel, const char* sVal, int flags)
 {
-	return MQTT_PublishTopicToClient(mqtt_client, sTopic, sChannel, sVal, flags, false);
+	return MQTT_PublishTopicToClient(mqtt_client, -1, sTopic, -1, sChannel, sVal, flags, false);
 }
 
 void MQTT_OBK_Printf(char* s) {
@@ -926,74 +1353,145 @@ void MQTT_OBK_Printf(char* s) {
 // we should do callbacks from one of our threads?
 static void mqtt_incoming_data_cb(void* arg, const u8_t* data, u16_t len, u8_t flags)
 {
-	int i;
+	mqttRxRecord_t* r = mqtt_rx_pending;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// if we stored a topic in g_mqtt_request, then we found a matching callback, so use it.
-	if (g_mqtt_request.topic[0])
-	{
-		// note: data is NOT terminated (it may be binary...).
-		g_mqtt_request.received = data;
-		g_mqtt_request.receivedLen = len;
+	// if there is a pending record, then we found a matching callback in mqtt_incoming_publish_cb
+	if (r == 0 || mqtt_rx_skipData) {
+		if (flags & MQTT_DATA_FLAG_LAST) {
+			mqtt_rx_skipData = 0;
+		}
+		return;
+	}
+	// payload may come in parts, copy each one directly to its place in the ring
+	if (len > r->dataLen - mqtt_rx_pendingFill) {
+		len = r->dataLen - mqtt_rx_pendingFill;
+	}
+	memcpy(MQTT_RX_RECORD_DATA(r) + mqtt_rx_pendingFill, data, len);
+	mqtt_rx_pendingFill += len;
+	if (flags & MQTT_DATA_FLAG_LAST) {
+		MQTT_RX_RECORD_DATA(r)[mqtt_rx_pendingFill] = 0;
+		if (MQTT_Mutex_Take(100) == 0) {
+			// record stays pending, next mqtt_incoming_publish_cb drops it
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx mutex busy, message will be dropped");
+			return;
+		}
+		if (mqtt_rx_pendingFill == r->dataLen) {
+			r->state = MQTT_RX_REC_READY;
+		}
+		else {
+			r->state = MQTT_RX_REC_DROPPED;
+			mqtt_rx_drops++;
+		}
+		mqtt_rx_pending = 0;
+		MQTT_Mutex_Free();
+		MQTT_TriggerRead();
+	}
+}
 
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", g_mqtt_request.topic);
-		mqtt_received_events++;
+// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
+// i.e. multiple people can get each topic if required.
+// callbacks matching one message are copied out under lock and run without it,
+// since trie may be changed from other threads meanwhile, also by callbacks themselves.
+// Usually they fit on stack, list is allocated only for topics with more matches
+#define MQTT_MAX_DISPATCH 16
+typedef struct mqttDispatchList_s {
+	mqtt_callback_fn* fns;
+	int count;
+	int max;
+} mqttDispatchList_t;
 
-		for (i = 0; i < numCallbacks; i++)
-		{
-			if (callbacks[i] == 0)
-				continue;
-			char* cbtopic = callbacks[i]->topic;
-			if (!strncmp(g_mqtt_request.topic, cbtopic, strlen(cbtopic)))
-			{
-				MQTT_Post_Received(g_mqtt_request.topic, strlen(g_mqtt_request.topic), data, len);
-				// if ANYONE is interested, store it.
-				break;
-				// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-				// i.e. multiple people can get each topic if required.
-				//if (callbacks[i]->callback(&g_mqtt_request))
-				//{
-				//	return;
-				//}
+static int MQTT_CollectCallback(void* value, void* userData) {
+	mqttDispatchList_t* list = (mqttDispatchList_t*)userData;
+
+	list->fns[list->count++] = ((mqtt_callback_t*)value)->callback;
+	return list->count >= list->max;
+}
+
+static void MQTT_DispatchToCallbacks(obk_mqtt_request_t* request) {
+	mqtt_callback_fn stackFns[MQTT_MAX_DISPATCH];
+	mqtt_callback_fn* bigFns = 0;
+	mqttDispatchList_t list;
+	bool bLocked;
+	int matches = 0;
+	int i;
+
+	list.fns = stackFns;
+	list.count = 0;
+	list.max = MQTT_MAX_DISPATCH;
+	bLocked = MQTT_Callbacks_Lock();
+	MQTT_Trie_Match(g_callbacksTrie, request->topic, MQTT_CollectCallback, &list);
+	if (list.count == MQTT_MAX_DISPATCH) {
+		// may be more, count them and collect again
+		matches = MQTT_Trie_Match(g_callbacksTrie, request->topic, 0, 0);
+		if (matches > MQTT_MAX_DISPATCH) {
+			bigFns = (mqtt_callback_fn*)os_malloc(matches * sizeof(mqtt_callback_fn));
+			if (bigFns) {
+				list.fns = bigFns;
+				list.count = 0;
+				list.max = matches;
+				MQTT_Trie_Match(g_callbacksTrie, request->topic, MQTT_CollectCallback, &list);
 			}
 		}
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", g_mqtt_request.topic);
+	}
+	MQTT_Callbacks_Unlock(bLocked);
+	if (matches > list.count) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT %s: no memory for %i callbacks, only %i are run", request->topic, matches, list.count);
+	}
+	for (i = 0; i < list.count; i++) {
+		if (list.fns[i](request)) {
+			break;
+		}
+	}
+	if (bigFns) {
+		os_free(bigFns);
 	}
 }
 
-
 // run from userland (quicktick or wakeable thread)
 int MQTT_process_received(){
-	char *topic;
-	int topiclen;
-	unsigned char *data;
-	int datalen;
-	int found = 0;
+	mqttRxRecord_t* r;
+	unsigned int latency;
 	int count = 0;
-	do{
-		found = get_received(&topic, &topiclen, &data, &datalen);
-		if (found){
-			count++;
-			strncpy(g_mqtt_request_cb.topic, topic, sizeof(g_mqtt_request_cb.topic));
-			g_mqtt_request_cb.received = data;
-			g_mqtt_request_cb.receivedLen = datalen;
-			for (int i = 0; i < numCallbacks; i++)
-			{
-				char* cbtopic = callbacks[i]->topic;
-				if (!strncmp(topic, cbtopic, strlen(cbtopic)))
-				{
-					// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-					// i.e. multiple people can get each topic if required.
-					if (callbacks[i]->callback(&g_mqtt_request_cb))
-					{
-						// if no further processing, then break this loop.
-						break;
-					}
-				}
-			}
+
+	while (1) {
+		if (MQTT_Mutex_Take(100) == 0) {
+			// try again soon
+			MQTT_TriggerRead();
+			break;
+		}
+		if (mqtt_rx_unreleased) {
+			MQTT_RxRing_Release(mqtt_rx_unreleased);
+			mqtt_rx_unreleased = 0;
+		}
+		r = MQTT_RxRing_Peek();
+		MQTT_Mutex_Free();
+		if (r == 0) {
+			break;
+		}
+		count++;
+		latency = MQTT_GetTimeMS() - r->rxTime;
+		mqtt_rx_latencyLast = latency;
+		if (latency > mqtt_rx_latencyMax) {
+			mqtt_rx_latencyMax = latency;
+		}
+		mqtt_rx_latencyTotal += latency;
+		mqtt_rx_latencyCount++;
+		// record stays in the ring until all callbacks are done, so no copy is needed
+		g_mqtt_request_cb.topic = MQTT_RX_RECORD_TOPIC(r);
+		g_mqtt_request_cb.received = MQTT_RX_RECORD_DATA(r);
+		g_mqtt_request_cb.receivedLen = r->dataLen;
+		MQTT_DispatchToCallbacks(&g_mqtt_request_cb);
+		if (MQTT_Mutex_Take(100) == 0) {
+			// released on next call, so it's not dispatched twice
+			mqtt_rx_unreleased = r;
+			MQTT_TriggerRead();
+			break;
 		}
-	} while (found);
+		MQTT_RxRing_Release(r);
+		MQTT_Mutex_Free();
+	}
 
 	return count;
 }
@@ -1003,24 +1501,49 @@ int MQTT_process_received(){
 // called from tcp_thread context
 static void mqtt_incoming_publish_cb(void* arg, const char* topic, u32_t tot_len)
 {
-	//const char *p;
-	int i;
+	mqttRxRecord_t* r = 0;
+	int topicLen;
+	int matches;
+	bool bLocked;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	g_mqtt_request.topic[0] = '\0';
-	for (i = 0; i < numCallbacks; i++)
-	{
-		char* cbtopic = callbacks[i]->topic;
-		if (strncmp(topic, cbtopic, strlen(cbtopic)))
-		{
-			strncpy(g_mqtt_request.topic, topic, sizeof(g_mqtt_request.topic) - 1);
-			g_mqtt_request.topic[sizeof(g_mqtt_request.topic) - 1] = 0;
-			break;
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
+	mqtt_received_events++;
+
+	topicLen = strlen(topic);
+	bLocked = MQTT_Callbacks_Lock();
+	matches = MQTT_Trie_Match(g_callbacksTrie, topic, 0, 0);
+	MQTT_Callbacks_Unlock(bLocked);
+	if (MQTT_Mutex_Take(100) == 0) {
+		// counted in mqtt_lock_fails, data of this message is skipped
+		mqtt_rx_skipData = 1;
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx mutex busy, dropped topic %s", topic);
+		return;
+	}
+	mqtt_rx_skipData = 0;
+	// previous message was never completed, so reader must skip it
+	if (mqtt_rx_pending) {
+		mqtt_rx_pending->state = MQTT_RX_REC_DROPPED;
+		mqtt_rx_pending = 0;
+		mqtt_rx_drops++;
+	}
+	if (matches) {
+		// if ANYONE is interested, reserve space for whole message, data is copied there by mqtt_incoming_data_cb
+		r = MQTT_RxRing_Reserve(topicLen, tot_len);
+		if (r) {
+			memcpy(MQTT_RX_RECORD_TOPIC(r), topic, topicLen + 1);
+			mqtt_rx_pending = r;
+			mqtt_rx_pendingFill = 0;
 		}
 	}
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
+	MQTT_Mutex_Free();
+	if (matches == 0) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", topic);
+	}
+	else if (r == 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s (%i bytes)", topic, (int)tot_len);
+	}
 }
 
 static void mqtt_request_cb(void* arg, err_t err)
@@ -1034,9 +1557,11 @@ static void mqtt_request_cb(void* arg, err_t err)
 // should be called in tcp_thread context.
 static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection_status_t status)
 {
-	int i;
+	mqtt_callback_t* cb;
+	bool bLocked;
 	char tmp[CGF_MQTT_CLIENT_ID_SIZE + 16];
 	const char* clientId;
+	u8_t qos, retain;
 	err_t err = ERR_OK;
 	const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 	LWIP_UNUSED_ARG(client);
@@ -1058,28 +1583,32 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 		// subscribe to all callback subscription topics
 		// this makes a BIG assumption that we can subscribe multiple times to the same one?
 		// TODO - check that subscribing multiple times to the same topic is not BAD
-		for (i = 0; i < numCallbacks; i++) {
-			if (callbacks[i]) {
-				if (callbacks[i]->subscriptionTopic && callbacks[i]->subscriptionTopic[0]) {
-					err = mqtt_sub_unsub(client,
-						callbacks[i]->subscriptionTopic, 1,
-						mqtt_request_cb, LWIP_CONST_CAST(void*, client_info),
-						1);
-					if (err != ERR_OK) {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", callbacks[i]->subscriptionTopic, err);
-					}
-					else {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", callbacks[i]->subscriptionTopic);
-					}
+		// Incoming publishes are handled later on this same lwIP thread, so list lock can be held here
+		bLocked = MQTT_Callbacks_Lock();
+		for (cb = g_callbacks; cb; cb = cb->next) {
+			if (cb->subscriptionTopic[0]) {
+				err = mqtt_sub_unsub(client,
+					cb->subscriptionTopic, 1,
+					mqtt_request_cb, LWIP_CONST_CAST(void*, client_info),
+					1);
+				if (err != ERR_OK) {
+					addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", cb->subscriptionTopic, err);
+				}
+				else {
+					addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", cb->subscriptionTopic);
 				}
 			}
 		}
+		MQTT_Callbacks_Unlock(bLocked);
 
 		clientId = CFG_GetMQTTClientId();
 
 		snprintf(tmp, sizeof(tmp), "%s/connected", clientId);
+		qos = 2;
+		retain = 1;
+		MQTT_ApplyPublishPolicy(tmp, &qos, &retain);
 		//LOCK_TCPIP_CORE();
-		err = mqtt_publish(client, tmp, "online", strlen("online"), 2, true, mqtt_pub_request_cb, 0);
+		err = mqtt_publish(client, tmp, "online", strlen("online"), qos, retain, mqtt_pub_request_cb, 0);
 		//UNLOCK_TCPIP_CORE();
 		if (err != ERR_OK) {
 			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
@@ -1101,6 +1630,16 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 	}
 	else {
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_connection_cb: Disconnected, reason: %d(%s)\n", status, get_callback_error(status));
+#if LWIP_MQTT_V5
+		if (mqtt_client_reason_code(client)) {
+			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_connection_cb: MQTT 5 reason: 0x%02X(%s)\n", mqtt_client_reason_code(client),
+				MQTT5_ReasonCodeStr(mqtt_client_reason_code(client)));
+		}
+#endif
+		if (status == MQTT_CONNECT_REFUSED_PROTOCOL_VERSION && MQTT_GetProtocolVersion() == MQTT5_PROTOCOL_LEVEL) {
+			addLogAdv(LOG_WARN, LOG_FEATURE_MQTT, "Broker does not support MQTT 5, falling back to 3.1.1\n");
+			g_mqttV5Fallback = 1;
+		}
 	}
 }
 
@@ -1111,8 +1650,10 @@ static void MQTT_do_connect(mqtt_client_t* client)
 	int res;
 	struct hostent* hostEntry;
 	char will_topic[CGF_MQTT_CLIENT_ID_SIZE + 16];
+	u8_t will_qos, will_retain;
 
 	mqtt_host = CFG_GetMQTTHost();
+	MQTT_RenderTopicPrefixes();
 
 	if (!mqtt_host[0]) {
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_host empty, not starting mqtt\r\n");
@@ -1151,8 +1692,11 @@ static void MQTT_do_connect(mqtt_client_t* client)
 	sprintf(will_topic, "%s/connected", mqtt_clientID);
 	mqtt_client_info.will_topic = will_topic;
 	mqtt_client_info.will_msg = "offline";
-	mqtt_client_info.will_retain = true,
-		mqtt_client_info.will_qos = 2,
+	will_qos = 2;
+	will_retain = 1;
+	MQTT_ApplyPublishPolicy(will_topic, &will_qos, &will_retain);
+	mqtt_client_info.will_retain = will_retain,
+		mqtt_client_info.will_qos = will_qos,
 
 		hostEntry = gethostbyname(mqtt_host);
 	if (NULL != hostEntry)
@@ -1177,7 +1721,10 @@ static void MQTT_do_connect(mqtt_client_t* client)
 		/* Initiate client and connect to server, if this fails immediately an error code is returned
 		  otherwise mqtt_connection_cb will be called with connection result after attempting
 		  to establish a connection with the server.
-		  For now MQTT version 3.1.1 is always used */
+		  MQTT 5 is used only if selected by mqtt_version and supported by lwIP port */
+#if LWIP_MQTT_V5
+		mqtt_client_info.protocol_version = MQTT_GetProtocolVersion();
+#endif
 
 		LOCK_TCPIP_CORE();
 		res = mqtt_client_connect(mqtt_client,
@@ -1262,28 +1809,78 @@ double MQTT_MultiplierConfiguredOnChannel(int channel, int iVal) {
 	// Returning double value. If it is zero then we dod nothing, or the value is indeed zero so it doesn't matter if we send a double or int.
 	return dVal;
 }
-OBK_Publish_Result MQTT_ChannelChangeCallback(int channel, int iVal)
-{
-	char channelNameStr[8];
-	char valueStr[16];
-	int flags;
-
+// formats channel value, taking configured multiplier into account
+static void MQTT_FormatChannelValue(int channel, int iVal, char* valueStr) {
 	// Getting double value if any, and converting if required
 	double dVal = MQTT_MultiplierConfiguredOnChannel(channel, iVal);
 	if (dVal == 0) {
 		// Integer value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %i to channel %i \n", iVal, channel);
 		sprintf(valueStr, "%i", iVal);
 	}
 	else {
 		// Float value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %f to channel %i \n", dVal, channel);
 		sprintf(valueStr, "%lf", dVal);
 	}
+}
+static int MQTT_ShouldPublishChannel(int idx) {
+	// Do not publish raw channel value for channels like PWM values, RGBCW has 5 raw channels.
+	// We do not need raw values for RGBCW lights (or RGB, etc)
+	// because we are using led_basecolor_rgb, led_dimmer, led_enableAll, etc
+	if (CHANNEL_HasRoleThatShouldBePublished(idx)) {
+		return 1;
+	}
+#ifdef ENABLE_DRIVER_TUYAMCU
+	// publish if channel is used by TuyaMCU (no pin role set), for example door sensor state with power saving V0 protocol
+	// Not enabled by default, you have to set OBK_FLAG_TUYAMCU_ALWAYSPUBLISHCHANNELS flag
+	if (CFG_HasFlag(OBK_FLAG_TUYAMCU_ALWAYSPUBLISHCHANNELS) && TuyaMCU_IsChannelUsedByTuyaMCU(idx)) {
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+static bool MQTT_Aggregate_Lock() {
+	if (g_aggregateMutex == 0)
+	{
+		g_aggregateMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_aggregateMutex, portMAX_DELAY) == pdTRUE;
+}
+
+// only gives what MQTT_Aggregate_Lock has taken
+static void MQTT_Aggregate_Unlock(bool bTaken) {
+	if (bTaken) {
+		xSemaphoreGive(g_aggregateMutex);
+	}
+}
+
+static void MQTT_Aggregate_MarkDirty(int channel) {
+	bool bLocked = MQTT_Aggregate_Lock();
+
+	g_aggregateDirty[channel / 32] |= 1u << (channel % 32);
+	MQTT_Aggregate_Unlock(bLocked);
+}
+
+OBK_Publish_Result MQTT_ChannelChangeCallback(int channel, int iVal)
+{
+	char channelNameStr[8];
+	char valueStr[16];
+	int flags;
+
+	MQTT_FormatChannelValue(channel, iVal, valueStr);
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %s to channel %i \n", valueStr, channel);
 
 	flags = 0;
 	MQTT_BroadcastTasmotaTeleSTATE();
 
+	if (g_aggregateMode != MQTT_AGGREGATE_OFF && channel >= 0 && channel < CHANNEL_MAX) {
+		MQTT_Aggregate_MarkDirty(channel);
+		// relay state is still published right away, so switching feels responsive
+		if (!CHANNEL_IsPowerRelayChannel(channel)) {
+			return OBK_PUBLISH_OK;
+		}
+	}
+
 	// String from channel number
 	sprintf(channelNameStr, "%i", channel);
 
@@ -1304,18 +1901,8 @@ OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags)
 
 	iValue = CHANNEL_Get(channel);
 
-	// Getting double value if any, and converting if required
-	double dVal = MQTT_MultiplierConfiguredOnChannel(channel, iValue);
-	if (dVal == 0) {
-		// Integer value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Forced channel publish! Publishing val %i to %i", iValue, channel);
-		sprintf(valueStr, "%i", iValue);
-	}
-	else {
-		// Float value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Forced channel publish! Publishing val %f to %i", dVal, channel);
-		sprintf(valueStr, "%lf", dVal);
-	}
+	MQTT_FormatChannelValue(channel, iValue, valueStr);
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Forced channel publish! Publishing val %s to %i", valueStr, channel);
 
 	// String from channel number
 	sprintf(channelNameStr, "%i", channel);
@@ -1329,6 +1916,70 @@ OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags)
 
 	return MQTT_PublishMain(mqtt_client, channelNameStr, valueStr, flags, true);
 }
+// Publishes channels as one JSON object, like {"1":0,"5":21.5}, to obk0696FB33/channels/get.
+// This is what per channel publishes are replaced with in aggregated mode.
+static OBK_Publish_Result MQTT_PublishAggregatedChannels(int bAll) {
+	OBK_Publish_Result res;
+	unsigned int dirty[(CHANNEL_MAX + 31) / 32];
+	char valueStr[16];
+	bool bLocked;
+	int len;
+	int ch;
+	int bDirty;
+
+	if (g_aggregateJSON == 0) {
+		g_aggregateJSON = (char*)os_malloc(MQTT_AGGREGATE_JSON_SIZE);
+		if (g_aggregateJSON == 0) {
+			return OBK_PUBLISH_MEM_FAIL;
+		}
+	}
+	// changes made while message is built go in next one
+	bLocked = MQTT_Aggregate_Lock();
+	memcpy(dirty, g_aggregateDirty, sizeof(dirty));
+	memset(g_aggregateDirty, 0, sizeof(g_aggregateDirty));
+	MQTT_Aggregate_Unlock(bLocked);
+	len = 0;
+	g_aggregateJSON[len++] = '{';
+	for (ch = 0; ch < CHANNEL_MAX; ch++) {
+		bDirty = (dirty[ch / 32] >> (ch % 32)) & 1;
+		if (!bDirty && !(bAll && MQTT_ShouldPublishChannel(ch))) {
+			continue;
+		}
+		MQTT_FormatChannelValue(ch, CHANNEL_Get(ch), valueStr);
+		len += sprintf(g_aggregateJSON + len, "%s\"%i\":%s", len > 1 ? "," : "", ch, valueStr);
+	}
+	if (len == 1) {
+		return OBK_PUBLISH_WAS_NOT_REQUIRED;
+	}
+	g_aggregateJSON[len++] = '}';
+	g_aggregateJSON[len] = 0;
+	res = MQTT_PublishMain(mqtt_client, "channels", g_aggregateJSON, OBK_PUBLISH_FLAG_MUTEX_SILENT, true);
+	if (res != OBK_PUBLISH_OK) {
+		// not sent, so these are still to be published
+		bLocked = MQTT_Aggregate_Lock();
+		for (ch = 0; ch < (CHANNEL_MAX + 31) / 32; ch++) {
+			g_aggregateDirty[ch] |= dirty[ch];
+		}
+		MQTT_Aggregate_Unlock(bLocked);
+	}
+	return res;
+}
+// called every second when connected
+static void MQTT_Aggregate_RunEverySecond() {
+	if (g_aggregateMode == MQTT_AGGREGATE_OFF) {
+		return;
+	}
+	g_aggregateCountdown--;
+	if (g_aggregateCountdown > 0 && !g_aggregateForceFull) {
+		return;
+	}
+	if (MQTT_PublishAggregatedChannels(g_aggregateMode == MQTT_AGGREGATE_FULL || g_aggregateForceFull) == OBK_PUBLISH_MUTEX_FAIL) {
+		// try again next second
+		return;
+	}
+	g_aggregateForceFull = 0;
+	g_aggregateCountdown = g_aggregateInterval;
+}
 // This console command will trigger a publish of all used variables (channels and extra stuff)
 commandResult_t MQTT_PublishAll(const void* context, const char* cmd, const char* args, int cmdFlags) {
 	MQTT_PublishWholeDeviceState_Internal(true);
@@ -1496,7 +2147,8 @@ commandResult_t MQTT_SetMaxBroadcastItemsPublishedPerSecond(const void* context,
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Requires 1 arg");
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
-	g_maxBroadcastItemsPublishedPerSecond = Tokenizer_GetArgInteger(0);
+	// fixed rate, as before adaptive pacing was added
+	MQTT_Pacer_SetLimits(Tokenizer_GetArgInteger(0), Tokenizer_GetArgInteger(0));
 
 	return CMD_RES_OK;
 }
@@ -1512,6 +2164,158 @@ commandResult_t MQTT_SetBroadcastInterval(const void* context, const char* cmd,
 
 	return CMD_RES_OK;
 }
+commandResult_t MQTT_SetRxBufferSize(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	int size;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() >= 1) {
+		size = Tokenizer_GetArgInteger(0) & ~3;
+		if (size < MQTT_RX_BUFFER_MIN) {
+			size = MQTT_RX_BUFFER_MIN;
+		}
+		if (MQTT_Mutex_Take(100) == 0) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer is busy, try again later");
+			return CMD_RES_ERROR;
+		}
+		// records are processed in place, so ring can only be swapped when empty
+		if (mqtt_rx_used != 0 || mqtt_rx_pending != 0) {
+			MQTT_Mutex_Free();
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer is busy, try again later");
+			return CMD_RES_ERROR;
+		}
+		if (mqtt_rx_buffer) {
+			os_free(mqtt_rx_buffer);
+			mqtt_rx_buffer = 0;
+		}
+		mqtt_rx_buffer_size = size;
+		mqtt_rx_highWater = 0;
+		mqtt_rx_overflows = 0;
+		mqtt_rx_drops = 0;
+		mqtt_rx_latencyLast = 0;
+		mqtt_rx_latencyMax = 0;
+		mqtt_rx_latencyTotal = 0;
+		mqtt_rx_latencyCount = 0;
+		MQTT_Mutex_Free();
+	}
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_rx buffer size %i, used %i, high water %i, overflows %i, drops %i",
+		mqtt_rx_buffer_size, mqtt_rx_used, mqtt_rx_highWater, mqtt_rx_overflows, mqtt_rx_drops);
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT_rx latency last %ims, max %ims, total %ims over %i messages",
+		mqtt_rx_latencyLast, mqtt_rx_latencyMax, mqtt_rx_latencyTotal, mqtt_rx_latencyCount);
+
+	return CMD_RES_OK;
+}
+commandResult_t MQTT_SetQoSPolicy(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	mqttPublishPolicy_t* p;
+	bool bLocked;
+	int res;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		bLocked = MQTT_Callbacks_Lock();
+		for (p = g_publishPolicies; p; p = p->next) {
+			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "%s qos %i retain %i", p->filter, p->qos, p->retain);
+		}
+		MQTT_Callbacks_Unlock(bLocked);
+		return CMD_RES_OK;
+	}
+	if (Tokenizer_GetArgsCount() < 2) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Requires 2 args");
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	bLocked = MQTT_Callbacks_Lock();
+	res = MQTT_SetPublishPolicy(Tokenizer_GetArg(0), Tokenizer_GetArgInteger(1),
+		Tokenizer_GetArgsCount() >= 3 ? Tokenizer_GetArgInteger(2) : -1);
+	MQTT_Callbacks_Unlock(bLocked);
+	if (res == -1) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Bad topic filter or QoS/retain value");
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	if (res) {
+		return CMD_RES_ERROR;
+	}
+	return CMD_RES_OK;
+}
+commandResult_t MQTT_SetQueueCoalesce(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() >= 1) {
+		g_queueCoalesce = Tokenizer_GetArgInteger(0);
+	}
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish queue coalesce %i, queued %i, coalesced %i, dropped %i",
+		g_queueCoalesce, g_MqttPublishItemsQueued, g_queueCoalesced, g_queueDropped);
+
+	return CMD_RES_OK;
+}
+int MQTT_GetProtocolVersion() {
+#if LWIP_MQTT_V5
+	if (g_mqttProtocolVersion == MQTT5_PROTOCOL_LEVEL && !g_mqttV5Fallback) {
+		return MQTT5_PROTOCOL_LEVEL;
+	}
+#endif
+	return MQTT311_PROTOCOL_LEVEL;
+}
+#if LWIP_MQTT_V5
+// mqtt_version [4 or 5] [TelemetryExpirySeconds]
+// only in builds whose lwIP MQTT client can speak MQTT 5, others have just 3.1.1
+commandResult_t MQTT_SetProtocolVersion(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	int version;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT protocol level %i, asked %i, telemetry expiry %i",
+			MQTT_GetProtocolVersion(), g_mqttProtocolVersion, g_mqttTelemetryExpiry);
+		return CMD_RES_OK;
+	}
+	version = Tokenizer_GetArgInteger(0);
+	if (version != MQTT311_PROTOCOL_LEVEL && version != MQTT5_PROTOCOL_LEVEL) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Protocol level must be 4 (3.1.1) or 5");
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	if (Tokenizer_GetArgsCount() >= 2) {
+		g_mqttTelemetryExpiry = Tokenizer_GetArgInteger(1);
+	}
+	if (version != g_mqttProtocolVersion || g_mqttV5Fallback) {
+		g_mqttProtocolVersion = version;
+		g_mqttV5Fallback = 0;
+		// new connection is needed
+		mqtt_reconnect = 5;
+	}
+	return CMD_RES_OK;
+}
+#endif
+commandResult_t MQTT_SetAggregate(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	bool bLocked;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Requires 1 arg");
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	g_aggregateMode = Tokenizer_GetArgInteger(0);
+	if (Tokenizer_GetArgsCount() >= 2) {
+		g_aggregateInterval = Tokenizer_GetArgInteger(1);
+		if (g_aggregateInterval < 1) {
+			g_aggregateInterval = 1;
+		}
+	}
+	g_aggregateCountdown = g_aggregateInterval;
+	bLocked = MQTT_Aggregate_Lock();
+	memset(g_aggregateDirty, 0, sizeof(g_aggregateDirty));
+	MQTT_Aggregate_Unlock(bLocked);
+	// start with complete state
+	g_aggregateForceFull = 1;
+
+	return CMD_RES_OK;
+}
 static BENCHMARK_TEST_INFO* info = NULL;
 
 #if WINDOWS
@@ -1602,6 +2406,7 @@ void MQTT_InitCallbacks() {
 
 	MQTT_ClearCallbacks();
 	g_mqtt_bBaseTopicDirty = 0;
+	MQTT_RenderTopicPrefixes();
 
 	clientId = CFG_GetMQTTClientId();
 	groupId = CFG_GetMQTTGroupTopic();
@@ -1667,9 +2472,20 @@ void MQTT_init()
 	// WINDOWS must support reinit
 #ifdef WINDOWS
 	mqtt_client = 0;
+	if (g_queuePool) {
+		MQTT_Queue_Init();
+	}
+	g_aggregateMode = MQTT_AGGREGATE_OFF;
+	g_mqttProtocolVersion = MQTT311_PROTOCOL_LEVEL;
+	g_mqttV5Fallback = 0;
+	g_mqttTelemetryExpiry = 0;
 #endif
 
 	MQTT_InitCallbacks();
+	MQTT_InitPublishPolicies();
+	MQTT_Dedup_Init();
+	MQTT_Offline_Init();
+	MQTT_Pacer_Init();
 
 	mqtt_initialised = 1;
 
@@ -1709,10 +2525,37 @@ void MQTT_init()
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("mqtt_broadcastInterval", MQTT_SetBroadcastInterval, NULL);
 	//cmddetail:{"name":"mqtt_broadcastItemsPerSec","args":"[PublishCountPerSecond]",
-	//cmddetail:"descr":"If broadcast self state (this option in flags) is started, then gradually device info is published, with a speed of N publishes per second. Do not set too high value, it may overload LWIP MQTT library. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"descr":"If broadcast self state (this option in flags) is started, then gradually device info is published, with a fixed speed of N publishes per second, instead of rate adapted by mqtt_broadcastPacing. Do not set too high value, it may overload LWIP MQTT library. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
 	//cmddetail:"fn":"MQTT_SetMaxBroadcastItemsPublishedPerSecond","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("mqtt_broadcastItemsPerSec", MQTT_SetMaxBroadcastItemsPublishedPerSecond, NULL);
+	//cmddetail:{"name":"mqtt_rxBufferSize","args":"[Bytes]",
+	//cmddetail:"descr":"Sets size of the ring buffer used to pass received MQTT messages from TCP thread to the main loop. A message larger than this (topic and payload) is dropped. Without argument, prints buffer usage, high water mark, overflow and drop counters. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"MQTT_SetRxBufferSize","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_rxBufferSize 8192"}
+	CMD_RegisterCommand("mqtt_rxBufferSize", MQTT_SetRxBufferSize, NULL);
+	//cmddetail:{"name":"mqtt_qos","args":"[TopicFilter][QoS][Retain]",
+	//cmddetail:"descr":"Sets QoS (0, 1 or 2) and optionally retain (0 or 1, -1 keeps what publisher asked for) for published topics matching given MQTT topic filter. Exact levels take priority over + and #, so for example tele/# overrides #. QoS -1 removes the entry. Without arguments, prints the table. Defaults: +/+/get and tele/# use QoS 0, everything else QoS 1, +/connected is retained. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"MQTT_SetQoSPolicy","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_qos obk0696FB33/+/get 1 1"}
+	CMD_RegisterCommand("mqtt_qos", MQTT_SetQoSPolicy, NULL);
+	//cmddetail:{"name":"mqtt_queueCoalesce","args":"[0or1]",
+	//cmddetail:"descr":"Enables (default) or disables coalescing in publish queue. When enabled, a value queued for a topic that is still waiting to be published replaces the waiting one instead of taking another slot. Prints queue statistics.",
+	//cmddetail:"fn":"MQTT_SetQueueCoalesce","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("mqtt_queueCoalesce", MQTT_SetQueueCoalesce, NULL);
+	//cmddetail:{"name":"mqtt_aggregate","args":"[Mode][IntervalSeconds]",
+	//cmddetail:"descr":"Publishes channels as a single JSON message (like {\"1\":0,\"2\":21.5}) to obk0696FB33/channels/get instead of one publish per channel. Mode 0 is off (default), 1 publishes all channels every interval, 2 publishes only channels changed since last message. Relay channels are still also published on their own right away. Note that Home Assistant discovery uses per channel topics. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"MQTT_SetAggregate","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_aggregate 2 10"}
+	CMD_RegisterCommand("mqtt_aggregate", MQTT_SetAggregate, NULL);
+#if LWIP_MQTT_V5
+	//cmddetail:{"name":"mqtt_version","args":"[4or5][TelemetryExpirySeconds]",
+	//cmddetail:"descr":"Sets MQTT protocol level, 4 is 3.1.1 (default), 5 is MQTT 5. With MQTT 5, repeated topics are sent as short topic aliases (if broker allows them), not retained publishes get message expiry of TelemetryExpirySeconds (0 = none), and broker reason codes are logged. If broker does not support MQTT 5, 3.1.1 is used. Causes reconnect. Only available where lwIP MQTT client supports MQTT 5 (LWIP_MQTT_V5), currently the simulator; device SDK clients speak only 3.1.1.",
+	//cmddetail:"fn":"MQTT_SetProtocolVersion","file":"mqtt/new_mqtt.c","requires":"LWIP_MQTT_V5",
+	//cmddetail:"examples":"mqtt_version 5 60"}
+	CMD_RegisterCommand("mqtt_version", MQTT_SetProtocolVersion, NULL);
+#endif
 }
 
 OBK_Publish_Result MQTT_DoItemPublishString(const char* sChannel, const char* valueStr)
@@ -1788,25 +2631,16 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 		break;
 	}
 
-	// Do not publish raw channel value for channels like PWM values, RGBCW has 5 raw channels.
-	// We do not need raw values for RGBCW lights (or RGB, etc)
-	// because we are using led_basecolor_rgb, led_dimmer, led_enableAll, etc
 	// NOTE: negative indexes are not channels - they are special values
-	bWantsToPublish = false;
-	if (CHANNEL_HasRoleThatShouldBePublished(idx)) {
-		bWantsToPublish = true;
-	}
-#ifdef ENABLE_DRIVER_TUYAMCU
-	// publish if channel is used by TuyaMCU (no pin role set), for example door sensor state with power saving V0 protocol
-	// Not enabled by default, you have to set OBK_FLAG_TUYAMCU_ALWAYSPUBLISHCHANNELS flag
-	if (!bWantsToPublish && CFG_HasFlag(OBK_FLAG_TUYAMCU_ALWAYSPUBLISHCHANNELS) && TuyaMCU_IsChannelUsedByTuyaMCU(idx)) {
-		bWantsToPublish = true;
-	}
-#endif
+	bWantsToPublish = MQTT_ShouldPublishChannel(idx);
 	// TODO
 	//type = CHANNEL_GetType(idx);
 	if (bWantsToPublish) 
     {
+		// channels go in one message, see MQTT_PublishAggregatedChannels
+		if (g_aggregateMode != MQTT_AGGREGATE_OFF) {
+			return OBK_PUBLISH_WAS_NOT_REQUIRED;
+		}
 		return MQTT_ChannelPublish(g_publishItemIndex, OBK_PUBLISH_FLAG_MUTEX_SILENT);
 	}
 
@@ -1821,6 +2655,8 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 int MQTT_RunQuickTick(){
 #ifndef PLATFORM_BEKEN
 	// on Beken, we use a one-shot timer for this.
+	// Elsewhere MQTT_TriggerRead wakes the quick tick thread early,
+	// this is only a fallback so nothing is left in the ring.
 	MQTT_process_received();
 #endif
 	return 0;
@@ -1857,6 +2693,9 @@ int MQTT_RunEverySecondUpdate()
 	if (!mqtt_initialised)
 		return 0;
 
+	// publishes while offline are only kept in RAM, file is written from here
+	MQTT_Offline_SaveEverySecond();
+
 	if (Main_HasWiFiConnected() == 0)
 	{
 		mqtt_reconnect = 0;
@@ -1944,6 +2783,9 @@ int MQTT_RunEverySecondUpdate()
 		// things to do in our threads on connection accepted.
 		if (g_just_connected){
 			g_just_connected = 0;
+			MQTT_Pacer_Reset();
+			// broker may have lost retained discovery, so next one publishes all
+			hass_discovery_forget();
 			// publish TELE
 			MQTT_BroadcastTasmotaTeleSTATE();
 			// publish all values on state
@@ -1991,6 +2833,13 @@ int MQTT_RunEverySecondUpdate()
 			}
 		}
 
+		MQTT_Pacer_RunEverySecond(MQTT_GetOutputFree(), MQTT_OUTPUT_RINGBUF_SIZE);
+		MQTT_Aggregate_RunEverySecond();
+		// replay what was stored while offline, but only when live data was already sent
+		if (g_MqttPublishItemsQueued == 0 && g_bPublishAllStatesNow == 0) {
+			MQTT_Offline_RunEverySecond();
+		}
+
 		// do we want to broadcast full state?
 		// Do it slowly in order not to overload the buffers
 		// The item indexes start at negative values for special items
@@ -2007,10 +2856,17 @@ int MQTT_RunEverySecondUpdate()
 			//if (g_timeSinceLastMQTTPublish > 2)
 			{
 				OBK_Publish_Result publishRes;
-				int g_sent_thisFrame = 0;
+				int bHasToken = 0;
 
 				while (g_publishItemIndex < CHANNEL_MAX)
 				{
+					// token is taken before publish, and kept for next item if this one was not required
+					if (bHasToken == 0) {
+						bHasToken = MQTT_Pacer_Take();
+						if (bHasToken == 0) {
+							break;
+						}
+					}
 					publishRes = MQTT_DoItemPublish(g_publishItemIndex);
 					if (publishRes != OBK_PUBLISH_WAS_NOT_REQUIRED)
 					{
@@ -2020,12 +2876,7 @@ int MQTT_RunEverySecondUpdate()
 					// OBK_PUBLISH_OK - it was required and was published
 					if (publishRes == OBK_PUBLISH_OK)
 					{
-						g_sent_thisFrame++;
-						if (g_sent_thisFrame >= g_maxBroadcastItemsPublishedPerSecond)
-						{
-							g_publishItemIndex++;
-							break;
-						}
+						bHasToken = 0;
 					}
 					// OBK_PUBLISH_MUTEX_FAIL - MQTT is busy
 					if (publishRes == OBK_PUBLISH_MUTEX_FAIL
@@ -2063,84 +2914,252 @@ int MQTT_RunEverySecondUpdate()
 	return 1;
 }
 
-MqttPublishItem_t* get_queue_tail(MqttPublishItem_t* head) {
-	if (head == NULL) { return NULL; }
+/////////////////////////////////////////////////////////////
+// Publish queue. Items live in a fixed pool, allocated on first use,
+// and are linked by index into one FIFO per priority, so both enqueue
+// and dequeue are O(1). With coalescing on, queueing the same topic/channel
+// again only replaces the value of the item still waiting (latest value wins).
+// Waiting items are found by a small hash table.
+//
+static bool MQTT_Queue_Lock() {
+	if (g_queueMutex == 0)
+	{
+		g_queueMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_queueMutex, portMAX_DELAY) == pdTRUE;
+}
 
-	while (head->next != NULL) {
-		head = head->next;
+static void MQTT_Queue_Unlock(bool bTaken) {
+	if (bTaken) {
+		xSemaphoreGive(g_queueMutex);
 	}
-	return head;
 }
 
-MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
-	while (head != NULL) {
-		if (MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {
-			return head;
+static int MQTT_Queue_Init() {
+	int i;
+
+	if (g_queuePool == 0) {
+		g_queuePool = (MqttPublishItem_t*)os_malloc(sizeof(MqttPublishItem_t) * MQTT_MAX_QUEUE_SIZE);
+		if (g_queuePool == 0) {
+			return 0;
 		}
-		head = head->next;
 	}
-	return head;
+	for (i = 0; i < MQTT_MAX_QUEUE_SIZE; i++) {
+		g_queuePool[i].next = (i + 1 < MQTT_MAX_QUEUE_SIZE) ? i + 1 : -1;
+	}
+	g_queueFree = 0;
+	for (i = 0; i < MQTT_QUEUE_PRIORITIES; i++) {
+		g_queueHeads[i] = g_queueTails[i] = -1;
+	}
+	for (i = 0; i < MQTT_QUEUE_HASH_SIZE; i++) {
+		g_queueHash[i] = -1;
+	}
+	g_queueLast = -1;
+	g_queueReserved = -1;
+	g_queuePublishing = -1;
+	g_MqttPublishItemsQueued = 0;
+	return 1;
 }
 
-/// @brief Queue an entry for publish and execute a command after the publish.
-/// @param topic 
-/// @param channel 
-/// @param value 
-/// @param flags
-/// @param command Command to execute after the publish
-void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
-	MqttPublishItem_t* newItem;
-	if (g_MqttPublishItemsQueued >= MQTT_MAX_QUEUE_SIZE) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
-		return;
+static unsigned int MQTT_Queue_Hash(const char* topic, const char* channel) {
+	unsigned int h = 2166136261u;
+
+	while (*topic) {
+		h = (h ^ (unsigned char)*topic++) * 16777619u;
+	}
+	h = (h ^ '/') * 16777619u;
+	while (*channel) {
+		h = (h ^ (unsigned char)*channel++) * 16777619u;
 	}
+	return h;
+}
 
-	if ((strlen(topic) > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
-		(strlen(channel) > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
-		(strlen(value) > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
-			strlen(topic), strlen(channel), strlen(value));
-		return;
+static int MQTT_Queue_Find(unsigned int hash, const char* topic, const char* channel) {
+	int i;
+
+	for (i = g_queueHash[hash % MQTT_QUEUE_HASH_SIZE]; i != -1; i = g_queuePool[i].hashNext) {
+		if (g_queuePool[i].hash == hash && !strcmp(g_queuePool[i].topic, topic) && !strcmp(g_queuePool[i].channel, channel)) {
+			return i;
+		}
 	}
+	return -1;
+}
 
-	//Queue data for publish. This might be a new item in the queue or an existing item. This is done to prevent
-	//memory fragmentation. The total queue length is limited to MQTT_MAX_QUEUE_SIZE.
+// removes first item of given priority and puts it on the free list
+static void MQTT_Queue_PopHead(int priority) {
+	MqttPublishItem_t* item;
+	short* slot;
+	int i = g_queueHeads[priority];
 
-	if (g_MqttPublishQueueHead == NULL) {
-		g_MqttPublishQueueHead = newItem = os_malloc(sizeof(MqttPublishItem_t));
-		newItem->next = NULL;
+	item = &g_queuePool[i];
+	g_queueHeads[priority] = item->next;
+	if (g_queueHeads[priority] == -1) {
+		g_queueTails[priority] = -1;
+	}
+	slot = &g_queueHash[item->hash % MQTT_QUEUE_HASH_SIZE];
+	while (*slot != i) {
+		slot = &g_queuePool[*slot].hashNext;
+	}
+	*slot = item->hashNext;
+	if (g_queueLast == i) {
+		g_queueLast = -1;
+	}
+	item->next = g_queueFree;
+	g_queueFree = i;
+	g_MqttPublishItemsQueued--;
+}
+
+static int MQTT_Queue_FirstPriority() {
+	int p;
+
+	// heads are set up with pool, on first queued publish
+	if (g_queuePool == 0) {
+		return -1;
+	}
+	for (p = 0; p < MQTT_QUEUE_PRIORITIES; p++) {
+		if (g_queueHeads[p] != -1) {
+			return p;
+		}
+	}
+	return -1;
+}
+
+// both commands are to be run after publish, PublishAll covers channels too
+static PostPublishCommands MQTT_Queue_MergeCommands(PostPublishCommands a, PostPublishCommands b) {
+	if (a == PublishAll || b == PublishAll) {
+		return PublishAll;
+	}
+	if (a == PublishChannels || b == PublishChannels) {
+		return PublishChannels;
+	}
+	return None;
+}
+
+// adds entry to queue, queue lock must be held.
+// Reserved item given is used for new entry, or put back on free list if waiting entry is replaced
+static void MQTT_Queue_Add(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command, int reserved) {
+	MqttPublishItem_t* newItem;
+	unsigned int hash;
+	int priority;
+	int i;
+
+	// command results go before telemetry
+	priority = MQTT_QUEUE_PRIORITY_NORMAL;
+	if ((flags & OBK_PUBLISH_FLAG_QUEUE_PRIORITY) || !strncmp(topic, "stat/", 5)) {
+		priority = MQTT_QUEUE_PRIORITY_HIGH;
+	}
+	hash = MQTT_Queue_Hash(topic, channel);
+
+	if (g_queueCoalesce) {
+		i = MQTT_Queue_Find(hash, topic, channel);
+		// item being published can't be changed any more
+		if (i != -1 && i != g_queuePublishing) {
+			newItem = &g_queuePool[i];
+			strcpy(newItem->value, value);
+			newItem->flags = flags;
+			newItem->command = MQTT_Queue_MergeCommands(newItem->command, command);
+			if (reserved != -1) {
+				g_queuePool[reserved].next = g_queueFree;
+				g_queueFree = reserved;
+			}
+			g_queueLast = i;
+			g_queueCoalesced++;
+			addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Queued topic=%s/%s replaced waiting value", topic, channel);
+			return;
+		}
 	}
-	else {
-		newItem = find_queue_reusable_item(g_MqttPublishQueueHead);
 
-		if (newItem == NULL) {
-			newItem = os_malloc(sizeof(MqttPublishItem_t));
-			newItem->next = NULL;
-			get_queue_tail(g_MqttPublishQueueHead)->next = newItem; //Append new item
+	if (reserved == -1) {
+		if (g_queueFree == -1) {
+			// make room for important one by dropping oldest less important one
+			if (priority == MQTT_QUEUE_PRIORITY_HIGH && g_queueHeads[MQTT_QUEUE_PRIORITY_NORMAL] != -1
+				&& g_queueHeads[MQTT_QUEUE_PRIORITY_NORMAL] != g_queuePublishing) {
+				// its command is run after new one is published instead
+				command = MQTT_Queue_MergeCommands(command, g_queuePool[g_queueHeads[MQTT_QUEUE_PRIORITY_NORMAL]].command);
+				MQTT_Queue_PopHead(MQTT_QUEUE_PRIORITY_NORMAL);
+				g_queueDropped++;
+			}
+			else {
+				g_queueDropped++;
+				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
+				return;
+			}
 		}
+		i = g_queueFree;
+		newItem = &g_queuePool[i];
+		g_queueFree = newItem->next;
+		//os_strcpy does copy ending null character.
+		os_strcpy(newItem->value, value);
+	}
+	else {
+		// value is already in place
+		i = reserved;
+		newItem = &g_queuePool[i];
 	}
 
-	//os_strcpy does copy ending null character.
 	os_strcpy(newItem->topic, topic);
 	os_strcpy(newItem->channel, channel);
-	os_strcpy(newItem->value, value);
 	newItem->command = command;
 	newItem->flags = flags;
+	newItem->hash = hash;
+	newItem->next = -1;
+	if (g_queueTails[priority] == -1) {
+		g_queueHeads[priority] = i;
+	}
+	else {
+		g_queuePool[g_queueTails[priority]].next = i;
+	}
+	g_queueTails[priority] = i;
+	newItem->hashNext = g_queueHash[hash % MQTT_QUEUE_HASH_SIZE];
+	g_queueHash[hash % MQTT_QUEUE_HASH_SIZE] = i;
+	g_queueLast = i;
 
 	g_MqttPublishItemsQueued++;
 	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", newItem->topic, newItem->channel, g_MqttPublishItemsQueued);
 }
 
+/// @brief Queue an entry for publish and execute a command after the publish.
+/// @param topic 
+/// @param channel 
+/// @param value 
+/// @param flags
+/// @param command Command to execute after the publish
+void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
+	bool bLocked;
+
+	if ((strlen(topic) >= MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
+		(strlen(channel) >= MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
+		(strlen(value) >= MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
+			strlen(topic), strlen(channel), strlen(value));
+		return;
+	}
+	bLocked = MQTT_Queue_Lock();
+	if (bLocked == false) {
+		return;
+	}
+	if (g_queuePool == 0 && MQTT_Queue_Init() == 0) {
+		MQTT_Queue_Unlock(bLocked);
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Out of memory\r\n");
+		return;
+	}
+	MQTT_Queue_Add(topic, channel, value, flags, command, -1);
+	MQTT_Queue_Unlock(bLocked);
+}
+
 /// @brief Add the specified command to the last entry in the queue.
 /// @param command 
 void MQTT_InvokeCommandAtEnd(PostPublishCommands command) {
-	MqttPublishItem_t* tail = get_queue_tail(g_MqttPublishQueueHead);
-	if (tail == NULL){
+	bool bLocked;
+
+	bLocked = MQTT_Queue_Lock();
+	if (g_queueLast == -1){
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
 	}
 	else {
-		tail->command = command;
+		g_queuePool[g_queueLast].command = command;
 	}
+	MQTT_Queue_Unlock(bLocked);
 }
 
 /// @brief Queue an entry for publish.
@@ -2152,44 +3171,134 @@ void MQTT_QueuePublish(const char* topic, const char* channel, const char* value
 	MQTT_QueuePublishWithCommand(topic, channel, value, flags, None);
 }
 
+/// @brief Takes free queue item, so that long value can be written in place instead of copied.
+/// It must be given back by MQTT_QueuePublishCommit or MQTT_QueuePublishCancel. Only one item can be reserved at a time.
+/// @return Value buffer of MQTT_PUBLISH_ITEM_VALUE_LENGTH bytes, or NULL if queue is full
+char* MQTT_QueuePublishReserve() {
+	char* value = 0;
+	bool bLocked;
+
+	bLocked = MQTT_Queue_Lock();
+	if (bLocked == false) {
+		return 0;
+	}
+	if (g_queuePool == 0 && MQTT_Queue_Init() == 0) {
+		MQTT_Queue_Unlock(bLocked);
+		return 0;
+	}
+	if (g_queueFree != -1 && g_queueReserved == -1) {
+		g_queueReserved = g_queueFree;
+		g_queueFree = g_queuePool[g_queueReserved].next;
+		value = g_queuePool[g_queueReserved].value;
+	}
+	MQTT_Queue_Unlock(bLocked);
+	return value;
+}
+
+/// @brief Queues reserved item with value written in it, like MQTT_QueuePublish.
+/// @param topic 
+/// @param channel 
+/// @param flags 
+void MQTT_QueuePublishCommit(const char* topic, const char* channel, int flags) {
+	bool bLocked;
+	int reserved;
+
+	if ((strlen(topic) >= MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
+		(strlen(channel) >= MQTT_PUBLISH_ITEM_CHANNEL_LENGTH)) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i) or channel (%i) exceeds size limit\r\n",
+			strlen(topic), strlen(channel));
+		MQTT_QueuePublishCancel();
+		return;
+	}
+	bLocked = MQTT_Queue_Lock();
+	if (bLocked == false) {
+		return;
+	}
+	reserved = g_queueReserved;
+	if (reserved != -1) {
+		g_queueReserved = -1;
+		MQTT_Queue_Add(topic, channel, g_queuePool[reserved].value, flags, None, reserved);
+	}
+	MQTT_Queue_Unlock(bLocked);
+}
+
+void MQTT_QueuePublishCancel() {
+	bool bLocked;
+
+	bLocked = MQTT_Queue_Lock();
+	if (bLocked == false) {
+		return;
+	}
+	if (g_queueReserved != -1) {
+		g_queuePool[g_queueReserved].next = g_queueFree;
+		g_queueFree = g_queueReserved;
+		g_queueReserved = -1;
+	}
+	MQTT_Queue_Unlock(bLocked);
+}
+
+void MQTT_GetQueueStats(int* queued, int* coalesced, int* dropped) {
+	*queued = g_MqttPublishItemsQueued;
+	*coalesced = g_queueCoalesced;
+	*dropped = g_queueDropped;
+}
 
 /// @brief Publish MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE queued items.
+/// Head item is published without queue lock, it is marked so that it is neither changed nor dropped meanwhile.
 /// @return 
 OBK_Publish_Result PublishQueuedItems() {
 	OBK_Publish_Result result = OBK_PUBLISH_WAS_NOT_REQUIRED;
-
+	MqttPublishItem_t* head;
+	PostPublishCommands command;
+	bool bLocked;
+	int priority;
 	int count = 0;
-	MqttPublishItem_t* head = g_MqttPublishQueueHead;
-
-	//The next actionable item might not be at the front. The queue size is limited to MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE
-	//so this traversal is fast.
-	//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems g_MqttPublishItemsQueued=%i",g_MqttPublishItemsQueued );
-	while ((head != NULL) && (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (g_MqttPublishItemsQueued > 0)) {
-		if (!MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {  //Skip reusable entries
-			count++;
-			result = MQTT_PublishTopicToClient(mqtt_client, head->topic, head->channel, head->value, head->flags, false);
-			MQTT_QUEUE_ITEM_SET_REUSABLE(head); //Flag item as reusable
-			g_MqttPublishItemsQueued--;   //decrement queued count
-
-			//Stop if last publish failed
-			if (result != OBK_PUBLISH_OK) break;
-
-			switch (head->command) {
-			case None:
-				break;
-			case PublishAll:
-				MQTT_PublishWholeDeviceState_Internal(true);
-				break;
-			case PublishChannels:
-				MQTT_PublishOnlyDeviceChannelsIfPossible();
-				break;
-			}
+
+	while (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) {
+		bLocked = MQTT_Queue_Lock();
+		if (bLocked == false) {
+			break;
 		}
-		else {
-			//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems item skipped reusable");
+		priority = MQTT_Queue_FirstPriority();
+		if (priority == -1) {
+			MQTT_Queue_Unlock(bLocked);
+			break;
+		}
+		g_queuePublishing = g_queueHeads[priority];
+		MQTT_Queue_Unlock(bLocked);
+
+		head = &g_queuePool[g_queuePublishing];
+		count++;
+		result = MQTT_PublishTopicToClient(mqtt_client, -1, head->topic, -1, head->channel, head->value, head->flags, false);
+		if (result == OBK_PUBLISH_OK && (head->flags & OBK_PUBLISH_FLAG_HASS_CONFIG)) {
+			hass_discovery_onPublished(head->topic, head->channel, head->value);
 		}
 
-		head = head->next;
+		bLocked = MQTT_Queue_Lock();
+		g_queuePublishing = -1;
+		// keep it for later if it was not sent because of connection state
+		if (result == OBK_PUBLISH_WAS_DISCONNECTED || result == OBK_PUBLISH_MUTEX_FAIL) {
+			MQTT_Queue_Unlock(bLocked);
+			break;
+		}
+		command = head->command;
+		// nothing else takes items off the queue, so it is still the head
+		MQTT_Queue_PopHead(priority);
+		MQTT_Queue_Unlock(bLocked);
+
+		//Stop if last publish failed
+		if (result != OBK_PUBLISH_OK) break;
+
+		switch (command) {
+		case None:
+			break;
+		case PublishAll:
+			MQTT_PublishWholeDeviceState_Internal(true);
+			break;
+		case PublishChannels:
+			MQTT_PublishOnlyDeviceChannelsIfPossible();
+			break;
+		}
 	}
 
 	return result;
@@ -18,6 +18,13 @@ extern mqtt_client_t* mqtt_client;
 
 void MQTT_init();
 int MQTT_RunQuickTick();
+// processes everything waiting in the rx ring, returns number of messages
+int MQTT_process_received();
+// called from tcp_thread when a message is complete, wakes the thread that runs
+// MQTT_process_received, implemented per platform (hal_main_bk7231.c, user_main.c)
+void MQTT_TriggerRead();
+// milliseconds, used for rx latency and broadcast pacing
+unsigned int MQTT_GetTimeMS();
 int MQTT_RunEverySecondUpdate();
 void MQTT_BroadcastTasmotaTeleSTATE();
 void MQTT_BroadcastTasmotaTeleSENSOR();
@@ -60,15 +67,24 @@ enum OBK_Publish_Result_e {
 #define OBK_PUBLISH_FLAG_MUTEX_SILENT			1
 #define OBK_PUBLISH_FLAG_RETAIN					2
 #define OBK_PUBLISH_FLAG_FORCE_REMOVE_GET		4
+// publish queue only: send before normal items
+#define OBK_PUBLISH_FLAG_QUEUE_PRIORITY			8
+// set by deduper, so publish is not routed into it again
+#define OBK_PUBLISH_FLAG_NO_DEDUP				16
+// HA discovery config, hass_discovery_onPublished is told once it is published
+#define OBK_PUBLISH_FLAG_HASS_CONFIG			32
 
 #include "new_mqtt_deduper.h"
+#include "new_mqtt_offline.h"
 
 
 // ability to register callbacks for MQTT data
 typedef struct obk_mqtt_request_tag {
-	const unsigned char* received; // note: NOT terminated, may be binary
+	// note: may be binary, but there is always a NUL after receivedLen bytes
+	const unsigned char* received;
 	int receivedLen;
-	char topic[128];
+	// points into receive ring, only valid during callback
+	const char* topic;
 } obk_mqtt_request_t;
 
 #define MQTT_PUBLISH_ITEM_TOPIC_LENGTH    64
@@ -89,10 +105,18 @@ typedef struct MqttPublishItem
 	char channel[MQTT_PUBLISH_ITEM_CHANNEL_LENGTH];
 	char value[MQTT_PUBLISH_ITEM_VALUE_LENGTH];
 	int flags;
-	struct MqttPublishItem* next;
 	PostPublishCommands command;
+	// hash of topic and channel, for coalescing
+	unsigned int hash;
+	// indexes in queue pool, -1 is none
+	short next;
+	short hashNext;
 } MqttPublishItem_t;
 
+#define MQTT_QUEUE_PRIORITY_HIGH	0
+#define MQTT_QUEUE_PRIORITY_NORMAL	1
+#define MQTT_QUEUE_PRIORITIES		2
+
 
 // Maximum length to log data parameters
 #define MQTT_MAX_DATA_LOG_LENGTH					12
@@ -106,8 +130,10 @@ typedef struct MqttPublishItem
 // return 1 to 'eat the packet and terminate further processing.
 typedef int (*mqtt_callback_fn)(obk_mqtt_request_t* request);
 
-// topics must be unique (i.e. you can't have /about and /aboutme or /about/me)
-// ALL topics currently must start with main device topic root.
+// Incoming topics are dispatched by subscription topic, which may contain MQTT
+// wildcards (+ for one level, # for all remaining levels). If subscription topic
+// is empty, base topic is used as a prefix. When more than one callback matches,
+// exact levels are tried first, then +, then #, until one returns 1.
 // ID is unique and non-zero - so that callbacks can be replaced....
 int MQTT_GetConnectEvents(void);
 const char* get_error_name(int err);
@@ -129,6 +155,13 @@ int MQTT_RemoveCallback(int ID);
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen);
 int MQTT_Post_Received_Str(const char *topic, const char *data);
+void MQTT_GetRxBufferStats(int* size, int* used, int* highWater, int* overflows, int* drops);
+// receipt to dispatch latency in ms, reset by mqtt_rxBufferSize
+void MQTT_GetRxLatencyStats(int* last, int* avg, int* max, int* count);
+void MQTT_GetPublishPathStats(int* allocs, int* lockWaits, int* lockFails);
+void MQTT_GetQueueStats(int* queued, int* coalesced, int* dropped);
+// protocol level in use, 4 (3.1.1) or 5
+int MQTT_GetProtocolVersion();
 
 void MQTT_GetStats(int* outUsed, int* outMax, int* outFreeMem);
 
@@ -140,6 +173,10 @@ OBK_Publish_Result MQTT_ChannelChangeCallback(int channel, int iVal);
 void MQTT_PublishOnlyDeviceChannelsIfPossible();
 void MQTT_QueuePublish(const char* topic, const char* channel, const char* value, int flags);
 void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command);
+// value written in place into queue item, see MQTT_QueuePublishReserve
+char* MQTT_QueuePublishReserve();
+void MQTT_QueuePublishCommit(const char* topic, const char* channel, int flags);
+void MQTT_QueuePublishCancel();
 OBK_Publish_Result MQTT_Publish(const char* sTopic, const char* sChannel, const char* value, int flags);
 OBK_Publish_Result MQTT_PublishStat(const char* statName, const char* statValue);
 OBK_Publish_Result MQTT_PublishTele(const char* teleName, const char* teleValue);
@@ -0,0 +1,206 @@
+
+#include "../new_common.h"
+#include "new_mqtt5.h"
+
+static unsigned int MQTT5_Hash(const char *s) {
+	unsigned int h = 2166136261u;
+
+	while (*s) {
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	}
+	return h;
+}
+
+void MQTT5_Alias_Reset(mqtt5AliasTable_t *t, int brokerMax) {
+	int i;
+
+	for (i = 0; i < t->used; i++) {
+		os_free(t->topics[i]);
+	}
+	memset(t, 0, sizeof(*t));
+	if (brokerMax > MQTT5_ALIAS_SLOTS) {
+		brokerMax = MQTT5_ALIAS_SLOTS;
+	}
+	t->max = brokerMax > 0 ? brokerMax : 0;
+}
+
+unsigned short MQTT5_Alias_Get(mqtt5AliasTable_t *t, const char *topic, int *bSendTopic) {
+	unsigned int h;
+	unsigned int *seen;
+	int i;
+
+	*bSendTopic = 1;
+	if (t->max == 0) {
+		return 0;
+	}
+	h = MQTT5_Hash(topic);
+	for (i = 0; i < t->used; i++) {
+		if (t->hashes[i] == h && !strcmp(t->topics[i], topic)) {
+			*bSendTopic = 0;
+			return i + 1;
+		}
+	}
+	seen = &t->seen[h % MQTT5_ALIAS_CANDIDATES];
+	if (*seen != h || t->used >= t->max) {
+		// first time seen (or no free aliases), not worth an alias yet
+		*seen = h;
+		return 0;
+	}
+	t->topics[t->used] = (char*)os_malloc(strlen(topic) + 1);
+	if (t->topics[t->used] == 0) {
+		return 0;
+	}
+	strcpy(t->topics[t->used], topic);
+	t->hashes[t->used] = h;
+	t->used++;
+	return t->used;
+}
+
+int MQTT5_VarIntSize(unsigned int v) {
+	int n = 1;
+
+	while (v >= 128) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+int MQTT5_WriteVarInt(unsigned char *out, unsigned int v) {
+	int n = 0;
+
+	do {
+		out[n] = (v & 0x7f) | (v >= 128 ? 0x80 : 0);
+		v >>= 7;
+		n++;
+	} while (v > 0);
+	return n;
+}
+
+int MQTT5_ReadVarInt(const unsigned char *p, int len, unsigned int *out) {
+	int n = 0;
+
+	*out = 0;
+	while (n < len && n < 4) {
+		*out |= (unsigned int)(p[n] & 0x7f) << (7 * n);
+		if ((p[n++] & 0x80) == 0) {
+			return n;
+		}
+	}
+	return 0;
+}
+
+int MQTT5_PublishPropsLen(unsigned short alias, unsigned int expiry) {
+	return (alias ? 3 : 0) + (expiry ? 5 : 0);
+}
+
+int MQTT5_WritePublishProps(unsigned char *out, unsigned short alias, unsigned int expiry) {
+	int n;
+
+	n = MQTT5_WriteVarInt(out, MQTT5_PublishPropsLen(alias, expiry));
+	if (expiry) {
+		out[n++] = MQTT5_PROP_MESSAGE_EXPIRY;
+		out[n++] = expiry >> 24;
+		out[n++] = expiry >> 16;
+		out[n++] = expiry >> 8;
+		out[n++] = expiry;
+	}
+	if (alias) {
+		out[n++] = MQTT5_PROP_TOPIC_ALIAS;
+		out[n++] = alias >> 8;
+		out[n++] = alias;
+	}
+	return n;
+}
+
+// returns size of property value, or -1 for unknown property
+static int MQTT5_PropertyValueLen(unsigned char id, const unsigned char *p, int len) {
+	unsigned int v;
+
+	switch (id) {
+	case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+		return 1;
+	case 0x13: case 0x21: case 0x22: case 0x23:
+		return 2;
+	case 0x02: case 0x11: case 0x18: case 0x27:
+		return 4;
+	case 0x0B:
+		return MQTT5_ReadVarInt(p, len, &v);
+	case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+		if (len < 2) {
+			return -1;
+		}
+		return 2 + ((p[0] << 8) | p[1]);
+	case 0x26:
+		// string pair
+		if (len < 2 || len < 4 + ((p[0] << 8) | p[1])) {
+			return -1;
+		}
+		v = 2 + ((p[0] << 8) | p[1]);
+		return v + 2 + ((p[v] << 8) | p[v + 1]);
+	}
+	return -1;
+}
+
+int MQTT5_GetPropertyU16(const unsigned char *props, int len, unsigned char id, unsigned short *out) {
+	int i = 0;
+	int vlen;
+
+	while (i < len) {
+		vlen = MQTT5_PropertyValueLen(props[i], props + i + 1, len - i - 1);
+		if (vlen <= 0 || i + 1 + vlen > len) {
+			return -1;
+		}
+		if (props[i] == id && vlen == 2) {
+			*out = (props[i + 1] << 8) | props[i + 2];
+			return 1;
+		}
+		i += 1 + vlen;
+	}
+	return 0;
+}
+
+int MQTT_PublishPacketSize(int protocolLevel, int topicLen, int payloadLen, int qos, unsigned short alias, unsigned int expiry) {
+	int rem;
+	int props;
+
+	rem = 2 + topicLen + (qos ? 2 : 0) + payloadLen;
+	if (protocolLevel >= MQTT5_PROTOCOL_LEVEL) {
+		props = MQTT5_PublishPropsLen(alias, expiry);
+		rem += MQTT5_VarIntSize(props) + props;
+	}
+	return 1 + MQTT5_VarIntSize(rem) + rem;
+}
+
+const char *MQTT5_ReasonCodeStr(int code) {
+	switch (code) {
+	case 0x00: return "Success";
+	case 0x10: return "No matching subscribers";
+	case 0x80: return "Unspecified error";
+	case 0x81: return "Malformed packet";
+	case 0x82: return "Protocol error";
+	case 0x83: return "Implementation specific error";
+	case 0x84: return "Unsupported protocol version";
+	case 0x85: return "Client identifier not valid";
+	case 0x86: return "Bad user name or password";
+	case 0x87: return "Not authorized";
+	case 0x88: return "Server unavailable";
+	case 0x89: return "Server busy";
+	case 0x8A: return "Banned";
+	case 0x8B: return "Server shutting down";
+	case 0x8D: return "Keep alive timeout";
+	case 0x8E: return "Session taken over";
+	case 0x90: return "Topic name invalid";
+	case 0x93: return "Receive maximum exceeded";
+	case 0x94: return "Topic alias invalid";
+	case 0x95: return "Packet too large";
+	case 0x96: return "Message rate too high";
+	case 0x97: return "Quota exceeded";
+	case 0x99: return "Payload format invalid";
+	case 0x9A: return "Retain not supported";
+	case 0x9B: return "QoS not supported";
+	case 0x9C: return "Use another server";
+	case 0x9F: return "Connection rate exceeded";
+	}
+	return "";
+}
@@ -0,0 +1,61 @@
+#ifndef __NEW_MQTT5_H__
+#define __NEW_MQTT5_H__
+
+// MQTT 5 protocol helpers, independent of the client implementation.
+// lwIP ports that can speak MQTT 5 define LWIP_MQTT_V5 and use these to
+// encode properties, manage outgoing topic aliases and describe reason codes.
+// Only the simulator's lwIP stub does so for now. Device SDK clients speak 3.1.1 only,
+// so MQTT 5 on a device needs an SDK lwIP port with MQTT 5 support first.
+
+#define MQTT5_PROTOCOL_LEVEL 5
+#define MQTT311_PROTOCOL_LEVEL 4
+
+// property identifiers used by us
+#define MQTT5_PROP_MESSAGE_EXPIRY 0x02
+#define MQTT5_PROP_RECEIVE_MAXIMUM 0x21
+#define MQTT5_PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT5_PROP_TOPIC_ALIAS 0x23
+#define MQTT5_PROP_REASON_STRING 0x1F
+
+// CONNACK reason code sent by MQTT 5 brokers for unsupported protocol version
+#define MQTT5_RC_UNSUPPORTED_PROTOCOL_VERSION 0x84
+
+// how many topics can get an alias, broker may allow less
+#define MQTT5_ALIAS_SLOTS 16
+// topics seen once are remembered by hash, so alias is given only to repeated ones
+#define MQTT5_ALIAS_CANDIDATES 32
+
+typedef struct mqtt5AliasTable_s {
+	// negotiated with broker (CONNACK Topic Alias Maximum), limited to MQTT5_ALIAS_SLOTS
+	unsigned short max;
+	unsigned short used;
+	unsigned int hashes[MQTT5_ALIAS_SLOTS];
+	char *topics[MQTT5_ALIAS_SLOTS];
+	unsigned int seen[MQTT5_ALIAS_CANDIDATES];
+} mqtt5AliasTable_t;
+
+// aliases are only valid for one connection, so reset it on every connect
+void MQTT5_Alias_Reset(mqtt5AliasTable_t *t, int brokerMax);
+// Returns alias to use for topic, or 0 if none. bSendTopic is set to 1 if the full topic
+// has to be sent too (no alias, or the first publish that establishes alias mapping).
+unsigned short MQTT5_Alias_Get(mqtt5AliasTable_t *t, const char *topic, int *bSendTopic);
+
+int MQTT5_VarIntSize(unsigned int v);
+int MQTT5_WriteVarInt(unsigned char *out, unsigned int v);
+// returns number of bytes used, or 0 if data is malformed/truncated
+int MQTT5_ReadVarInt(const unsigned char *p, int len, unsigned int *out);
+
+// length of PUBLISH properties (without the length field itself)
+int MQTT5_PublishPropsLen(unsigned short alias, unsigned int expiry);
+// writes properties with length field, returns bytes written
+int MQTT5_WritePublishProps(unsigned char *out, unsigned short alias, unsigned int expiry);
+// Finds two byte property in properties block (without length field), returns 1 if found.
+// Returns -1 if properties are malformed.
+int MQTT5_GetPropertyU16(const unsigned char *props, int len, unsigned char id, unsigned short *out);
+
+// total bytes of PUBLISH packet, computed from its fields, used by simulator to count wire bytes
+int MQTT_PublishPacketSize(int protocolLevel, int topicLen, int payloadLen, int qos, unsigned short alias, unsigned int expiry);
+
+const char *MQTT5_ReasonCodeStr(int code);
+
+#endif // __NEW_MQTT5_H__
@@ -19,103 +19,213 @@
 // If option above is enabled,
 // do not send the same publish (even with differnt value) more often that this:
 #define MIN_INTERVAL_BETWEEN_SENDS 1
+// must be power of two
+#define DEDUPER_HASH_SIZE 16
 
-// TODO: diferriate between string and int types, do not malloc buffer for int type
 typedef struct mqtt_dedup_slot_s {
 	int flags;
 	char name[DEDUPER_MAX_STRING_LEN];
+	// latest value, waiting to be sent if bValueDirty, heartbeat sends it too
 	char value[DEDUPER_MAX_STRING_LEN];
+	// value that was really sent, deadband is checked against it
+	char sentValue[DEDUPER_MAX_STRING_LEN];
 	// if dirty, then it needs to be resend manually
 	bool bValueDirty;
+	// set by mqtt_dedup command, otherwise defaults are used
+	bool bHasRule;
 	int timeSinceLastSend;
+	unsigned int hash;
+	// rule
+	int minInterval;
+	// 0 means no heartbeat, and equal values are never resent
+	int maxSilence;
+	float deadbandAbs;
+	float deadbandPercent;
+	struct mqtt_dedup_slot_s *next;
 } mqtt_dedup_slot_t;
 
-static mqtt_dedup_slot_t *mqtt_dedups[DEDUP_MAX];
+static mqtt_dedup_slot_t *mqtt_dedups[DEDUPER_HASH_SIZE];
+static int mqtt_dedup_rules = 0;
 
 static int stat_deduper_send = 0;
 static int stat_deduper_culled_duplicates = 0;
 static int stat_deduper_culled_tooFast = 0;
+static int stat_deduper_culled_deadband = 0;
+static int stat_deduper_heartbeats = 0;
 
-static SemaphoreHandle_t g_mutex = 0;
+static unsigned int DD_Hash(const char *s) {
+	unsigned int h = 2166136261u;
 
+	while (*s) {
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	}
+	return h;
+}
+
+static mqtt_dedup_slot_t *DD_Find(const char *name, unsigned int hash) {
+	mqtt_dedup_slot_t *slot;
+
+	for (slot = mqtt_dedups[hash & (DEDUPER_HASH_SIZE - 1)]; slot; slot = slot->next) {
+		if (slot->hash == hash && !strcmp(slot->name, name)) {
+			return slot;
+		}
+	}
+	return 0;
+}
+
+static mqtt_dedup_slot_t *DD_FindOrCreate(const char *name) {
+	mqtt_dedup_slot_t *slot;
+	unsigned int hash;
+
+	// longer names can't be stored, so they are not deduped at all
+	if (strlen(name) >= DEDUPER_MAX_STRING_LEN) {
+		return 0;
+	}
+	hash = DD_Hash(name);
+	slot = DD_Find(name, hash);
+	if (slot) {
+		return slot;
+	}
+	// alloc only when it's required
+	slot = (mqtt_dedup_slot_t*)malloc(sizeof(mqtt_dedup_slot_t));
+	if (slot == 0) {
+		return 0;
+	}
+	memset(slot, 0, sizeof(mqtt_dedup_slot_t));
+	strcpy(slot->name, name);
+	slot->hash = hash;
+	slot->timeSinceLastSend = 999;
+	slot->minInterval = MIN_INTERVAL_BETWEEN_SENDS;
+	slot->next = mqtt_dedups[hash & (DEDUPER_HASH_SIZE - 1)];
+	mqtt_dedups[hash & (DEDUPER_HASH_SIZE - 1)] = slot;
+	return slot;
+}
+
+static bool DD_ParseNumber(const char *s, float *out) {
+	char *end;
+
+	if (*s == 0) {
+		return false;
+	}
+	*out = (float)strtod(s, &end);
+	return *end == 0;
+}
 
-static bool DD_Mutex_Take(int del) {
-    int taken;
+#define DD_DIFFERENT	0
+#define DD_SAME			1
+#define DD_IN_DEADBAND	2
 
-    if (g_mutex == 0)
-    {
-        g_mutex = xSemaphoreCreateMutex();
-    }
-    taken = xSemaphoreTake(g_mutex, del);
-    if (taken == pdTRUE) {
-        return true;
-    }
-    return false;
+// tells if new value is worth sending: DD_SAME if it's the same as sent one,
+// DD_IN_DEADBAND if it's a number within deadband of sent one
+static int DD_CompareToSent(mqtt_dedup_slot_t *slot, const char *valueStr) {
+	float prev, cur, diff;
+
+	if (!strcmp(slot->sentValue, valueStr)) {
+		return DD_SAME;
+	}
+	if (slot->deadbandAbs <= 0 && slot->deadbandPercent <= 0) {
+		return DD_DIFFERENT;
+	}
+	if (!DD_ParseNumber(slot->sentValue, &prev) || !DD_ParseNumber(valueStr, &cur)) {
+		return DD_DIFFERENT;
+	}
+	diff = cur > prev ? cur - prev : prev - cur;
+	if (slot->deadbandAbs > 0 && diff <= slot->deadbandAbs) {
+		return DD_IN_DEADBAND;
+	}
+	if (slot->deadbandPercent > 0 && diff <= (prev > 0 ? prev : -prev) * slot->deadbandPercent * 0.01f) {
+		return DD_IN_DEADBAND;
+	}
+	return DD_DIFFERENT;
 }
 
-static void DD_Mutex_Free()
-{
-    xSemaphoreGive(g_mutex);
+static OBK_Publish_Result DD_Send(mqtt_dedup_slot_t *slot, const char *valueStr, int flags) {
+	OBK_Publish_Result res;
+
+	res = MQTT_PublishMain_StringString(slot->name, valueStr, flags | OBK_PUBLISH_FLAG_NO_DEDUP);
+	if (res == OBK_PUBLISH_OK) {
+		slot->bValueDirty = false;
+		// mark as sent
+		slot->timeSinceLastSend = 0;
+		// save previous value
+		strcpy_safe(slot->sentValue, valueStr, DEDUPER_MAX_STRING_LEN);
+		if (valueStr != slot->value) {
+			strcpy_safe(slot->value, valueStr, DEDUPER_MAX_STRING_LEN);
+		}
+		slot->flags = flags;
+	}
+	stat_deduper_send++;
+	return res;
 }
 
 void MQTT_Dedup_Tick() {
+	mqtt_dedup_slot_t *slot;
 	int i;
 
-	//if(DD_Mutex_Take(10)) {
-	//	return;
-	///}
-	for(i = 0; i < DEDUP_MAX; i++) {
-		if(mqtt_dedups[i]) {
-			mqtt_dedups[i]->timeSinceLastSend++;
+	for(i = 0; i < DEDUPER_HASH_SIZE; i++) {
+		for (slot = mqtt_dedups[i]; slot; slot = slot->next) {
+			slot->timeSinceLastSend++;
 #if DEDUPER_ENABLE_DELAY_SEND_OF_FAST_CHANGING_VALUES
-			if(mqtt_dedups[i]->timeSinceLastSend > MIN_INTERVAL_BETWEEN_SENDS && mqtt_dedups[i]->bValueDirty) {
+			if(slot->timeSinceLastSend > slot->minInterval && slot->bValueDirty) {
 				// Some values of this publish were not published, because we had too many publish requests in one second or so.
 				// Now the cooldown has passed, so we can send the LATEST, most up-to-date value of this publish.
-				MQTT_PublishMain_StringString(mqtt_dedups[i]->name,mqtt_dedups[i]->value,mqtt_dedups[i]->flags);
-				mqtt_dedups[i]->bValueDirty = false;
-				mqtt_dedups[i]->timeSinceLastSend = 0;
+				DD_Send(slot, slot->value, slot->flags);
+				continue;
 			}
 #endif
+			// nothing was sent for a long time, so send latest value to show we are alive,
+			// it may differ from sent one by less than deadband
+			if (slot->maxSilence > 0 && slot->timeSinceLastSend >= slot->maxSilence && slot->sentValue[0]) {
+				stat_deduper_heartbeats++;
+				DD_Send(slot, slot->value, slot->flags);
+			}
 		}
 	}
-//	DD_Mutex_Free();
-	
-    ADDLOG_DEBUG(LOG_FEATURE_MQTT, "MQTT deduper sent %i, culled duplicates %i, culled too fast %i",
-		stat_deduper_send,stat_deduper_culled_duplicates,stat_deduper_culled_tooFast);
+
+    ADDLOG_DEBUG(LOG_FEATURE_MQTT, "MQTT deduper sent %i, culled duplicates %i, culled too fast %i, culled deadband %i",
+		stat_deduper_send,stat_deduper_culled_duplicates,stat_deduper_culled_tooFast,stat_deduper_culled_deadband);
 
 }
-OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int slotCode, int expireTime, const char* sChannel, int val, int flags) {
+OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int expireTime, const char* sChannel, int val, int flags) {
 	char buffer[16];
 	sprintf(buffer,"%i",val);
-	return MQTT_PublishMain_StringString_DeDuped(slotCode,expireTime,sChannel,buffer,flags);
+	return MQTT_PublishMain_StringString_DeDuped(expireTime,sChannel,buffer,flags);
 }
-OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expireTime, const char* sChannel, const char* valueStr, int flags) {
+OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int expireTime, const char* sChannel, const char* valueStr, int flags) {
 	mqtt_dedup_slot_t *slot;
-	OBK_Publish_Result res;
+	int same;
 
-	// for simulator, we don't currently need dups removal
+	// for simulator, we don't currently need dups removal, unless rule was set by user
 #ifdef WINDOWS
-	return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
+	if (!MQTT_Dedup_HasRule(sChannel)) {
+		return MQTT_PublishMain_StringString(sChannel, valueStr, flags | OBK_PUBLISH_FLAG_NO_DEDUP);
+	}
 #endif
 
-	// alloc only when it's required
-	if(mqtt_dedups[slotCode] == 0) {
-		mqtt_dedups[slotCode] = malloc(sizeof(mqtt_dedup_slot_t));
-		// just in case malloc fails..
-		if (mqtt_dedups[slotCode] == 0) {
-			 return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
-		}
-		memset(mqtt_dedups[slotCode],0,sizeof(mqtt_dedup_slot_t));
-		mqtt_dedups[slotCode]->timeSinceLastSend = 999;
+	slot = DD_FindOrCreate(sChannel);
+	// just in case malloc fails..
+	if (slot == 0) {
+		return MQTT_PublishMain_StringString(sChannel, valueStr, flags | OBK_PUBLISH_FLAG_NO_DEDUP);
+	}
+	if (slot->bHasRule) {
+		expireTime = slot->maxSilence;
 	}
-
-	slot = mqtt_dedups[slotCode];
 
 	// is value the same?
-	if(!strcmp(slot->value,valueStr)) {
+	same = DD_CompareToSent(slot, valueStr);
+	if(same != DD_DIFFERENT) {
 		// has minimal time to republish passed?
-		if(expireTime > slot->timeSinceLastSend) {
-			stat_deduper_culled_duplicates++;
+		if(expireTime > slot->timeSinceLastSend || (slot->bHasRule && expireTime == 0)) {
+			// value went back to what was sent, so waiting one is not needed anymore
+			slot->bValueDirty = false;
+			// but heartbeat sends the latest one
+			strcpy_safe(slot->value, valueStr, DEDUPER_MAX_STRING_LEN);
+			if (same == DD_IN_DEADBAND) {
+				stat_deduper_culled_deadband++;
+			}
+			else {
+				stat_deduper_culled_duplicates++;
+			}
 			return OBK_PUBLISH_OK; // do not resend if just few seconds passed
 		}
 	}
@@ -123,14 +233,11 @@ OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expir
 	// has minimal time to republish passed?
 	// 'slot->timeSinceLastSend' is increased ONCE per second
 	// So we check if it was just sent this second or previous second
-	if(MIN_INTERVAL_BETWEEN_SENDS >= slot->timeSinceLastSend) {
+	if(slot->minInterval >= slot->timeSinceLastSend) {
 		// It was sent in last second, don't resend just again
 
 		// Just save values for later
-
-		// save previous value
 		strcpy_safe(slot->value,valueStr, DEDUPER_MAX_STRING_LEN);
-		strcpy_safe(slot->name,sChannel, DEDUPER_MAX_STRING_LEN);
 		// mark as 'have to republish later'
 		slot->bValueDirty = true;
 		slot->flags = flags;
@@ -139,14 +246,87 @@ OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expir
 	}
 #endif
 	// send futher
-	res = MQTT_PublishMain_StringString(sChannel,valueStr,flags);
-	if(res == OBK_PUBLISH_OK) {
-		slot->bValueDirty = false;
-		// mark as sent
-		slot->timeSinceLastSend = 0;
-		// save previous value
-		strcpy_safe(slot->value,valueStr, DEDUPER_MAX_STRING_LEN);
+	return DD_Send(slot, valueStr, flags);
+}
+int MQTT_Dedup_HasRule(const char* sChannel) {
+	mqtt_dedup_slot_t *slot;
+
+	if (mqtt_dedup_rules == 0) {
+		return 0;
 	}
-	stat_deduper_send++;
-	return res;
+	slot = DD_Find(sChannel, DD_Hash(sChannel));
+	return slot && slot->bHasRule;
+}
+void MQTT_Dedup_GetStats(int* sent, int* culledDuplicates, int* culledTooFast, int* culledDeadband, int* heartbeats) {
+	*sent = stat_deduper_send;
+	*culledDuplicates = stat_deduper_culled_duplicates;
+	*culledTooFast = stat_deduper_culled_tooFast;
+	*culledDeadband = stat_deduper_culled_deadband;
+	*heartbeats = stat_deduper_heartbeats;
+}
+// mqtt_dedup [Name] [MinIntervalSeconds] [MaxSilenceSeconds] [DeadbandAbs] [DeadbandPercent]
+static commandResult_t CMD_MQTT_Dedup(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	mqtt_dedup_slot_t *slot;
+	int i;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		for (i = 0; i < DEDUPER_HASH_SIZE; i++) {
+			for (slot = mqtt_dedups[i]; slot; slot = slot->next) {
+				if (slot->bHasRule) {
+					ADDLOG_INFO(LOG_FEATURE_MQTT, "%s: min interval %i, max silence %i, deadband %f or %f%%",
+						slot->name, slot->minInterval, slot->maxSilence, slot->deadbandAbs, slot->deadbandPercent);
+				}
+			}
+		}
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT deduper sent %i, culled duplicates %i, culled too fast %i, culled deadband %i, heartbeats %i",
+			stat_deduper_send, stat_deduper_culled_duplicates, stat_deduper_culled_tooFast, stat_deduper_culled_deadband, stat_deduper_heartbeats);
+		return CMD_RES_OK;
+	}
+	slot = DD_FindOrCreate(Tokenizer_GetArg(0));
+	if (slot == 0) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	if (slot->bHasRule) {
+		mqtt_dedup_rules--;
+	}
+	slot->bHasRule = false;
+	slot->minInterval = MIN_INTERVAL_BETWEEN_SENDS;
+	slot->maxSilence = 0;
+	slot->deadbandAbs = 0;
+	slot->deadbandPercent = 0;
+	// negative interval removes the rule
+	if (Tokenizer_GetArgsCount() >= 2 && Tokenizer_GetArgInteger(1) < 0) {
+		return CMD_RES_OK;
+	}
+	if (Tokenizer_GetArgsCount() >= 2) {
+		slot->minInterval = Tokenizer_GetArgInteger(1);
+	}
+	slot->maxSilence = Tokenizer_GetArgInteger(2);
+	slot->deadbandAbs = Tokenizer_GetArgFloat(3);
+	slot->deadbandPercent = Tokenizer_GetArgFloat(4);
+	slot->bHasRule = true;
+	mqtt_dedup_rules++;
+	return CMD_RES_OK;
+}
+void MQTT_Dedup_Init() {
+	mqtt_dedup_slot_t *slot;
+	int i;
+
+	// WINDOWS must support reinit
+	for (i = 0; i < DEDUPER_HASH_SIZE; i++) {
+		while (mqtt_dedups[i]) {
+			slot = mqtt_dedups[i];
+			mqtt_dedups[i] = slot->next;
+			free(slot);
+		}
+	}
+	mqtt_dedup_rules = 0;
+
+	//cmddetail:{"name":"mqtt_dedup","args":"[Name][MinIntervalSeconds][MaxSilenceSeconds][DeadbandAbs][DeadbandPercent]",
+	//cmddetail:"descr":"Sets deduplication rule for publish with given name (like power or 1 for channel 1). Value is not sent more often than MinIntervalSeconds (latest one is sent when interval passes). Value equal to last sent one, or for numbers, differing from it by no more than DeadbandAbs or DeadbandPercent percent, is not sent, but last value is repeated after MaxSilenceSeconds without sends (0 disables that). Negative interval removes the rule. Without arguments, prints rules and statistics. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"CMD_MQTT_Dedup","file":"mqtt/new_mqtt_deduper.c","requires":"",
+	//cmddetail:"examples":"mqtt_dedup power 2 60 1 2"}
+	CMD_RegisterCommand("mqtt_dedup", CMD_MQTT_Dedup, NULL);
 }
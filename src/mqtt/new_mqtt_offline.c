@@ -0,0 +1,334 @@
+
+#include "../new_common.h"
+#include "../logging/logging.h"
+#include "../cmnds/cmd_public.h"
+#include "../driver/drv_ntp.h"
+#include "../new_cfg.h"
+#include "../littlefs/our_lfs.h"
+#include "new_mqtt.h"
+
+#define MQTT_OFFLINE_NAME_LEN 28
+#define MQTT_OFFLINE_VALUE_LEN 28
+
+// records are stored as they are in LFS file, so keep it fixed size
+typedef struct mqttOfflineRecord_s {
+	// NTP time, 0 if time was not synced yet
+	unsigned int time;
+	unsigned int uptime;
+	char name[MQTT_OFFLINE_NAME_LEN];
+	char value[MQTT_OFFLINE_VALUE_LEN];
+} mqttOfflineRecord_t;
+
+#define MQTT_OFFLINE_POLICY_DROP_OLDEST 0
+#define MQTT_OFFLINE_POLICY_DROP_NEWEST 1
+
+// RAM tier
+static mqttOfflineRecord_t* g_offlineRam = 0;
+static int g_offlineRamMax = 0;
+static int g_offlineRamHead = 0;
+static int g_offlineRamCount = 0;
+// LFS tier, file is only appended and it's removed when all records are replayed
+static int g_offlineLfsMax = 0;
+static int g_offlineLfsWritten = 0;
+static int g_offlineLfsRead = 0;
+// settings
+static int g_offlineReplayPerSecond = 5;
+static int g_offlinePolicy = MQTT_OFFLINE_POLICY_DROP_OLDEST;
+// stats
+static int g_offlineStored = 0;
+static int g_offlineSpilled = 0;
+static int g_offlineDropped = 0;
+static int g_offlineReplayed = 0;
+// Store is called from any publishing thread and only touches RAM ring.
+// File is written and read only by MQTT_Offline_SaveEverySecond and MQTT_Offline_RunEverySecond
+static SemaphoreHandle_t g_offlineMutex = 0;
+
+static bool MQTT_Offline_Lock() {
+	if (g_offlineMutex == 0) {
+		g_offlineMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_offlineMutex, portMAX_DELAY) == pdTRUE;
+}
+
+static void MQTT_Offline_Unlock() {
+	xSemaphoreGive(g_offlineMutex);
+}
+
+bool MQTT_Offline_IsEnabled() {
+	return g_offlineRamMax > 0;
+}
+
+static bool MQTT_Offline_HasLfs() {
+#if ENABLE_LITTLEFS
+	return g_offlineLfsMax > 0 && lfs_present();
+#else
+	return false;
+#endif
+}
+
+// appends whole RAM ring to the file, oldest first, returns 1 if RAM is now empty. Lock must be held
+static int MQTT_Offline_Spill() {
+#if ENABLE_LITTLEFS
+	lfs_file_t f;
+	int i;
+	int ok = 1;
+
+	if (!MQTT_Offline_HasLfs() || g_offlineLfsWritten + g_offlineRamCount > g_offlineLfsMax) {
+		return 0;
+	}
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, MQTT_OFFLINE_FILE, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) < 0) {
+		return 0;
+	}
+	for (i = 0; i < g_offlineRamCount; i++) {
+		if (lfs_file_write(&lfs, &f, &g_offlineRam[(g_offlineRamHead + i) % g_offlineRamMax], sizeof(mqttOfflineRecord_t)) != sizeof(mqttOfflineRecord_t)) {
+			ok = 0;
+			break;
+		}
+	}
+	lfs_file_close(&lfs, &f);
+	// partially written record is never counted, so it will be skipped by next spill
+	g_offlineLfsWritten += i;
+	g_offlineSpilled += i;
+	g_offlineRamHead = (g_offlineRamHead + i) % g_offlineRamMax;
+	g_offlineRamCount -= i;
+	return ok;
+#else
+	return 0;
+#endif
+}
+
+void MQTT_Offline_Store(const char* sChannel, const char* sVal) {
+	mqttOfflineRecord_t* r;
+
+	if (strlen(sChannel) >= MQTT_OFFLINE_NAME_LEN || strlen(sVal) >= MQTT_OFFLINE_VALUE_LEN) {
+		g_offlineDropped++;
+		return;
+	}
+	if (MQTT_Offline_Lock() == false) {
+		g_offlineDropped++;
+		return;
+	}
+	if (g_offlineRam == 0) {
+		MQTT_Offline_Unlock();
+		return;
+	}
+	// file is not written here, RAM is moved to it every second before it fills up
+	if (g_offlineRamCount == g_offlineRamMax) {
+		g_offlineDropped++;
+		if (g_offlinePolicy == MQTT_OFFLINE_POLICY_DROP_NEWEST) {
+			MQTT_Offline_Unlock();
+			return;
+		}
+		// overwrite oldest one
+		g_offlineRamHead = (g_offlineRamHead + 1) % g_offlineRamMax;
+		g_offlineRamCount--;
+	}
+	r = &g_offlineRam[(g_offlineRamHead + g_offlineRamCount) % g_offlineRamMax];
+	r->time = NTP_IsTimeSynced() ? NTP_GetCurrentTime() : 0;
+	r->uptime = Time_getUpTimeSeconds();
+	strcpy(r->name, sChannel);
+	strcpy(r->value, sVal);
+	g_offlineRamCount++;
+	g_offlineStored++;
+	MQTT_Offline_Unlock();
+}
+
+void MQTT_Offline_SaveEverySecond() {
+	if (g_offlineRam == 0 || MQTT_Offline_Lock() == false) {
+		return;
+	}
+	// in batches, so file is not written for each record
+	if (g_offlineRamCount * 2 > g_offlineRamMax) {
+		MQTT_Offline_Spill();
+	}
+	MQTT_Offline_Unlock();
+}
+
+static bool MQTT_Offline_IsNumber(const char* s) {
+	char* end;
+
+	if (*s == 0) {
+		return false;
+	}
+	strtod(s, &end);
+	return *end == 0;
+}
+
+static OBK_Publish_Result MQTT_Offline_Replay(const mqttOfflineRecord_t* r) {
+	char topic[MQTT_OFFLINE_NAME_LEN + 8];
+	char payload[64 + MQTT_OFFLINE_VALUE_LEN];
+	const char* q;
+
+	q = MQTT_Offline_IsNumber(r->value) ? "" : "\"";
+	snprintf(topic, sizeof(topic), "%s/offline", r->name);
+	snprintf(payload, sizeof(payload), "{\"time\":%u,\"uptime\":%u,\"val\":%s%s%s}", r->time, r->uptime, q, r->value, q);
+	return MQTT_Publish(CFG_GetMQTTClientId(), topic, payload, OBK_PUBLISH_FLAG_MUTEX_SILENT);
+}
+
+#if ENABLE_LITTLEFS
+static void MQTT_Offline_RemoveFile() {
+	if (lfs_present()) {
+		lfs_remove(&lfs, MQTT_OFFLINE_FILE);
+	}
+	g_offlineLfsWritten = 0;
+	g_offlineLfsRead = 0;
+}
+// returns number of records replayed
+static int MQTT_Offline_ReplayLfs(int budget) {
+	mqttOfflineRecord_t r;
+	lfs_file_t f;
+	int done = 0;
+
+	if (g_offlineLfsRead >= g_offlineLfsWritten || !lfs_present()) {
+		return 0;
+	}
+	memset(&f, 0, sizeof(f));
+	if (lfs_file_open(&lfs, &f, MQTT_OFFLINE_FILE, LFS_O_RDONLY) < 0) {
+		// file is gone, nothing to replay
+		g_offlineLfsWritten = g_offlineLfsRead = 0;
+		return 0;
+	}
+	lfs_file_seek(&lfs, &f, g_offlineLfsRead * sizeof(mqttOfflineRecord_t), LFS_SEEK_SET);
+	while (done < budget && g_offlineLfsRead < g_offlineLfsWritten) {
+		if (lfs_file_read(&lfs, &f, &r, sizeof(r)) != sizeof(r)) {
+			g_offlineDropped += g_offlineLfsWritten - g_offlineLfsRead;
+			g_offlineLfsRead = g_offlineLfsWritten;
+			break;
+		}
+		r.name[MQTT_OFFLINE_NAME_LEN - 1] = 0;
+		r.value[MQTT_OFFLINE_VALUE_LEN - 1] = 0;
+		if (MQTT_Offline_Replay(&r) != OBK_PUBLISH_OK) {
+			break;
+		}
+		g_offlineLfsRead++;
+		g_offlineReplayed++;
+		done++;
+	}
+	lfs_file_close(&lfs, &f);
+	if (g_offlineLfsRead >= g_offlineLfsWritten) {
+		MQTT_Offline_RemoveFile();
+	}
+	return done;
+}
+#endif
+
+void MQTT_Offline_RunEverySecond() {
+	int budget = g_offlineReplayPerSecond;
+
+	// replay does not store anything, so lock can be held while publishing
+	if (MQTT_Offline_Lock() == false) {
+		return;
+	}
+#if ENABLE_LITTLEFS
+	// file has older records than RAM
+	if (g_offlineLfsRead < g_offlineLfsWritten) {
+		budget -= MQTT_Offline_ReplayLfs(budget);
+		if (g_offlineLfsRead < g_offlineLfsWritten) {
+			MQTT_Offline_Unlock();
+			return;
+		}
+	}
+#endif
+	while (budget > 0 && g_offlineRamCount > 0) {
+		if (MQTT_Offline_Replay(&g_offlineRam[g_offlineRamHead]) != OBK_PUBLISH_OK) {
+			break;
+		}
+		g_offlineRamHead = (g_offlineRamHead + 1) % g_offlineRamMax;
+		g_offlineRamCount--;
+		g_offlineReplayed++;
+		budget--;
+	}
+	MQTT_Offline_Unlock();
+}
+
+void MQTT_Offline_GetStats(int* pending, int* stored, int* spilled, int* dropped, int* replayed) {
+	*pending = g_offlineRamCount + g_offlineLfsWritten - g_offlineLfsRead;
+	*stored = g_offlineStored;
+	*spilled = g_offlineSpilled;
+	*dropped = g_offlineDropped;
+	*replayed = g_offlineReplayed;
+}
+
+static void MQTT_Offline_Configure(int ramMax, int lfsMax) {
+	if (MQTT_Offline_Lock() == false) {
+		return;
+	}
+	if (ramMax != g_offlineRamMax) {
+		// RAM records are lost on resize
+		g_offlineDropped += g_offlineRamCount;
+		if (g_offlineRam) {
+			os_free(g_offlineRam);
+			g_offlineRam = 0;
+		}
+		g_offlineRamMax = 0;
+		g_offlineRamHead = 0;
+		g_offlineRamCount = 0;
+		if (ramMax > 0) {
+			g_offlineRam = (mqttOfflineRecord_t*)os_malloc(sizeof(mqttOfflineRecord_t) * ramMax);
+			if (g_offlineRam) {
+				g_offlineRamMax = ramMax;
+			}
+		}
+	}
+	g_offlineLfsMax = g_offlineRamMax > 0 ? lfsMax : 0;
+#if ENABLE_LITTLEFS
+	if (g_offlineLfsMax == 0) {
+		MQTT_Offline_RemoveFile();
+	}
+	else if (g_offlineLfsWritten == 0 && lfs_present()) {
+		struct lfs_info info;
+		// records left from before reboot
+		if (lfs_stat(&lfs, MQTT_OFFLINE_FILE, &info) >= 0) {
+			g_offlineLfsWritten = info.size / sizeof(mqttOfflineRecord_t);
+			g_offlineLfsRead = 0;
+		}
+	}
+#endif
+	MQTT_Offline_Unlock();
+}
+
+// mqtt_offline [RamRecords] [LfsRecords] [ReplayPerSecond] [DropNewest]
+static commandResult_t MQTT_Offline_Command(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	int pending, stored, spilled, dropped, replayed;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		MQTT_Offline_GetStats(&pending, &stored, &spilled, &dropped, &replayed);
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Offline buffer: RAM %i/%i, LFS %i/%i, pending %i, stored %i, spilled %i, dropped %i, replayed %i",
+			g_offlineRamCount, g_offlineRamMax, g_offlineLfsWritten - g_offlineLfsRead, g_offlineLfsMax,
+			pending, stored, spilled, dropped, replayed);
+		return CMD_RES_OK;
+	}
+	if (Tokenizer_GetArgInteger(0) < 0 || Tokenizer_GetArgInteger(1) < 0) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	MQTT_Offline_Configure(Tokenizer_GetArgInteger(0), Tokenizer_GetArgInteger(1));
+	if (Tokenizer_GetArgsCount() >= 3) {
+		g_offlineReplayPerSecond = Tokenizer_GetArgInteger(2);
+	}
+	if (Tokenizer_GetArgsCount() >= 4) {
+		g_offlinePolicy = Tokenizer_GetArgInteger(3) ? MQTT_OFFLINE_POLICY_DROP_NEWEST : MQTT_OFFLINE_POLICY_DROP_OLDEST;
+	}
+	if (Tokenizer_GetArgInteger(0) > 0 && g_offlineRam == 0) {
+		return CMD_RES_ERROR;
+	}
+	return CMD_RES_OK;
+}
+
+void MQTT_Offline_Init() {
+	// WINDOWS must support reinit
+#ifdef WINDOWS
+	MQTT_Offline_Configure(0, 0);
+	g_offlineReplayPerSecond = 5;
+	g_offlinePolicy = MQTT_OFFLINE_POLICY_DROP_OLDEST;
+	g_offlineStored = g_offlineSpilled = g_offlineDropped = g_offlineReplayed = 0;
+#endif
+
+	//cmddetail:{"name":"mqtt_offline","args":"[RamRecords][LfsRecords][ReplayPerSecond][DropNewest]",
+	//cmddetail:"descr":"Enables store-and-forward buffer for publishes made while MQTT is disconnected. RamRecords are kept in RAM, once per second, when RAM is more than half full, they are moved to LittleFS file, up to LfsRecords records (0 disables file). After reconnect they are replayed, ReplayPerSecond at once (default 5), to [Name]/offline topic with time and value. When buffer is full, oldest record is dropped, or new one if DropNewest is 1. RamRecords 0 disables buffer. Without arguments, prints statistics.",
+	//cmddetail:"fn":"MQTT_Offline_Command","file":"mqtt/new_mqtt_offline.c","requires":"",
+	//cmddetail:"examples":"mqtt_offline 32 256 5"}
+	CMD_RegisterCommand("mqtt_offline", MQTT_Offline_Command, NULL);
+}
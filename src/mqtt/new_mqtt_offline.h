@@ -0,0 +1,23 @@
+#ifndef __NEW_MQTT_OFFLINE_H__
+#define __NEW_MQTT_OFFLINE_H__
+
+// Store-and-forward buffer for publishes made while broker is unreachable.
+// Records are kept in RAM ring first, and when it is more than half full, whole ring is
+// appended to a file on LittleFS (if enabled) by the once-per-second MQTT task. After reconnect, records are replayed, oldest first,
+// at limited rate, to <client>/<name>/offline as {"time":T,"uptime":U,"val":V},
+// so they don't overwrite current state published to <client>/<name>/get.
+// Disabled by default, see mqtt_offline command.
+
+#define MQTT_OFFLINE_FILE "mqtt_offline.bin"
+
+void MQTT_Offline_Init();
+bool MQTT_Offline_IsEnabled();
+// called when publish of client topic failed because of disconnection, from any thread
+void MQTT_Offline_Store(const char* sChannel, const char* sVal);
+// called every second also while disconnected, moves RAM records to file
+void MQTT_Offline_SaveEverySecond();
+// called every second while connected, replays some of stored records
+void MQTT_Offline_RunEverySecond();
+void MQTT_Offline_GetStats(int* pending, int* stored, int* spilled, int* dropped, int* replayed);
+
+#endif // __NEW_MQTT_OFFLINE_H__
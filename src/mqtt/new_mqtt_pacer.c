@@ -0,0 +1,177 @@
+
+#include "../new_common.h"
+#include "../logging/logging.h"
+#include "../cmnds/cmd_public.h"
+#include "new_mqtt.h"
+#include "new_mqtt_pacer.h"
+
+// ack times this close to the best one are not treated as queueing
+#define MQTT_PACER_RTT_SLACK 20
+
+// settings
+static int g_pacerFloor = MQTT_PACER_DEFAULT_FLOOR;
+static int g_pacerCeiling = MQTT_PACER_DEFAULT_CEILING;
+// state
+static int g_pacerRate = MQTT_PACER_DEFAULT_FLOOR;
+static int g_pacerTokens = MQTT_PACER_DEFAULT_FLOOR;
+static int g_pacerSlowStart = 1;
+// -1 until first sample
+static int g_pacerMinRtt = -1;
+static int g_pacerAvgRtt = -1;
+static int g_pacerInFlight = 0;
+// collected since last MQTT_Pacer_RunEverySecond, samples and errors come from tcp_thread
+static int g_pacerSamples = 0;
+static unsigned int g_pacerSampleSum = 0;
+static int g_pacerErrors = 0;
+
+static void MQTT_Pacer_Clamp() {
+	if (g_pacerRate > g_pacerCeiling) {
+		g_pacerRate = g_pacerCeiling;
+	}
+	if (g_pacerRate < g_pacerFloor) {
+		g_pacerRate = g_pacerFloor;
+	}
+}
+
+void MQTT_Pacer_Reset() {
+	g_pacerRate = g_pacerFloor;
+	g_pacerTokens = g_pacerRate;
+	g_pacerSlowStart = 1;
+	g_pacerMinRtt = -1;
+	g_pacerAvgRtt = -1;
+	g_pacerInFlight = 0;
+	g_pacerSamples = 0;
+	g_pacerSampleSum = 0;
+	g_pacerErrors = 0;
+}
+
+void MQTT_Pacer_SetLimits(int floor, int ceiling) {
+	if (floor < 1) {
+		floor = 1;
+	}
+	if (ceiling < floor) {
+		ceiling = floor;
+	}
+	g_pacerFloor = floor;
+	g_pacerCeiling = ceiling;
+	MQTT_Pacer_Clamp();
+	if (g_pacerTokens > g_pacerRate) {
+		g_pacerTokens = g_pacerRate;
+	}
+}
+
+void* MQTT_Pacer_OnSent() {
+	g_pacerInFlight++;
+	// send time is the tag, lowest bit is set so it's never NULL
+	return (void*)(size_t)(MQTT_GetTimeMS() | 1);
+}
+
+void MQTT_Pacer_OnSendError(void* tag) {
+	if (tag == 0) {
+		return;
+	}
+	g_pacerInFlight--;
+	g_pacerErrors++;
+}
+
+void MQTT_Pacer_OnAck(void* tag, int bOk) {
+	int sample;
+
+	if (tag == 0) {
+		return;
+	}
+	if (g_pacerInFlight > 0) {
+		g_pacerInFlight--;
+	}
+	if (bOk == 0) {
+		g_pacerErrors++;
+		return;
+	}
+	sample = MQTT_GetTimeMS() - (unsigned int)(size_t)tag;
+	if (sample < 0) {
+		sample = 0;
+	}
+	if (g_pacerMinRtt < 0 || sample < g_pacerMinRtt) {
+		g_pacerMinRtt = sample;
+	}
+	g_pacerSampleSum += sample;
+	g_pacerSamples++;
+}
+
+void MQTT_Pacer_RunEverySecond(int outputFree, int outputSize) {
+	int avg = -1;
+	int step;
+
+	if (g_pacerSamples > 0) {
+		avg = g_pacerSampleSum / g_pacerSamples;
+		g_pacerAvgRtt = avg;
+	}
+	if (g_pacerErrors > 0 || outputFree * 4 < outputSize
+		|| (avg >= 0 && avg > g_pacerMinRtt * 4 + MQTT_PACER_RTT_SLACK)) {
+		g_pacerRate /= 2;
+		g_pacerSlowStart = 0;
+	}
+	else if (avg >= 0 && avg <= g_pacerMinRtt * 2 + MQTT_PACER_RTT_SLACK) {
+		if (g_pacerSlowStart) {
+			g_pacerRate *= 2;
+		}
+		else {
+			step = g_pacerRate / 4;
+			g_pacerRate += step > 0 ? step : 1;
+		}
+	}
+	// without acks we know nothing, so rate is kept
+	MQTT_Pacer_Clamp();
+	g_pacerSamples = 0;
+	g_pacerSampleSum = 0;
+	g_pacerErrors = 0;
+	// bucket holds at most one second worth of items
+	g_pacerTokens = g_pacerRate;
+}
+
+int MQTT_Pacer_Take() {
+	if (g_pacerTokens <= 0) {
+		return 0;
+	}
+	g_pacerTokens--;
+	return 1;
+}
+
+void MQTT_Pacer_GetStats(int* rate, int* avgRtt, int* minRtt, int* inFlight) {
+	*rate = g_pacerRate;
+	*avgRtt = g_pacerAvgRtt;
+	*minRtt = g_pacerMinRtt;
+	*inFlight = g_pacerInFlight;
+}
+
+// mqtt_broadcastPacing [Floor] [Ceiling]
+static commandResult_t MQTT_Pacer_Command(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Broadcast pacing: %i/s (%i-%i), ack avg %ims, min %ims, in flight %i",
+			g_pacerRate, g_pacerFloor, g_pacerCeiling, g_pacerAvgRtt, g_pacerMinRtt, g_pacerInFlight);
+		return CMD_RES_OK;
+	}
+	if (Tokenizer_GetArgInteger(0) < 1) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	MQTT_Pacer_SetLimits(Tokenizer_GetArgInteger(0),
+		Tokenizer_GetArgsCount() >= 2 ? Tokenizer_GetArgInteger(1) : g_pacerCeiling);
+	return CMD_RES_OK;
+}
+
+void MQTT_Pacer_Init() {
+	// WINDOWS must support reinit
+#ifdef WINDOWS
+	g_pacerFloor = MQTT_PACER_DEFAULT_FLOOR;
+	g_pacerCeiling = MQTT_PACER_DEFAULT_CEILING;
+	MQTT_Pacer_Reset();
+#endif
+
+	//cmddetail:{"name":"mqtt_broadcastPacing","args":"[Floor][Ceiling]",
+	//cmddetail:"descr":"Sets range of self state broadcast rate, in items per second. Rate starts at Floor after connection and adapts to broker acknowledgement times and free space in lwIP output buffer, up to Ceiling. Without arguments, prints current rate and measured times.",
+	//cmddetail:"fn":"MQTT_Pacer_Command","file":"mqtt/new_mqtt_pacer.c","requires":"",
+	//cmddetail:"examples":"mqtt_broadcastPacing 2 40"}
+	CMD_RegisterCommand("mqtt_broadcastPacing", MQTT_Pacer_Command, NULL);
+}
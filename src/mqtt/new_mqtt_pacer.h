@@ -0,0 +1,34 @@
+#ifndef __NEW_MQTT_PACER_H__
+#define __NEW_MQTT_PACER_H__
+
+// Token bucket pacer for self state broadcast (publishAll, broadcast on connect and every minute).
+// Bucket is refilled once per second with current rate, and rate adapts between
+// floor and ceiling:
+// - it's doubled each second while acknowledgements come back quickly (slow start),
+//   and after first congestion it grows by 1/4 per second,
+// - it's halved when average acknowledgement time goes well above the best seen,
+//   when lwIP output buffer is mostly full, or when a publish failed.
+// Acknowledgement is PUBACK for QoS 1, and TCP ACK of the sent data for QoS 0
+// (lwIP calls publish callback then).
+// Floor equal to ceiling gives a fixed rate, as mqtt_broadcastItemsPerSec does.
+
+#define MQTT_PACER_DEFAULT_FLOOR 1
+#define MQTT_PACER_DEFAULT_CEILING 20
+
+void MQTT_Pacer_Init();
+// called on (re)connection, starts from floor and forgets measured times
+void MQTT_Pacer_Reset();
+void MQTT_Pacer_SetLimits(int floor, int ceiling);
+// call before publish, pass result as publish callback arg
+void* MQTT_Pacer_OnSent();
+// call if publish failed, with result of MQTT_Pacer_OnSent
+void MQTT_Pacer_OnSendError(void* tag);
+// call from publish callback (tcp_thread), tag 0 is ignored
+void MQTT_Pacer_OnAck(void* tag, int bOk);
+// called every second while connected, adapts rate and refills the bucket
+void MQTT_Pacer_RunEverySecond(int outputFree, int outputSize);
+// returns 1 if one more broadcast item can be published now
+int MQTT_Pacer_Take();
+void MQTT_Pacer_GetStats(int* rate, int* avgRtt, int* minRtt, int* inFlight);
+
+#endif // __NEW_MQTT_PACER_H__
@@ -0,0 +1,251 @@
+
+#include "../new_common.h"
+#include "new_mqtt_trie.h"
+
+// returns pointer to next level (after '/'), or NULL if this was the last one
+static const char *MQTT_Trie_NextLevel(const char *p, int *outLen) {
+	const char *end = strchr(p, '/');
+	if (end == 0) {
+		*outLen = strlen(p);
+		return 0;
+	}
+	*outLen = end - p;
+	return end + 1;
+}
+
+static mqttTrieNode_t *MQTT_Trie_NewNode(const char *level, int len) {
+	mqttTrieNode_t *n;
+
+	n = (mqttTrieNode_t*)os_malloc(sizeof(mqttTrieNode_t));
+	if (n == 0) {
+		return 0;
+	}
+	memset(n, 0, sizeof(mqttTrieNode_t));
+	n->level = (char*)os_malloc(len + 1);
+	if (n->level == 0) {
+		os_free(n);
+		return 0;
+	}
+	memcpy(n->level, level, len);
+	n->level[len] = 0;
+	n->levelLen = len;
+	return n;
+}
+
+// returns the slot where child for given level is (or should be) kept
+static mqttTrieNode_t **MQTT_Trie_ChildSlot(mqttTrieNode_t *node, const char *level, int len) {
+	mqttTrieNode_t **slot;
+
+	if (len == 1 && level[0] == '+') {
+		return &node->plus;
+	}
+	if (len == 1 && level[0] == '#') {
+		return &node->hash;
+	}
+	slot = &node->children;
+	while (*slot) {
+		if ((*slot)->levelLen == len && !memcmp((*slot)->level, level, len)) {
+			break;
+		}
+		slot = &(*slot)->next;
+	}
+	return slot;
+}
+
+int MQTT_Trie_IsValidFilter(const char *filter) {
+	const char *p;
+	int len;
+
+	if (filter == 0 || *filter == 0) {
+		return 0;
+	}
+	p = filter;
+	while (p) {
+		const char *level = p;
+		p = MQTT_Trie_NextLevel(p, &len);
+		if (memchr(level, '+', len) || memchr(level, '#', len)) {
+			if (len != 1) {
+				return 0;
+			}
+			// multi-level wildcard must be the last one
+			if (level[0] == '#' && p != 0) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int MQTT_Trie_Insert(mqttTrieNode_t **root, const char *filter, void *value) {
+	mqttTrieNode_t *node;
+	mqttTrieNode_t **slot;
+	mqttTrieValue_t *v;
+	mqttTrieValue_t **tail;
+	const char *p;
+	int len;
+
+	if (!MQTT_Trie_IsValidFilter(filter)) {
+		return -1;
+	}
+	if (*root == 0) {
+		*root = MQTT_Trie_NewNode("", 0);
+		if (*root == 0) {
+			return -2;
+		}
+	}
+	node = *root;
+	p = filter;
+	while (p) {
+		const char *level = p;
+		p = MQTT_Trie_NextLevel(p, &len);
+		slot = MQTT_Trie_ChildSlot(node, level, len);
+		if (*slot == 0) {
+			*slot = MQTT_Trie_NewNode(level, len);
+			if (*slot == 0) {
+				return -2;
+			}
+		}
+		node = *slot;
+	}
+	v = (mqttTrieValue_t*)os_malloc(sizeof(mqttTrieValue_t));
+	if (v == 0) {
+		return -2;
+	}
+	v->value = value;
+	v->next = 0;
+	tail = &node->values;
+	while (*tail) {
+		tail = &(*tail)->next;
+	}
+	*tail = v;
+	return 0;
+}
+
+static int MQTT_Trie_IsNodeEmpty(mqttTrieNode_t *n) {
+	return n->values == 0 && n->children == 0 && n->plus == 0 && n->hash == 0;
+}
+
+// filter is NULL when we are at the node for the whole filter
+static int MQTT_Trie_RemoveNode(mqttTrieNode_t **slot, const char *filter, void *value) {
+	mqttTrieNode_t *node = *slot;
+	mqttTrieValue_t **v;
+	mqttTrieValue_t *tmp;
+	int removed = 0;
+	int len;
+
+	if (node == 0) {
+		return 0;
+	}
+	if (filter == 0) {
+		v = &node->values;
+		while (*v) {
+			if ((*v)->value == value) {
+				tmp = *v;
+				*v = tmp->next;
+				os_free(tmp);
+				removed = 1;
+				break;
+			}
+			v = &(*v)->next;
+		}
+	}
+	else {
+		const char *level = filter;
+		const char *rest = MQTT_Trie_NextLevel(filter, &len);
+		removed = MQTT_Trie_RemoveNode(MQTT_Trie_ChildSlot(node, level, len), rest, value);
+	}
+	// prune branches that lead nowhere
+	if (removed && MQTT_Trie_IsNodeEmpty(node)) {
+		*slot = node->next;
+		os_free(node->level);
+		os_free(node);
+	}
+	return removed;
+}
+
+int MQTT_Trie_Remove(mqttTrieNode_t **root, const char *filter, void *value) {
+	if (*root == 0 || !MQTT_Trie_IsValidFilter(filter)) {
+		return 0;
+	}
+	return MQTT_Trie_RemoveNode(root, filter, value);
+}
+
+void MQTT_Trie_Free(mqttTrieNode_t **root) {
+	mqttTrieNode_t *n = *root;
+	mqttTrieValue_t *v;
+
+	while (n) {
+		mqttTrieNode_t *next = n->next;
+		MQTT_Trie_Free(&n->children);
+		MQTT_Trie_Free(&n->plus);
+		MQTT_Trie_Free(&n->hash);
+		while (n->values) {
+			v = n->values;
+			n->values = v->next;
+			os_free(v);
+		}
+		os_free(n->level);
+		os_free(n);
+		n = next;
+	}
+	*root = 0;
+}
+
+static int MQTT_Trie_Visit(mqttTrieNode_t *n, mqttTrieVisitor_t visitor, void *userData, int *visited) {
+	mqttTrieValue_t *v;
+
+	if (n == 0) {
+		return 0;
+	}
+	for (v = n->values; v; v = v->next) {
+		(*visited)++;
+		if (visitor && visitor(v->value, userData)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// topic is NULL when all levels were consumed. Returns 1 if visitor asked to stop.
+static int MQTT_Trie_MatchNode(mqttTrieNode_t *node, const char *topic, int bFirst,
+	mqttTrieVisitor_t visitor, void *userData, int *visited) {
+	mqttTrieNode_t *c;
+	const char *rest;
+	int len;
+
+	if (topic == 0) {
+		if (MQTT_Trie_Visit(node, visitor, userData, visited)) {
+			return 1;
+		}
+		// "a/#" also matches "a"
+		return MQTT_Trie_Visit(node->hash, visitor, userData, visited);
+	}
+	rest = MQTT_Trie_NextLevel(topic, &len);
+	for (c = node->children; c; c = c->next) {
+		if (c->levelLen == len && !memcmp(c->level, topic, len)) {
+			if (MQTT_Trie_MatchNode(c, rest, 0, visitor, userData, visited)) {
+				return 1;
+			}
+			break;
+		}
+	}
+	if (bFirst && topic[0] == '$') {
+		return 0;
+	}
+	if (node->plus) {
+		if (MQTT_Trie_MatchNode(node->plus, rest, 0, visitor, userData, visited)) {
+			return 1;
+		}
+	}
+	return MQTT_Trie_Visit(node->hash, visitor, userData, visited);
+}
+
+int MQTT_Trie_Match(mqttTrieNode_t *root, const char *topic, mqttTrieVisitor_t visitor, void *userData) {
+	int visited = 0;
+
+	if (root == 0 || topic == 0) {
+		return 0;
+	}
+	MQTT_Trie_MatchNode(root, topic, 1, visitor, userData, &visited);
+	return visited;
+}
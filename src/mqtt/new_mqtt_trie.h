@@ -0,0 +1,44 @@
+#ifndef __NEW_MQTT_TRIE_H__
+#define __NEW_MQTT_TRIE_H__
+
+// MQTT topic filter trie.
+// Filters are split on '/' into levels, each level is a node, so matching
+// a topic costs one lookup per topic level, no matter how many filters are stored.
+// Supports MQTT wildcards: '+' matches a single level, '#' (last level only) matches
+// all remaining levels, including none (so "a/#" matches "a").
+// Topics starting with '$' are not matched by wildcards on first level, as in MQTT spec.
+
+typedef struct mqttTrieValue_s {
+	void *value;
+	struct mqttTrieValue_s *next;
+} mqttTrieValue_t;
+
+typedef struct mqttTrieNode_s {
+	char *level;
+	int levelLen;
+	// values stored for filter ending at this node, in insertion order
+	mqttTrieValue_t *values;
+	// plain child levels
+	struct mqttTrieNode_s *children;
+	struct mqttTrieNode_s *next;
+	// wildcard children are kept separately, so no search is needed for them
+	struct mqttTrieNode_s *plus;
+	struct mqttTrieNode_s *hash;
+} mqttTrieNode_t;
+
+// return non-zero to stop matching
+typedef int (*mqttTrieVisitor_t)(void *value, void *userData);
+
+// returns 0 on success, -1 on bad filter, -2 on out of memory
+int MQTT_Trie_Insert(mqttTrieNode_t **root, const char *filter, void *value);
+// returns 1 if value was found and removed
+int MQTT_Trie_Remove(mqttTrieNode_t **root, const char *filter, void *value);
+void MQTT_Trie_Free(mqttTrieNode_t **root);
+// Calls visitor for each value whose filter matches topic.
+// Exact levels are tried before '+', and '+' before '#'.
+// Returns number of visited values.
+int MQTT_Trie_Match(mqttTrieNode_t *root, const char *topic, mqttTrieVisitor_t visitor, void *userData);
+// checks if filter is a valid MQTT topic filter (wildcards only as whole levels, '#' last)
+int MQTT_Trie_IsValidFilter(const char *filter);
+
+#endif // __NEW_MQTT_TRIE_H__
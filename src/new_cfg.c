@@ -68,10 +68,12 @@ void CFG_SetDefaultLEDCorrectionTable() {
 	g_cfg.led_corr.led_gamma = 2.2f;
 	g_cfg.led_corr.rgb_bright_min = 0.1f;
 	g_cfg.led_corr.cw_bright_min = 0.1f;
-	g_cfg_pendingChanges++;
+	CFG_MarkAsDirty();
 }
 void CFG_MarkAsDirty() {
 	g_cfg_pendingChanges++;
+	STATE_BumpRevision();
+	JSON_MarkStatusDirty(JSON_STATUS_CONFIG);
 }
 void CFG_SetDefaultConfig() {
 	// must be unsigned, else print below prints negatives as e.g. FFFFFFFe
@@ -128,7 +130,7 @@ void CFG_SetDefaultConfig() {
 	
 	CFG_SetDefaultLEDCorrectionTable();
 
-	g_cfg_pendingChanges++;
+	CFG_MarkAsDirty();
 }
 
 void CFG_SetLEDRemap(int r, int g, int b, int c, int w) {
@@ -159,7 +161,7 @@ void CFG_SetBootOkSeconds(int v) {
 		v = 1;
 	if(g_cfg.timeRequiredToMarkBootSuccessfull != v) {
 		g_cfg.timeRequiredToMarkBootSuccessfull = v;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 int CFG_GetBootOkSeconds() {
@@ -184,21 +186,21 @@ void CFG_SetPingHost(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.ping_host, s,sizeof(g_cfg.ping_host))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetPingDisconnectedSecondsToRestart(int i) {
 	if(g_cfg.ping_seconds != i) {
 		g_cfg.ping_seconds = i;
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetPingIntervalSeconds(int i) {
 	if(g_cfg.ping_interval != i) {
 		g_cfg.ping_interval = i;
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetShortStartupCommand_AndExecuteNow(const char *s) {
@@ -209,14 +211,14 @@ void CFG_SetShortStartupCommand(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.initCommandLine, s,sizeof(g_cfg.initCommandLine))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 int CFG_SetWebappRoot(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.webappRoot, s,sizeof(g_cfg.webappRoot))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 	return 1;
 }
@@ -246,14 +248,14 @@ void CFG_SetShortDeviceName(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.shortDeviceName, s,sizeof(g_cfg.shortDeviceName))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetDeviceName(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.longDeviceName, s,sizeof(g_cfg.longDeviceName))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetMQTTPort(int p) {
@@ -261,7 +263,7 @@ void CFG_SetMQTTPort(int p) {
 	if(g_cfg.mqtt_port != p) {
 		g_cfg.mqtt_port = p;
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetOpenAccessPoint() {
@@ -272,7 +274,7 @@ void CFG_SetOpenAccessPoint() {
 	g_cfg.wifi_ssid[0] = 0;
 	g_cfg.wifi_pass[0] = 0;
 	// mark as dirty (value has changed)
-	g_cfg_pendingChanges++;
+	CFG_MarkAsDirty();
 }
 const char *CFG_GetWiFiSSID(){
 	return g_cfg.wifi_ssid;
@@ -288,7 +290,7 @@ void CFG_SetWiFiSSID(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.wifi_ssid, s,sizeof(g_cfg.wifi_ssid))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetWiFiPass(const char *s) {
@@ -300,7 +302,7 @@ void CFG_SetWiFiPass(const char *s) {
 	if(memcmp(g_cfg.wifi_pass, s, len)) {
 		memcpy(g_cfg.wifi_pass, s, len);
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 const char *CFG_GetMQTTHost() {
@@ -322,14 +324,14 @@ void CFG_SetMQTTHost(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.mqtt_host, s,sizeof(g_cfg.mqtt_host))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetMQTTClientId(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.mqtt_clientId, s,sizeof(g_cfg.mqtt_clientId))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 		g_mqtt_bBaseTopicDirty++;
 	}
 }
@@ -337,7 +339,7 @@ void CFG_SetMQTTGroupTopic(const char *s) {
 	// this will return non-zero if there were any changes
 	if (strcpy_safe_checkForChanges(g_cfg.mqtt_group, s, sizeof(g_cfg.mqtt_group))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 		g_mqtt_bBaseTopicDirty++;
 	}
 }
@@ -345,28 +347,28 @@ void CFG_SetMQTTUserName(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.mqtt_userName, s,sizeof(g_cfg.mqtt_userName))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetMQTTPass(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.mqtt_pass, s,sizeof(g_cfg.mqtt_pass))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_ClearPins() {
 	memset(&g_cfg.pins,0,sizeof(g_cfg.pins));
-	g_cfg_pendingChanges++;
+	CFG_MarkAsDirty();
 }
 void CFG_IncrementOTACount() {
 	g_cfg.otaCounter++;
-	g_cfg_pendingChanges++;
+	CFG_MarkAsDirty();
 }
 void CFG_SetMac(char *mac) {
 	if(memcmp(mac,g_cfg.mac,6)) {
 		memcpy(g_cfg.mac,mac,6);
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_Save_IfThereArePendingChanges() {
@@ -382,19 +384,19 @@ void CFG_DeviceGroups_SetName(const char *s) {
 	// this will return non-zero if there were any changes
 	if(strcpy_safe_checkForChanges(g_cfg.dgr_name, s,sizeof(g_cfg.dgr_name))) {
 		// mark as dirty (value has changed)
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_DeviceGroups_SetSendFlags(int newSendFlags) {
 	if(g_cfg.dgr_sendFlags != newSendFlags) {
 		g_cfg.dgr_sendFlags = newSendFlags;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_DeviceGroups_SetRecvFlags(int newRecvFlags) {
 	if(g_cfg.dgr_recvFlags != newRecvFlags) {
 		g_cfg.dgr_recvFlags = newRecvFlags;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 const char *CFG_DeviceGroups_GetName() {
@@ -410,7 +412,7 @@ void CFG_SetFlags(int first4bytes, int second4bytes) {
 	if (g_cfg.genericFlags != first4bytes || g_cfg.genericFlags2 != second4bytes) {
 		g_cfg.genericFlags = first4bytes;
 		g_cfg.genericFlags2 = second4bytes;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetFlag(int flag, bool bValue) {
@@ -431,7 +433,7 @@ void CFG_SetFlag(int flag, bool bValue) {
 	}
 	if(nf != *cfgValue) {
 		*cfgValue = nf;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 		// this will start only if it wasnt running
 		if(bValue && flag == OBK_FLAG_CMD_ENABLETCPRAWPUTTYSERVER) {
 			CMD_StartTCPCommandLine();
@@ -456,7 +458,7 @@ void CFG_SetChannelStartupValue(int channelIndex,short newValue) {
 	}
 	if(g_cfg.startChannelValues[channelIndex] != newValue) {
 		g_cfg.startChannelValues[channelIndex] = newValue;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 short CFG_GetChannelStartupValue(int channelIndex) {
@@ -476,7 +478,7 @@ void PIN_SetPinChannelForPinIndex(int index, int ch) {
 		return;
 	}
 	if(g_cfg.pins.channels[index] != ch) {
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 		g_cfg.pins.channels[index] = ch;
 	}
 }
@@ -486,7 +488,7 @@ void PIN_SetPinChannel2ForPinIndex(int index, int ch) {
 		return;
 	}
 	if(g_cfg.pins.channels2[index] != ch) {
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 		g_cfg.pins.channels2[index] = ch;
 	}
 }
@@ -506,7 +508,7 @@ const char *CFG_GetNTPServer() {
 }
 void CFG_SetNTPServer(const char *s) {	
 	if(strcpy_safe_checkForChanges(g_cfg.ntpServer, s,sizeof(g_cfg.ntpServer))) {
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 int CFG_GetPowerMeasurementCalibrationInteger(int index, int def) {
@@ -518,7 +520,7 @@ int CFG_GetPowerMeasurementCalibrationInteger(int index, int def) {
 void CFG_SetPowerMeasurementCalibrationInteger(int index, int value) {
 	if(g_cfg.cal.values[index].i != value) {
 		g_cfg.cal.values[index].i = value;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 float CFG_GetPowerMeasurementCalibrationFloat(int index, float def) {
@@ -530,25 +532,25 @@ float CFG_GetPowerMeasurementCalibrationFloat(int index, float def) {
 void CFG_SetPowerMeasurementCalibrationFloat(int index, float value) {
 	if(g_cfg.cal.values[index].f != value) {
 		g_cfg.cal.values[index].f = value;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetButtonLongPressTime(int value) {
 	if(g_cfg.buttonLongPress != value) {
 		g_cfg.buttonLongPress = value;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetButtonShortPressTime(int value) {
 	if(g_cfg.buttonShortPress != value) {
 		g_cfg.buttonShortPress = value;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 void CFG_SetButtonRepeatPressTime(int value) {
 	if(g_cfg.buttonHoldRepeat != value) {
 		g_cfg.buttonHoldRepeat = value;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 
@@ -556,7 +558,7 @@ void CFG_SetButtonRepeatPressTime(int value) {
 void CFG_SetLFS_Size(uint32_t value) {
 	if(g_cfg.LFS_Size != value) {
 		g_cfg.LFS_Size = value;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 }
 
@@ -579,7 +581,7 @@ void CFG_InitAndLoad() {
 			addLogAdv(LOG_WARN, LOG_FEATURE_CFG, "CFG_InitAndLoad: Config crc or ident mismatch. Default config will be loaded.");
 		CFG_SetDefaultConfig();
 		// mark as changed
-		g_cfg_pendingChanges ++;
+		CFG_MarkAsDirty();
 	} else {
 #if PLATFORM_XR809
 		WiFI_SetMacAddress(g_cfg.mac);
@@ -592,7 +594,7 @@ void CFG_InitAndLoad() {
 		addLogAdv(LOG_WARN, LOG_FEATURE_CFG, "CFG_InitAndLoad: Old config version found, updating to v3.");
 		strcpy_safe(g_cfg.mqtt_clientId, g_cfg.shortDeviceName, sizeof(g_cfg.mqtt_clientId));
 		g_cfg.version = 3;
-		g_cfg_pendingChanges++;
+		CFG_MarkAsDirty();
 	}
 
 	if(g_cfg.buttonHoldRepeat == 0) {
@@ -164,6 +164,7 @@ typedef long portTickType;
 typedef int SemaphoreHandle_t;
 #define pdTRUE 1
 #define pdFALSE 0
+#define portMAX_DELAY 0xffffffff
 typedef int OSStatus;
 
 enum {
@@ -427,6 +428,26 @@ extern int g_startPingWatchDogAfter;
 
 typedef int(*jsonCb_t)(void *userData, const char *fmt, ...);
 int JSON_ProcessCommandReply(const char *cmd, const char *args, void *request, jsonCb_t printer, int flags);
+// sections of STATUS reply kept rendered by JSON_ProcessCommandReply, see json_interface.c
+enum {
+	JSON_STATUS_INDEX_MAIN,
+	JSON_STATUS_INDEX_PRM,
+	JSON_STATUS_INDEX_FWR,
+	JSON_STATUS_INDEX_LOG,
+	JSON_STATUS_INDEX_MEM,
+	JSON_STATUS_INDEX_NET,
+	JSON_STATUS_INDEX_MQT,
+	JSON_STATUS_SECTIONS
+};
+#define JSON_STATUS_LOG		(1 << JSON_STATUS_INDEX_LOG)
+#define JSON_STATUS_NET		(1 << JSON_STATUS_INDEX_NET)
+#define JSON_STATUS_MQT		(1 << JSON_STATUS_INDEX_MQT)
+// sections showing config values
+#define JSON_STATUS_CONFIG	(JSON_STATUS_LOG | JSON_STATUS_NET | JSON_STATUS_MQT)
+// next STATUS request renders these sections again
+void JSON_MarkStatusDirty(int sections);
+// how many times sections were rendered, for selftests
+int JSON_GetStatusRenders();
 void ScheduleDriverStart(const char *name, int delay);
 bool isWhiteSpace(char ch);
 
@@ -4,6 +4,7 @@
 #include "quicktick.h"
 #include "new_cfg.h"
 #include "httpserver/new_http.h"
+#include "httpserver/http_sse.h"
 #include "logging/logging.h"
 #include "mqtt/new_mqtt.h"
 // Commands register, execution API and cmd tokenizer
@@ -71,6 +72,13 @@ char g_enable_pins = 0;
 int g_channelValues[CHANNEL_MAX] = { 0 };
 float g_channelValuesFloats[CHANNEL_MAX] = { 0 };
 
+// State revision for conditional REST replies, see STATE_GetRevision.
+// Counted from boot, base makes revisions of previous boot not match.
+static unsigned int g_stateRevisionBase = 0;
+static unsigned int g_stateChanges = 0;
+// g_stateChanges when channel last changed, 0 if not since boot
+static unsigned int g_channelChanges[CHANNEL_MAX];
+
 pinButton_s g_buttons[PLATFORM_GPIO_MAX];
 
 void (*g_doubleClickCallback)(int pinIndex) = 0;
@@ -243,6 +251,18 @@ int PIN_GetPinChannel2ForPinIndex(int index) {
     }
     return g_cfg.pins.channels2[index];
 }
+// Some roles do not need any channels
+int PIN_RoleUsesChannel(int role) {
+    return role != IOR_SHT3X_CLK && role != IOR_CHT8305_CLK && role != IOR_Button_ToggleAll && role != IOR_Button_ToggleAll_n
+        && role != IOR_BL0937_CF && role != IOR_BL0937_CF1 && role != IOR_BL0937_SEL
+        && role != IOR_LED_WIFI && role != IOR_LED_WIFI_n
+        && !(role >= IOR_IRRecv && role <= IOR_DHT11)
+        && !(role >= IOR_SM2135_DAT && role <= IOR_BP1658CJ_CLK);
+}
+// For button, is relay index to toggle on double click
+int PIN_RoleUsesChannel2(int role) {
+    return role == IOR_Button || role == IOR_Button_n || IS_PIN_DHT_ROLE(role) || IS_PIN_TEMP_HUM_SENSOR_ROLE(role);
+}
 void RAW_SetPinValue(int index, int iVal){
     if(index < 0 || index >= PLATFORM_GPIO_MAX) {
         addLogAdv(LOG_ERROR, LOG_FEATURE_CFG, "RAW_SetPinValue: Pin index %i out of range <0,%i).",index,PLATFORM_GPIO_MAX);
@@ -641,7 +661,7 @@ void PIN_SetPinRoleForPinIndex(int index, int role) {
             }
         }
         g_cfg.pins.roles[index] = role;
-        g_cfg_pendingChanges++;
+        CFG_MarkAsDirty();
     }
 
     if (g_enable_pins) {
@@ -803,6 +823,29 @@ void PIN_SetPinRoleForPinIndex(int index, int role) {
     }
 }
 
+unsigned int STATE_GetRevision() {
+    if(g_stateRevisionBase == 0) {
+        // boot count is known by the time anyone asks
+        g_stateRevisionBase = ((unsigned int)HAL_FlashVars_GetBootCount() * 2654435761u) | 0x10000;
+    }
+    return g_stateRevisionBase + g_stateChanges;
+}
+void STATE_BumpRevision() {
+    g_stateChanges++;
+}
+int CHANNEL_ChangedSince(int ch, unsigned int revision) {
+    // changes counted up to given revision
+    unsigned int changes = revision - STATE_GetRevision() + g_stateChanges;
+
+    if(ch < 0 || ch >= CHANNEL_MAX) {
+        return 0;
+    }
+    // revision of other boot, or not given yet
+    if(changes > g_stateChanges) {
+        return 1;
+    }
+    return g_channelChanges[ch] > changes;
+}
 void PIN_SetGenericDoubleClickCallback(void (*cb)(int pinIndex)) {
     g_doubleClickCallback = cb;
 }
@@ -889,6 +932,10 @@ static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
             MQTT_ChannelChangeCallback(ch,iVal);
         }
     }
+    STATE_BumpRevision();
+    g_channelChanges[ch] = g_stateChanges;
+    // push to open web pages
+    HTTP_SSE_OnChannelChanged(ch);
     // Simple event - it just says that there was a change
     EventHandlers_FireEvent(CMD_EVENT_CHANNEL_ONCHANGE,ch);
     // more advanced events - change FROM value TO value
@@ -940,6 +987,8 @@ void CHANNEL_Set_FloatPWM(int ch, float fVal, int iFlags) {
 
     g_channelValues[ch] = (int)fVal;
     g_channelValuesFloats[ch] = fVal;
+    STATE_BumpRevision();
+    g_channelChanges[ch] = g_stateChanges;
 
     for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
         if (g_cfg.pins.channels[i] == ch) {
@@ -350,7 +350,7 @@ typedef struct mainConfig_s {
 	byte unused_fill1;
 
 	// offset 0x000004BC
-	unsigned long LFS_Size; // szie of LFS volume.  it's aligned against the end of OTA
+	unsigned int LFS_Size; // szie of LFS volume.  it's aligned against the end of OTA
 #if PLATFORM_W800
     byte unusedSectorAB[71];
 #else    
@@ -426,6 +426,12 @@ int CHANNEL_HasChannelPinWithRoleOrRole(int ch, int iorType, int iorType2);
 bool CHANNEL_IsInUse(int ch);
 void Channel_SaveInFlashIfNeeded(int ch);
 int CHANNEL_FindMaxValueForChannel(int ch);
+// Revision of device state, bumped on each channel, LED, sensor or config change.
+// Used as ETag of REST state endpoints. Starts at a value derived from boot count.
+unsigned int STATE_GetRevision();
+void STATE_BumpRevision();
+// true if channel changed after given state revision, or revision is not one of this boot
+int CHANNEL_ChangedSince(int ch, unsigned int revision);
 // cmd_channels.c
 const char *CHANNEL_GetLabel(int ch);
 //ledRemap_t *CFG_GetLEDRemap();
@@ -440,6 +446,9 @@ int h_isChannelDigitalInput(int tg_ch);
 
 int PIN_ParsePinRoleName(const char* name);
 const char *PIN_RoleToString(int role);
+// whether role uses first/second channel field of pin config
+int PIN_RoleUsesChannel(int role);
+int PIN_RoleUsesChannel2(int role);
 
 // from new_builtin.c
 /*
@@ -10,63 +10,63 @@ void Test_ExpandConstant() {
 	// reset whole device
 	SIM_ClearOBK();
 
-	CMD_ExpandConstantsWithinString("Hello", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("Hello", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "Hello");
 
 
 	CHANNEL_Set(1, 123, 0);
-	CMD_ExpandConstantsWithinString("$CH1", buffer,sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH1", buffer,sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "123");
 
 	CHANNEL_Set(1, 456, 0);
-	CMD_ExpandConstantsWithinString("$CH1", buffer, sizeof(buffer), 0);;
+	CMD_ExpandConstantsWithinString("$CH1", buffer, sizeof(buffer));;
 	SELFTEST_ASSERT_STRING(buffer, "456");
 
 	CHANNEL_Set(11, 2022, 0);
 	// must be able to tell whether it's $CH11 or a $CH1
-	CMD_ExpandConstantsWithinString("$CH11", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH11", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "2022");
 
-	CMD_ExpandConstantsWithinString("$CH1", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH1", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "456");
 
 	// must be able to tell whether it's $CH11 or a $CH1 - with a suffix
-	CMD_ExpandConstantsWithinString("$CH11ba", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH11ba", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "2022ba");
 
-	CMD_ExpandConstantsWithinString("$CH1ba", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH1ba", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "456ba");
 
 	// must be able to tell whether it's $CH11 or a $CH1 - with a prefix
-	CMD_ExpandConstantsWithinString("ba$CH11", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("ba$CH11", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "ba2022");
 
-	CMD_ExpandConstantsWithinString("ba$CH1", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("ba$CH1", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "ba456");
 
 	// must be able to tell whether it's $CH11 or a $CH1 - with a prefix and a suffix
-	CMD_ExpandConstantsWithinString("ba$CH11ha", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("ba$CH11ha", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "ba2022ha");
 
-	CMD_ExpandConstantsWithinString("ba$CH1ha", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("ba$CH1ha", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "ba456ha");
 
-	CMD_ExpandConstantsWithinString("ba$CH1$CH1ha", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("ba$CH1$CH1ha", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "ba456456ha");
 
-	CMD_ExpandConstantsWithinString("$CH1$CH1ha", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH1$CH1ha", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "456456ha");
 
-	CMD_ExpandConstantsWithinString("$CH1$CH1", buffer, sizeof(buffer), 0);
+	CMD_ExpandConstantsWithinString("$CH1$CH1", buffer, sizeof(buffer));
 	SELFTEST_ASSERT_STRING(buffer, "456456");
 
 	// check buffer len truncating
-	CMD_ExpandConstantsWithinString("Hello long one!", smallBuffer, sizeof(smallBuffer), 0);
+	CMD_ExpandConstantsWithinString("Hello long one!", smallBuffer, sizeof(smallBuffer));
 	// Buffer was too short - text truncated!
 	SELFTEST_ASSERT_STRING(smallBuffer, "Hello l");
 
 
-	//CMD_ExpandConstantsWithinString("Hello $CH1", smallBuffer, sizeof(smallBuffer), 0);
+	//CMD_ExpandConstantsWithinString("Hello $CH1", smallBuffer, sizeof(smallBuffer));
 	// Buffer was too short - text truncated!
 	//SELFTEST_ASSERT_STRING(smallBuffer, "Hello 4");
 	// NOTE: it won't work like that because of the sprintf behaviour....
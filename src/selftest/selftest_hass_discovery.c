@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h".
+#include "../httpserver/hass.h"
 
 void Test_HassDiscovery_Relay_1x() {
 	const char *shortName = "WinRelTest1x";
@@ -32,8 +33,77 @@ void Test_HassDiscovery_Relay_1x() {
 	SELFTEST_ASSERT_JSON_VALUE_STRING(NULL, "stat_t", "~/1/get");
 	SELFTEST_ASSERT_JSON_VALUE_STRING(NULL, "cmd_t", "~/1/set");
 }
+static bool Test_HassDiscovery_HasRelay(const char *fullName, int channel) {
+	char topic[128];
+
+	sprintf(topic, "homeassistant/switch/%s_relay_%i/config", fullName, channel);
+	return SIM_GetMQTTHistoryString(topic, false) != 0;
+}
 void Test_HassDiscovery_Relay_2x() {
-	// TODO
+	const char *shortName = "My \"Relays\"";
+	const char *fullName = "WinRelays";
+	int queued, coalesced, dropped, droppedBefore;
+	int i;
+
+	SIM_ClearOBK(shortName);
+	SIM_ClearAndPrepareForMQTTTesting("testDeviceRelays", "bekens");
+
+	CFG_SetShortDeviceName(shortName);
+	CFG_SetDeviceName(fullName);
+
+	// more entities than publish queue can hold
+	for (i = 0; i < 12; i++) {
+		PIN_SetPinRoleForPinIndex(6 + i, IOR_Relay);
+		PIN_SetPinChannelForPinIndex(6 + i, 1 + i);
+	}
+
+	SIM_ClearMQTTHistory();
+	MQTT_GetQueueStats(&queued, &coalesced, &droppedBefore);
+	CMD_ExecuteCommand("scheduleHADiscovery 1", 0);
+	Sim_RunSeconds(3, false);
+	// paced, so not all at once
+	SELFTEST_ASSERT(hass_discovery_isRunning());
+	Sim_RunSeconds(10, false);
+	SELFTEST_ASSERT(hass_discovery_isRunning() == false);
+	MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+	SELFTEST_ASSERT_INTEGER(dropped, droppedBefore);
+	for (i = 0; i < 12; i++) {
+		SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 1 + i));
+	}
+	// name with quotes is escaped
+	SELFTEST_ASSERT_HAS_MQTT_JSON_SENT("homeassistant/switch/WinRelays_relay_12/config", false);
+	SELFTEST_ASSERT_JSON_VALUE_STRING("dev", "name", shortName);
+	SELFTEST_ASSERT_JSON_VALUE_STRING(NULL, "name", "My \"Relays\" 12");
+	SELFTEST_ASSERT_JSON_VALUE_STRING(NULL, "cmd_t", "~/12/set");
+
+	// nothing changed, nothing published again by automatic discovery
+	SIM_ClearMQTTHistory();
+	Main_ScheduleHomeAssistantDiscovery(1);
+	Sim_RunSeconds(10, false);
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 1) == false);
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 12) == false);
+
+	// only changed one is
+	PIN_SetPinChannelForPinIndex(17, 20);
+	Main_ScheduleHomeAssistantDiscovery(1);
+	Sim_RunSeconds(10, false);
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 20));
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 11) == false);
+
+	// command asks for all of them
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("scheduleHADiscovery 1", 0);
+	Sim_RunSeconds(10, false);
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 1));
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 20));
+
+	// request from web page publishes all
+	SIM_ClearMQTTHistory();
+	Test_FakeHTTPClientPacket_GET("ha_discovery");
+	// channels published after previous discovery go first
+	Sim_RunSeconds(20, false);
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 1));
+	SELFTEST_ASSERT(Test_HassDiscovery_HasRelay(fullName, 20));
 }
 
 
@@ -2,9 +2,16 @@
 
 #include "selftest_local.h"
 #include "../httpserver/new_http.h"
+#include "../httpserver/http_sse.h"
+#include "../httpserver/http_ws.h"
+#include "../httpserver/http_tcp_server.h"
+#include "../logging/logging.h"
+#include "../hal/hal_wifi.h"
 //#define JSMN_HEADER
 ///#include "../jsmn/jsmn.h"
 #include "../cJSON/cJSON.h"
+#include "../cJSON/json_arena.h"
+#include <timeapi.h>
 
 // "GET /index?tgl=1 HTTP/1.1\r\n"
 const char *http_get_template1 = "GET /%s HTTP/1.1\r\n"
@@ -108,11 +115,18 @@ void Test_FakeHTTPClientPacket_POST(const char *tg, const char *data) {
 	Test_FakeHTTPClientPacket_Generic();
 }
 void Test_GetJSONValue_Setup(const char *text) {
+	int bLocked;
+
+	// tree is kept between calls, so it comes from heap, not arena
+	bLocked = JSON_Arena_Lock();
 	if (g_json) {
 		cJSON_Delete(g_json);
 	}
 	printf("Received JSON: %s\n", text);
 	g_json = cJSON_Parse(text);
+	if (bLocked) {
+		JSON_Arena_Unlock();
+	}
 	g_sec_power = cJSON_GetObjectItemCaseSensitive(g_json, "POWER");
 }
 void Test_FakeHTTPClientPacket_JSON(const char *tg) {
@@ -892,10 +906,878 @@ void Test_Http_LED_RGB() {
 	*/
 
 }
+// sends packet as if server with given reply buffer allowed keep-alive, returns result of HTTP_FinishKeepAlive
+static int Test_Http_KeepAliveRequestSized(const char *packet, int replyMaxLen) {
+	http_request_t request;
+	int r;
+
+	strcpy(buffer, packet);
+	memset(&request, 0, sizeof(request));
+	request.fd = 0;
+	request.received = buffer;
+	request.receivedLen = strlen(buffer);
+	outbuf[0] = '\0';
+	request.reply = outbuf;
+	request.replylen = 0;
+	request.replymaxlen = replyMaxLen;
+	request.receivedLenmax = 1022;
+	request.keepAlive = 1;
+	request.responseCode = HTTP_RESPONSE_OK;
+
+	HTTP_ProcessPacket(&request);
+	r = HTTP_FinishKeepAlive(&request);
+	outbuf[request.replylen] = 0;
+	replyAt = Helper_GetPastHTTPHeader(outbuf);
+	return r;
+}
+static int Test_Http_KeepAliveRequest(const char *packet) {
+	return Test_Http_KeepAliveRequestSized(packet, sizeof(outbuf));
+}
+void Test_Http_KeepAlive() {
+	const char *p;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+
+	// reply gets Content-Length of its body
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("GET /cm?cmnd=POWER HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Connection: keep-alive\r\n"));
+	p = strstr(outbuf, "Content-Length:");
+	SELFTEST_ASSERT(p != 0);
+	SELFTEST_ASSERT(replyAt != 0);
+	SELFTEST_ASSERT_INTEGER(atoi(p + 15), (int)strlen(replyAt));
+	Test_GetJSONValue_Setup(replyAt);
+	SELFTEST_ASSERT_JSON_VALUE_STRING(0, "POWER", "OFF");
+	// HTTP/1.1 is persistent by default
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("GET /index?state=1 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"));
+
+	// client asks to close
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest("GET /cm?cmnd=POWER HTTP/1.1\r\nConnection: Close\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Connection: close\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Length") == 0);
+	// HTTP/1.0
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest("GET /cm?cmnd=POWER HTTP/1.0\r\n\r\n"));
+	// body not fully received, rest would be read by handler
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest("POST /cm?cmnd=POWER HTTP/1.1\r\nContent-Length: 100\r\n\r\nabc"));
+	// whole body received
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("POST /cm?cmnd=POWER HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"));
+	// pipelined request is not handled
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest("GET /cm?cmnd=POWER HTTP/1.1\r\n\r\nGET /index HTTP/1.1\r\n\r\n"));
+
+	CMD_ExecuteCommand("http_keepAlive 3000 5", 0);
+	SELFTEST_ASSERT_INTEGER(g_http_keepAliveIdleTime, 3000);
+	SELFTEST_ASSERT_INTEGER(g_http_keepAliveMaxRequests, 5);
+	CMD_ExecuteCommand("http_keepAlive 2000 16", 0);
+}
+// connected loopback TCP sockets, server side is like one accepted by device's HTTP server
+static void Test_Http_LoopbackPair(int *client, int *server) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	SOCKET l;
+
+	l = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(l, (struct sockaddr*)&addr, sizeof(addr));
+	listen(l, 1);
+	getsockname(l, (struct sockaddr*)&addr, &len);
+	*client = (int)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	connect(*client, (struct sockaddr*)&addr, sizeof(addr));
+	*server = (int)accept(l, 0, 0);
+	closesocket(l);
+}
+// reads until server closes connection
+static int Test_Http_ReceiveAll(int s, char *o, int maxLen) {
+	int len = 0;
+	int r;
+
+	while (len < maxLen - 1) {
+		r = recv(s, o + len, maxLen - 1 - len, 0);
+		if (r <= 0) {
+			break;
+		}
+		len += r;
+	}
+	o[len] = 0;
+	return len;
+}
+#define TEST_HTTP_POOL_QUEUE 4
+// runs worker pool connection handling on loopback sockets, worker thread is the test itself
+void Test_Http_WorkerPool() {
+	const char *req = "GET /cm?cmnd=POWER HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	char reply[1024];
+	int client[TEST_HTTP_POOL_QUEUE + 1];
+	int server[TEST_HTTP_POOL_QUEUE + 1];
+	int start, i;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+
+	// nothing queued
+	SELFTEST_ASSERT(!HTTP_Pool_ServeNext());
+
+	// request is answered and connection kept open until idle time passes
+	CMD_ExecuteCommand("http_keepAlive 200 16", 0);
+	Test_Http_LoopbackPair(&client[0], &server[0]);
+	send(client[0], req, strlen(req), 0);
+	SELFTEST_ASSERT(HTTP_Pool_AddConnection(server[0]));
+	start = timeGetTime();
+	SELFTEST_ASSERT(HTTP_Pool_ServeNext());
+	SELFTEST_ASSERT((int)(timeGetTime() - start) >= 150);
+	Test_Http_ReceiveAll(client[0], reply, sizeof(reply));
+	SELFTEST_ASSERT(strstr(reply, "Connection: keep-alive\r\n"));
+	SELFTEST_ASSERT(strstr(reply, "{\"POWER\":\"OFF\"}"));
+	closesocket(client[0]);
+	SELFTEST_ASSERT(!HTTP_Pool_ServeNext());
+
+	// last request allowed on connection is closed at once
+	CMD_ExecuteCommand("http_keepAlive 2000 1", 0);
+	Test_Http_LoopbackPair(&client[0], &server[0]);
+	send(client[0], req, strlen(req), 0);
+	SELFTEST_ASSERT(HTTP_Pool_AddConnection(server[0]));
+	start = timeGetTime();
+	SELFTEST_ASSERT(HTTP_Pool_ServeNext());
+	SELFTEST_ASSERT((int)(timeGetTime() - start) < 1000);
+	Test_Http_ReceiveAll(client[0], reply, sizeof(reply));
+	SELFTEST_ASSERT(strstr(reply, "Connection: keep-alive\r\n") == 0);
+	SELFTEST_ASSERT(strstr(reply, "{\"POWER\":\"OFF\"}"));
+	closesocket(client[0]);
+
+	// idle connection is given up as soon as another one waits
+	CMD_ExecuteCommand("http_keepAlive 2000 16", 0);
+	Test_Http_LoopbackPair(&client[0], &server[0]);
+	Test_Http_LoopbackPair(&client[1], &server[1]);
+	send(client[0], req, strlen(req), 0);
+	SELFTEST_ASSERT(HTTP_Pool_AddConnection(server[0]));
+	SELFTEST_ASSERT(HTTP_Pool_AddConnection(server[1]));
+	start = timeGetTime();
+	SELFTEST_ASSERT(HTTP_Pool_ServeNext());
+	SELFTEST_ASSERT((int)(timeGetTime() - start) < 1000);
+	Test_Http_ReceiveAll(client[0], reply, sizeof(reply));
+	SELFTEST_ASSERT(strstr(reply, "{\"POWER\":\"OFF\"}"));
+	closesocket(client[0]);
+	// client closed without request
+	closesocket(client[1]);
+	SELFTEST_ASSERT(HTTP_Pool_ServeNext());
+	SELFTEST_ASSERT(!HTTP_Pool_ServeNext());
+
+	// full accept queue refuses connection with 503
+	for (i = 0; i <= TEST_HTTP_POOL_QUEUE; i++) {
+		Test_Http_LoopbackPair(&client[i], &server[i]);
+		SELFTEST_ASSERT(HTTP_Pool_AddConnection(server[i]) == (i < TEST_HTTP_POOL_QUEUE));
+	}
+	Test_Http_ReceiveAll(client[TEST_HTTP_POOL_QUEUE], reply, sizeof(reply));
+	SELFTEST_ASSERT(strstr(reply, "HTTP/1.1 503 ") == reply);
+	closesocket(client[TEST_HTTP_POOL_QUEUE]);
+	for (i = 0; i < TEST_HTTP_POOL_QUEUE; i++) {
+		closesocket(client[i]);
+		SELFTEST_ASSERT(HTTP_Pool_ServeNext());
+	}
+	SELFTEST_ASSERT(!HTTP_Pool_ServeNext());
+}
+// page larger than reply buffer, from formatted and binary parts
+static void Test_Http_ChunkTestBody(char *o) {
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		o += sprintf(o, "<p>line %i of test page</p>\n", i);
+	}
+	memset(o, 'x', 3000);
+	o[3000] = 0;
+}
+static int Test_Http_ChunkTestPage(http_request_t* request) {
+	char big[3001];
+	int i;
+
+	http_setup(request, httpMimeTypeHTML);
+	for (i = 0; i < 100; i++) {
+		hprintf255(request, "<p>line %i of test page</p>\n", i);
+	}
+	memset(big, 'x', 3000);
+	postany(request, big, 3000);
+	poststr(request, NULL);
+	return 0;
+}
+// decodes chunked body of whole reply, returns 0 if it's malformed
+static int Test_Http_DecodeChunked(const char *reply, int len, char *o) {
+	const char *p = strstr(reply, "\r\n\r\n");
+	const char *end = reply + len;
+	char *next;
+	int size;
+
+	if (p == 0) {
+		return 0;
+	}
+	for (p += 4; p < end; p = next + 2 + size + 2) {
+		size = strtol(p, &next, 16);
+		if (strncmp(next, "\r\n", 2) || next + 2 + size + 2 > end || strncmp(next + 2 + size, "\r\n", 2)) {
+			return 0;
+		}
+		if (size == 0) {
+			*o = 0;
+			// nothing may follow last chunk
+			return next + 4 == end;
+		}
+		memcpy(o, next + 2, size);
+		o += size;
+	}
+	return 0;
+}
+void Test_Http_Chunked() {
+	static char expected[8192];
+	static char whole[16384];
+	static char body[16384];
+	const char *sent;
+	int sentLen, sends, len;
+
+	SIM_ClearOBK();
+	HTTP_RegisterCallback("/chunktest", HTTP_GET, Test_Http_ChunkTestPage);
+	Test_Http_ChunkTestBody(expected);
+
+	// reply fits in buffer and gets Content-Length
+	SIM_ClearHTTPSentOutput();
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("GET /chunktest HTTP/1.1\r\n\r\n"));
+	SIM_GetHTTPSentOutput(&sentLen, &sends);
+	SELFTEST_ASSERT_INTEGER(sends, 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Transfer-Encoding") == 0);
+	SELFTEST_ASSERT_STRING(replyAt, expected);
+
+	// device-sized buffer, body goes out in chunks and connection stays open
+	SIM_ClearHTTPSentOutput();
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequestSized("GET /chunktest HTTP/1.1\r\n\r\n", 2048));
+	sent = SIM_GetHTTPSentOutput(&sentLen, &sends);
+	memcpy(whole, sent, sentLen);
+	memcpy(whole + sentLen, outbuf, strlen(outbuf));
+	len = sentLen + strlen(outbuf);
+	whole[len] = 0;
+	SELFTEST_ASSERT(strstr(whole, "Connection: keep-alive\r\nTransfer-Encoding: chunked") != 0);
+	SELFTEST_ASSERT(strstr(whole, "Content-Length") == 0);
+	SELFTEST_ASSERT(Test_Http_DecodeChunked(whole, len, body));
+	SELFTEST_ASSERT_STRING(body, expected);
+	// sends are whole TCP segments, except around text that didn't fit
+	SELFTEST_ASSERT(sends > 0);
+	SELFTEST_ASSERT(sends <= len / 1460 + 1);
+
+	// without keep-alive body is sent as is, until connection is closed
+	SIM_ClearHTTPSentOutput();
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequestSized("GET /chunktest HTTP/1.1\r\nConnection: close\r\n\r\n", 2048));
+	sent = SIM_GetHTTPSentOutput(&sentLen, &sends);
+	memcpy(whole, sent, sentLen);
+	memcpy(whole + sentLen, outbuf, strlen(outbuf) + 1);
+	SELFTEST_ASSERT(strstr(whole, "Connection: close") != 0);
+	SELFTEST_ASSERT(strstr(whole, "Transfer-Encoding") == 0);
+	SELFTEST_ASSERT_STRING(Helper_GetPastHTTPHeader(whole), expected);
+	SIM_ClearHTTPSentOutput();
+}
+// upload larger than request buffer, received in small pieces
+void Test_Http_RequestBody() {
+	static char data[3001];
+	static char chunkedBody[4096];
+	char packet[512];
+	int i, at, size;
+
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("lfs_format", 0);
+	for (i = 0; i < 3000; i++) {
+		data[i] = 'a' + i % 26;
+	}
+	data[3000] = 0;
+
+	// Content-Length, part of body came with headers
+	sprintf(packet, "POST /api/lfs/bodytest.txt HTTP/1.1\r\nContent-Length: 3000\r\n\r\n%.200s", data);
+	SIM_SetHTTPBodyInput(data + 200, 2800, 97);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(packet));
+	SELFTEST_ASSERT(strstr(replyAt, "\"size\":3000") != 0);
+	Test_FakeHTTPClientPacket_GET("api/lfs/bodytest.txt");
+	SELFTEST_ASSERT_STRING(replyAt, data);
+
+	// chunked, with extension and trailer, received byte by byte
+	at = 0;
+	for (i = 0; i < 3000; i += size) {
+		size = 3000 - i < 700 ? 3000 - i : 700;
+		at += sprintf(chunkedBody + at, i == 0 ? "%x;name=value\r\n%.*s\r\n" : "%X\r\n%.*s\r\n", size, size, data + i);
+	}
+	at += sprintf(chunkedBody + at, "0\r\nX-Trailer: 1\r\n\r\n");
+	CMD_ExecuteCommand("lfs_format", 0);
+	SIM_SetHTTPBodyInput(chunkedBody, at, 1);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("POST /api/lfs/bodytest.txt HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(replyAt, "\"size\":3000") != 0);
+	Test_FakeHTTPClientPacket_GET("api/lfs/bodytest.txt");
+	SELFTEST_ASSERT_STRING(replyAt, data);
+
+	// small body is put together for handlers that parse it
+	SIM_SetHTTPBodyInput("3\r\n 33\r\n0\r\n\r\n", 13, 2);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("POST /api/cmnd HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+		"C\r\nsetChannel 5\r\n"));
+	SELFTEST_ASSERT_CHANNEL(5, 33);
+
+	// body ends early - error, and connection is not reused
+	SIM_SetHTTPBodyInput(data + 200, 1000, 97);
+	sprintf(packet, "POST /api/lfs/bodytest.txt HTTP/1.1\r\nContent-Length: 3000\r\n\r\n%.200s", data);
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest(packet));
+	SELFTEST_ASSERT(strstr(outbuf, " 500 ") != 0);
+	// malformed size line
+	SIM_SetHTTPBodyInput("zz\r\nabc\r\n0\r\n\r\n", 15, 100);
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest("POST /api/cmnd HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, " 400 ") != 0);
+
+	// body collected for parsing that doesn't fit - error, and nothing past request buffer is touched
+	memset(buffer + 1022, '#', 1024);
+	sprintf(packet, "POST /api/cmnd HTTP/1.1\r\nContent-Length: 3000\r\n\r\n%.200s", data);
+	SIM_SetHTTPBodyInput(data + 200, 2800, 300);
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest(packet));
+	SELFTEST_ASSERT(strstr(outbuf, " 413 ") != 0);
+	for (i = 1022; i < 1022 + 1024; i++) {
+		SELFTEST_ASSERT(buffer[i] == '#');
+	}
+	// same for chunked one
+	memset(buffer + 1022, '#', 1024);
+	SIM_SetHTTPBodyInput(chunkedBody, at, 500);
+	SELFTEST_ASSERT(!Test_Http_KeepAliveRequest("POST /api/channels HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, " 413 ") != 0);
+	for (i = 1022; i < 1022 + 1024; i++) {
+		SELFTEST_ASSERT(buffer[i] == '#');
+	}
+	SIM_SetHTTPBodyInput(0, 0, 0);
+}
+void Test_Http_PinConfig() {
+	cJSON *pins, *pin;
+	char url[64];
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 3);
+	PIN_SetPinRoleForPinIndex(10, IOR_Button);
+	PIN_SetPinChannelForPinIndex(10, 1);
+	PIN_SetPinChannel2ForPinIndex(10, 2);
+
+	Test_FakeHTTPClientPacket_JSON("api/pinconfig");
+	SELFTEST_ASSERT(g_json != 0);
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArraySize(cJSON_GetObjectItem(g_json, "roles")), IOR_Total_Options);
+	SELFTEST_ASSERT_STRING(cJSON_GetArrayItem(cJSON_GetObjectItem(g_json, "roles"), IOR_Relay)->valuestring, "Rel");
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArrayItem(cJSON_GetObjectItem(g_json, "flags"), IOR_Relay)->valueint, 1);
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArrayItem(cJSON_GetObjectItem(g_json, "flags"), IOR_Button)->valueint, 3);
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArrayItem(cJSON_GetObjectItem(g_json, "flags"), IOR_LED_WIFI)->valueint, 0);
+	pins = cJSON_GetObjectItem(g_json, "pins");
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArraySize(pins), PLATFORM_GPIO_MAX);
+	pin = cJSON_GetArrayItem(pins, 9);
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArrayItem(pin, 1)->valueint, IOR_Relay);
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArrayItem(pin, 2)->valueint, 3);
+	pin = cJSON_GetArrayItem(pins, 10);
+	SELFTEST_ASSERT_INTEGER(cJSON_GetArrayItem(pin, 3)->valueint, 2);
+
+	// page only has form placeholder, it was tens of kilobytes. Saving works as before
+	sprintf(url, "cfg_pins?9=%i&r9=4&11=%i&r11=5", IOR_Button, IOR_Relay);
+	Test_FakeHTTPClientPacket_GET(url);
+	SELFTEST_ASSERT(strstr(replyAt, "id=\"pins\"") != 0);
+	SELFTEST_ASSERT(strlen(outbuf) < 4096);
+	SELFTEST_ASSERT_INTEGER(PIN_GetPinRoleForPinIndex(9), IOR_Button);
+	SELFTEST_ASSERT_INTEGER(PIN_GetPinChannelForPinIndex(9), 4);
+	SELFTEST_ASSERT_INTEGER(PIN_GetPinRoleForPinIndex(11), IOR_Relay);
+	SELFTEST_ASSERT_INTEGER(PIN_GetPinChannelForPinIndex(11), 5);
+}
+// returns revision from ETag of last reply, 0 if none
+static unsigned int Test_Http_GetETag() {
+	const char *p = strstr(outbuf, "ETag: \"");
+
+	return p ? strtoul(p + 7, 0, 10) : 0;
+}
+// STATUS sections come from cache until something they show has changed
+void Test_Http_StatusCache() {
+	int renders;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	CHANNEL_Set(1, 0, 0);
+	CFG_SetMQTTHost("first.host");
+
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS");
+	SELFTEST_ASSERT_JSON_VALUE_INTEGER("Status", "Power", 0);
+	SELFTEST_ASSERT_JSON_VALUE_STRING("StatusMQT", "MqttHost", "first.host");
+	renders = JSON_GetStatusRenders();
+	// nothing changed, longer sections are sent in chunks and must still parse
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS");
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders);
+	SELFTEST_ASSERT_JSON_VALUE_STRING("StatusMQT", "MqttHost", "first.host");
+	SELFTEST_ASSERT_JSON_VALUE_STRING("StatusMEM", "FlashChipId", "1540A1");
+	SELFTEST_ASSERT_JSON_VALUE_STRING("StatusPRM", "SaveAddress", "F9000");
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS%202");
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders);
+
+	// channel change renders only main block
+	CHANNEL_Set(1, 1, 0);
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS");
+	SELFTEST_ASSERT_JSON_VALUE_INTEGER("Status", "Power", 1);
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders + 1);
+
+	// config change marks main block and config sections
+	CFG_SetMQTTHost("second.host");
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS%206");
+	SELFTEST_ASSERT_JSON_VALUE_STRING("StatusMQT", "MqttHost", "second.host");
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders + 2);
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS");
+	SELFTEST_ASSERT_JSON_VALUE_STRING("StatusMQT", "MqttHost", "second.host");
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders + 5);
+
+	// WiFi status change renders network section
+	renders = JSON_GetStatusRenders();
+	Main_OnWiFiStatusChange(WIFI_STA_CONNECTED);
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS%205");
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders + 1);
+	Test_FakeHTTPClientPacket_JSON("cm?cmnd=STATUS%205");
+	SELFTEST_ASSERT_INTEGER(JSON_GetStatusRenders(), renders + 1);
+}
+void Test_Http_StateRevision() {
+	unsigned int rev, rev2;
+	char tmp[128];
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	PIN_SetPinRoleForPinIndex(10, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(10, 2);
+	CHANNEL_Set(1, 0, 0);
+	CHANNEL_Set(2, 0, 0);
+
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("GET /api/channels HTTP/1.1\r\n\r\n"));
+	rev = Test_Http_GetETag();
+	SELFTEST_ASSERT(rev != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Cache-Control: no-cache\r\n") != 0);
+	SELFTEST_ASSERT_STRING(replyAt, "{\"1\":0,\"2\":0}");
+	// nothing changed, empty 304
+	sprintf(tmp, "GET /api/channels HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == outbuf);
+	SELFTEST_ASSERT_STRING(replyAt, "");
+	sprintf(tmp, "GET /api/channels?since=%u HTTP/1.1\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == outbuf);
+
+	// change gives full reply with new ETag, and delta with only changed channel
+	CHANNEL_Set(2, 1, 0);
+	sprintf(tmp, "GET /api/channels HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	rev2 = Test_Http_GetETag();
+	SELFTEST_ASSERT(rev2 != rev);
+	SELFTEST_ASSERT_STRING(replyAt, "{\"1\":0,\"2\":1}");
+	sprintf(tmp, "GET /api/channels?since=%u HTTP/1.1\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT_STRING(replyAt, "{\"2\":1}");
+	SELFTEST_ASSERT(Test_Http_GetETag() == rev2);
+	// unknown revision, like one from before reboot, gives all
+	sprintf(tmp, "GET /api/channels?since=%u HTTP/1.1\r\n\r\n", rev2 + 1000);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT_STRING(replyAt, "{\"1\":0,\"2\":1}");
+
+	// config change is a state change too
+	sprintf(tmp, "GET /api/info HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev2);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == outbuf);
+	CFG_SetShortDeviceName("revTest");
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	rev = Test_Http_GetETag();
+
+	// Tasmota status query of config sections, but not other commands
+	sprintf(tmp, "GET /cm?cmnd=STATUS%%206 HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == outbuf);
+	sprintf(tmp, "GET /cm?cmnd=POWER2%%20OFF HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "ETag:") == 0);
+	SELFTEST_ASSERT_CHANNEL(2, 0);
+	sprintf(tmp, "GET /cm?cmnd=STATUS%%206 HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	SELFTEST_ASSERT(strstr(replyAt, "\"StatusMQT\"") != 0);
+	rev = Test_Http_GetETag();
+	// readings change without revision bump, so replies with them are always full
+	sprintf(tmp, "GET /cm?cmnd=STATUS HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "ETag:") == 0);
+	SELFTEST_ASSERT(strstr(replyAt, "\"Status\"") != 0);
+	sprintf(tmp, "GET /cm?cmnd=STATUS%%208 HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "ETag:") == 0);
+	sprintf(tmp, "GET /cm?cmnd=STATE HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "ETag:") == 0);
+	// new IP address is a state change of network section
+	sprintf(tmp, "GET /cm?cmnd=STATUS%%205 HTTP/1.1\r\nIf-None-Match: \"%u\"\r\n\r\n", rev);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == outbuf);
+	Main_OnWiFiStatusChange(WIFI_STA_CONNECTED);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 200") == outbuf);
+	SELFTEST_ASSERT(strstr(replyAt, "\"StatusNET\"") != 0);
+}
+static int g_routeHit;
+static char g_routeParam[32];
+
+static int Test_Http_Route1(http_request_t* request) {
+	g_routeHit = 1;
+	http_getPathParam(request, 0, g_routeParam, sizeof(g_routeParam));
+	return 0;
+}
+static int Test_Http_Route2(http_request_t* request) {
+	g_routeHit = 2;
+	http_getPathParam(request, 0, g_routeParam, sizeof(g_routeParam));
+	return 0;
+}
+static int Test_Http_Route3(http_request_t* request) {
+	g_routeHit = 3;
+	http_getPathParam(request, 0, g_routeParam, sizeof(g_routeParam));
+	return 0;
+}
+void Test_Http_Routes() {
+	const char *url;
+	int method;
+	int found = 0;
+	int i;
+
+	SIM_ClearOBK();
+	HTTP_RegisterCallback("/rtest/:id/info", HTTP_GET, Test_Http_Route1);
+	HTTP_RegisterCallback("/rtest/*", HTTP_ANY, Test_Http_Route2);
+	HTTP_RegisterCallback("/rtest/exact", HTTP_POST, Test_Http_Route3);
+
+	Test_FakeHTTPClientPacket_GET("rtest/12/info?x=1");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 1);
+	SELFTEST_ASSERT_STRING(g_routeParam, "12");
+	// ':id' needs whole segment, and rest must match too
+	Test_FakeHTTPClientPacket_GET("rtest/12/other");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 2);
+	SELFTEST_ASSERT_STRING(g_routeParam, "12/other");
+	// method of exact route doesn't match, so it goes to wildcard
+	Test_FakeHTTPClientPacket_GET("rtest/exact");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 2);
+	SELFTEST_ASSERT_STRING(g_routeParam, "exact");
+	Test_FakeHTTPClientPacket_POST("rtest/exact", "a=1");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 3);
+	SELFTEST_ASSERT_STRING(g_routeParam, "");
+	// ':id' route is only for GET
+	Test_FakeHTTPClientPacket_POST("rtest/12/info", "a=1");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 2);
+	// registering again replaces handler
+	HTTP_RegisterCallback("/rtest/exact", HTTP_POST, Test_Http_Route1);
+	Test_FakeHTTPClientPacket_POST("rtest/exact", "a=1");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 1);
+	// prefix of a route is not that route
+	g_routeHit = 0;
+	Test_FakeHTTPClientPacket_GET("rtes");
+	SELFTEST_ASSERT_INTEGER(g_routeHit, 0);
+
+	// routes can be listed, sorted
+	for (i = 0; (url = HTTP_GetRoute(i, &method)) != 0; i++) {
+		if (!strcmp(url, "/rtest/:id/info")) {
+			SELFTEST_ASSERT_INTEGER(method, HTTP_GET);
+			found++;
+		}
+		if (!strcmp(url, "/index")) {
+			SELFTEST_ASSERT_INTEGER(method, HTTP_ANY);
+			found++;
+		}
+	}
+	SELFTEST_ASSERT_INTEGER(found, 2);
+	Test_FakeHTTPClientPacket_GET("api/routes");
+	SELFTEST_ASSERT(strstr(replyAt, "{\"url\":\"/api/lfs/*\",\"method\":\"GET\"}") != 0);
+	// built-in pages still work
+	Test_FakeHTTPClientPacket_GET("index");
+	SELFTEST_ASSERT(strstr(replyAt, "<html>") != 0);
+}
+void Test_Http_Assets() {
+	char tmp[512];
+
+	SIM_ClearOBK();
+	// pages link assets, with version in query
+	Test_FakeHTTPClientPacket_GET("index");
+	sprintf(tmp, "href=\"/style.css?%s\"", styleCss_etag);
+	SELFTEST_ASSERT(strstr(replyAt, tmp) != 0);
+	sprintf(tmp, "src=\"/script.js?%s\"", scriptJs_etag);
+	SELFTEST_ASSERT(strstr(replyAt, tmp) != 0);
+
+	// gzip variant
+	sprintf(tmp, "GET /style.css?%s HTTP/1.1\r\nAccept-Encoding: deflate, gzip, br\r\n\r\n", styleCss_etag);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "Content-type: text/css\r\n") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Encoding: gzip\r\n") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Cache-Control: public, max-age=31536000, immutable\r\n") != 0);
+	sprintf(tmp, "ETag: \"%s-gz\"\r\n", styleCss_etag);
+	SELFTEST_ASSERT(strstr(outbuf, tmp) != 0);
+	SELFTEST_ASSERT((unsigned char)replyAt[0] == 0x1f && (unsigned char)replyAt[1] == 0x8b);
+	// much smaller than plain text
+	SELFTEST_ASSERT(atoi(strstr(outbuf, "Content-Length:") + 15) < strlen(styleCss) * 3 / 4);
+
+	// plain variant
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest("GET /script.js HTTP/1.1\r\n\r\n"));
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Encoding") == 0);
+	sprintf(tmp, "ETag: \"%s\"\r\n", scriptJs_etag);
+	SELFTEST_ASSERT(strstr(outbuf, tmp) != 0);
+	SELFTEST_ASSERT_STRING(replyAt, scriptJs);
+
+	// conditional request for same variant gets empty 304
+	sprintf(tmp, "GET /style.css HTTP/1.1\r\nAccept-Encoding: gzip\r\nIf-None-Match: \"%s-gz\"\r\n\r\n", styleCss_etag);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "Content-Encoding") == 0);
+	SELFTEST_ASSERT_STRING(replyAt, "");
+	// but not for the other one
+	sprintf(tmp, "GET /style.css HTTP/1.1\r\nIf-None-Match: \"%s-gz\"\r\n\r\n", styleCss_etag);
+	SELFTEST_ASSERT(Test_Http_KeepAliveRequest(tmp));
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 304") == 0);
+	SELFTEST_ASSERT_STRING(replyAt, styleCss);
+}
+void Test_Http_Events() {
+	const char *out;
+
+	SIM_ClearOBK();
+	SELFTEST_ASSERT_INTEGER(HTTP_SSE_GetClientsCount(), 0);
+	Test_FakeHTTPClientPacket_GET("events");
+	SELFTEST_ASSERT(strstr(outbuf, "Content-type: text/event-stream\r\n") != 0);
+	SELFTEST_ASSERT(strstr(outbuf, "Cache-Control: no-cache\r\n") != 0);
+	SELFTEST_ASSERT_STRING(replyAt, "retry: 3000\n\n");
+	SELFTEST_ASSERT_INTEGER(HTTP_SSE_GetClientsCount(), 1);
+
+	// nothing changed, nothing sent
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_STRING(SIM_GetSSEOutput(), "");
+
+	// changes within one tick give latest value once
+	CHANNEL_Set(1, 5, 0);
+	CHANNEL_Set(1, 6, 0);
+	CHANNEL_Set(3, 1, 0);
+	Sim_RunFrames(1, false);
+	out = SIM_GetSSEOutput();
+	SELFTEST_ASSERT(strstr(out, "event: channel\ndata: {\"ch\":1,\"val\":6}\n\n") != 0);
+	SELFTEST_ASSERT(strstr(out, "event: channel\ndata: {\"ch\":3,\"val\":1}\n\n") != 0);
+	SELFTEST_ASSERT(strstr(out, "\"val\":5") == 0);
+	SIM_ClearSSEOutput();
+
+	// other events
+	EventHandlers_FireEvent(CMD_EVENT_LED_STATE, 1);
+	Sim_RunFrames(1, false);
+	out = SIM_GetSSEOutput();
+	sprintf(buffer, "event: state\ndata: {\"event\":%i,\"arg\":1}\n\n", CMD_EVENT_LED_STATE);
+	SELFTEST_ASSERT_STRING(out, buffer);
+	SIM_ClearSSEOutput();
+
+	// log lines only for client that asked
+	Test_FakeHTTPClientPacket_GET("events?log=1");
+	SELFTEST_ASSERT_INTEGER(HTTP_SSE_GetClientsCount(), 2);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "Event stream test line");
+	Sim_RunFrames(1, false);
+	out = SIM_GetSSEOutput();
+	SELFTEST_ASSERT(strstr(out, "event: log\n") == out);
+	SELFTEST_ASSERT(strstr(out, "Event stream test line\n") != 0);
+	SELFTEST_ASSERT(strstr(out + 1, "event: log\n") == 0);
+	SIM_ClearSSEOutput();
+
+	// both clients get channel change
+	CHANNEL_Set(1, 7, 0);
+	Sim_RunFrames(1, false);
+	out = strstr(SIM_GetSSEOutput(), "{\"ch\":1,\"val\":7}");
+	SELFTEST_ASSERT(out != 0 && strstr(out + 1, "{\"ch\":1,\"val\":7}") != 0);
+
+	// no more free slots
+	Test_FakeHTTPClientPacket_GET("events");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 503") == outbuf);
+	SELFTEST_ASSERT_INTEGER(HTTP_SSE_GetClientsCount(), 2);
+
+	// index page script uses event stream
+	SELFTEST_ASSERT(strstr(scriptJs, "new EventSource(\"events\")") != 0);
+
+	SIM_ClearOBK();
+	SELFTEST_ASSERT_INTEGER(HTTP_SSE_GetClientsCount(), 0);
+}
+// sends masked client frame to session of faked request
+static void Test_WS_Send(int op, const char *payload, int len) {
+	unsigned char frame[400];
+	unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	int hdr, i;
+
+	frame[0] = 0x80 | op;
+	if (len < 126) {
+		frame[1] = 0x80 | len;
+		hdr = 2;
+	}
+	else {
+		frame[1] = 0x80 | 126;
+		frame[2] = len >> 8;
+		frame[3] = len & 0xFF;
+		hdr = 4;
+	}
+	memcpy(frame + hdr, mask, 4);
+	hdr += 4;
+	for (i = 0; i < len; i++) {
+		frame[hdr + i] = payload[i] ^ mask[i % 4];
+	}
+	SIM_WS_Receive(frame, hdr + len);
+}
+// returns opcode of frame at *ofs of session output, or -1 if there is no more, and moves past it
+static int Test_WS_NextFrame(int *ofs, char *payload, int maxLen) {
+	const unsigned char *p;
+	int total, len, hdr;
+
+	p = (const unsigned char*)SIM_GetWSOutput(&total);
+	if (*ofs + 2 > total) {
+		return -1;
+	}
+	p += *ofs;
+	len = p[1] & 0x7F;
+	hdr = 2;
+	if (len == 126) {
+		len = (p[2] << 8) | p[3];
+		hdr = 4;
+	}
+	if (len >= maxLen) {
+		len = maxLen - 1;
+	}
+	memcpy(payload, p + hdr, len);
+	payload[len] = 0;
+	*ofs += hdr + ((p[1] & 0x7F) == 126 ? (p[2] << 8) | p[3] : (p[1] & 0x7F));
+	return p[0] & 0x0F;
+}
+// looks for text frame containing str
+static int Test_WS_FindText(const char *str) {
+	char payload[2048];
+	int ofs = 0;
+	int op;
+
+	while ((op = Test_WS_NextFrame(&ofs, payload, sizeof(payload))) >= 0) {
+		if (op == 1 && strstr(payload, str)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+static void Test_WS_Handshake(const char *key) {
+	sprintf(buffer, "GET /ws HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+		"Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n", key);
+	Test_FakeHTTPClientPacket_Generic();
+}
+void Test_Http_WebSocket() {
+	char payload[256];
+	char big[300];
+	int ofs;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+
+	// plain request is refused
+	Test_FakeHTTPClientPacket_GET("ws");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 400") == outbuf);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 0);
+
+	// key and accept from RFC 6455
+	Test_WS_Handshake("dGhlIHNhbXBsZSBub25jZQ==");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 101 Switching Protocols\r\n") == outbuf);
+	SELFTEST_ASSERT(strstr(outbuf, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != 0);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 1);
+
+	// command without JSON reply
+	Test_WS_Send(1, "setChannel 1 1", 14);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(1, 1);
+	SELFTEST_ASSERT(Test_WS_FindText("{\"res\":\"OK\"}"));
+	SIM_ClearWSOutput();
+	// command with Tasmota JSON reply, and its log
+	Test_WS_Send(1, "POWER OFF", 9);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(1, 0);
+	SELFTEST_ASSERT(Test_WS_FindText("{\"res\":\"OK\",\"reply\":{\"POWER\":\"OFF\"}}"));
+	SIM_ClearWSOutput();
+	Test_WS_Send(1, "noSuchCommand", 13);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(Test_WS_FindText("{\"res\":\"Unknown command\"}"));
+	SIM_ClearWSOutput();
+	// two frames received at once, terminating first command must not touch second frame
+	Test_WS_Send(1, "setChannel 2 5", 14);
+	Test_WS_Send(1, "setChannel 3 6", 14);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(2, 5);
+	SELFTEST_ASSERT_CHANNEL(3, 6);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 1);
+	SIM_ClearWSOutput();
+
+	// log streaming, escaped
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "WebSocket \"test\" line");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(Test_WS_FindText("{\"log\":\""));
+	SELFTEST_ASSERT(Test_WS_FindText("WebSocket \\\"test\\\" line\\r\\n"));
+	SIM_ClearWSOutput();
+	// more than log memory holds between two ticks is counted
+	for (ofs = 0; ofs < 60; ofs++) {
+		ADDLOG_INFO(LOG_FEATURE_HTTP, "WebSocket flood line %i, long enough to fill log memory quickly", ofs);
+	}
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(Test_WS_FindText("{\"dropped\":0,\"logLost\":"));
+	SELFTEST_ASSERT(Test_WS_FindText("WebSocket flood line 59,"));
+	SIM_ClearWSOutput();
+
+	// nothing to do, nothing sent
+	Sim_RunFrames(5, false);
+	ofs = 0;
+	SELFTEST_ASSERT_INTEGER(Test_WS_NextFrame(&ofs, payload, sizeof(payload)), -1);
+
+	// ping gets pong with same payload
+	Test_WS_Send(9, "abc", 3);
+	Sim_RunFrames(1, false);
+	ofs = 0;
+	SELFTEST_ASSERT_INTEGER(Test_WS_NextFrame(&ofs, payload, sizeof(payload)), 0xA);
+	SELFTEST_ASSERT_STRING(payload, "abc");
+	SIM_ClearWSOutput();
+
+	// second session, then no more
+	Test_WS_Handshake("x3JJHMbDL1EzLkh9GBhXDw==");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 101") == outbuf);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 2);
+	Test_WS_Handshake("x3JJHMbDL1EzLkh9GBhXDw==");
+	SELFTEST_ASSERT(strstr(outbuf, "HTTP/1.1 503") == outbuf);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 2);
+
+	// too large frame closes session with 1009
+	memset(big, 'a', sizeof(big));
+	Test_WS_Send(1, big, sizeof(big));
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 1);
+	ofs = 0;
+	SELFTEST_ASSERT_INTEGER(Test_WS_NextFrame(&ofs, payload, sizeof(payload)), 0x8);
+	SELFTEST_ASSERT((unsigned char)payload[0] == 0x03 && (unsigned char)payload[1] == 0xF1);
+	SIM_ClearWSOutput();
+
+	// close is answered
+	Test_WS_Send(8, "\x03\xe8", 2);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(HTTP_WS_GetSessionsCount(), 0);
+	ofs = 0;
+	SELFTEST_ASSERT_INTEGER(Test_WS_NextFrame(&ofs, payload, sizeof(payload)), 0x8);
+
+	SIM_ClearOBK();
+}
 void Test_Http() {
 	Test_Http_SingleRelayOnChannel1();
 	Test_Http_TwoRelays();
 	Test_Http_FourRelays();
+	Test_Http_KeepAlive();
+	Test_Http_WorkerPool();
+	Test_Http_Chunked();
+	Test_Http_RequestBody();
+	Test_Http_PinConfig();
+	Test_Http_StateRevision();
+	Test_Http_StatusCache();
+	Test_Http_Routes();
+	Test_Http_Assets();
+	Test_Http_Events();
+	Test_Http_WebSocket();
 
 
 	Test_Http_LED_SingleChannel();
@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h".
+#include "../cJSON/json_arena.h"
 
 void Test_LEDDriver_CW() {
 	int i;
@@ -257,11 +258,45 @@ void Test_LEDDriver_RGB() {
 	// make error
 	//SELFTEST_ASSERT_CHANNEL(3, 666);
 }
+// Domoticz style dimmer command, parsed in JSON arena
+void Test_LEDDriver_DimmerJSON() {
+	int lastPeak, maxPeak, fallbacksBefore, fallbacks;
+
+	SIM_ClearOBK();
+	PIN_SetPinRoleForPinIndex(24, IOR_PWM);
+	PIN_SetPinChannelForPinIndex(24, 1);
+	CMD_ExecuteCommand("led_enableAll 0", 0);
+	CMD_ExecuteCommand("led_dimmer 10", 0);
+
+	JSON_Arena_GetStats(&lastPeak, &maxPeak, &fallbacksBefore);
+	CMD_ExecuteCommand("Dimmer {\"brightness\":52,\"state\":\"ON\"}", 0);
+	SELFTEST_ASSERT_EXPRESSION("$led_dimmer", 52.0f);
+	SELFTEST_ASSERT_EXPRESSION("$led_enableAll", 1.0f);
+	JSON_Arena_GetStats(&lastPeak, &maxPeak, &fallbacks);
+	SELFTEST_ASSERT(lastPeak > 0);
+	SELFTEST_ASSERT_INTEGER(fallbacks, fallbacksBefore);
+
+	CMD_ExecuteCommand("Dimmer {\"state\":\"OFF\"}", 0);
+	SELFTEST_ASSERT_EXPRESSION("$led_dimmer", 52.0f);
+	SELFTEST_ASSERT_EXPRESSION("$led_enableAll", 0.0f);
+
+	// build and print cycle also fits, hooks are back to heap afterwards
+	CMD_ExecuteCommand("testJSON 3", 0);
+	JSON_Arena_GetStats(&lastPeak, &maxPeak, &fallbacks);
+	SELFTEST_ASSERT(lastPeak > 0);
+	SELFTEST_ASSERT(maxPeak >= lastPeak);
+	// one block kept for lifetime, so every scope fits in it
+	SELFTEST_ASSERT(maxPeak <= JSON_ARENA_SIZE);
+	SELFTEST_ASSERT_INTEGER(fallbacks, fallbacksBefore);
+	CMD_ExecuteCommand("Dimmer {broken", 0);
+	SELFTEST_ASSERT_EXPRESSION("$led_dimmer", 52.0f);
+}
 void Test_LEDDriver() {
 
 	Test_LEDDriver_CW();
 	Test_LEDDriver_RGB();
 	Test_LEDDriver_RGBCW();
+	Test_LEDDriver_DimmerJSON();
 }
 
 #endif
@@ -127,6 +127,30 @@ void Test_LFS() {
 	CMD_ExecuteCommand("lfs_appendInt numbers.txt 15+16", 0);
 	Test_FakeHTTPClientPacket_GET("api/lfs/numbers.txt");
 	SELFTEST_ASSERT_HTML_REPLY("value is 2023, and 31");
+
+	// persistent log tail
+	CMD_ExecuteCommand("logPersist 1", 0);
+	Test_FakeHTTPClientPacket_GET("api/logtail?current=1");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "no saved log tail"));
+	CMD_ExecuteCommand("echo Marker before reboot 1234", 0);
+	Sim_RunSeconds(2, false);
+	Test_FakeHTTPClientPacket_GET("api/logtail?current=1");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Marker before reboot 1234"));
+	// simulate reboot, tail of previous session must be still there
+	SIM_ClearOBK();
+	Test_FakeHTTPClientPacket_GET("api/logtail");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Marker before reboot 1234"));
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "(reset reason power on)"));
+	// and it must stay there after we start saving in new session,
+	// interval is restored from LFS, no need to set it again
+	CMD_ExecuteCommand("echo Marker after reboot", 0);
+	Sim_RunSeconds(3, false);
+	Test_FakeHTTPClientPacket_GET("api/logtail");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Marker before reboot 1234"));
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Marker after reboot") == 0);
+	Test_FakeHTTPClientPacket_GET("api/logtail?current=1");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Marker after reboot"));
+	CMD_ExecuteCommand("logPersist 0", 0);
 }
 
 #endif
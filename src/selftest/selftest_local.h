@@ -8,6 +8,7 @@
 #include "../sim/sim_import.h"
 
 void SelfTest_Failed(const char *file, const char *function, int line, const char *exp);
+int SelfTest_GetFailedCount();
 
 #define SELFTEST_ASSERT(expr) \
 	if (!(expr)) \
@@ -35,7 +36,7 @@ void SelfTest_Failed(const char *file, const char *function, int line, const cha
 #define SELFTEST_ASSERT_HAS_MQTT_JSON_SENT(topic, bPrefixMode) SELFTEST_ASSERT(!SIM_BeginParsingMQTTJSON(topic, bPrefixMode));
 
 //#define FLOAT_EQUALS (a,b) (fabs(a-b)<0.001f)
-inline bool Float_Equals(float a, float b) {
+static inline bool Float_Equals(float a, float b) {
 	float res = fabs(a - b);
 	return res < 0.001f;
 }
@@ -43,7 +44,7 @@ inline bool Float_Equals(float a, float b) {
 #define VA_BUFFER_SIZE 4096
 #define VA_COUNT 4
 
-inline const char *va(const char *fmt, ...) {
+static inline const char *va(const char *fmt, ...) {
 	va_list argList;
 	static int whi = 0;
 	static char buffer[VA_COUNT][VA_BUFFER_SIZE];
@@ -104,6 +105,7 @@ int Test_GetJSONValue_Integer_Nested2(const char *par1, const char *par2, const
 float Test_GetJSONValue_Float_Nested2(const char *par1, const char *par2, const char *keyword);
 int Test_GetJSONValue_Integer(const char *keyword, const char *obj);
 const char *Test_GetJSONValue_String(const char *keyword, const char *obj);
+struct cJSON *Test_GetJSONValue_Generic(const char *keyword, const char *obj);
 const char *Test_GetJSONValue_String_Nested(const char *par1, const char *keyword);
 const char *Test_GetJSONValue_String_Nested2(const char *par1, const char *par2, const char *keyword);
 
@@ -116,6 +118,14 @@ void SIM_ClearMQTTHistory();
 bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bRetain);
 bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain);
 const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode);
+int SIM_GetMQTTHistoryQoS(const char *topic);
+// in win_mqtt_stub.c
+void SIM_SetMQTTBrokerOnline(int bOnline);
+void SIM_SetMQTTBrokerMaxVersion(int protocolLevel);
+void SIM_GetMQTTWireStats(int *bytes, int *publishes);
+void SIM_SetMQTTBrokerAckDelay(int ms);
+// in selftest_mqtt_broker.c, returns number of lost messages
+int SIM_RunMQTTBenchmark(int maxRate);
 bool SIM_BeginParsingMQTTJSON(const char *topic, bool bPrefixMode);
 
 void SIM_SimulateUserClickOnPin(int pin);
@@ -2,10 +2,18 @@
 
 #include "selftest_local.h"
 
+static int g_selfTestsFailed = 0;
+
 void SelfTest_Failed(const char *file, const char *function, int line, const char *exp) {
+	g_selfTestsFailed++;
 	printf("SelfTest failed for %s\n", exp);
 	printf("Check %s - %s - line %i\n", file, function, line);
+#ifdef _WIN32
 	system("pause");
+#endif
+}
+int SelfTest_GetFailedCount() {
+	return g_selfTestsFailed;
 }
 
 
@@ -2,6 +2,9 @@
 
 #include "selftest_local.h"
 #include "../hal/hal_wifi.h"
+#include "../mqtt/new_mqtt.h"
+#include "../mqtt/new_mqtt_trie.h"
+#include "../mqtt/new_mqtt_pacer.h"
 
 void SIM_ClearAndPrepareForMQTTTesting(const char *clientName, const char *groupName) {
 	SIM_ClearOBK();
@@ -403,7 +406,725 @@ void Test_MQTT_Topic_With_Slash() {
 }
 
 
+static int Test_MQTT_Trie_Collect(void *value, void *userData) {
+	strcat((char*)userData, (const char*)value);
+	return 0;
+}
+static int Test_MQTT_Trie_Stop(void *value, void *userData) {
+	strcat((char*)userData, (const char*)value);
+	return 1;
+}
+static int g_extraCallbackHits = 0;
+static int Test_MQTT_ExtraCallback(obk_mqtt_request_t *request) {
+	g_extraCallbackHits++;
+	return 1;
+}
+static int Test_MQTT_PassCallback(obk_mqtt_request_t *request) {
+	g_extraCallbackHits++;
+	return 0;
+}
+static const char *Test_MQTT_Trie_Matches(mqttTrieNode_t *root, const char *topic) {
+	static char buffer[64];
+	buffer[0] = 0;
+	MQTT_Trie_Match(root, topic, Test_MQTT_Trie_Collect, buffer);
+	return buffer;
+}
+void Test_MQTT_TopicTrie() {
+	mqttTrieNode_t *root = 0;
+	char buffer[64];
+
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "dev/+/set", "A") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "dev/+/get", "B") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "cmnd/dev/+", "C") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "dev/1/set", "D") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "dev/#", "E") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "#", "F") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "a/#/b", "X") == -1);
+	SELFTEST_ASSERT(MQTT_Trie_Insert(&root, "a/b+", "X") == -1);
+	// exact levels first, then +, then #
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "dev/1/set"), "DAEF");
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "dev/2/set"), "AEF");
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "dev/2/get"), "BEF");
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "dev/2/get/x"), "EF");
+	// "dev/#" also matches parent level
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "dev"), "EF");
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "cmnd/dev/POWER"), "CF");
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "cmnd/other/POWER"), "F");
+	// wildcards on first level don't match $ topics
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "$SYS/x"), "");
+	// visitor can stop matching
+	buffer[0] = 0;
+	SELFTEST_ASSERT(MQTT_Trie_Match(root, "dev/1/set", Test_MQTT_Trie_Stop, buffer) == 1);
+	SELFTEST_ASSERT_STRING(buffer, "D");
+	// removal prunes only given value
+	SELFTEST_ASSERT(MQTT_Trie_Remove(&root, "dev/1/set", "D") == 1);
+	SELFTEST_ASSERT(MQTT_Trie_Remove(&root, "dev/1/set", "D") == 0);
+	SELFTEST_ASSERT(MQTT_Trie_Remove(&root, "#", "F") == 1);
+	SELFTEST_ASSERT_STRING(Test_MQTT_Trie_Matches(root, "dev/1/set"), "AE");
+	MQTT_Trie_Free(&root);
+	SELFTEST_ASSERT(root == 0);
+
+	// dispatch in OBK itself. Callbacks are not limited anymore, so register a lot
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	for (int i = 0; i < 64; i++) {
+		sprintf(buffer, "myTestDevice/extra%i/+", i);
+		SELFTEST_ASSERT(MQTT_RegisterCallback("myTestDevice/", buffer, 100 + i, Test_MQTT_ExtraCallback) == 0);
+	}
+	g_extraCallbackHits = 0;
+	SIM_SendFakeMQTT("myTestDevice/extra63/abc", "1");
+	SIM_SendFakeMQTT("myTestDevice/extra64/abc", "1");
+	SELFTEST_ASSERT_INTEGER(g_extraCallbackHits, 1);
+	for (int i = 0; i < 64; i++) {
+		SELFTEST_ASSERT(MQTT_RemoveCallback(100 + i) == 1);
+	}
+	SIM_SendFakeMQTT("myTestDevice/extra63/abc", "1");
+	SELFTEST_ASSERT_INTEGER(g_extraCallbackHits, 1);
+	// more callbacks for one topic than fit in dispatch list on stack, all of them are run
+	for (int i = 0; i < 40; i++) {
+		SELFTEST_ASSERT(MQTT_RegisterCallback("myTestDevice/", "myTestDevice/many/+", 100 + i, Test_MQTT_PassCallback) == 0);
+	}
+	g_extraCallbackHits = 0;
+	SIM_SendFakeMQTT("myTestDevice/many/abc", "1");
+	SELFTEST_ASSERT_INTEGER(g_extraCallbackHits, 40);
+	for (int i = 0; i < 40; i++) {
+		SELFTEST_ASSERT(MQTT_RemoveCallback(100 + i) == 1);
+	}
+	SIM_SendFakeMQTTRawChannelSet(5, "123");
+	SELFTEST_ASSERT_CHANNEL(5, 123);
+	// not a subscribed topic, so it's not a channel set
+	SIM_SendFakeMQTT("myTestDevice/5/set/more", "44");
+	SELFTEST_ASSERT_CHANNEL(5, 123);
+	SIM_SendFakeMQTTAndRunSimFrame_CMND_ViaGroupTopic("SetChannel", "5 77");
+	SELFTEST_ASSERT_CHANNEL(5, 77);
+}
+
+static int g_rxCallbackHits = 0;
+static int g_rxCallbackBad = 0;
+static int g_rxPostOnHit = 0;
+static char g_rxPayload[6000];
+static int Test_MQTT_RxCallback(obk_mqtt_request_t *request) {
+	int i;
+
+	g_rxCallbackHits++;
+	// payload is given in place, it must be complete and terminated
+	for (i = 0; i < request->receivedLen; i++) {
+		if (request->received[i] != 'a' + (g_rxCallbackHits % 20)) {
+			g_rxCallbackBad++;
+			break;
+		}
+	}
+	if (request->received[request->receivedLen] != 0 || strcmp(request->topic, "myTestDevice/rx/big")) {
+		g_rxCallbackBad++;
+	}
+	// simulate tcp thread posting while this record is still in use
+	if (g_rxCallbackHits == g_rxPostOnHit) {
+		memset(g_rxPayload, 'a' + ((g_rxCallbackHits + 1) % 20), 1500);
+		MQTT_Post_Received("myTestDevice/rx/big", strlen("myTestDevice/rx/big"), (const unsigned char*)g_rxPayload, 1500);
+	}
+	return 1;
+}
+static void Test_MQTT_RxPost(int len) {
+	static int posted = 0;
+	posted++;
+	memset(g_rxPayload, 'a' + (posted % 20), len);
+	MQTT_Post_Received("myTestDevice/rx/big", strlen("myTestDevice/rx/big"), (const unsigned char*)g_rxPayload, len);
+}
+void Test_MQTT_RxBuffer() {
+	int size, used, highWater, overflows, drops;
+	int posted;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	SELFTEST_ASSERT(MQTT_RegisterCallback("myTestDevice/", "myTestDevice/rx/+", 200, Test_MQTT_RxCallback) == 0);
+	CMD_ExecuteCommand("mqtt_rxBufferSize 4096", 0);
+	g_rxCallbackHits = 0;
+	g_rxCallbackBad = 0;
+	g_rxPostOnHit = 0;
+
+	// payload is not limited to 2KB anymore
+	Test_MQTT_RxPost(3000);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(g_rxCallbackHits, 1);
+	MQTT_GetRxBufferStats(&size, &used, &highWater, &overflows, &drops);
+	SELFTEST_ASSERT_INTEGER(size, 4096);
+	SELFTEST_ASSERT_INTEGER(used, 0);
+	SELFTEST_ASSERT(highWater > 3000);
+	SELFTEST_ASSERT_INTEGER(overflows, 0);
+	SELFTEST_ASSERT_INTEGER(drops, 0);
+
+	// third one does not fit until first two are processed
+	Test_MQTT_RxPost(1500);
+	Test_MQTT_RxPost(1500);
+	Test_MQTT_RxPost(1500);
+	MQTT_GetRxBufferStats(&size, &used, &highWater, &overflows, &drops);
+	SELFTEST_ASSERT_INTEGER(overflows, 1);
+	// while second record is processed, a new one arrives and goes to the start of ring
+	g_rxPostOnHit = 3;
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(g_rxCallbackHits, 4);
+	MQTT_GetRxBufferStats(&size, &used, &highWater, &overflows, &drops);
+	SELFTEST_ASSERT_INTEGER(used, 0);
+	SELFTEST_ASSERT_INTEGER(overflows, 1);
+
+	// larger than the whole ring, so it's dropped
+	posted = g_rxCallbackHits;
+	MQTT_Post_Received("myTestDevice/rx/big", strlen("myTestDevice/rx/big"), (const unsigned char*)g_rxPayload, 5000);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(g_rxCallbackHits, posted);
+	MQTT_GetRxBufferStats(&size, &used, &highWater, &overflows, &drops);
+	SELFTEST_ASSERT_INTEGER(drops, 1);
+
+	// until ring is resized
+	CMD_ExecuteCommand("mqtt_rxBufferSize 8192", 0);
+	MQTT_GetRxBufferStats(&size, &used, &highWater, &overflows, &drops);
+	SELFTEST_ASSERT_INTEGER(size, 8192);
+	g_rxCallbackHits = 4;
+	Test_MQTT_RxPost(5000);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(g_rxCallbackHits, 5);
+	SELFTEST_ASSERT_INTEGER(g_rxCallbackBad, 0);
+
+	SELFTEST_ASSERT(MQTT_RemoveCallback(200) == 1);
+	CMD_ExecuteCommand("mqtt_rxBufferSize 4096", 0);
+}
+
+void Test_MQTT_RxLatency() {
+	int last, avg, max, count;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	// also resets latency stats
+	CMD_ExecuteCommand("mqtt_rxBufferSize 4096", 0);
+	MQTT_GetRxLatencyStats(&last, &avg, &max, &count);
+	SELFTEST_ASSERT_INTEGER(count, 0);
+
+	// woken right away, as MQTT_TriggerRead does on device
+	MQTT_Post_Received_Str("cmnd/myTestDevice/setChannel", "3 7");
+	SELFTEST_ASSERT_INTEGER(MQTT_process_received(), 1);
+	SELFTEST_ASSERT_CHANNEL(3, 7);
+	MQTT_GetRxLatencyStats(&last, &avg, &max, &count);
+	SELFTEST_ASSERT_INTEGER(count, 1);
+	SELFTEST_ASSERT_INTEGER(last, 0);
+	SELFTEST_ASSERT_INTEGER(max, 0);
+
+	// picked up by the quick tick fallback, one 5ms frame later
+	MQTT_Post_Received_Str("cmnd/myTestDevice/setChannel", "3 8");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(3, 8);
+	MQTT_GetRxLatencyStats(&last, &avg, &max, &count);
+	SELFTEST_ASSERT_INTEGER(count, 2);
+	SELFTEST_ASSERT_INTEGER(last, 5);
+	SELFTEST_ASSERT_INTEGER(max, 5);
+	SELFTEST_ASSERT_INTEGER(avg, 2);
+
+	// nothing is left to process
+	SELFTEST_ASSERT_INTEGER(MQTT_process_received(), 0);
+}
+
+void Test_MQTT_PublishNoAlloc() {
+	int allocs, lockWaits, lockFails;
+	int allocsBefore;
+	char longName[300];
+	char value[16];
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	MQTT_GetPublishPathStats(&allocsBefore, &lockWaits, &lockFails);
+
+	for (int i = 0; i < 50; i++) {
+		SIM_ClearMQTTHistory();
+		MQTT_PublishMain_StringInt("someValue", i);
+		sprintf(value, "%i", i);
+		SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/someValue/get", value, false);
+	}
+	MQTT_PublishMain_StringString("test", "abc", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/test/get", "abc", false);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishStat("STATUS", "xyz");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("stat/myTestDevice/STATUS", "xyz", false);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishTele("STATE", "qwe");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("tele/myTestDevice/STATE", "qwe", false);
+	SIM_ClearMQTTHistory();
+	// prefix follows client id change right away
+	CFG_SetMQTTClientId("renamedDevice");
+	MQTT_PublishMain_StringString("test", "abc", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("renamedDevice/test/get", "abc", false);
+	SIM_ClearMQTTHistory();
+	MQTT_GetPublishPathStats(&allocs, &lockWaits, &lockFails);
+	SELFTEST_ASSERT_INTEGER(allocs, allocsBefore);
+	SELFTEST_ASSERT_INTEGER(lockFails, 0);
+
+	// only a topic that does not fit in the static buffer is allocated
+	memset(longName, 'x', sizeof(longName) - 1);
+	longName[sizeof(longName) - 1] = 0;
+	MQTT_Publish("renamedDevice", longName, "1", 0);
+	MQTT_GetPublishPathStats(&allocs, &lockWaits, &lockFails);
+	SELFTEST_ASSERT_INTEGER(allocs, allocsBefore + 1);
+	SIM_ClearMQTTHistory();
+}
+
+void Test_MQTT_QoSPolicy() {
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	// defaults, telemetry is QoS 0
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "230", 0);
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("myTestDevice/voltage/get"), 0);
+	MQTT_PublishTele("STATE", "{}");
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("tele/myTestDevice/STATE"), 0);
+	MQTT_PublishStat("RESULT", "{}");
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("stat/myTestDevice/RESULT"), 1);
+	MQTT_Publish("some/other", "topic", "1", 0);
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("some/other/topic"), 1);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("some/other/topic", "1", false);
+	// retain requested by publisher is kept
+	MQTT_Publish("homeassistant", "x/config", "{}", OBK_PUBLISH_FLAG_RETAIN);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("homeassistant/x/config", "{}", true);
+
+	// more specific entry overrides
+	CMD_ExecuteCommand("mqtt_qos myTestDevice/voltage/get 2 1", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "231", 0);
+	MQTT_PublishMain_StringString("current", "1", 0);
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("myTestDevice/voltage/get"), 2);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/voltage/get", "231", true);
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("myTestDevice/current/get"), 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/current/get", "1", false);
+	// and can be removed
+	CMD_ExecuteCommand("mqtt_qos myTestDevice/voltage/get -1", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_PublishMain_StringString("voltage", "232", 0);
+	SELFTEST_ASSERT_INTEGER(SIM_GetMQTTHistoryQoS("myTestDevice/voltage/get"), 0);
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_qos a/#/b 1", 0) == CMD_RES_BAD_ARGUMENT);
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_qos a/b 3", 0) == CMD_RES_BAD_ARGUMENT);
+	SIM_ClearMQTTHistory();
+}
+
+void Test_MQTT_PublishQueue() {
+	int queued, coalesced, dropped;
+	int coalescedBefore, droppedBefore;
+	char buffer[32];
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	// let the initial full broadcast finish
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SIM_ClearMQTTHistory();
+	MQTT_GetQueueStats(&queued, &coalescedBefore, &droppedBefore);
+	SELFTEST_ASSERT_INTEGER(queued, 0);
+
+	// same topic queued many times is published once, with latest value
+	for (int i = 0; i < 10; i++) {
+		sprintf(buffer, "%i", i);
+		MQTT_QueuePublish("myTestDevice", "burst", buffer, 0);
+	}
+	MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+	SELFTEST_ASSERT_INTEGER(queued, 1);
+	SELFTEST_ASSERT_INTEGER(coalesced, coalescedBefore + 9);
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/burst", "9", false);
+	SELFTEST_ASSERT(!SIM_CheckMQTTHistoryForString("myTestDevice/burst", "0", false));
+	MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+	SELFTEST_ASSERT_INTEGER(queued, 0);
+	SIM_ClearMQTTHistory();
+
+	// fill the queue with telemetry
+	for (int i = 0; i < MQTT_MAX_QUEUE_SIZE; i++) {
+		sprintf(buffer, "value%i", i);
+		MQTT_QueuePublish("myTestDevice", buffer, "1", 0);
+	}
+	MQTT_QueuePublish("myTestDevice", "oneMore", "1", 0);
+	MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+	SELFTEST_ASSERT_INTEGER(queued, MQTT_MAX_QUEUE_SIZE);
+	SELFTEST_ASSERT_INTEGER(dropped, droppedBefore + 1);
+	// command result still gets in, oldest telemetry makes room for it, and goes first
+	MQTT_QueuePublish("stat/myTestDevice", "RESULT", "{\"POWER\":\"ON\"}", 0);
+	MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+	SELFTEST_ASSERT_INTEGER(queued, MQTT_MAX_QUEUE_SIZE);
+	SELFTEST_ASSERT_INTEGER(dropped, droppedBefore + 2);
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("stat/myTestDevice/RESULT", "{\"POWER\":\"ON\"}", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/value0", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/value1", false) != 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/value6", false) == 0);
+	for (int i = 0; i < 5; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/value6", false) != 0);
+	MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+	SELFTEST_ASSERT_INTEGER(queued, 0);
+	SIM_ClearMQTTHistory();
+
+	// command of dropped telemetry is run after the item that took its place
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	MQTT_QueuePublishWithCommand("myTestDevice", "value0", "1", 0, PublishChannels);
+	for (int i = 1; i < MQTT_MAX_QUEUE_SIZE; i++) {
+		sprintf(buffer, "value%i", i);
+		MQTT_QueuePublish("myTestDevice", buffer, "1", 0);
+	}
+	MQTT_QueuePublish("stat/myTestDevice", "RESULT", "{\"POWER\":\"OFF\"}", 0);
+	SIM_ClearMQTTHistory();
+	for (int i = 0; i < 10; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/value0", false) == 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("stat/myTestDevice/RESULT", "{\"POWER\":\"OFF\"}", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "0", false);
+	SIM_ClearMQTTHistory();
+}
+
+void Test_MQTT_Aggregate() {
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	CMD_ExecuteCommand("setChannelType 2 Temperature", 0);
+	CMD_ExecuteCommand("setChannelType 3 Humidity", 0);
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+
+	// delta mode starts with full state
+	CMD_ExecuteCommand("mqtt_aggregate 2 5", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/channels/get", "{\"1\":0}", false);
+	SIM_ClearMQTTHistory();
+	// changes are not published one by one
+	CMD_ExecuteCommand("setChannel 2 215", 0);
+	CMD_ExecuteCommand("setChannel 3 40", 0);
+	CMD_ExecuteCommand("setChannel 2 216", 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/channels/get", false) == 0);
+	for (int i = 0; i < 5; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/channels/get", "{\"2\":216,\"3\":40}", false);
+	SIM_ClearMQTTHistory();
+	// nothing has changed, nothing is sent
+	for (int i = 0; i < 5; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/channels/get", false) == 0);
+	// relay is still published right away, and in next message
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "1", false);
+	for (int i = 0; i < 5; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/channels/get", "{\"1\":1}", false);
+	SIM_ClearMQTTHistory();
+
+	// full mode sends all published channels, and the changed ones
+	CMD_ExecuteCommand("mqtt_aggregate 1 5", 0);
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/channels/get", "{\"1\":1}", false);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 3 41", 0);
+	for (int i = 0; i < 5; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/channels/get", "{\"1\":1,\"3\":41}", false);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("mqtt_aggregate 0", 0);
+	CMD_ExecuteCommand("setChannel 3 42", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/3/get", "42", false);
+	SIM_ClearMQTTHistory();
+}
+
+void Test_MQTT_Dedup() {
+	int sent, duplicates, tooFast, deadband, deadband2, heartbeats;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	CMD_ExecuteCommand("setChannelType 2 Temperature", 0);
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+
+	// min interval 1, heartbeat after 10 seconds, deadband 1
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_dedup 2 1 10 1 0", 0) == CMD_RES_OK);
+	SIM_ClearMQTTHistory();
+	CMD_ExecuteCommand("setChannel 2 200", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "200", false);
+	SIM_ClearMQTTHistory();
+	// within deadband
+	CMD_ExecuteCommand("setChannel 2 201", 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	// bigger change, but too fast, so it waits for interval
+	CMD_ExecuteCommand("setChannel 2 210", 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	MQTT_Dedup_Tick();
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	MQTT_Dedup_Tick();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "210", false);
+	SIM_ClearMQTTHistory();
+	// nothing sent for max silence time, so last value is repeated
+	for (int i = 0; i < 9; i++) {
+		MQTT_Dedup_Tick();
+	}
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	MQTT_Dedup_Tick();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "210", false);
+	SIM_ClearMQTTHistory();
+	// value held back by deadband is counted, and heartbeat sends it instead of sent one
+	MQTT_Dedup_GetStats(&sent, &duplicates, &tooFast, &deadband, &heartbeats);
+	CMD_ExecuteCommand("setChannel 2 211", 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	MQTT_Dedup_GetStats(&sent, &duplicates, &tooFast, &deadband2, &heartbeats);
+	SELFTEST_ASSERT_INTEGER(deadband2, deadband + 1);
+	for (int i = 0; i < 10; i++) {
+		MQTT_Dedup_Tick();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "211", false);
+	SIM_ClearMQTTHistory();
+	// without rule, values are sent right away
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_dedup 2 -1", 0) == CMD_RES_OK);
+	CMD_ExecuteCommand("setChannel 2 212", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "212", false);
+	SIM_ClearMQTTHistory();
+}
+
+static void Test_MQTT_Offline_ExpectReplay(const char *val) {
+	const char *s;
+
+	SIM_ClearMQTTHistory();
+	MQTT_RunEverySecondUpdate();
+	s = SIM_GetMQTTHistoryString("myTestDevice/2/offline", false);
+	SELFTEST_ASSERT(s != 0);
+	SELFTEST_ASSERT(s && strstr(s, val));
+}
+void Test_MQTT_Offline() {
+	int pending, stored, spilled, dropped, replayed;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	CMD_ExecuteCommand("lfs_format", 0);
+	CMD_ExecuteCommand("setChannelType 2 Temperature", 0);
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+
+	// 2 records in RAM, 8 in file, replay one per second
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_offline 2 8 1", 0) == CMD_RES_OK);
+	SIM_SetMQTTBrokerOnline(0);
+	SIM_ClearMQTTHistory();
+	// RAM is moved to file once per second, when it's more than half full
+	CMD_ExecuteCommand("setChannel 2 10", 0);
+	CMD_ExecuteCommand("setChannel 2 11", 0);
+	MQTT_RunEverySecondUpdate();
+	CMD_ExecuteCommand("setChannel 2 12", 0);
+	CMD_ExecuteCommand("setChannel 2 13", 0);
+	MQTT_RunEverySecondUpdate();
+	CMD_ExecuteCommand("setChannel 2 14", 0);
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	MQTT_Offline_GetStats(&pending, &stored, &spilled, &dropped, &replayed);
+	SELFTEST_ASSERT(pending == 5);
+	SELFTEST_ASSERT(spilled == 4);
+	SELFTEST_ASSERT(dropped == 0);
+
+	// back online, oldest ones are replayed first, from the file
+	SIM_SetMQTTBrokerOnline(1);
+	Test_MQTT_Offline_ExpectReplay("\"val\":10}");
+	Test_MQTT_Offline_ExpectReplay("\"val\":11}");
+	Test_MQTT_Offline_ExpectReplay("\"val\":12}");
+	Test_MQTT_Offline_ExpectReplay("\"val\":13}");
+	Test_MQTT_Offline_ExpectReplay("\"val\":14}");
+	MQTT_Offline_GetStats(&pending, &stored, &spilled, &dropped, &replayed);
+	SELFTEST_ASSERT(pending == 0);
+	SELFTEST_ASSERT(replayed == 5);
+	SIM_ClearMQTTHistory();
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/offline", false) == 0);
+
+	// RAM only, so oldest is dropped when it's full
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_offline 2 0 1", 0) == CMD_RES_OK);
+	SIM_SetMQTTBrokerOnline(0);
+	CMD_ExecuteCommand("setChannel 2 20", 0);
+	CMD_ExecuteCommand("setChannel 2 21", 0);
+	CMD_ExecuteCommand("setChannel 2 22", 0);
+	SIM_SetMQTTBrokerOnline(1);
+	Test_MQTT_Offline_ExpectReplay("\"val\":21}");
+	Test_MQTT_Offline_ExpectReplay("\"val\":22}");
+	MQTT_Offline_GetStats(&pending, &stored, &spilled, &dropped, &replayed);
+	SELFTEST_ASSERT(pending == 0);
+	SELFTEST_ASSERT(dropped == 1);
+
+	// or newest one, if asked so
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_offline 2 0 1 1", 0) == CMD_RES_OK);
+	SIM_SetMQTTBrokerOnline(0);
+	CMD_ExecuteCommand("setChannel 2 30", 0);
+	CMD_ExecuteCommand("setChannel 2 31", 0);
+	CMD_ExecuteCommand("setChannel 2 32", 0);
+	SIM_SetMQTTBrokerOnline(1);
+	Test_MQTT_Offline_ExpectReplay("\"val\":30}");
+	Test_MQTT_Offline_ExpectReplay("\"val\":31}");
+	CMD_ExecuteCommand("mqtt_offline 0 0", 0);
+	SIM_ClearMQTTHistory();
+}
+
+// average computed PUBLISH packet size for publishing the same topic again and again
+static int Test_MQTT_V5_BytesPerPublish() {
+	int bytes0, pubs0, bytes1, pubs1;
+
+	SIM_GetMQTTWireStats(&bytes0, &pubs0);
+	for (int i = 0; i < 10; i++) {
+		MQTT_PublishMain_StringInt("myvalue", 10 + i);
+	}
+	SIM_GetMQTTWireStats(&bytes1, &pubs1);
+	SELFTEST_ASSERT(pubs1 - pubs0 == 10);
+	return (bytes1 - bytes0) / 10;
+}
+static void Test_MQTT_V5_Reconnect() {
+	SIM_SetMQTTBrokerOnline(0);
+	for (int i = 0; i < 40; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SIM_SetMQTTBrokerOnline(1);
+	for (int i = 0; i < 40; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+}
+void Test_MQTT_V5() {
+	int bytes311, bytes5;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	CFG_SetMQTTHost("127.0.0.1");
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT(MQTT_GetProtocolVersion() == 4);
+	bytes311 = Test_MQTT_V5_BytesPerPublish();
+
+	// MQTT 5 sends repeated topic as alias
+	SELFTEST_ASSERT(CMD_ExecuteCommand("mqtt_version 5 60", 0) == CMD_RES_OK);
+	Test_MQTT_V5_Reconnect();
+	SELFTEST_ASSERT(MQTT_GetProtocolVersion() == 5);
+	SIM_ClearMQTTHistory();
+	bytes5 = Test_MQTT_V5_BytesPerPublish();
+	SELFTEST_ASSERT(bytes5 < bytes311);
+	// alias is only on the wire
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myvalue/get", "19", false);
+
+	// old broker refuses MQTT 5, so 3.1.1 is used
+	SIM_SetMQTTBrokerMaxVersion(4);
+	Test_MQTT_V5_Reconnect();
+	SELFTEST_ASSERT(MQTT_GetProtocolVersion() == 4);
+	SIM_ClearMQTTHistory();
+	SELFTEST_ASSERT(Test_MQTT_V5_BytesPerPublish() == bytes311);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myvalue/get", "19", false);
+
+	SIM_SetMQTTBrokerMaxVersion(5);
+	CMD_ExecuteCommand("mqtt_version 4", 0);
+	Test_MQTT_V5_Reconnect();
+	SIM_ClearMQTTHistory();
+}
+
+// runs given seconds of self state broadcast, returns number of publishes in last one
+static int Test_MQTT_Pacing_Run(int seconds) {
+	int bytes, pubsBefore, pubs;
+
+	pubsBefore = pubs = 0;
+	while (seconds-- > 0) {
+		// restart, so it never runs out of items
+		CMD_ExecuteCommand("publishAll", 0);
+		SIM_GetMQTTWireStats(&bytes, &pubsBefore);
+		Sim_RunSeconds(1, false);
+		SIM_GetMQTTWireStats(&bytes, &pubs);
+	}
+	return pubs - pubsBefore;
+}
+void Test_MQTT_Pacing() {
+	int rate, avgRtt, minRtt, inFlight;
+	int i;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	// 20 relays, so broadcast has more items than max rate
+	for (i = 0; i < 20; i++) {
+		PIN_SetPinRoleForPinIndex(i, IOR_Relay);
+		PIN_SetPinChannelForPinIndex(i, i + 1);
+	}
+	for (i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	CMD_ExecuteCommand("mqtt_broadcastPacing 1 16", 0);
+
+	// nothing is acknowledged, so rate stays at floor
+	Test_MQTT_Pacing_Run(3);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT_INTEGER(rate, 1);
+	SELFTEST_ASSERT_INTEGER(minRtt, -1);
+
+	// fast acks, rate doubles every second up to ceiling
+	SIM_SetMQTTBrokerAckDelay(10);
+	Test_MQTT_Pacing_Run(2);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT(rate >= 2 && rate <= 4);
+	SELFTEST_ASSERT(minRtt >= 9 && minRtt <= 10);
+	Test_MQTT_Pacing_Run(4);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT_INTEGER(rate, 16);
+	SELFTEST_ASSERT_INTEGER(Test_MQTT_Pacing_Run(1), 16);
+
+	// broker gets slow, rate backs off
+	SIM_SetMQTTBrokerAckDelay(300);
+	Test_MQTT_Pacing_Run(2);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT(rate <= 8);
+	SELFTEST_ASSERT(avgRtt >= 290);
+
+	// and grows again, slowly, when it's fast again
+	SIM_SetMQTTBrokerAckDelay(10);
+	Test_MQTT_Pacing_Run(2);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	i = rate;
+	Test_MQTT_Pacing_Run(1);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT(rate > i && rate < i * 2);
+
+	// lwIP output buffer almost full, rate backs off even with fast acks
+	mqtt_client->output.put = MQTT_OUTPUT_RINGBUF_SIZE - 64;
+	mqtt_client->output.get = 0;
+	Test_MQTT_Pacing_Run(1);
+	mqtt_client->output.put = 0;
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT(rate < i);
+
+	// old command gives fixed rate
+	CMD_ExecuteCommand("mqtt_broadcastItemsPerSec 3", 0);
+	Test_MQTT_Pacing_Run(3);
+	MQTT_Pacer_GetStats(&rate, &avgRtt, &minRtt, &inFlight);
+	SELFTEST_ASSERT_INTEGER(rate, 3);
+
+	SIM_SetMQTTBrokerAckDelay(-1);
+	CMD_ExecuteCommand("mqtt_broadcastPacing 1 20", 0);
+}
+
 void Test_MQTT(){
+	Test_MQTT_TopicTrie();
+	Test_MQTT_RxBuffer();
+	Test_MQTT_RxLatency();
+	Test_MQTT_PublishNoAlloc();
+	Test_MQTT_QoSPolicy();
+	Test_MQTT_PublishQueue();
+	Test_MQTT_Aggregate();
+	Test_MQTT_Dedup();
+	Test_MQTT_Offline();
+	Test_MQTT_V5();
+	Test_MQTT_Pacing();
+	Test_MQTT_Broker();
 	Test_MQTT_Get_And_Reply();
 	Test_MQTT_Misc();
 	Test_MQTT_Channels();
@@ -0,0 +1,297 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../mqtt/new_mqtt.h"
+#include "../win32/stubs/lwip/win_mqtt_broker.h"
+#if defined(_MSC_VER) || defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/////////////////////////////////////////////////////////////
+// external client used by tests, remembers last delivery
+typedef struct testBrokerClient_s {
+	char topic[64];
+	char payload[256];
+	int qos;
+	int retain;
+	int hits;
+} testBrokerClient_t;
+
+static void Test_MQTT_Broker_OnDeliver(int clientId, const char *topic, const unsigned char *payload, int len,
+	int qos, int retain, void *userData) {
+	testBrokerClient_t *c = (testBrokerClient_t*)userData;
+
+	strcpy_safe(c->topic, topic, sizeof(c->topic));
+	if (len >= sizeof(c->payload)) {
+		len = sizeof(c->payload) - 1;
+	}
+	memcpy(c->payload, payload, len);
+	c->payload[len] = 0;
+	c->qos = qos;
+	c->retain = retain;
+	c->hits++;
+}
+
+static void Test_MQTT_Broker_Connect() {
+	SIM_SetMQTTBrokerOnline(0);
+	for (int i = 0; i < 20; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SIM_SetMQTTBrokerOnline(1);
+	for (int i = 0; i < 20; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+}
+
+void Test_MQTT_Broker() {
+	testBrokerClient_t a, b;
+	simBrokerStats_t st;
+	char longPayload[300];
+	int idA, idB;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	CFG_SetMQTTHost("127.0.0.1");
+	SIM_Broker_Reset();
+	SIM_Broker_Enable(1);
+	Test_MQTT_Broker_Connect();
+	// device has subscribed to its command topics
+	SIM_Broker_GetStats(&st);
+	SELFTEST_ASSERT(st.subscriptions > 0);
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	idA = SIM_Broker_AddClient(Test_MQTT_Broker_OnDeliver, &a);
+	idB = SIM_Broker_AddClient(Test_MQTT_Broker_OnDeliver, &b);
+	SELFTEST_ASSERT(idA > 0 && idB > 0);
+
+	// wildcards
+	SELFTEST_ASSERT(SIM_Broker_Subscribe(idA, "myTestDevice/+/get", 1) == 1);
+	SELFTEST_ASSERT(SIM_Broker_Subscribe(idB, "myTestDevice/#", 2) == 2);
+	SELFTEST_ASSERT(SIM_Broker_Subscribe(idB, "bad/#/filter", 0) == -1);
+	// device has already published some retained topics
+	SELFTEST_ASSERT(b.hits > 0);
+	a.hits = 0;
+	b.hits = 0;
+	CMD_ExecuteCommand("publishInt myValue 12", 0);
+	SELFTEST_ASSERT_STRING(a.topic, "myTestDevice/myValue/get");
+	SELFTEST_ASSERT_STRING(a.payload, "12");
+	SELFTEST_ASSERT_INTEGER(b.hits, 1);
+	// QoS is the lower of publish and subscription
+	SELFTEST_ASSERT_INTEGER(a.qos, b.qos);
+	SELFTEST_ASSERT(a.qos <= 1);
+
+	// command from external client reaches device through the normal receive path
+	SIM_Broker_Publish(idA, "cmnd/myTestDevice/setChannel", "5 77", 4, 1, 0);
+	SELFTEST_ASSERT_CHANNEL(5, 0);
+	Sim_RunFrames(2, false);
+	SELFTEST_ASSERT_CHANNEL(5, 77);
+	// group topic too, with QoS 2
+	SIM_Broker_Publish(idA, "cmnd/bekens/setChannel", "5 78", 4, 2, 0);
+	Sim_RunFrames(2, false);
+	SELFTEST_ASSERT_CHANNEL(5, 78);
+
+	// payload larger than one lwIP chunk is reassembled
+	memset(longPayload, ' ', sizeof(longPayload));
+	memcpy(longPayload, "5 79", 4);
+	SIM_Broker_Publish(idA, "cmnd/myTestDevice/setChannel", longPayload, sizeof(longPayload), 0, 0);
+	Sim_RunFrames(2, false);
+	SELFTEST_ASSERT_CHANNEL(5, 79);
+
+	// retained message is sent to late subscriber, and cleared by empty one
+	SIM_Broker_Publish(idA, "other/state", "on", 2, 1, 1);
+	a.hits = 0;
+	SIM_Broker_Subscribe(idA, "other/#", 1);
+	SELFTEST_ASSERT_INTEGER(a.hits, 1);
+	SELFTEST_ASSERT_STRING(a.payload, "on");
+	SELFTEST_ASSERT_INTEGER(a.retain, 1);
+	SIM_Broker_Publish(idB, "other/state", "", 0, 1, 1);
+	SIM_Broker_Unsubscribe(idA, "other/#");
+	a.hits = 0;
+	SIM_Broker_Subscribe(idA, "other/#", 1);
+	SELFTEST_ASSERT_INTEGER(a.hits, 0);
+
+	// retained command is delivered to device when it (re)subscribes
+	SIM_Broker_Publish(idA, "cmnd/myTestDevice/setChannel", "6 12", 4, 1, 1);
+	Sim_RunFrames(2, false);
+	CHANNEL_Set(6, 0, 0);
+	Test_MQTT_Broker_Connect();
+	Sim_RunFrames(2, false);
+	SELFTEST_ASSERT_CHANNEL(6, 12);
+
+	// QoS 2 handshakes were counted
+	SIM_Broker_GetStats(&st);
+	SELFTEST_ASSERT(st.pubRecs > 0 && st.pubRecs == st.pubRels && st.pubRels == st.pubComps);
+	SELFTEST_ASSERT(st.pubAcks > 0);
+	SELFTEST_ASSERT_INTEGER(st.pending, 0);
+
+	// short benchmark run, nothing may get lost at these rates
+	SELFTEST_ASSERT_INTEGER(SIM_RunMQTTBenchmark(50), 0);
+
+	SIM_Broker_Reset();
+	SIM_Broker_Enable(0);
+	Test_MQTT_Broker_Connect();
+}
+
+/////////////////////////////////////////////////////////////
+// Benchmark. Bench client sends "publish echo <seq>" commands to device at fixed rate,
+// device publishes <seq> to <client>/echo/get, and round trip time is taken from that.
+// Rate is doubled each round until maxRate.
+// Times are simulated, so they show how many frames the command path takes, not CPU time.
+// Run with: -mqttBenchmark <maxRate>
+#define BENCH_SECONDS 2
+#define BENCH_DRAIN_FRAMES 400
+
+typedef struct mqttBench_s {
+	int *sentAt;
+	int *latency;
+	int sent;
+	int received;
+} mqttBench_t;
+
+static void SIM_Bench_OnEcho(int clientId, const char *topic, const unsigned char *payload, int len,
+	int qos, int retain, void *userData) {
+	mqttBench_t *b = (mqttBench_t*)userData;
+	int seq = atoi((const char*)payload);
+
+	if (seq < 0 || seq >= b->sent || b->sentAt[seq] < 0) {
+		return;
+	}
+	b->latency[b->received++] = rtos_get_time() - b->sentAt[seq];
+	b->sentAt[seq] = -1;
+}
+
+// bytes in allocated heap blocks of the whole simulator process, -1 if C runtime can't tell
+static int SIM_Bench_HeapInUse() {
+#if defined(_MSC_VER)
+	_HEAPINFO hi;
+	int used = 0;
+
+	hi._pentry = NULL;
+	while (_heapwalk(&hi) == _HEAPOK) {
+		if (hi._useflag == _USEDENTRY) {
+			used += hi._size;
+		}
+	}
+	return used;
+#elif defined(__GLIBC__)
+	return mallinfo2().uordblks;
+#else
+	return -1;
+#endif
+}
+
+static int SIM_Bench_Compare(const void *a, const void *b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+// returns number of lost messages
+static int SIM_Bench_Round(int clientId, mqttBench_t *b, int rate, int qos) {
+	char cmdTopic[64];
+	char payload[32];
+	int size, used, highWater, overflows, drops;
+	int queued, coalesced, dropped;
+	int allocsBefore, allocs, lockWaits, lockFails;
+	int queueHigh = 0;
+	int heapBefore, heap, heapHigh;
+	char heapStr[16];
+	int start, now, target;
+	int frame, frames;
+	int lost;
+
+	sprintf(cmdTopic, "cmnd/%s/publish", CFG_GetMQTTClientId());
+	b->sent = 0;
+	b->received = 0;
+	// also resets ring stats
+	CMD_ExecuteCommand("mqtt_rxBufferSize 4096", 0);
+	MQTT_GetPublishPathStats(&allocsBefore, &lockWaits, &lockFails);
+	heapBefore = heapHigh = SIM_Bench_HeapInUse();
+	start = rtos_get_time();
+	frames = BENCH_SECONDS * 1000 / 5 + BENCH_DRAIN_FRAMES;
+	for (frame = 0; frame < frames; frame++) {
+		now = rtos_get_time() - start;
+		target = now < BENCH_SECONDS * 1000 ? rate * now / 1000 : rate * BENCH_SECONDS;
+		while (b->sent < target) {
+			sprintf(payload, "echo %i", b->sent);
+			b->sentAt[b->sent] = rtos_get_time();
+			b->sent++;
+			SIM_Broker_Publish(clientId, cmdTopic, payload, strlen(payload), qos, 0);
+		}
+		Sim_RunFrames(1, false);
+		MQTT_GetQueueStats(&queued, &coalesced, &dropped);
+		if (queued > queueHigh) {
+			queueHigh = queued;
+		}
+		// heap walk is slow, so it's sampled
+		if (frame % 20 == 0) {
+			heap = SIM_Bench_HeapInUse();
+			if (heap > heapHigh) {
+				heapHigh = heap;
+			}
+		}
+	}
+	MQTT_GetRxBufferStats(&size, &used, &highWater, &overflows, &drops);
+	MQTT_GetPublishPathStats(&allocs, &lockWaits, &lockFails);
+	lost = b->sent - b->received;
+	qsort(b->latency, b->received, sizeof(int), SIM_Bench_Compare);
+	// heap use can't be measured on every host
+	if (heapBefore < 0) {
+		strcpy(heapStr, "n/a");
+	}
+	else {
+		sprintf(heapStr, "+%i", heapHigh - heapBefore);
+	}
+	if (b->received > 0) {
+		printf("MQTT bench: rate %5i/s QoS %i sent %6i recv %6i lost %5i thr %6i/s lat p50 %4i p90 %4i p99 %4i max %4i ms"
+			" rx ring high %5i/%i overflow %4i queue high %3i publish allocs %i heap high %s\n",
+			rate, qos, b->sent, b->received, lost, b->received / BENCH_SECONDS,
+			b->latency[b->received / 2], b->latency[b->received * 9 / 10], b->latency[b->received * 99 / 100],
+			b->latency[b->received - 1], highWater, size, overflows, queueHigh, allocs - allocsBefore, heapStr);
+	}
+	else {
+		printf("MQTT bench: rate %5i/s QoS %i sent %6i, nothing received\n", rate, qos, b->sent);
+	}
+	return lost;
+}
+
+int SIM_RunMQTTBenchmark(int maxRate) {
+	mqttBench_t b;
+	simBrokerStats_t st;
+	char filter[64];
+	int clientId;
+	int rate;
+	int qos;
+	int lost = 0;
+
+	SIM_ClearAndPrepareForMQTTTesting("benchDevice", "bench");
+	CFG_SetMQTTHost("127.0.0.1");
+	SIM_Broker_Reset();
+	SIM_Broker_Enable(1);
+	SIM_SetMQTTBrokerAckDelay(0);
+	for (int i = 0; i < 100; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	Test_MQTT_Broker_Connect();
+	clientId = SIM_Broker_AddClient(SIM_Bench_OnEcho, &b);
+	sprintf(filter, "%s/echo/get", CFG_GetMQTTClientId());
+	SIM_Broker_Subscribe(clientId, filter, 2);
+
+	b.sentAt = (int*)malloc(sizeof(int) * maxRate * BENCH_SECONDS);
+	b.latency = (int*)malloc(sizeof(int) * maxRate * BENCH_SECONDS);
+	for (qos = 0; qos <= 2; qos++) {
+		for (rate = 10; rate <= maxRate; rate *= 2) {
+			lost += SIM_Bench_Round(clientId, &b, rate, qos);
+		}
+	}
+	free(b.sentAt);
+	free(b.latency);
+
+	SIM_Broker_GetStats(&st);
+	printf("MQTT bench: broker in %i out %i PUBACK %i PUBREC %i PUBREL %i PUBCOMP %i pending high %i\n",
+		st.publishesIn, st.publishesOut, st.pubAcks, st.pubRecs, st.pubRels, st.pubComps, st.pendingHighWater);
+	SIM_SetMQTTBrokerAckDelay(-1);
+	SIM_ClearMQTTHistory();
+	return lost;
+}
+
+#endif
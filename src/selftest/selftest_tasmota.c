@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h".
+#include "../hal/hal_wifi.h"
 
 void Test_Tasmota_MQTT_Switch() {
 	SIM_ClearOBK();
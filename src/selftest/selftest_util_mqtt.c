@@ -84,6 +84,19 @@ const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode) {
 	}
 	return 0;
 }
+int SIM_GetMQTTHistoryQoS(const char *topic) {
+	mqttHistoryEntry_t *ne;
+	int cur = history_tail;
+	while (cur != history_head) {
+		ne = &mqtt_history[cur];
+		if (!strcmp(ne->topic, topic)) {
+			return ne->qos;
+		}
+		cur++;
+		cur %= MAX_MQTT_HISTORY;
+	}
+	return -1;
+}
 bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain) {
 	mqttHistoryEntry_t *ne;
 	int cur = history_tail;
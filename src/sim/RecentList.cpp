@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 #include "RecentList.h"
 #include "../cJSON/cJSON.h"
+#include "../cJSON/json_arena.h"
 
 void CRecentList::remove(const char *s) {
 	for (int i = recents.size() - 1; i >= 0; i--) {
@@ -21,6 +22,7 @@ bool CRecentList::load(const char *fname) {
 	if (jsonData == 0) {
 		return 0;
 	}
+	int bArena = JSON_Arena_Begin();
 	cJSON *n_jSim = cJSON_Parse(jsonData);
 	cJSON *n_jObjects = cJSON_GetObjectItemCaseSensitive(n_jSim, "recents");
 	cJSON *jObject;
@@ -30,9 +32,14 @@ bool CRecentList::load(const char *fname) {
 		cJSON *cPath = cJSON_GetObjectItemCaseSensitive(jObject, "path");
 		push_back(cPath->valuestring);
 	}
+	cJSON_Delete(n_jSim);
+	if (bArena) {
+		JSON_Arena_End();
+	}
 	return true;
 }
 void CRecentList::save(const char *fname) {
+	int bArena = JSON_Arena_Begin();
 	cJSON *root_sim = cJSON_CreateObject();
 	cJSON *main_objects = cJSON_AddObjectToObject(root_sim, "recents");
 	for (int i = 0; i < size(); i++) {
@@ -44,7 +51,11 @@ void CRecentList::save(const char *fname) {
 
 	FS_WriteTextFile(msg, fname);
 
-	free(msg);
+	cJSON_free(msg);
+	cJSON_Delete(root_sim);
+	if (bArena) {
+		JSON_Arena_End();
+	}
 }
 
 #endif
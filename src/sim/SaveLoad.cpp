@@ -8,6 +8,7 @@
 #include "PrefabManager.h"
 #include "Text.h"
 #include "../cJSON/cJSON.h"
+#include "../cJSON/json_arena.h"
 
 class CProject *CSaveLoad::loadProjectFile(const char *fname) {
 	CProject *p;
@@ -17,15 +18,22 @@ class CProject *CSaveLoad::loadProjectFile(const char *fname) {
 	if (jsonData == 0) {
 		return 0;
 	}
+	// setters copy strings, so tree can go away with arena scope
+	int bArena = JSON_Arena_Begin();
 	cJSON *n_jProj = cJSON_Parse(jsonData);
 	cJSON *n_jProjCreated = cJSON_GetObjectItemCaseSensitive(n_jProj, "created");
 	cJSON *n_jProjModified = cJSON_GetObjectItemCaseSensitive(n_jProj, "lastModified");
 	p->setCreated(n_jProjCreated->valuestring);
 	p->setLastModified(n_jProjModified->valuestring);
+	cJSON_Delete(n_jProj);
+	if (bArena) {
+		JSON_Arena_End();
+	}
 	return p;
 }
 void CSaveLoad::saveProjectToFile(class CProject *projToSave, const char *fname) {
 
+	int bArena = JSON_Arena_Begin();
 	cJSON *root_proj = cJSON_CreateObject();
 	cJSON_AddStringToObject(root_proj, "created", projToSave->getCreated());
 	cJSON_AddStringToObject(root_proj, "lastModified", projToSave->getLastModified());
@@ -34,7 +42,11 @@ void CSaveLoad::saveProjectToFile(class CProject *projToSave, const char *fname)
 
 	FS_WriteTextFile(msg, fname);
 
-	free(msg);
+	cJSON_free(msg);
+	cJSON_Delete(root_proj);
+	if (bArena) {
+		JSON_Arena_End();
+	}
 }
 class CSimulation *CSaveLoad::loadSimulationFromFile(const char *fname) {
 	CSimulation *s;
@@ -45,6 +57,7 @@ class CSimulation *CSaveLoad::loadSimulationFromFile(const char *fname) {
 	}
 	s = new CSimulation();
 	s->setSimulator(sim);
+	int bArena = JSON_Arena_Begin();
 	cJSON *n_jSim = cJSON_Parse(jsonData);
 	cJSON *n_jSimSim = cJSON_GetObjectItemCaseSensitive(n_jSim, "simulation");
 	cJSON *n_jWires = cJSON_GetObjectItemCaseSensitive(n_jSimSim, "wires");
@@ -87,6 +100,10 @@ class CSimulation *CSaveLoad::loadSimulationFromFile(const char *fname) {
 		cJSON *jY1 = cJSON_GetObjectItemCaseSensitive(jWire, "y1");
 		s->addWire(jX0->valuedouble, jY0->valuedouble, jX1->valuedouble, jY1->valuedouble);
 	}
+	cJSON_Delete(n_jSim);
+	if (bArena) {
+		JSON_Arena_End();
+	}
 	s->matchAllJunctions();
 	s->recalcBounds();
 	return s;
@@ -94,6 +111,7 @@ class CSimulation *CSaveLoad::loadSimulationFromFile(const char *fname) {
 void CSaveLoad::saveSimulationToFile(class CSimulation *simToSave, const char *fname) {
 
 	//sim->saveTo(simPath.c_str());
+	int bArena = JSON_Arena_Begin();
 	cJSON *root_sim = cJSON_CreateObject();
 	cJSON *main_sim = cJSON_AddObjectToObject(root_sim, "simulation");
 	cJSON *main_objects = cJSON_AddObjectToObject(main_sim, "objects");
@@ -129,8 +147,11 @@ void CSaveLoad::saveSimulationToFile(class CSimulation *simToSave, const char *f
 
 	FS_WriteTextFile(msg, fname);
 
-	free(msg);
-
+	cJSON_free(msg);
+	cJSON_Delete(root_sim);
+	if (bArena) {
+		JSON_Arena_End();
+	}
 
 }
 
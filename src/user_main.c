@@ -27,6 +27,9 @@
 #include "logging/logging.h"
 #include "httpserver/http_tcp_server.h"
 #include "httpserver/rest_interface.h"
+#include "httpserver/http_sse.h"
+#include "httpserver/http_ws.h"
+#include "httpserver/hass.h"
 #include "mqtt/new_mqtt.h"
 #include "ota/ota.h"
 
@@ -269,6 +272,9 @@ void Main_OnWiFiStatusChange(int code)
         default:
             break;
     }
+	// IP address is shown in StatusNET and api/info
+	JSON_MarkStatusDirty(JSON_STATUS_NET);
+	STATE_BumpRevision();
 	g_newWiFiStatus = code;
 }
 
@@ -386,7 +392,11 @@ void Main_OnEverySecond()
 	}
     ADDLOGF_DEBUG("Main#2\n");
 	MQTT_Dedup_Tick();
+#ifdef ENABLE_LITTLEFS
+	LOG_PersistTail_OnEverySecond();
+#endif
 	RepeatingEvents_OnEverySecond();
+	HTTP_SSE_RunEverySecond();
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_OnEverySecond();
 #endif
@@ -584,6 +594,7 @@ void Main_OnEverySecond()
 			ADDLOGF_INFO("HA discovery is scheduled, but MQTT connection is not present yet\n");
 		}
 	}
+	hass_discovery_runEverySecond();
 
     ADDLOGF_DEBUG("Main#10\n");
 	if (g_openAP)
@@ -757,6 +768,9 @@ void QuickTick(void *param)
 
 	// process recieved messages here..
 	MQTT_RunQuickTick();
+	// push changes to open web pages
+	HTTP_SSE_RunQuickTick();
+	HTTP_WS_RunQuickTick();
 	
 	if(CFG_HasFlag(OBK_FLAG_LED_SMOOTH_TRANSITIONS) == true) {
 		LED_RunQuickColorLerp(t_diff);
@@ -790,26 +804,50 @@ void QuickTick(void *param)
 
 ////////////////////////////////////////////////////////
 // this is the bit which runs the quick tick timer
+// MQTT_TriggerRead wakes it early, so received MQTT commands
+// don't have to wait up to QUICK_TMR_DURATION for the next tick.
+// On Beken, a one-shot timer in hal_main_bk7231.c does the same.
 #if WINDOWS
+// simulator runs QuickTick every frame, so it's polled there
+void MQTT_TriggerRead() {
+}
+#elif PLATFORM_BL602 || PLATFORM_W600 || PLATFORM_W800
+static SemaphoreHandle_t g_quickWake = 0;
 
-#elif PLATFORM_BL602
-void quick_timer_thread(void *param)
-{
-    while(1) {
-        vTaskDelay(QUICK_TMR_DURATION);
-		QuickTick(0);
-    }
+void MQTT_TriggerRead() {
+	if (g_quickWake) {
+		xSemaphoreGive(g_quickWake);
+	}
 }
-#elif PLATFORM_W600 || PLATFORM_W800
 void quick_timer_thread(void *param)
 {
+	TickType_t lastTick = xTaskGetTickCount();
+	TickType_t elapsed;
+
     while(1) {
-        vTaskDelay(QUICK_TMR_DURATION);
+		elapsed = xTaskGetTickCount() - lastTick;
+		if (elapsed < QUICK_TMR_DURATION) {
+			if (xSemaphoreTake(g_quickWake, QUICK_TMR_DURATION - elapsed) == pdTRUE) {
+				MQTT_process_received();
+				continue;
+			}
+		}
+		lastTick = xTaskGetTickCount();
 		QuickTick(0);
     }
 }
 #elif PLATFORM_XR809
 OS_Timer_t g_quick_timer;
+OS_Timer_t g_mqtt_wake_timer;
+
+static void MQTT_WakeTimer(void *arg) {
+	MQTT_process_received();
+}
+void MQTT_TriggerRead() {
+	if (OS_TimerIsValid(&g_mqtt_wake_timer)) {
+		OS_TimerStart(&g_mqtt_wake_timer);
+	}
+}
 #else
 beken_timer_t g_quick_timer;
 #endif
@@ -817,14 +855,17 @@ void QuickTick_StartThread(void)
 {
 #if WINDOWS
 
-#elif PLATFORM_BL602
-
-    xTaskCreate(quick_timer_thread, "quick", 1024, NULL, 15, NULL);
-#elif PLATFORM_W600 || PLATFORM_W800
+#elif PLATFORM_BL602 || PLATFORM_W600 || PLATFORM_W800
 
+	vSemaphoreCreateBinary(g_quickWake);
     xTaskCreate(quick_timer_thread, "quick", 1024, NULL, 15, NULL);
 #elif PLATFORM_XR809
 
+	OS_TimerSetInvalid(&g_mqtt_wake_timer);
+	if (OS_TimerCreate(&g_mqtt_wake_timer, OS_TIMER_ONCE, MQTT_WakeTimer, NULL, 1) != OS_OK) {
+		printf("MQTT wake timer create failed\n");
+	}
+
 	OS_TimerSetInvalid(&g_quick_timer);
 	if (OS_TimerCreate(&g_quick_timer, OS_TIMER_PERIODIC, QuickTick, NULL,
 	                   QUICK_TMR_DURATION) != OS_OK) {
@@ -966,6 +1007,7 @@ void Main_Init_BeforeDelay_Unsafe(bool bAutoRunScripts) {
 
 #ifdef ENABLE_LITTLEFS
 	LFSAddCmds(); // setlfssize
+	LOG_PersistTail_Init();
 #endif
 
 	PIN_SetGenericDoubleClickCallback(app_on_generic_dbl_click);
@@ -973,6 +1015,8 @@ void Main_Init_BeforeDelay_Unsafe(bool bAutoRunScripts) {
 
 	// initialise rest interface
 	init_rest();
+	HTTP_SSE_Init();
+	HTTP_WS_Init();
 
 	// add some commands...
 	taslike_commands_init();
@@ -0,0 +1 @@
+// Types come from windows.h in this build
@@ -0,0 +1,47 @@
+# Headless build of the Windows simulator on Linux, for selftests and MQTT benchmark in CI.
+# Same sources as openBeken_win32_mvsc2017.vcxproj, except window code of src/sim (C++, SDL).
+# Run from repository root:
+#   make -f src/win32/linux/simulator.mk            builds output/simulator/openbeken_sim
+#   make -f src/win32/linux/simulator.mk test       runs selftests, fails if any assert fails
+#   make -f src/win32/linux/simulator.mk benchmark  runs MQTT benchmark against in-process broker
+
+CC ?= gcc
+OUT_DIR ?= output/simulator
+SIM_BIN := $(OUT_DIR)/openbeken_sim
+BENCHMARK_RATE ?= 80
+
+SIM_DIRS := src src/bitmessage src/cJSON src/cmnds src/devicegroups src/driver src/hal/win32 \
+	src/httpclient src/httpserver src/i2c src/jsmn src/littlefs src/logging src/mqtt src/selftest \
+	src/win32/stubs src/win32/stubs/lwip src/win32/linux
+# not part of simulator project either
+SIM_EXCLUDE := src/cmnds/cmd_tcp.c src/driver/drv_sm16703P.c \
+	src/new_ping.c src/win_main_scriptOnly.c
+SIM_SRCS := $(filter-out $(SIM_EXCLUDE),$(foreach d,$(SIM_DIRS),$(wildcard $(d)/*.c)))
+SIM_OBJS := $(patsubst %.c,$(OUT_DIR)/obj/%.o,$(SIM_SRCS))
+
+# src/win32/linux provides windows.h and friends, stubs only fill headers missing on host
+SIM_CFLAGS := -g -O1 -std=gnu99 -DWINDOWS=1 -Isrc -Isrc/win32/linux -idirafter src/win32/stubs \
+	-fno-common -w
+SIM_LDLIBS := -lm -lpthread
+
+.PHONY: all test benchmark clean
+all: $(SIM_BIN)
+
+$(SIM_BIN): $(SIM_OBJS)
+	$(CC) -o $@ $^ $(SIM_LDLIBS)
+
+$(OUT_DIR)/obj/%.o: %.c
+	@mkdir -p $(dir $@)
+	$(CC) $(SIM_CFLAGS) $(CFLAGS) -c $< -o $@
+
+# selftests write their files to working directory
+test: $(SIM_BIN)
+	mkdir -p $(OUT_DIR)/run
+	cd $(OUT_DIR)/run && ../openbeken_sim -runUnitTests 2
+
+benchmark: $(SIM_BIN)
+	mkdir -p $(OUT_DIR)/run
+	cd $(OUT_DIR)/run && ../openbeken_sim -runUnitTests 0 -mqttBenchmark $(BENCHMARK_RATE)
+
+clean:
+	rm -rf $(OUT_DIR)
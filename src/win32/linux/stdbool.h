@@ -0,0 +1 @@
+// bool is a typedef in new_common.h, so C99 stdbool.h must not define it
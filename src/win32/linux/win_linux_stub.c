@@ -0,0 +1,17 @@
+#if defined(WINDOWS) && !defined(_WIN32)
+// Headless simulator build on Linux, see simulator.mk. Window code of src/sim is C++ with SDL
+// and OpenGL, so it is left out, and simulated device just runs in main loop.
+
+#include "../../new_common.h"
+#include "../../sim/sim_public.h"
+
+int SIM_CreateWindow(int argc, char **argv) {
+	printf("Headless simulator, no window\n");
+	return 0;
+}
+void SIM_RunWindow() {
+	// main loop runs frames by real time, so don't spin
+	Sleep(5);
+}
+
+#endif
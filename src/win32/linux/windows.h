@@ -0,0 +1,82 @@
+// Minimal Windows API on top of POSIX, just enough for the headless simulator build
+// on Linux (see simulator.mk). Not used by Visual Studio build.
+#ifndef __WIN_LINUX_WINDOWS_H__
+#define __WIN_LINUX_WINDOWS_H__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+// new_common.h declares its own usleep
+#define usleep posix_usleep
+#include <unistd.h>
+#undef usleep
+// new_common.h maps close to lwip_close, which closes with closesocket, so that one must reach libc directly
+extern int posix_close(int fd) __asm__("close");
+
+typedef int SOCKET;
+typedef unsigned long DWORD;
+typedef unsigned short WORD;
+typedef unsigned char UINT8;
+typedef unsigned short UINT16;
+typedef unsigned int UINT32;
+typedef void* HANDLE;
+typedef void* xTaskHandle;
+typedef unsigned long (*LPTHREAD_START_ROUTINE)(void* arg);
+typedef struct { int unused; } WSADATA;
+
+#define INVALID_SOCKET		(-1)
+#define SOCKET_ERROR		(-1)
+#define SD_SEND				SHUT_WR
+#define SD_BOTH				SHUT_RDWR
+#define WSAEWOULDBLOCK		EWOULDBLOCK
+#define closesocket			posix_close
+#define ioctlsocket			ioctl
+#define WSAGetLastError()	errno
+#define WSAStartup(ver, data)	0
+#define WSACleanup()
+#define MAKEWORD(a, b)		0
+#define __cdecl
+#define _stricmp			strcasecmp
+#define _strnicmp			strncasecmp
+#define stricmp				strcasecmp
+#define strnicmp			strncasecmp
+#define sprintf_s			snprintf
+#define ZeroMemory(p, n)	memset(p, 0, n)
+static inline DWORD timeGetTime(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+static inline DWORD GetTickCount(void) {
+	return timeGetTime();
+}
+static inline void Sleep(DWORD ms) {
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, 0);
+}
+static inline HANDLE CreateThread(void* attr, int stackSize, LPTHREAD_START_ROUTINE function, void* arg, int flags, void* id) {
+	pthread_t thread;
+
+	if (pthread_create(&thread, 0, (void* (*)(void*))function, arg) != 0) {
+		return 0;
+	}
+	pthread_detach(thread);
+	return (HANDLE)thread;
+}
+
+#endif // __WIN_LINUX_WINDOWS_H__
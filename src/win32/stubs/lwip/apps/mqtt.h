@@ -9,6 +9,12 @@
 
 typedef struct mqtt_client_s mqtt_client_t;
 
+#include "../../../../mqtt/new_mqtt5.h"
+
+/** This simulator-only port can also connect with MQTT 5 (topic aliases, message expiry, reason codes).
+  * Device SDK lwIP ports don't define it, so there mqtt_version isn't available */
+#define LWIP_MQTT_V5 1
+
 /*---------------------------------------------------------------------------------------------- */
 /* Connection with server */
 
@@ -29,6 +35,8 @@ struct mqtt_connect_client_info_t {
   const char* will_msg;
   uint8_t will_qos;
   uint8_t will_retain;
+  /** MQTT5_PROTOCOL_LEVEL for MQTT 5, anything else means 3.1.1 */
+  uint8_t protocol_version;
 };
 
 /**
@@ -158,6 +166,14 @@ typedef struct mqtt_client_s {
 	/** Output ring-buffer */
 	struct mqtt_ringbuf_t output; 
 	struct altcp_pcb *conn;
+	/** Protocol level used for this connection, 4 (3.1.1) or 5 */
+	u8_t protocol_version;
+	/** Last MQTT 5 reason code received (CONNACK, PUBACK, SUBACK, DISCONNECT) */
+	u8_t reason_code;
+	/** Set by simulated broker when it refused connection */
+	u8_t sim_refused;
+	/** Outgoing topic aliases, MQTT 5 only */
+	mqtt5AliasTable_t aliases;
 } mqtt_client_t;
 
 
@@ -193,5 +209,11 @@ err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_re
   /** Publish data to topic */
 err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos, u8_t retain,
 	mqtt_request_cb_t cb, void *arg);
+/** Publish data to topic, with MQTT 5 message expiry in seconds (0 for none, ignored for 3.1.1).
+    Topic alias is used automatically for repeated topics if broker allows it. */
+err_t mqtt_publish_v5(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos, u8_t retain,
+	u32_t message_expiry, mqtt_request_cb_t cb, void *arg);
+/** Last MQTT 5 reason code received from broker */
+u8_t mqtt_client_reason_code(mqtt_client_t *client);
 
 
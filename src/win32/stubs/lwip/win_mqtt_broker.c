@@ -0,0 +1,320 @@
+#ifdef WINDOWS
+
+#include "../../../new_common.h"
+#include "../../../mqtt/new_mqtt_trie.h"
+#include "apps/mqtt.h"
+#include "win_mqtt_broker.h"
+
+// lwIP passes payload to data callback in pieces of its rx buffer, do the same
+#define SIM_BROKER_CHUNK 128
+
+typedef struct simBrokerSub_s {
+	int clientId;
+	int qos;
+	char *filter;
+	struct simBrokerSub_s *next;
+} simBrokerSub_t;
+
+typedef struct simBrokerMsg_s {
+	char *topic;
+	unsigned char *payload;
+	int len;
+	int qos;
+	int retain;
+	struct simBrokerMsg_s *next;
+} simBrokerMsg_t;
+
+typedef struct simBrokerClient_s {
+	simBrokerDeliver_t cb;
+	void *userData;
+} simBrokerClient_t;
+
+static int g_brokerEnabled = 0;
+static simBrokerClient_t g_brokerClients[SIM_BROKER_MAX_CLIENTS];
+static int g_brokerClientCount = 1;
+static mqtt_client_t *g_brokerDevice = 0;
+static simBrokerSub_t *g_brokerSubs = 0;
+static mqttTrieNode_t *g_brokerSubsTrie = 0;
+// retained messages, one per topic
+static simBrokerMsg_t *g_brokerRetained = 0;
+// waiting for delivery to device, FIFO
+static simBrokerMsg_t *g_brokerPending = 0;
+static simBrokerMsg_t *g_brokerPendingTail = 0;
+static simBrokerStats_t g_brokerStats;
+
+void SIM_Broker_Enable(int bEnable) {
+	g_brokerEnabled = bEnable;
+}
+int SIM_Broker_IsEnabled() {
+	return g_brokerEnabled;
+}
+
+static simBrokerMsg_t *SIM_Broker_NewMsg(const char *topic, const void *payload, int len, int qos, int retain) {
+	simBrokerMsg_t *m;
+
+	m = (simBrokerMsg_t*)malloc(sizeof(simBrokerMsg_t));
+	m->topic = strdup(topic);
+	m->payload = (unsigned char*)malloc(len + 1);
+	memcpy(m->payload, payload, len);
+	m->payload[len] = 0;
+	m->len = len;
+	m->qos = qos;
+	m->retain = retain;
+	m->next = 0;
+	return m;
+}
+static void SIM_Broker_FreeMsg(simBrokerMsg_t *m) {
+	free(m->topic);
+	free(m->payload);
+	free(m);
+}
+
+// counts packets of QoS handshake for one PUBLISH
+static void SIM_Broker_CountHandshake(int qos) {
+	if (qos == 1) {
+		g_brokerStats.pubAcks++;
+	}
+	else if (qos == 2) {
+		g_brokerStats.pubRecs++;
+		g_brokerStats.pubRels++;
+		g_brokerStats.pubComps++;
+	}
+}
+
+static void SIM_Broker_Deliver(int clientId, const char *topic, const unsigned char *payload, int len, int qos, int retain) {
+	simBrokerMsg_t *m;
+
+	g_brokerStats.publishesOut++;
+	g_brokerStats.bytesOut += len;
+	SIM_Broker_CountHandshake(qos);
+	if (clientId != SIM_BROKER_DEVICE) {
+		if (g_brokerClients[clientId].cb) {
+			g_brokerClients[clientId].cb(clientId, topic, payload, len, qos, retain, g_brokerClients[clientId].userData);
+		}
+		return;
+	}
+	if (g_brokerDevice == 0) {
+		return;
+	}
+	// device gets it on next frame, as from network
+	m = SIM_Broker_NewMsg(topic, payload, len, qos, retain);
+	if (g_brokerPendingTail) {
+		g_brokerPendingTail->next = m;
+	}
+	else {
+		g_brokerPending = m;
+	}
+	g_brokerPendingTail = m;
+	g_brokerStats.pending++;
+	if (g_brokerStats.pending > g_brokerStats.pendingHighWater) {
+		g_brokerStats.pendingHighWater = g_brokerStats.pending;
+	}
+}
+
+static void SIM_Broker_RemoveSubs(int clientId, const char *filter) {
+	simBrokerSub_t **p = &g_brokerSubs;
+	simBrokerSub_t *s;
+
+	while (*p) {
+		s = *p;
+		if (s->clientId == clientId && (filter == 0 || !strcmp(s->filter, filter))) {
+			*p = s->next;
+			MQTT_Trie_Remove(&g_brokerSubsTrie, s->filter, s);
+			free(s->filter);
+			free(s);
+			g_brokerStats.subscriptions--;
+		}
+		else {
+			p = &s->next;
+		}
+	}
+}
+
+void SIM_Broker_Reset() {
+	simBrokerMsg_t *m;
+
+	while (g_brokerSubs) {
+		SIM_Broker_RemoveSubs(g_brokerSubs->clientId, 0);
+	}
+	MQTT_Trie_Free(&g_brokerSubsTrie);
+	while (g_brokerRetained) {
+		m = g_brokerRetained;
+		g_brokerRetained = m->next;
+		SIM_Broker_FreeMsg(m);
+	}
+	while (g_brokerPending) {
+		m = g_brokerPending;
+		g_brokerPending = m->next;
+		SIM_Broker_FreeMsg(m);
+	}
+	g_brokerPendingTail = 0;
+	memset(g_brokerClients, 0, sizeof(g_brokerClients));
+	g_brokerClientCount = 1;
+	memset(&g_brokerStats, 0, sizeof(g_brokerStats));
+}
+
+int SIM_Broker_AddClient(simBrokerDeliver_t cb, void *userData) {
+	if (g_brokerClientCount >= SIM_BROKER_MAX_CLIENTS) {
+		return -1;
+	}
+	g_brokerClients[g_brokerClientCount].cb = cb;
+	g_brokerClients[g_brokerClientCount].userData = userData;
+	return g_brokerClientCount++;
+}
+
+static int SIM_Broker_MatchOne(void *value, void *userData) {
+	*(simBrokerSub_t**)userData = (simBrokerSub_t*)value;
+	return 1;
+}
+
+int SIM_Broker_Subscribe(int clientId, const char *filter, int qos) {
+	simBrokerSub_t *s;
+	simBrokerMsg_t *m;
+	simBrokerSub_t *hit;
+	mqttTrieNode_t *one = 0;
+
+	if (!MQTT_Trie_IsValidFilter(filter)) {
+		return -1;
+	}
+	if (qos > 2) {
+		qos = 2;
+	}
+	// same filter again replaces the old subscription
+	SIM_Broker_RemoveSubs(clientId, filter);
+	s = (simBrokerSub_t*)malloc(sizeof(simBrokerSub_t));
+	s->clientId = clientId;
+	s->qos = qos;
+	s->filter = strdup(filter);
+	s->next = g_brokerSubs;
+	g_brokerSubs = s;
+	MQTT_Trie_Insert(&g_brokerSubsTrie, filter, s);
+	g_brokerStats.subscriptions++;
+
+	MQTT_Trie_Insert(&one, filter, s);
+	for (m = g_brokerRetained; m; m = m->next) {
+		hit = 0;
+		MQTT_Trie_Match(one, m->topic, SIM_Broker_MatchOne, &hit);
+		if (hit) {
+			SIM_Broker_Deliver(clientId, m->topic, m->payload, m->len, m->qos < qos ? m->qos : qos, 1);
+		}
+	}
+	MQTT_Trie_Free(&one);
+	return qos;
+}
+
+int SIM_Broker_Unsubscribe(int clientId, const char *filter) {
+	int before = g_brokerStats.subscriptions;
+
+	SIM_Broker_RemoveSubs(clientId, filter);
+	return before != g_brokerStats.subscriptions;
+}
+
+static void SIM_Broker_Retain(const char *topic, const void *payload, int len, int qos) {
+	simBrokerMsg_t **p = &g_brokerRetained;
+	simBrokerMsg_t *m;
+
+	while (*p) {
+		if (!strcmp((*p)->topic, topic)) {
+			m = *p;
+			*p = m->next;
+			SIM_Broker_FreeMsg(m);
+			g_brokerStats.retained--;
+			break;
+		}
+		p = &(*p)->next;
+	}
+	// empty retained message only clears it
+	if (len == 0) {
+		return;
+	}
+	m = SIM_Broker_NewMsg(topic, payload, len, qos, 1);
+	m->next = g_brokerRetained;
+	g_brokerRetained = m;
+	g_brokerStats.retained++;
+}
+
+// overlapping subscriptions of one client give one message, with highest QoS
+static int SIM_Broker_CollectQoS(void *value, void *userData) {
+	simBrokerSub_t *s = (simBrokerSub_t*)value;
+	int *qosPerClient = (int*)userData;
+
+	if (s->qos > qosPerClient[s->clientId]) {
+		qosPerClient[s->clientId] = s->qos;
+	}
+	return 0;
+}
+
+void SIM_Broker_Publish(int clientId, const char *topic, const void *payload, int len, int qos, int retain) {
+	int qosPerClient[SIM_BROKER_MAX_CLIENTS];
+	int i;
+
+	g_brokerStats.publishesIn++;
+	g_brokerStats.bytesIn += len;
+	SIM_Broker_CountHandshake(qos);
+	if (retain) {
+		SIM_Broker_Retain(topic, payload, len, qos);
+	}
+	for (i = 0; i < SIM_BROKER_MAX_CLIENTS; i++) {
+		qosPerClient[i] = -1;
+	}
+	MQTT_Trie_Match(g_brokerSubsTrie, topic, SIM_Broker_CollectQoS, qosPerClient);
+	for (i = 0; i < SIM_BROKER_MAX_CLIENTS; i++) {
+		if (qosPerClient[i] >= 0) {
+			SIM_Broker_Deliver(i, topic, (const unsigned char*)payload, len, qos < qosPerClient[i] ? qos : qosPerClient[i], 0);
+		}
+	}
+}
+
+void SIM_Broker_AttachDevice(void *client) {
+	// clean session
+	SIM_Broker_DetachDevice();
+	g_brokerDevice = (mqtt_client_t*)client;
+}
+
+void SIM_Broker_DetachDevice() {
+	simBrokerMsg_t *m;
+
+	g_brokerDevice = 0;
+	SIM_Broker_RemoveSubs(SIM_BROKER_DEVICE, 0);
+	while (g_brokerPending) {
+		m = g_brokerPending;
+		g_brokerPending = m->next;
+		SIM_Broker_FreeMsg(m);
+	}
+	g_brokerPendingTail = 0;
+	g_brokerStats.pending = 0;
+}
+
+void SIM_Broker_RunFrame() {
+	simBrokerMsg_t *m;
+	int ofs, len;
+
+	while (g_brokerPending) {
+		m = g_brokerPending;
+		g_brokerPending = m->next;
+		if (g_brokerPending == 0) {
+			g_brokerPendingTail = 0;
+		}
+		g_brokerStats.pending--;
+		if (g_brokerDevice && g_brokerDevice->pub_cb) {
+			g_brokerDevice->pub_cb(g_brokerDevice->inpub_arg, m->topic, m->len);
+			ofs = 0;
+			do {
+				len = m->len - ofs;
+				if (len > SIM_BROKER_CHUNK) {
+					len = SIM_BROKER_CHUNK;
+				}
+				g_brokerDevice->data_cb(g_brokerDevice->inpub_arg, m->payload + ofs, len,
+					ofs + len == m->len ? MQTT_DATA_FLAG_LAST : 0);
+				ofs += len;
+			} while (ofs < m->len);
+		}
+		SIM_Broker_FreeMsg(m);
+	}
+}
+
+void SIM_Broker_GetStats(simBrokerStats_t *s) {
+	*s = g_brokerStats;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __WIN_MQTT_BROKER_H__
+#define __WIN_MQTT_BROKER_H__
+
+// Minimal in-process MQTT broker stand-in for the simulator.
+// It's plain C with no sockets, so it builds wherever the simulator does.
+// When enabled, win_mqtt_stub.c (in unit test mode) connects device to it:
+// subscriptions made by new_mqtt.c go to the broker, publishes from device are routed
+// to matching subscribers, and messages for device are delivered through
+// the same incoming publish/data callbacks as lwIP uses, in chunks, on the next frame.
+// Other clients (tests, benchmark) are plain callbacks.
+// Supports QoS 0/1/2 (handshakes are counted, nothing can be lost in process),
+// retained messages and '+'/'#' wildcards.
+
+#define SIM_BROKER_DEVICE 0
+#define SIM_BROKER_MAX_CLIENTS 8
+
+typedef void (*simBrokerDeliver_t)(int clientId, const char *topic, const unsigned char *payload, int len,
+	int qos, int retain, void *userData);
+
+typedef struct simBrokerStats_s {
+	// PUBLISH packets received from and sent to clients
+	int publishesIn;
+	int publishesOut;
+	int bytesIn;
+	int bytesOut;
+	// acknowledgement packets, in both directions
+	int pubAcks;
+	int pubRecs;
+	int pubRels;
+	int pubComps;
+	int retained;
+	int subscriptions;
+	// messages waiting for delivery to device
+	int pending;
+	int pendingHighWater;
+} simBrokerStats_t;
+
+void SIM_Broker_Enable(int bEnable);
+int SIM_Broker_IsEnabled();
+// drops all clients, subscriptions, retained and pending messages, and stats
+void SIM_Broker_Reset();
+// returns client id, or -1
+int SIM_Broker_AddClient(simBrokerDeliver_t cb, void *userData);
+// returns granted QoS, or -1 for bad filter. Matching retained messages are sent right away.
+int SIM_Broker_Subscribe(int clientId, const char *filter, int qos);
+int SIM_Broker_Unsubscribe(int clientId, const char *filter);
+void SIM_Broker_Publish(int clientId, const char *topic, const void *payload, int len, int qos, int retain);
+// called from win_mqtt_stub.c
+void SIM_Broker_AttachDevice(void *client);
+void SIM_Broker_DetachDevice();
+void SIM_Broker_RunFrame();
+void SIM_Broker_GetStats(simBrokerStats_t *s);
+
+#endif // __WIN_MQTT_BROKER_H__
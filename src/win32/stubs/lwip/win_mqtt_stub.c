@@ -4,6 +4,7 @@
 #include "apps/mqtt.h"
 #include "ip_addr.h"
 #include "mqtt_opts.h"
+#include "win_mqtt_broker.h"
 
 #define LWIP_MAX(x, y)   (((x) > (y)) ? (x) : (y))
 #define LWIP_MIN(x, y)   (((x) < (y)) ? (x) : (y))
@@ -58,6 +59,25 @@ extern int g_bDoingUnitTestsNow;
 bool MQTT_IsFakingOnlineMQTT() {
 	return g_bDoingUnitTestsNow;
 }
+// Simulated broker used by selftests. It can be taken down to test behaviour during outages,
+// or limited to 3.1.1 to test fallback. Bytes that publishes would take on the wire are counted,
+// computed with MQTT_PublishPacketSize, since no real packets are sent.
+// Publishes can be acknowledged after a given delay, by default they are never acknowledged.
+#define SIM_BROKER_TOPIC_ALIAS_MAX 10
+#define SIM_BROKER_MAX_PENDING_ACKS 64
+static int g_simBrokerOffline = 0;
+static int g_simBrokerMaxVersion = MQTT5_PROTOCOL_LEVEL;
+static int g_simWireBytes = 0;
+static int g_simWirePublishes = 0;
+static int g_simBrokerAckDelay = -1;
+typedef struct simPendingAck_s {
+	mqtt_request_cb_t cb;
+	void *arg;
+	int due;
+} simPendingAck_t;
+static simPendingAck_t g_simPendingAcks[SIM_BROKER_MAX_PENDING_ACKS];
+static int g_simPendingAckCount = 0;
+extern int rtos_get_time();
 /**
  * MQTT connect flags, only used in CONNECT message
  */
@@ -376,10 +396,34 @@ err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ip_addr, u16_t
 	u16_t remaining_length = 2 + 4 + 1 + 1 + 2;
 	u8_t flags = 0, will_topic_len = 0, will_msg_len = 0;
 	u16_t client_user_len = 0, client_pass_len = 0;
+	u8_t protocol_version = client_info->protocol_version == MQTT5_PROTOCOL_LEVEL ? MQTT5_PROTOCOL_LEVEL : MQTT311_PROTOCOL_LEVEL;
 
 
-	if (MQTT_IsFakingOnlineMQTT())
+	if (MQTT_IsFakingOnlineMQTT()) {
+		client->protocol_version = protocol_version;
+		// simulated broker may be an old one
+		if (protocol_version > g_simBrokerMaxVersion) {
+			client->sim_refused = 1;
+			client->reason_code = MQTT5_RC_UNSUPPORTED_PROTOCOL_VERSION;
+			if (cb) {
+				cb(client, arg, MQTT_CONNECT_REFUSED_PROTOCOL_VERSION);
+			}
+			return 0;
+		}
+		client->sim_refused = 0;
+		client->reason_code = 0;
+		MQTT5_Alias_Reset(&client->aliases, protocol_version == MQTT5_PROTOCOL_LEVEL ? SIM_BROKER_TOPIC_ALIAS_MAX : 0);
+		// with broker stand-in, connection goes through the usual callback, so device subscribes
+		if (SIM_Broker_IsEnabled()) {
+			SIM_Broker_AttachDevice(client);
+			client->connect_cb = cb;
+			client->connect_arg = arg;
+			if (cb) {
+				cb(client, arg, MQTT_CONNECT_ACCEPTED);
+			}
+		}
 		return 0;
+	}
 
 	LWIP_ASSERT_CORE_LOCKED();
 	LWIP_ASSERT("mqtt_client_connect: client != NULL", client != NULL);
@@ -393,7 +437,9 @@ err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ip_addr, u16_t
 	}
 
 	/* Wipe clean */
+	MQTT5_Alias_Reset(&client->aliases, 0);
 	memset(client, 0, sizeof(mqtt_client_t));
+	client->protocol_version = protocol_version;
 	client->connect_arg = arg;
 	client->connect_cb = cb;
 	client->keep_alive = client_info->keep_alive;
@@ -441,6 +487,11 @@ err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ip_addr, u16_t
 	/* Don't complicate things, always connect using clean session */
 	flags |= MQTT_CONNECT_FLAG_CLEAN_SESSION;
 
+	/* MQTT 5 has (empty) property blocks for connect and will */
+	if (protocol_version == MQTT5_PROTOCOL_LEVEL) {
+		remaining_length += 1 + ((flags & MQTT_CONNECT_FLAG_WILL) ? 1 : 0);
+	}
+
 	len = strlen(client_info->client_id);
 	LWIP_ERROR("mqtt_client_connect: client_info->client_id length overflow", len <= 0xFFFF, return ERR_VAL);
 	client_id_length = (u16_t)len;
@@ -503,15 +554,22 @@ err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ip_addr, u16_t
 		/* Append Protocol string */
 		mqtt_output_append_string(&client->output, "MQTT", 4);
 		/* Append Protocol level */
-		mqtt_output_append_u8(&client->output, 4);
+		mqtt_output_append_u8(&client->output, protocol_version);
 		/* Append connect flags */
 		mqtt_output_append_u8(&client->output, flags);
 		/* Append keep-alive */
 		mqtt_output_append_u16(&client->output, client_info->keep_alive);
+		/* Append connect properties, none are needed, broker tells us its limits in CONNACK */
+		if (protocol_version == MQTT5_PROTOCOL_LEVEL) {
+			mqtt_output_append_u8(&client->output, 0);
+		}
 		/* Append client id */
 		mqtt_output_append_string(&client->output, client_info->client_id, client_id_length);
 		/* Append will message if used */
 		if ((flags & MQTT_CONNECT_FLAG_WILL) != 0) {
+			if (protocol_version == MQTT5_PROTOCOL_LEVEL) {
+				mqtt_output_append_u8(&client->output, 0);
+			}
 			mqtt_output_append_string(&client->output, client_info->will_topic, will_topic_len);
 			mqtt_output_append_string(&client->output, client_info->will_msg, will_msg_len);
 		}
@@ -739,18 +797,62 @@ mqtt_client_t *mqtt_client_new(void) {
 	return r;
 }
 
+void SIM_SetMQTTBrokerOnline(int bOnline) {
+	g_simBrokerOffline = !bOnline;
+}
+void SIM_SetMQTTBrokerMaxVersion(int protocolLevel) {
+	g_simBrokerMaxVersion = protocolLevel;
+}
+void SIM_GetMQTTWireStats(int *bytes, int *publishes) {
+	*bytes = g_simWireBytes;
+	*publishes = g_simWirePublishes;
+}
+void SIM_SetMQTTBrokerAckDelay(int ms) {
+	g_simBrokerAckDelay = ms;
+	if (ms < 0) {
+		g_simPendingAckCount = 0;
+	}
+}
+static void SIM_QueueBrokerAck(mqtt_request_cb_t cb, void *arg) {
+	if (g_simBrokerAckDelay < 0 || cb == NULL) {
+		return;
+	}
+	if (g_simPendingAckCount >= SIM_BROKER_MAX_PENDING_ACKS) {
+		cb(arg, ERR_OK);
+		return;
+	}
+	g_simPendingAcks[g_simPendingAckCount].cb = cb;
+	g_simPendingAcks[g_simPendingAckCount].arg = arg;
+	g_simPendingAcks[g_simPendingAckCount].due = rtos_get_time() + g_simBrokerAckDelay;
+	g_simPendingAckCount++;
+}
+// acks are delivered in order, as broker sends them over single TCP stream
+static void SIM_RunBrokerAcks() {
+	int done = 0;
+	int now = rtos_get_time();
+
+	while (done < g_simPendingAckCount && g_simPendingAcks[done].due <= now) {
+		g_simPendingAcks[done].cb(g_simPendingAcks[done].arg, ERR_OK);
+		done++;
+	}
+	if (done > 0) {
+		memmove(g_simPendingAcks, g_simPendingAcks + done, (g_simPendingAckCount - done) * sizeof(simPendingAck_t));
+		g_simPendingAckCount -= done;
+	}
+}
+u8_t mqtt_client_reason_code(mqtt_client_t *client) {
+	return client->reason_code;
+}
 /** Check connection status */
 u8_t mqtt_client_is_connected(mqtt_client_t *client) {
 	if (MQTT_IsFakingOnlineMQTT())
-		return 1;
+		return !g_simBrokerOffline && !client->sim_refused;
 	return client->conn_state == MQTT_CONNECTED;
 }
 
 /** Set callback to call for incoming publish */
 void mqtt_set_inpub_callback(mqtt_client_t *client, mqtt_incoming_publish_cb_t pub_cb,
                              mqtt_incoming_data_cb_t data_cb, void *arg) {
-	if (MQTT_IsFakingOnlineMQTT())
-		return ;
 	client->data_cb = data_cb;
 	client->pub_cb = pub_cb;
 	client->inpub_arg = arg;
@@ -874,8 +976,20 @@ mqtt_create_request(struct mqtt_request_t *r_objs, size_t r_objs_len, u16_t pkt_
 /** Common function for subscribe and unsubscribe */
 err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_request_cb_t cb, void *arg, u8_t sub) {
 
-	if (MQTT_IsFakingOnlineMQTT())
-		return;
+	if (MQTT_IsFakingOnlineMQTT()) {
+		if (SIM_Broker_IsEnabled()) {
+			if (sub) {
+				SIM_Broker_Subscribe(SIM_BROKER_DEVICE, topic, qos);
+			}
+			else {
+				SIM_Broker_Unsubscribe(SIM_BROKER_DEVICE, topic);
+			}
+			if (cb) {
+				cb(arg, ERR_OK);
+			}
+		}
+		return ERR_OK;
+	}
 	size_t topic_strlen;
 	size_t total_len;
 	u16_t topic_len;
@@ -892,6 +1006,10 @@ err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_re
 	topic_len = (u16_t)topic_strlen;
 	/* Topic string, pkt_id, qos for subscribe */
 	total_len = topic_len + 2 + 2 + (sub != 0);
+	/* MQTT 5 (empty) properties */
+	if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+		total_len++;
+	}
 	LWIP_ERROR("mqtt_sub_unsub: total length overflow", (total_len <= 0xFFFF), return ERR_ARG);
 	remaining_length = (u16_t)total_len;
 
@@ -917,6 +1035,9 @@ err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_re
 	mqtt_output_append_fixed_header(&client->output, sub ? MQTT_MSG_TYPE_SUBSCRIBE : MQTT_MSG_TYPE_UNSUBSCRIBE, 0, 1, 0, remaining_length);
 	/* Packet id */
 	mqtt_output_append_u16(&client->output, pkt_id);
+	if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+		mqtt_output_append_u8(&client->output, 0);
+	}
 	/* Topic */
 	mqtt_output_append_string(&client->output, topic, topic_len);
 	/* QoS */
@@ -934,6 +1055,21 @@ void SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, b
 /** Publish data to topic */
 err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos, u8_t retain,
 				   mqtt_request_cb_t cb, void *arg) {
+	return mqtt_publish_v5(client, topic, payload, payload_length, qos, retain, 0, cb, arg);
+}
+err_t mqtt_publish_v5(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos, u8_t retain,
+	u32_t message_expiry, mqtt_request_cb_t cb, void *arg) {
+	u16_t alias = 0;
+	int bSendTopic = 1;
+	u8_t props[16];
+	int props_len = 0;
+
+	if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+		alias = MQTT5_Alias_Get(&client->aliases, topic, &bSendTopic);
+	}
+	else {
+		message_expiry = 0;
+	}
 #if 1
 	{
 		FILE *f = fopen("lastMQTTPublishSentByOBK.txt", "wb");
@@ -946,6 +1082,13 @@ err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload
 	if (MQTT_IsFakingOnlineMQTT()) {
 		// on Windows simulator, forward MQTT publish for unit testing
 		SIM_OnMQTTPublish(topic, payload, payload_length, qos, retain);
+		g_simWireBytes += MQTT_PublishPacketSize(client->protocol_version, bSendTopic ? strlen(topic) : 0,
+			payload_length, qos, alias, message_expiry);
+		g_simWirePublishes++;
+		if (SIM_Broker_IsEnabled()) {
+			SIM_Broker_Publish(SIM_BROKER_DEVICE, topic, payload, payload_length, qos, retain);
+		}
+		SIM_QueueBrokerAck(cb, arg);
 		return 0;
 	}
 
@@ -961,10 +1104,14 @@ err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload
 	LWIP_ASSERT("mqtt_publish: topic != NULL", topic);
 	LWIP_ERROR("mqtt_publish: TCP disconnected", (client->conn_state != TCP_DISCONNECTED), return ERR_CONN);
 
-	topic_strlen = strlen(topic);
+	topic_strlen = bSendTopic ? strlen(topic) : 0;
 	LWIP_ERROR("mqtt_publish: topic length overflow", (topic_strlen <= (0xFFFF - 2)), return ERR_ARG);
 	topic_len = (u16_t)topic_strlen;
 	total_len = 2 + topic_len + payload_length;
+	if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+		props_len = MQTT5_WritePublishProps(props, alias, message_expiry);
+		total_len += props_len;
+	}
 
 	if (qos > 0) {
 		total_len += 2;
@@ -1008,6 +1155,12 @@ err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload
 			mqtt_output_append_u16(&client->output, pkt_id);
 		}
 
+		/* Append MQTT 5 properties */
+		if (props_len > 0)
+		{
+			mqtt_output_append_buf(&client->output, props, props_len);
+		}
+
 		/* Append optional publish payload */
 		if ((payload != NULL) && (payload_length > 0))
 		{
@@ -1105,6 +1258,34 @@ mqtt_message_received(mqtt_client_t *client, u8_t fixed_hdr_len, u16_t length, u
 			/* Get result code from CONNACK */
 			res = (mqtt_connection_status_t)var_hdr_payload[1];
 			LWIP_DEBUGF(MQTT_DEBUG_TRACE, ("mqtt_message_received: Connect response code %d\n", res));
+			if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+				u32_t props_len;
+				u16_t alias_max = 0;
+				int n;
+
+				client->reason_code = var_hdr_payload[1];
+				/* map MQTT 5 reason codes to 3.1.1 ones, brokers without MQTT 5 reply with 3.1.1 code 1 */
+				switch (client->reason_code) {
+				case 0: res = MQTT_CONNECT_ACCEPTED; break;
+				case 1: case MQTT5_RC_UNSUPPORTED_PROTOCOL_VERSION: res = MQTT_CONNECT_REFUSED_PROTOCOL_VERSION; break;
+				case 0x85: res = MQTT_CONNECT_REFUSED_IDENTIFIER; break;
+				case 0x86: res = MQTT_CONNECT_REFUSED_USERNAME_PASS; break;
+				case 0x87: res = MQTT_CONNECT_REFUSED_NOT_AUTHORIZED_; break;
+				default: res = MQTT_CONNECT_REFUSED_SERVER; break;
+				}
+				n = MQTT5_ReadVarInt(var_hdr_payload + 2, length - 2, &props_len);
+				if (res == MQTT_CONNECT_ACCEPTED && n > 0 && 2 + n + props_len <= length) {
+					MQTT5_GetPropertyU16(var_hdr_payload + 2 + n, props_len, MQTT5_PROP_TOPIC_ALIAS_MAXIMUM, &alias_max);
+				}
+				/* no Topic Alias Maximum means broker does not accept aliases */
+				MQTT5_Alias_Reset(&client->aliases, alias_max);
+			}
+			if (res != MQTT_CONNECT_ACCEPTED)
+			{
+				/* Notify upper layer about refused connection */
+				mqtt_close(client, res);
+				return res;
+			}
 			if (res == MQTT_CONNECT_ACCEPTED)
 			{
 				/* Reset cyclic_tick when changing to connected state */
@@ -1121,6 +1302,11 @@ mqtt_message_received(mqtt_client_t *client, u8_t fixed_hdr_len, u16_t length, u
 			LWIP_DEBUGF(MQTT_DEBUG_WARN, ("mqtt_message_received: Received CONNACK in connected state\n"));
 		}
 	}
+	else if (pkt_type == MQTT_MSG_TYPE_DISCONNECT && client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+		/* MQTT 5 broker tells why it disconnects us */
+		client->reason_code = length > 0 ? var_hdr_payload[0] : 0;
+		goto out_disconnect;
+	}
 	else if (pkt_type == MQTT_MSG_TYPE_PINGRESP) {
 		LWIP_DEBUGF(MQTT_DEBUG_TRACE, ("mqtt_message_received: Received PINGRESP from server\n"));
 	}
@@ -1173,6 +1359,16 @@ mqtt_message_received(mqtt_client_t *client, u8_t fixed_hdr_len, u16_t length, u
 			else {
 				client->inpub_pkt_id = 0;
 			}
+			/* skip MQTT 5 properties, we don't accept topic aliases from broker so none are needed */
+			if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+				u32_t props_len;
+				int n = MQTT5_ReadVarInt(var_hdr_payload + after_topic, length - after_topic, &props_len);
+				if (n == 0 || after_topic + n + props_len > length) {
+					LWIP_DEBUGF(MQTT_DEBUG_WARN, ("mqtt_message_received: Received short PUBLISH packet (properties)\n"));
+					goto out_disconnect;
+				}
+				after_topic += n + props_len;
+			}
 			/* Take backup of byte after topic */
 			bkp = topic[topic_len];
 			/* Zero terminate string */
@@ -1235,10 +1431,26 @@ mqtt_message_received(mqtt_client_t *client, u8_t fixed_hdr_len, u16_t length, u
 						LWIP_DEBUGF(MQTT_DEBUG_WARN, ("mqtt_message_received: To small SUBACK packet\n"));
 						goto out_disconnect;
 					}
+					else if (client->protocol_version == MQTT5_PROTOCOL_LEVEL) {
+						u32_t props_len;
+						int n = MQTT5_ReadVarInt(var_hdr_payload + 2, length - 2, &props_len);
+						if (n == 0 || 2 + n + props_len >= length) {
+							goto out_disconnect;
+						}
+						client->reason_code = var_hdr_payload[2 + n + props_len];
+						mqtt_incomming_suback(r, client->reason_code);
+					}
 					else {
 						mqtt_incomming_suback(r, var_hdr_payload[2]);
 					}
 				}
+				else if (client->protocol_version == MQTT5_PROTOCOL_LEVEL && length > 2) {
+					/* MQTT 5 acks may carry reason code, 0x80 and above means failure */
+					client->reason_code = var_hdr_payload[2];
+					if (r->cb != NULL) {
+						r->cb(r->arg, client->reason_code >= 0x80 ? ERR_ABRT : ERR_OK);
+					}
+				}
 				else if (r->cb != NULL) {
 					r->cb(r->arg, ERR_OK);
 				}
@@ -1399,6 +1611,10 @@ void WIN_RunMQTTClient(mqtt_client_t *cl) {
 			buf.len = len;
 			buf.tot_len = len;
 			mqtt_parse_incoming(cl, &buf);
+			// connection may have been refused
+			if (cl->conn == 0) {
+				return;
+			}
 		}
 		else {
 			err = WSAGetLastError();
@@ -1425,8 +1641,12 @@ void WIN_ResetMQTT() {
 	}
 	memset(g_clients, 0, sizeof(g_clients));
 	g_numClients = 0;
+	// device client is gone, broker must not deliver to it
+	SIM_Broker_DetachDevice();
 }
 void WIN_RunMQTTFrame() {
+	SIM_RunBrokerAcks();
+	SIM_Broker_RunFrame();
 	for (int i = 0; i < g_numClients; i++) {
 		mqtt_client_t *client = g_clients[i];
 		WIN_RunMQTTClient(client);
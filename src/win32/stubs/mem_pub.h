@@ -0,0 +1,14 @@
+#ifndef _MEM_PUB_H_
+#define _MEM_PUB_H_
+
+#include <stdlib.h>
+
+// littlefs takes its heap from here, same as new_common.h gives to rest of code
+#ifndef os_malloc
+#define os_malloc malloc
+#endif
+#ifndef os_free
+#define os_free free
+#endif
+
+#endif
@@ -10,9 +10,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "new_common.h"
-#include "driver\drv_public.h"
-#include "cmnds\cmd_public.h"
-#include "httpserver\new_http.h"
+#include "driver/drv_public.h"
+#include "cmnds/cmd_public.h"
+#include "httpserver/new_http.h"
 #include "new_pins.h"
 #include <timeapi.h>
 
@@ -105,6 +105,8 @@ void Sim_RunFrames(int n, bool bApplyRealtimeWait) {
 
 bool bObkStarted = false;
 void SIM_Hack_ClearSimulatedPinRoles();
+int SIM_RunMQTTBenchmark(int maxRate);
+int SelfTest_GetFailedCount();
 
 void SIM_ClearOBK() {
 	if (bObkStarted) {
@@ -191,6 +193,10 @@ int g_bDoingUnitTestsNow = 0;
 int __cdecl main(int argc, char **argv)
 {
 	bool bWantsUnitTests = 1;
+	// -runUnitTests 2 runs them and exits, status tells if any failed (for CI)
+	bool bExitAfterUnitTests = 0;
+	// if set, runs MQTT benchmark against in-process broker and exits
+	int benchmarkMaxRate = 0;
 
 	if (argc > 1) {
 		int value;
@@ -208,6 +214,13 @@ int __cdecl main(int argc, char **argv)
 
 					if (i < argc && sscanf(argv[i], "%d", &value) == 1) {
 						bWantsUnitTests = value != 0;
+						bExitAfterUnitTests = value == 2;
+					}
+				} else if (wal_strnicmp(argv[i] + 1, "mqttBenchmark", 13) == 0) {
+					i++;
+
+					if (i < argc && sscanf(argv[i], "%d", &value) == 1) {
+						benchmarkMaxRate = value;
 					}
 				}
 			}
@@ -288,6 +301,18 @@ int __cdecl main(int argc, char **argv)
 		Win_DoUnitTests();
 		Sim_RunFrames(50, false);
 		g_bDoingUnitTestsNow = 0;
+		if (bExitAfterUnitTests) {
+			printf("Unit tests done, %i failed\n", SelfTest_GetFailedCount());
+			return SelfTest_GetFailedCount() != 0;
+		}
+	}
+	if (benchmarkMaxRate > 0) {
+		g_bDoingUnitTestsNow = 1;
+		if (bObkStarted == false) {
+			SIM_DoFreshOBKBoot();
+			Sim_RunFrames(50, false);
+		}
+		return SIM_RunMQTTBenchmark(benchmarkMaxRate) != 0;
 	}
 
 
@@ -23,8 +23,10 @@ char myIP[] = "127.0.0.1";
 char *getMyIp() {
 	return myIP;
 }
+#ifdef _MSC_VER
 void __asm__(const char *s) {
 
 }
+#endif
 
 #endif
\ No newline at end of file